@@ -120,12 +120,22 @@ bool EmulatorWindow::Initialize() {
         GpuClearCaches();
       } break;
       case 0x76: {  // VK_F7
+        if (e->is_shift_pressed()) {
+          emulator()->SaveRewindState();
+          break;
+        }
         // Save to file
         // TODO: Choose path based on user input, or from options
         // TODO: Spawn a new thread to do this.
         emulator()->SaveToFile("test.sav");
       } break;
       case 0x77: {  // VK_F8
+        if (e->is_shift_pressed()) {
+          // Go back to the newest rewind state, or to the one before it if
+          // there are more.
+          emulator()->Rewind(emulator()->rewind_state_count() > 1 ? 1 : 0);
+          break;
+        }
         // Restore from file
         // TODO: Choose path from user
         // TODO: Spawn a new thread to do this.
@@ -0,0 +1,195 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2020 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/apu/conversion.h"
+
+#include "xenia/base/assert.h"
+#include "xenia/base/math.h"
+#include "xenia/base/memory.h"
+
+#if XE_ARCH_AMD64 && XE_COMPILER_MSVC
+#include <intrin.h>
+#endif
+
+// Functions using AVX2 intrinsics. The project is built for AVX, so AVX2 has to
+// be enabled per function on GCC and Clang and checked at runtime.
+#if XE_COMPILER_MSVC
+#define XE_APU_TARGET_AVX2
+#else
+#define XE_APU_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace xe {
+namespace apu {
+namespace conversion {
+
+void ConvertFloatToS16BEScalar(const float* const* samples,
+                               uint32_t channel_count, uint32_t sample_count,
+                               uint8_t* output) {
+  // Loop through every sample, convert and drop it into the output array.
+  // If more than one channel, we need to interleave the samples from each
+  // channel next to each other.
+  uint32_t o = 0;
+  for (uint32_t i = 0; i < sample_count; i++) {
+    for (uint32_t j = 0; j < channel_count; j++) {
+      // Raw sample should be within [-1, 1].
+      // Clamp it, just in case.
+      float raw_sample = xe::saturate(samples[j][i]);
+
+      // Convert the sample and output it in big endian.
+      float scaled_sample = raw_sample * ((1 << 15) - 1);
+      int sample = static_cast<int>(scaled_sample);
+      xe::store_and_swap<uint16_t>(&output[o++ * 2], sample & 0xFFFF);
+    }
+  }
+}
+
+#if XE_ARCH_AMD64
+
+namespace {
+
+// Converts the samples from first_sample on, left over by a vector loop.
+void ConvertTail(const float* const* samples, uint32_t channel_count,
+                 uint32_t first_sample, uint32_t sample_count,
+                 uint8_t* output) {
+  if (first_sample >= sample_count) {
+    return;
+  }
+  const float* tail_samples[2];
+  for (uint32_t i = 0; i < channel_count; ++i) {
+    tail_samples[i] = samples[i] + first_sample;
+  }
+  ConvertFloatToS16BEScalar(
+      tail_samples, channel_count, sample_count - first_sample,
+      output + first_sample * channel_count * sizeof(uint16_t));
+}
+
+// Clamps and scales like the scalar version. _mm_min_ps returns the second
+// operand for NaN, so NaN becomes 1 as with xe::saturate.
+inline __m128i ConvertSamples(__m128 samples) {
+  samples = _mm_min_ps(samples, _mm_set1_ps(1.0f));
+  samples = _mm_max_ps(samples, _mm_set1_ps(-1.0f));
+  return _mm_cvttps_epi32(_mm_mul_ps(samples, _mm_set1_ps(32767.0f)));
+}
+
+XE_APU_TARGET_AVX2 inline __m256i ConvertSamples(__m256 samples) {
+  samples = _mm256_min_ps(samples, _mm256_set1_ps(1.0f));
+  samples = _mm256_max_ps(samples, _mm256_set1_ps(-1.0f));
+  return _mm256_cvttps_epi32(_mm256_mul_ps(samples, _mm256_set1_ps(32767.0f)));
+}
+
+// Byte swaps 16-bit values.
+inline __m128i SwapMask() {
+  return _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+}
+
+// Interleaves 4 left and 4 right 16-bit values packed as L0-L3 R0-R3 and byte
+// swaps them.
+inline __m128i InterleaveSwapMask() {
+  return _mm_setr_epi8(1, 0, 9, 8, 3, 2, 11, 10, 5, 4, 13, 12, 7, 6, 15, 14);
+}
+
+}  // namespace
+
+void ConvertFloatToS16BESSE(const float* const* samples,
+                            uint32_t channel_count, uint32_t sample_count,
+                            uint8_t* output) {
+  assert_true(channel_count == 1 || channel_count == 2);
+  auto output_vector = reinterpret_cast<__m128i*>(output);
+  uint32_t i = 0;
+  if (channel_count == 1) {
+    const float* mono = samples[0];
+    __m128i swap_mask = SwapMask();
+    for (; i + 8 <= sample_count; i += 8) {
+      __m128i low = ConvertSamples(_mm_loadu_ps(mono + i));
+      __m128i high = ConvertSamples(_mm_loadu_ps(mono + i + 4));
+      // Values are within 16 bits, saturating packing keeps them as is.
+      __m128i packed = _mm_packs_epi32(low, high);
+      _mm_storeu_si128(output_vector++, _mm_shuffle_epi8(packed, swap_mask));
+    }
+  } else {
+    const float* left = samples[0];
+    const float* right = samples[1];
+    __m128i interleave_swap_mask = InterleaveSwapMask();
+    for (; i + 4 <= sample_count; i += 4) {
+      __m128i packed = _mm_packs_epi32(ConvertSamples(_mm_loadu_ps(left + i)),
+                                       ConvertSamples(_mm_loadu_ps(right + i)));
+      _mm_storeu_si128(output_vector++,
+                       _mm_shuffle_epi8(packed, interleave_swap_mask));
+    }
+  }
+  ConvertTail(samples, channel_count, i, sample_count, output);
+}
+
+XE_APU_TARGET_AVX2 void ConvertFloatToS16BEAVX2(const float* const* samples,
+                                                uint32_t channel_count,
+                                                uint32_t sample_count,
+                                                uint8_t* output) {
+  assert_true(channel_count == 1 || channel_count == 2);
+  auto output_vector = reinterpret_cast<__m256i*>(output);
+  uint32_t i = 0;
+  if (channel_count == 1) {
+    const float* mono = samples[0];
+    __m256i swap_mask = _mm256_broadcastsi128_si256(SwapMask());
+    for (; i + 16 <= sample_count; i += 16) {
+      __m256i low = ConvertSamples(_mm256_loadu_ps(mono + i));
+      __m256i high = ConvertSamples(_mm256_loadu_ps(mono + i + 8));
+      // Packing works within 128-bit lanes, producing 0-3 8-11 4-7 12-15.
+      __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(low, high),
+                                                0b11011000);
+      _mm256_storeu_si256(output_vector++,
+                          _mm256_shuffle_epi8(packed, swap_mask));
+    }
+  } else {
+    const float* left = samples[0];
+    const float* right = samples[1];
+    __m256i interleave_swap_mask =
+        _mm256_broadcastsi128_si256(InterleaveSwapMask());
+    for (; i + 8 <= sample_count; i += 8) {
+      // Lanes contain L0-L3 R0-R3 and L4-L7 R4-R7, already in output order
+      // once interleaved within them.
+      __m256i packed =
+          _mm256_packs_epi32(ConvertSamples(_mm256_loadu_ps(left + i)),
+                             ConvertSamples(_mm256_loadu_ps(right + i)));
+      _mm256_storeu_si256(output_vector++,
+                          _mm256_shuffle_epi8(packed, interleave_swap_mask));
+    }
+  }
+  ConvertTail(samples, channel_count, i, sample_count, output);
+}
+
+bool IsAVX2Supported() {
+  // The OS must already support saving the AVX state for the AVX build.
+#if XE_COMPILER_MSVC
+  int cpu_info[4];
+  __cpuidex(cpu_info, 7, 0);
+  return (cpu_info[1] & (1 << 5)) != 0;
+#else
+  return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+
+#endif  // XE_ARCH_AMD64
+
+void ConvertFloatToS16BE(const float* const* samples, uint32_t channel_count,
+                         uint32_t sample_count, uint8_t* output) {
+#if XE_ARCH_AMD64
+  if (channel_count == 1 || channel_count == 2) {
+    static const auto convert = IsAVX2Supported() ? ConvertFloatToS16BEAVX2
+                                                  : ConvertFloatToS16BESSE;
+    convert(samples, channel_count, sample_count, output);
+    return;
+  }
+#endif  // XE_ARCH_AMD64
+  ConvertFloatToS16BEScalar(samples, channel_count, sample_count, output);
+}
+
+}  // namespace conversion
+}  // namespace apu
+}  // namespace xe
@@ -0,0 +1,49 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2020 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_APU_CONVERSION_H_
+#define XENIA_APU_CONVERSION_H_
+
+#include <cstdint>
+
+#include "xenia/base/platform.h"
+
+namespace xe {
+namespace apu {
+namespace conversion {
+
+// Converts planar float samples to interleaved big-endian signed 16-bit
+// samples, as written to XMA output buffers. Samples are clamped to [-1, 1]
+// and scaled by 32767, rounding towards zero.
+// Mono and stereo use the fastest vector implementation supported by the
+// host.
+void ConvertFloatToS16BE(const float* const* samples, uint32_t channel_count,
+                         uint32_t sample_count, uint8_t* output);
+
+// Reference implementation, converting one sample at a time.
+void ConvertFloatToS16BEScalar(const float* const* samples,
+                               uint32_t channel_count, uint32_t sample_count,
+                               uint8_t* output);
+
+#if XE_ARCH_AMD64
+// Vector implementations for 1 or 2 channels, exposed for testing.
+void ConvertFloatToS16BESSE(const float* const* samples,
+                            uint32_t channel_count, uint32_t sample_count,
+                            uint8_t* output);
+void ConvertFloatToS16BEAVX2(const float* const* samples,
+                             uint32_t channel_count, uint32_t sample_count,
+                             uint8_t* output);
+bool IsAVX2Supported();
+#endif  // XE_ARCH_AMD64
+
+}  // namespace conversion
+}  // namespace apu
+}  // namespace xe
+
+#endif  // XENIA_APU_CONVERSION_H_
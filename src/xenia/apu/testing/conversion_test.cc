@@ -0,0 +1,147 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2020 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/apu/conversion.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "third_party/catch/include/catch.hpp"
+
+#include "xenia/base/math.h"
+
+namespace xe {
+namespace apu {
+namespace test {
+using namespace conversion;
+
+typedef void (*ConvertFunction)(const float* const* samples,
+                                uint32_t channel_count, uint32_t sample_count,
+                                uint8_t* output);
+
+struct Implementation {
+  const char* name;
+  ConvertFunction convert;
+};
+
+std::vector<Implementation> GetVectorImplementations() {
+  std::vector<Implementation> implementations;
+#if XE_ARCH_AMD64
+  implementations.push_back({"SSE", ConvertFloatToS16BESSE});
+  if (IsAVX2Supported()) {
+    implementations.push_back({"AVX2", ConvertFloatToS16BEAVX2});
+  }
+#endif  // XE_ARCH_AMD64
+  implementations.push_back({"dispatch", ConvertFloatToS16BE});
+  return implementations;
+}
+
+// Samples mostly in [-1, 1], with some out of range ones and special values.
+std::vector<float> GenerateSamples(uint32_t count, uint32_t seed) {
+  std::mt19937 random(seed);
+  std::uniform_real_distribution<float> distribution(-1.25f, 1.25f);
+  std::vector<float> samples(count);
+  for (auto& sample : samples) {
+    sample = distribution(random);
+  }
+  const float special_values[] = {0.0f,
+                                  -0.0f,
+                                  1.0f,
+                                  -1.0f,
+                                  32767.0f,
+                                  1e30f,
+                                  std::numeric_limits<float>::quiet_NaN(),
+                                  -std::numeric_limits<float>::infinity()};
+  for (size_t i = 0; i < xe::countof(special_values) && i * 3 < count; ++i) {
+    samples[i * 3] = special_values[i];
+  }
+  return samples;
+}
+
+TEST_CASE("CONVERT_FLOAT_TO_S16BE_REFERENCE", "[conversion]") {
+  const float left[] = {0.5f, -1.5f};
+  const float right[] = {-0.25f, 2.0f};
+  const float* samples[] = {left, right};
+  uint8_t output[8];
+  ConvertFloatToS16BEScalar(samples, 2, 2, output);
+  // 16383, -8191, -32767, 32767, big endian.
+  const uint8_t expected[] = {0x3F, 0xFF, 0xE0, 0x01, 0x80, 0x01, 0x7F, 0xFF};
+  REQUIRE(std::memcmp(output, expected, sizeof(expected)) == 0);
+}
+
+TEST_CASE("CONVERT_FLOAT_TO_S16BE", "[conversion]") {
+  // Odd counts leave tails for the vector loops.
+  const uint32_t sample_counts[] = {0, 1, 3, 4, 7, 8, 15, 16, 17, 31, 512};
+  for (uint32_t channel_count = 1; channel_count <= 2; ++channel_count) {
+    for (uint32_t sample_count : sample_counts) {
+      std::vector<float> channels[2];
+      const float* samples[2];
+      for (uint32_t i = 0; i < channel_count; ++i) {
+        channels[i] = GenerateSamples(sample_count, sample_count * 2 + i);
+        samples[i] = channels[i].data();
+      }
+      size_t output_size = sample_count * channel_count * sizeof(uint16_t);
+      std::vector<uint8_t> expected(output_size);
+      ConvertFloatToS16BEScalar(samples, channel_count, sample_count,
+                                expected.data());
+
+      for (const auto& implementation : GetVectorImplementations()) {
+        INFO(implementation.name << ", " << channel_count << " channels, "
+                                 << sample_count << " samples");
+        // One extra byte to detect overruns.
+        std::vector<uint8_t> output(output_size + 1, 0xCD);
+        implementation.convert(samples, channel_count, sample_count,
+                               output.data());
+        REQUIRE(std::memcmp(output.data(), expected.data(), output_size) ==
+                0);
+        REQUIRE(output[output_size] == 0xCD);
+      }
+    }
+  }
+}
+
+// Not run by default - reports the conversion speed of every implementation
+// for full XMA frames.
+TEST_CASE("CONVERT_FLOAT_TO_S16BE_BENCHMARK", "[.][conversion][benchmark]") {
+  const uint32_t kSamplesPerFrame = 512;
+  const uint32_t kFrameCount = 200000;
+  std::vector<Implementation> implementations = {
+      {"scalar", ConvertFloatToS16BEScalar}};
+  for (const auto& implementation : GetVectorImplementations()) {
+    implementations.push_back(implementation);
+  }
+  std::vector<float> channels[2] = {GenerateSamples(kSamplesPerFrame, 0),
+                                    GenerateSamples(kSamplesPerFrame, 1)};
+  const float* samples[2] = {channels[0].data(), channels[1].data()};
+  std::vector<uint8_t> output(kSamplesPerFrame * 2 * sizeof(uint16_t));
+  for (uint32_t channel_count = 1; channel_count <= 2; ++channel_count) {
+    for (const auto& implementation : implementations) {
+      auto start = std::chrono::steady_clock::now();
+      for (uint32_t i = 0; i < kFrameCount; ++i) {
+        implementation.convert(samples, channel_count, kSamplesPerFrame,
+                               output.data());
+      }
+      double seconds = std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - start)
+                           .count();
+      std::printf("%s, %u channels: %.1f M samples/s\n", implementation.name,
+                  channel_count,
+                  double(kSamplesPerFrame) * channel_count * kFrameCount /
+                      seconds / 1e6);
+    }
+  }
+}
+
+}  // namespace test
+}  // namespace apu
+}  // namespace xe
@@ -0,0 +1,202 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2020 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/apu/xma_work_queue.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "third_party/catch/include/catch.hpp"
+
+#include "xenia/apu/conversion.h"
+
+namespace xe {
+namespace apu {
+namespace test {
+using namespace std::chrono_literals;
+
+// Runs the workers of a queue on host threads for the lifetime of the object.
+class WorkerPool {
+ public:
+  WorkerPool(XmaWorkQueue* queue, uint32_t worker_count) : queue_(queue) {
+    for (uint32_t i = 0; i < worker_count; ++i) {
+      threads_.emplace_back([queue]() { queue->WorkerMain(); });
+    }
+  }
+  ~WorkerPool() {
+    queue_->Shutdown();
+    for (auto& thread : threads_) {
+      thread.join();
+    }
+  }
+
+  void WaitForIdle() {
+    while (!queue_->is_idle()) {
+      std::this_thread::sleep_for(1ms);
+    }
+  }
+
+ private:
+  XmaWorkQueue* queue_;
+  std::vector<std::thread> threads_;
+};
+
+TEST_CASE("XMA_WORK_QUEUE_CONTEXT_OWNERSHIP", "[xma]") {
+  const uint32_t kContextCount = 32;
+  const uint32_t kKickerCount = 4;
+  const uint32_t kKicksPerKicker = 20000;
+
+  // Kicks are counted before being made, and a run must see the count of every
+  // kick made before it started.
+  std::atomic<uint32_t> kick_counts[kContextCount] = {};
+  std::atomic<uint32_t> seen_kick_counts[kContextCount] = {};
+  std::atomic<bool> running[kContextCount] = {};
+  std::atomic<uint32_t> overlap_count(0);
+  XmaWorkQueue queue(kContextCount, [&](uint32_t context_id) {
+    if (running[context_id].exchange(true)) {
+      ++overlap_count;
+    }
+    seen_kick_counts[context_id] = kick_counts[context_id].load();
+    std::this_thread::yield();
+    running[context_id] = false;
+    return false;
+  });
+
+  {
+    WorkerPool pool(&queue, 4);
+    std::vector<std::thread> kickers;
+    for (uint32_t i = 0; i < kKickerCount; ++i) {
+      kickers.emplace_back([&, i]() {
+        std::mt19937 random(i);
+        for (uint32_t j = 0; j < kKicksPerKicker; ++j) {
+          uint32_t context_id = random() % kContextCount;
+          ++kick_counts[context_id];
+          queue.Kick(context_id);
+        }
+      });
+    }
+    for (auto& kicker : kickers) {
+      kicker.join();
+    }
+    pool.WaitForIdle();
+  }
+
+  REQUIRE(overlap_count == 0);
+  for (uint32_t i = 0; i < kContextCount; ++i) {
+    INFO("Context " << i);
+    REQUIRE(seen_kick_counts[i] == kick_counts[i]);
+  }
+}
+
+TEST_CASE("XMA_WORK_QUEUE_RUN_AGAIN", "[xma]") {
+  // Contexts asking to run again are requeued until they're done.
+  const uint32_t kContextCount = 4;
+  std::atomic<uint32_t> run_counts[kContextCount] = {};
+  XmaWorkQueue queue(kContextCount, [&](uint32_t context_id) {
+    return ++run_counts[context_id] < 10 * (context_id + 1);
+  });
+  WorkerPool pool(&queue, 2);
+  for (uint32_t i = 0; i < kContextCount; ++i) {
+    queue.Kick(i);
+  }
+  pool.WaitForIdle();
+  for (uint32_t i = 0; i < kContextCount; ++i) {
+    REQUIRE(run_counts[i] == 10 * (i + 1));
+  }
+}
+
+TEST_CASE("XMA_WORK_QUEUE_PAUSE", "[xma]") {
+  const uint32_t kContextCount = 8;
+  std::atomic<uint32_t> run_count(0);
+  XmaWorkQueue queue(kContextCount, [&](uint32_t context_id) {
+    ++run_count;
+    return false;
+  });
+  WorkerPool pool(&queue, 2);
+
+  queue.Pause();
+  for (uint32_t i = 0; i < kContextCount; ++i) {
+    queue.Kick(i);
+  }
+  std::this_thread::sleep_for(20ms);
+  REQUIRE(run_count == 0);
+  REQUIRE_FALSE(queue.is_idle());
+
+  queue.Resume();
+  pool.WaitForIdle();
+  REQUIRE(run_count == kContextCount);
+}
+
+// Not run by default - reports how many XMA packets per second the pool gets
+// through with different worker counts. Packets are kicked by a single thread
+// like guest register writes, and each packet costs the output conversion of
+// the frames it contains in place of the libav decode.
+TEST_CASE("XMA_WORK_QUEUE_BENCHMARK", "[.][xma][benchmark]") {
+  const uint32_t kContextCount = 320;
+  const uint32_t kActiveContextCount = 64;
+  const uint32_t kPacketCount = 200000;
+  const uint32_t kFramesPerPacket = 4;
+  const uint32_t kSamplesPerFrame = 512;
+
+  std::vector<float> channels[2] = {std::vector<float>(kSamplesPerFrame, 0.5f),
+                                    std::vector<float>(kSamplesPerFrame, -0.5f)};
+  const float* samples[2] = {channels[0].data(), channels[1].data()};
+
+  uint32_t max_worker_count =
+      std::max(4u, std::thread::hardware_concurrency());
+  for (uint32_t worker_count = 1; worker_count <= max_worker_count;
+       worker_count *= 2) {
+    auto pending_packets =
+        std::make_unique<std::atomic<uint32_t>[]>(kContextCount);
+    auto outputs = std::make_unique<std::vector<uint8_t>[]>(kContextCount);
+    for (uint32_t i = 0; i < kContextCount; ++i) {
+      pending_packets[i] = 0;
+      outputs[i].resize(kSamplesPerFrame * 2 * sizeof(uint16_t));
+    }
+    std::atomic<uint32_t> decoded_packets(0);
+    XmaWorkQueue queue(kContextCount, [&](uint32_t context_id) {
+      // Decode everything available, like XmaContext::Work.
+      uint32_t packet_count = pending_packets[context_id].exchange(0);
+      for (uint32_t i = 0; i < packet_count * kFramesPerPacket; ++i) {
+        conversion::ConvertFloatToS16BE(samples, 2, kSamplesPerFrame,
+                                        outputs[context_id].data());
+      }
+      decoded_packets += packet_count;
+      return false;
+    });
+
+    auto start = std::chrono::steady_clock::now();
+    {
+      WorkerPool pool(&queue, worker_count);
+      for (uint32_t i = 0; i < kPacketCount; ++i) {
+        uint32_t context_id = i % kActiveContextCount;
+        ++pending_packets[context_id];
+        queue.Kick(context_id);
+      }
+      while (decoded_packets < kPacketCount) {
+        std::this_thread::yield();
+      }
+    }
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    std::printf("%u workers: %.1f K packets/s\n", worker_count,
+                kPacketCount / seconds / 1e3);
+  }
+}
+
+}  // namespace test
+}  // namespace apu
+}  // namespace xe
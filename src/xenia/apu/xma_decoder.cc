@@ -9,6 +9,8 @@
 
 #include "xenia/apu/xma_decoder.h"
 
+#include <algorithm>
+
 #include "xenia/apu/xma_context.h"
 #include "xenia/base/cvar.h"
 #include "xenia/base/logging.h"
@@ -16,6 +18,7 @@
 #include "xenia/base/profiling.h"
 #include "xenia/base/ring_buffer.h"
 #include "xenia/base/string_buffer.h"
+#include "xenia/base/threading.h"
 #include "xenia/cpu/processor.h"
 #include "xenia/cpu/thread_state.h"
 #include "xenia/kernel/xthread.h"
@@ -50,6 +53,10 @@ extern "C" {
 
 DEFINE_bool(libav_verbose, false, "Verbose libav output (debug and above)",
             "APU");
+DEFINE_int32(xma_decoder_threads, 0,
+             "Number of threads decoding XMA contexts in parallel, 0 to pick "
+             "one based on the number of host logical processors.",
+             "APU");
 
 namespace xe {
 namespace apu {
@@ -137,72 +144,56 @@ X_STATUS XmaDecoder::Setup(kernel::KernelState* kernel_state) {
   register_file_[XE_XMA_REG_NEXT_CONTEXT_INDEX].u32 = 1;
   context_bitmap_.Resize(kContextCount);
 
-  worker_running_ = true;
-  work_event_ = xe::threading::Event::CreateAutoResetEvent(false);
-  worker_thread_ = kernel::object_ref<kernel::XHostThread>(
-      new kernel::XHostThread(kernel_state, 128 * 1024, 0, [this]() {
-        WorkerThreadMain();
-        return 0;
-      }));
-  worker_thread_->set_name("XMA Decoder");
-  worker_thread_->set_can_debugger_suspend(true);
-  worker_thread_->Create();
+  // Contexts are only decoded when kicked, by whichever worker picks them up
+  // first. A context is decoded by one worker at a time, and kicks made while
+  // it's being decoded queue it again once that's done.
+  work_queue_ = std::make_unique<XmaWorkQueue>(
+      kContextCount,
+      [this](uint32_t context_id) { return WorkContext(context_id); });
+  uint32_t worker_count = uint32_t(std::max(cvars::xma_decoder_threads, 0));
+  if (!worker_count) {
+    worker_count = xe::clamp(xe::threading::logical_processor_count() / 4,
+                             uint32_t(1), uint32_t(4));
+  }
+  for (uint32_t i = 0; i < worker_count; ++i) {
+    auto worker_thread = kernel::object_ref<kernel::XHostThread>(
+        new kernel::XHostThread(kernel_state, 128 * 1024, 0, [this]() {
+          work_queue_->WorkerMain();
+          return 0;
+        }));
+    worker_thread->set_name(
+        worker_count > 1 ? fmt::format("XMA Decoder {}", i) : "XMA Decoder");
+    worker_thread->set_can_debugger_suspend(true);
+    worker_thread->Create();
+    worker_threads_.push_back(std::move(worker_thread));
+  }
 
   return X_STATUS_SUCCESS;
 }
 
-void XmaDecoder::WorkerThreadMain() {
-  uint32_t idle_loop_count = 0;
-  while (worker_running_) {
-    // Okay, let's loop through XMA contexts to find ones we need to decode!
-    bool did_work = false;
-    for (uint32_t n = 0; n < kContextCount; n++) {
-      XmaContext& context = contexts_[n];
-      did_work = context.Work() || did_work;
-
-      // TODO: Need thread safety to do this.
-      // Probably not too important though.
-      // registers_.current_context = n;
-      // registers_.next_context = (n + 1) % kContextCount;
-    }
-
-    if (paused_) {
-      pause_fence_.Signal();
-      resume_fence_.Wait();
-    }
-
-    if (!did_work) {
-      idle_loop_count++;
-    } else {
-      idle_loop_count = 0;
-    }
-
-    if (idle_loop_count > 500) {
-      // Idle for an extended period. Introduce a 20ms wait.
-      xe::threading::Wait(work_event_.get(), false,
-                          std::chrono::milliseconds(20));
-    }
-
-    xe::threading::MaybeYield();
-  }
+bool XmaDecoder::WorkContext(uint32_t context_id) {
+  SCOPE_profile_cpu_f("apu");
+  // Work disables the context, it's decoded again once kicked again.
+  contexts_[context_id].Work();
+  return false;
 }
 
 void XmaDecoder::Shutdown() {
-  worker_running_ = false;
-
-  if (work_event_) {
-    work_event_->Set();
+  if (work_queue_) {
+    work_queue_->Shutdown();
   }
 
   if (paused_) {
     Resume();
   }
 
-  if (worker_thread_) {
-    // Wait for work thread.
-    xe::threading::Wait(worker_thread_->thread(), false);
-    worker_thread_.reset();
+  // Wait for the worker threads.
+  for (auto& worker_thread : worker_threads_) {
+    xe::threading::Wait(worker_thread->thread(), false);
   }
+  worker_threads_.clear();
+  // The queue is kept until the decoder is destroyed, as the MMIO handlers
+  // can't be removed and guest writes may still kick it.
 
   if (context_data_first_ptr_) {
     memory()->SystemHeapFree(context_data_first_ptr_);
@@ -311,10 +302,9 @@ void XmaDecoder::WriteRegister(uint32_t addr, uint32_t value) {
         uint32_t context_id = base_context_id + i;
         auto& context = contexts_[context_id];
         context.Enable();
+        work_queue_->Kick(context_id);
       }
     }
-    // Signal the decoder thread to start processing.
-    work_event_->Set();
   } else if (r >= XE_XMA_REG_CONTEXT_LOCK_0 && r <= XE_XMA_REG_CONTEXT_LOCK_9) {
     // Context lock command.
     // This requests a lock by flagging the context.
@@ -327,8 +317,6 @@ void XmaDecoder::WriteRegister(uint32_t addr, uint32_t value) {
         context.Disable();
       }
     }
-    // Signal the decoder thread to start processing.
-    work_event_->Set();
   } else if (r >= XE_XMA_REG_CONTEXT_CLEAR_0 &&
              r <= XE_XMA_REG_CONTEXT_CLEAR_9) {
     // Context clear command.
@@ -366,7 +354,7 @@ void XmaDecoder::Pause() {
   }
   paused_ = true;
 
-  pause_fence_.Wait();
+  work_queue_->Pause();
 }
 
 void XmaDecoder::Resume() {
@@ -375,7 +363,7 @@ void XmaDecoder::Resume() {
   }
   paused_ = false;
 
-  resume_fence_.Signal();
+  work_queue_->Resume();
 }
 
 }  // namespace apu
@@ -10,12 +10,12 @@
 #ifndef XENIA_APU_XMA_DECODER_H_
 #define XENIA_APU_XMA_DECODER_H_
 
-#include <atomic>
-#include <mutex>
-#include <queue>
+#include <memory>
+#include <vector>
 
 #include "xenia/apu/xma_context.h"
 #include "xenia/apu/xma_register_file.h"
+#include "xenia/apu/xma_work_queue.h"
 #include "xenia/base/bit_map.h"
 #include "xenia/kernel/xthread.h"
 #include "xenia/xbox.h"
@@ -55,7 +55,7 @@ class XmaDecoder {
   int GetContextId(uint32_t guest_ptr);
 
  private:
-  void WorkerThreadMain();
+  bool WorkContext(uint32_t context_id);
 
   static uint32_t MMIOReadRegisterThunk(void* ppc_context, XmaDecoder* as,
                                         uint32_t addr) {
@@ -70,13 +70,11 @@ class XmaDecoder {
   Memory* memory_ = nullptr;
   cpu::Processor* processor_ = nullptr;
 
-  std::atomic<bool> worker_running_ = {false};
-  kernel::object_ref<kernel::XHostThread> worker_thread_;
-  std::unique_ptr<xe::threading::Event> work_event_ = nullptr;
+  // Contexts kicked by the guest, decoded by the worker threads.
+  std::unique_ptr<XmaWorkQueue> work_queue_;
+  std::vector<kernel::object_ref<kernel::XHostThread>> worker_threads_;
 
   bool paused_ = false;
-  xe::threading::Fence pause_fence_;   // Signaled when worker paused.
-  xe::threading::Fence resume_fence_;  // Signaled when resume requested.
 
   XmaRegisterFile register_file_;
 
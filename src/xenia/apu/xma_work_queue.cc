@@ -0,0 +1,105 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2020 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/apu/xma_work_queue.h"
+
+#include "xenia/base/assert.h"
+
+namespace xe {
+namespace apu {
+
+XmaWorkQueue::XmaWorkQueue(uint32_t context_count, WorkCallback work_callback)
+    : work_callback_(std::move(work_callback)),
+      context_states_(context_count, ContextState::kIdle) {}
+
+void XmaWorkQueue::Kick(uint32_t context_id) {
+  assert_true(context_id < context_states_.size());
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (shutting_down_) {
+    return;
+  }
+  ContextState& state = context_states_[context_id];
+  switch (state) {
+    case ContextState::kIdle:
+      state = ContextState::kQueued;
+      queue_.push_back(context_id);
+      lock.unlock();
+      work_cond_.notify_one();
+      break;
+    case ContextState::kRunning:
+      state = ContextState::kRunningKicked;
+      break;
+    default:
+      // Already going to run.
+      break;
+  }
+}
+
+void XmaWorkQueue::WorkerMain() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    work_cond_.wait(lock, [this]() {
+      return shutting_down_ || (!paused_ && !queue_.empty());
+    });
+    if (shutting_down_) {
+      break;
+    }
+
+    uint32_t context_id = queue_.front();
+    queue_.pop_front();
+    context_states_[context_id] = ContextState::kRunning;
+    ++running_count_;
+
+    lock.unlock();
+    bool run_again = work_callback_(context_id);
+    lock.lock();
+
+    --running_count_;
+    ContextState& state = context_states_[context_id];
+    if (run_again || state == ContextState::kRunningKicked) {
+      // Back of the queue so busy contexts don't starve the others.
+      state = ContextState::kQueued;
+      queue_.push_back(context_id);
+    } else {
+      state = ContextState::kIdle;
+    }
+    done_cond_.notify_all();
+  }
+}
+
+void XmaWorkQueue::Shutdown() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    shutting_down_ = true;
+    queue_.clear();
+  }
+  work_cond_.notify_all();
+}
+
+void XmaWorkQueue::Pause() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  paused_ = true;
+  done_cond_.wait(lock, [this]() { return running_count_ == 0; });
+}
+
+void XmaWorkQueue::Resume() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    paused_ = false;
+  }
+  work_cond_.notify_all();
+}
+
+bool XmaWorkQueue::is_idle() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return queue_.empty() && running_count_ == 0;
+}
+
+}  // namespace apu
+}  // namespace xe
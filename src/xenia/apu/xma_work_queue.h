@@ -0,0 +1,81 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2020 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_APU_XMA_WORK_QUEUE_H_
+#define XENIA_APU_XMA_WORK_QUEUE_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace xe {
+namespace apu {
+
+// Queue of XMA contexts that have been kicked and need decoding, shared by a
+// pool of decoder workers.
+//
+// A context is owned by at most one worker at a time, so work for a single
+// context is never run concurrently and happens in kick order. Kicks arriving
+// while the context is being worked on make the owning worker run it again
+// once it's done instead of queuing it for another worker.
+class XmaWorkQueue {
+ public:
+  // Does the work for the context. Returns true if it should run again even if
+  // it hasn't been kicked in the meantime.
+  typedef std::function<bool(uint32_t context_id)> WorkCallback;
+
+  XmaWorkQueue(uint32_t context_count, WorkCallback work_callback);
+
+  // Queues the context for work unless it's already queued.
+  void Kick(uint32_t context_id);
+
+  // Runs queued work until Shutdown is called. Called by each worker thread.
+  void WorkerMain();
+  // Makes all workers return from WorkerMain once they finish their current
+  // work. Queued work is dropped, and later kicks are ignored.
+  void Shutdown();
+
+  // Waits for all workers to finish their current work and stops them from
+  // taking new work until Resume is called. Kicks are still queued.
+  void Pause();
+  void Resume();
+
+  // Returns true if there is no queued or running work.
+  bool is_idle();
+
+ private:
+  enum class ContextState : uint8_t {
+    kIdle,
+    kQueued,
+    kRunning,
+    // Kicked while running, the owning worker will run it again.
+    kRunningKicked,
+  };
+
+  WorkCallback work_callback_;
+
+  std::mutex mutex_;
+  // Notified when work is queued, or the queue is shut down or resumed.
+  std::condition_variable work_cond_;
+  // Notified when a worker finishes running a context.
+  std::condition_variable done_cond_;
+  std::deque<uint32_t> queue_;
+  std::vector<ContextState> context_states_;
+  uint32_t running_count_ = 0;
+  bool paused_ = false;
+  bool shutting_down_ = false;
+};
+
+}  // namespace apu
+}  // namespace xe
+
+#endif  // XENIA_APU_XMA_WORK_QUEUE_H_
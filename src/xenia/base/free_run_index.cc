@@ -0,0 +1,190 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2020 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/free_run_index.h"
+
+#include <algorithm>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/math.h"
+
+namespace xe {
+
+void FreeRunIndex::Reset(uint32_t count) {
+  count_ = count;
+  leaf_base_ = xe::next_pow2(std::max(count, uint32_t(1)));
+  tree_.clear();
+  tree_.resize(size_t(leaf_base_) * 2, 0);
+}
+
+void FreeRunIndex::SetRunLength(uint32_t first, uint32_t length) {
+  uint32_t node = leaf_base_ + first;
+  tree_[node] = length;
+  for (node >>= 1; node; node >>= 1) {
+    tree_[node] = std::max(tree_[node * 2], tree_[node * 2 + 1]);
+  }
+}
+
+uint32_t FreeRunIndex::FindFirstRun(uint32_t from, uint32_t min_length) const {
+  assert_not_zero(min_length);
+  if (from >= count_) {
+    return kInvalidIndex;
+  }
+  uint32_t node = leaf_base_ + from;
+  if (tree_[node] >= min_length) {
+    return from;
+  }
+  // Climb until there is a subtree to the right with a long enough run.
+  while (node > 1 && ((node & 1) || tree_[node + 1] < min_length)) {
+    node >>= 1;
+  }
+  if (node <= 1) {
+    return kInvalidIndex;
+  }
+  // Descend into its leftmost long enough leaf.
+  for (node = node + 1; node < leaf_base_;) {
+    node *= 2;
+    if (tree_[node] < min_length) {
+      ++node;
+    }
+  }
+  return node - leaf_base_;
+}
+
+uint32_t FreeRunIndex::FindLastRun(uint32_t to, uint32_t min_length) const {
+  assert_not_zero(min_length);
+  if (!count_) {
+    return kInvalidIndex;
+  }
+  uint32_t node = leaf_base_ + std::min(to, count_ - 1);
+  if (tree_[node] >= min_length) {
+    return node - leaf_base_;
+  }
+  // Climb until there is a subtree to the left with a long enough run.
+  while (node > 1 && (!(node & 1) || tree_[node - 1] < min_length)) {
+    node >>= 1;
+  }
+  if (node <= 1) {
+    return kInvalidIndex;
+  }
+  // Descend into its rightmost long enough leaf.
+  for (node = node - 1; node < leaf_base_;) {
+    node = node * 2 + 1;
+    if (tree_[node] < min_length) {
+      --node;
+    }
+  }
+  return node - leaf_base_;
+}
+
+void FreeRunIndex::MarkFree(uint32_t first, uint32_t count) {
+  assert_true(first <= count_ && count <= count_ - first);
+  if (!count) {
+    return;
+  }
+  uint32_t run_first = first;
+  uint32_t run_end = first + count;
+  // Absorb the run that ends inside or right before the range.
+  uint32_t previous = FindLastRun(first, 1);
+  if (previous != kInvalidIndex && previous < first &&
+      previous + run_length(previous) >= first) {
+    run_first = previous;
+    run_end = std::max(run_end, previous + run_length(previous));
+    SetRunLength(previous, 0);
+  }
+  // Absorb the runs that start inside or right after the range.
+  for (uint32_t next = FindFirstRun(first, 1);
+       next != kInvalidIndex && next <= first + count;
+       next = FindFirstRun(first, 1)) {
+    run_end = std::max(run_end, next + run_length(next));
+    SetRunLength(next, 0);
+  }
+  SetRunLength(run_first, run_end - run_first);
+}
+
+void FreeRunIndex::MarkUsed(uint32_t first, uint32_t count) {
+  assert_true(first <= count_ && count <= count_ - first);
+  if (!count) {
+    return;
+  }
+  uint32_t end = first + count;
+  // Cut the run that starts before the range.
+  uint32_t previous = FindLastRun(first, 1);
+  if (previous != kInvalidIndex && previous < first) {
+    uint32_t previous_end = previous + run_length(previous);
+    if (previous_end > first) {
+      SetRunLength(previous, first - previous);
+      if (previous_end > end) {
+        SetRunLength(end, previous_end - end);
+        return;
+      }
+    }
+  }
+  // Remove the runs that start inside the range, keeping the tail of the last.
+  for (uint32_t next = FindFirstRun(first, 1);
+       next != kInvalidIndex && next < end; next = FindFirstRun(first, 1)) {
+    uint32_t next_end = next + run_length(next);
+    SetRunLength(next, 0);
+    if (next_end > end) {
+      SetRunLength(end, next_end - end);
+      break;
+    }
+  }
+}
+
+uint32_t FreeRunIndex::Find(uint32_t count, uint32_t alignment,
+                            uint32_t min_first, uint32_t max_first,
+                            bool top_down) const {
+  assert_not_zero(count);
+  assert_not_zero(alignment);
+  if (min_first > max_first || count > largest_run()) {
+    return kInvalidIndex;
+  }
+  if (top_down) {
+    // Higher runs always give higher starts, so the first run that fits wins.
+    for (uint32_t run_first = FindLastRun(max_first, count);
+         run_first != kInvalidIndex;
+         run_first =
+             run_first ? FindLastRun(run_first - 1, count) : kInvalidIndex) {
+      uint32_t start =
+          std::min(max_first, run_first + run_length(run_first) - count);
+      start -= start % alignment;
+      if (start >= std::max(run_first, min_first)) {
+        return start;
+      }
+      if (run_first <= min_first) {
+        break;
+      }
+    }
+    return kInvalidIndex;
+  }
+  uint32_t aligned_min_first =
+      (min_first + (alignment - 1)) / alignment * alignment;
+  // The run containing min_first may start before it.
+  uint32_t run_first = FindLastRun(min_first, 1);
+  if (run_first != kInvalidIndex && run_first < min_first &&
+      aligned_min_first <= max_first &&
+      aligned_min_first + count <= run_first + run_length(run_first)) {
+    return aligned_min_first;
+  }
+  for (run_first = FindFirstRun(min_first, count);
+       run_first != kInvalidIndex && run_first <= max_first;
+       run_first = FindFirstRun(run_first + 1, count)) {
+    uint32_t start = (run_first + (alignment - 1)) / alignment * alignment;
+    if (start > max_first) {
+      break;
+    }
+    if (start + count <= run_first + run_length(run_first)) {
+      return start;
+    }
+  }
+  return kInvalidIndex;
+}
+
+}  // namespace xe
@@ -0,0 +1,74 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2020 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_BASE_FREE_RUN_INDEX_H_
+#define XENIA_BASE_FREE_RUN_INDEX_H_
+
+#include <cstdint>
+#include <vector>
+
+namespace xe {
+
+// Free Run Index: tracks runs of free entries (such as pages) and finds the
+// lowest or the highest aligned place for a range of entries in O(log n) per
+// run examined, instead of scanning all entries.
+//
+// Runs are stored in a max segment tree over the entries, where each leaf
+// holds the length of the free run starting at it, or 0. Adjacent free runs
+// are always coalesced.
+class FreeRunIndex {
+ public:
+  static constexpr uint32_t kInvalidIndex = UINT32_MAX;
+
+  FreeRunIndex() = default;
+
+  // Sets the number of entries and marks all of them as used.
+  void Reset(uint32_t count);
+
+  uint32_t count() const { return count_; }
+
+  // Length of the longest free run.
+  uint32_t largest_run() const { return tree_.empty() ? 0 : tree_[1]; }
+
+  // Marks [first, first + count) as free, merging with neighboring runs. Parts
+  // of the range may already be free.
+  void MarkFree(uint32_t first, uint32_t count);
+
+  // Marks [first, first + count) as used, splitting the runs it overlaps. Parts
+  // of the range may already be used.
+  void MarkUsed(uint32_t first, uint32_t count);
+
+  // Finds a start index that is a multiple of alignment, in
+  // [min_first, max_first], such that [start, start + count) is free. Returns
+  // the lowest such index, or the highest one if top_down is set, or
+  // kInvalidIndex if there is none.
+  uint32_t Find(uint32_t count, uint32_t alignment, uint32_t min_first,
+                uint32_t max_first, bool top_down) const;
+
+ private:
+  uint32_t run_length(uint32_t first) const {
+    return tree_[leaf_base_ + first];
+  }
+  void SetRunLength(uint32_t first, uint32_t length);
+
+  // Index of the first run at or after from with at least min_length entries.
+  uint32_t FindFirstRun(uint32_t from, uint32_t min_length) const;
+  // Index of the last run at or before to with at least min_length entries.
+  uint32_t FindLastRun(uint32_t to, uint32_t min_length) const;
+
+  uint32_t count_ = 0;
+  // Number of leaves, a power of two.
+  uint32_t leaf_base_ = 0;
+  // 1-based heap layout, leaves at [leaf_base_, 2 * leaf_base_).
+  std::vector<uint32_t> tree_;
+};
+
+}  // namespace xe
+
+#endif  // XENIA_BASE_FREE_RUN_INDEX_H_
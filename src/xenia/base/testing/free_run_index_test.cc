@@ -0,0 +1,115 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2020 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/free_run_index.h"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "third_party/catch/include/catch.hpp"
+
+namespace xe {
+namespace base {
+namespace test {
+
+// Scans entries one by one, like BaseHeap::AllocRange did before the index.
+uint32_t FindByScan(const std::vector<bool>& used, uint32_t count,
+                    uint32_t alignment, uint32_t min_first, uint32_t max_first,
+                    bool top_down) {
+  auto fits = [&](uint32_t start) {
+    for (uint32_t i = start; i < start + count; ++i) {
+      if (i >= used.size() || used[i]) {
+        return false;
+      }
+    }
+    return true;
+  };
+  uint32_t first = (min_first + alignment - 1) / alignment * alignment;
+  uint32_t last = max_first - max_first % alignment;
+  if (first > last || min_first > max_first) {
+    return FreeRunIndex::kInvalidIndex;
+  }
+  if (top_down) {
+    for (int64_t start = last; start >= first; start -= alignment) {
+      if (fits(uint32_t(start))) {
+        return uint32_t(start);
+      }
+    }
+  } else {
+    for (uint32_t start = first; start <= last; start += alignment) {
+      if (fits(start)) {
+        return start;
+      }
+    }
+  }
+  return FreeRunIndex::kInvalidIndex;
+}
+
+TEST_CASE("free_run_index_basic", "[free_run_index]") {
+  FreeRunIndex index;
+  index.Reset(64);
+  REQUIRE(index.largest_run() == 0);
+  REQUIRE(index.Find(1, 1, 0, 63, false) == FreeRunIndex::kInvalidIndex);
+
+  index.MarkFree(0, 64);
+  REQUIRE(index.largest_run() == 64);
+  REQUIRE(index.Find(4, 1, 0, 60, false) == 0);
+  REQUIRE(index.Find(4, 1, 0, 60, true) == 60);
+  REQUIRE(index.Find(4, 16, 0, 60, true) == 48);
+  REQUIRE(index.Find(4, 16, 1, 60, false) == 16);
+
+  index.MarkUsed(8, 8);
+  REQUIRE(index.largest_run() == 48);
+  REQUIRE(index.Find(8, 1, 0, 56, false) == 0);
+  REQUIRE(index.Find(9, 1, 0, 55, false) == 16);
+  REQUIRE(index.Find(4, 8, 4, 60, false) == 16);
+
+  // Freeing an overlapping range merges everything back.
+  index.MarkFree(4, 16);
+  REQUIRE(index.largest_run() == 64);
+  REQUIRE(index.Find(64, 1, 0, 0, false) == 0);
+}
+
+TEST_CASE("free_run_index_matches_scan", "[free_run_index]") {
+  const uint32_t kCount = 1000;
+  FreeRunIndex index;
+  index.Reset(kCount);
+  index.MarkFree(0, kCount);
+  std::vector<bool> used(kCount, false);
+
+  std::mt19937 random(1);
+  for (uint32_t i = 0; i < 20000; ++i) {
+    uint32_t first = random() % kCount;
+    uint32_t count = 1 + random() % std::min(64u, kCount - first);
+    bool mark_used = (random() % 2) != 0;
+    if (mark_used) {
+      index.MarkUsed(first, count);
+    } else {
+      index.MarkFree(first, count);
+    }
+    for (uint32_t j = first; j < first + count; ++j) {
+      used[j] = mark_used;
+    }
+
+    uint32_t find_count = 1 + random() % 48;
+    uint32_t alignment = 1u << (random() % 5);
+    uint32_t min_first = random() % kCount;
+    uint32_t max_first = random() % kCount;
+    bool top_down = (random() % 2) != 0;
+    REQUIRE(index.Find(find_count, alignment, min_first, max_first,
+                       top_down) == FindByScan(used, find_count, alignment,
+                                               min_first, max_first,
+                                               top_down));
+  }
+}
+
+}  // namespace test
+}  // namespace base
+}  // namespace xe
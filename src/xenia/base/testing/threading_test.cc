@@ -8,6 +8,8 @@
 */
 
 #include <array>
+#include <atomic>
+#include <cstdio>
 
 #include "xenia/base/threading.h"
 
@@ -962,6 +964,65 @@ TEST_CASE("Test Thread QueueUserCallback", "Thread") {
   // callbacks.
 }
 
+// Not run by default - reports how waits on independent objects scale with the
+// number of threads doing them at once. Pairs of threads ping-pong through
+// their own auto-reset events, waiting on one of them or on any of two.
+TEST_CASE("Wait Contention Benchmark", "[.][threading][benchmark]") {
+  const uint32_t kRoundTripsPerPair = 20000;
+  uint32_t max_pair_count = std::max(logical_processor_count(), 2u);
+  for (bool wait_any : {false, true}) {
+    for (uint32_t pair_count = 1; pair_count <= max_pair_count;
+         pair_count *= 2) {
+      std::vector<std::unique_ptr<Event>> events;
+      for (uint32_t i = 0; i < pair_count * 3; ++i) {
+        events.push_back(Event::CreateAutoResetEvent(false));
+      }
+      auto wait = [wait_any](Event* event, Event* other_event) {
+        if (wait_any) {
+          WaitHandle* handles[] = {event, other_event};
+          return WaitAny(handles, 2, false).first;
+        }
+        return Wait(event, false);
+      };
+      std::atomic<uint32_t> failures(0);
+      std::vector<std::unique_ptr<Thread>> threads;
+      auto start = std::chrono::steady_clock::now();
+      for (uint32_t i = 0; i < pair_count; ++i) {
+        Event* ping = events[i * 3].get();
+        Event* pong = events[i * 3 + 1].get();
+        // Never signaled, only adds to the objects waited on.
+        Event* idle = events[i * 3 + 2].get();
+        threads.push_back(Thread::Create({}, [&, ping, pong, idle] {
+          for (uint32_t j = 0; j < kRoundTripsPerPair; ++j) {
+            ping->Set();
+            if (wait(pong, idle) != WaitResult::kSuccess) {
+              failures.fetch_add(1, std::memory_order_relaxed);
+            }
+          }
+        }));
+        threads.push_back(Thread::Create({}, [&, ping, pong, idle] {
+          for (uint32_t j = 0; j < kRoundTripsPerPair; ++j) {
+            if (wait(ping, idle) != WaitResult::kSuccess) {
+              failures.fetch_add(1, std::memory_order_relaxed);
+            }
+            pong->Set();
+          }
+        }));
+      }
+      for (auto& thread : threads) {
+        REQUIRE(Wait(thread.get(), false) == WaitResult::kSuccess);
+      }
+      double seconds = std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - start)
+                           .count();
+      REQUIRE(failures.load() == 0);
+      std::printf("%s, %u pairs: %.1f K round trips/s\n",
+                  wait_any ? "WaitAny" : "Wait", pair_count,
+                  double(kRoundTripsPerPair) * pair_count / seconds / 1e3);
+    }
+  }
+}
+
 }  // namespace test
 }  // namespace base
 }  // namespace xe
@@ -15,12 +15,16 @@
 
 #include <pthread.h>
 #include <signal.h>
+#include <linux/futex.h>
 #include <sys/eventfd.h>
 #include <sys/syscall.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <cerrno>
 #include <cstring>
 #include <ctime>
 #include <memory>
@@ -190,94 +194,193 @@ std::unique_ptr<HighResolutionTimer> HighResolutionTimer::CreateRepeating(
   return std::unique_ptr<HighResolutionTimer>(timer.release());
 }
 
+// A thread blocked in a wait on one or more objects. Each object keeps a list
+// of the wait blocks of the threads waiting on it and wakes only them when it's
+// signaled, after which they check all the objects they wait on again.
+class PosixWaitBlock {
+ public:
+  uint32_t wake_count() const {
+    return wake_count_.load(std::memory_order_acquire);
+  }
+
+  void Wake() {
+    wake_count_.fetch_add(1, std::memory_order_release);
+    syscall(SYS_futex, &wake_count_, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr,
+            0);
+  }
+
+  // Sleeps until Wake is called after wake_count() returned last_wake_count,
+  // or until the CLOCK_MONOTONIC deadline (if not null). May return early.
+  // Returns false if the deadline has passed.
+  bool WaitForWake(uint32_t last_wake_count, const timespec* deadline) {
+    if (syscall(SYS_futex, &wake_count_, FUTEX_WAIT_BITSET_PRIVATE,
+                last_wake_count, deadline, nullptr,
+                FUTEX_BITSET_MATCH_ANY) == -1 &&
+        errno == ETIMEDOUT) {
+      return false;
+    }
+    return true;
+  }
+
+ private:
+  static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+                "Futex words must be 32-bit");
+  std::atomic<uint32_t> wake_count_{0};
+};
+
 class PosixConditionBase {
  public:
   virtual bool Signal() = 0;
 
   WaitResult Wait(std::chrono::milliseconds timeout) {
-    bool executed;
-    auto predicate = [this] { return this->signaled(); };
-    auto lock = std::unique_lock<std::mutex>(mutex_);
-    if (predicate()) {
-      executed = true;
-    } else {
-      if (timeout == std::chrono::milliseconds::max()) {
-        cond_.wait(lock, predicate);
-        executed = true;  // Did not time out;
-      } else {
-        executed = cond_.wait_for(lock, timeout, predicate);
-      }
-    }
-    if (executed) {
-      post_execution();
-      return WaitResult::kSuccess;
-    } else {
-      return WaitResult::kTimeout;
-    }
+    PosixConditionBase* handle = this;
+    return WaitLocked(&handle, 1, false, timeout).first;
   }
 
   static std::pair<WaitResult, size_t> WaitMultiple(
       std::vector<PosixConditionBase*>&& handles, bool wait_all,
       std::chrono::milliseconds timeout) {
-    using iter_t = std::vector<PosixConditionBase*>::const_iterator;
-    bool executed;
-    auto predicate = [](auto h) { return h->signaled(); };
-
-    // Construct a condition for all or any depending on wait_all
-    auto operation = wait_all ? std::all_of<iter_t, decltype(predicate)>
-                              : std::any_of<iter_t, decltype(predicate)>;
-    auto aggregate = [&handles, operation, predicate] {
-      return operation(handles.cbegin(), handles.cend(), predicate);
-    };
+    return WaitLocked(handles.data(), handles.size(), wait_all, timeout);
+  }
 
-    // TODO(bwrsandman, Triang3l) This is controversial, see issue #1677
-    // This will probably cause a deadlock on the next thread doing any waiting
-    // if the thread is suspended between locking and waiting
-    std::unique_lock<std::mutex> lock(PosixConditionBase::mutex_);
+  virtual void* native_handle() const { return mutex_.native_handle(); }
+
+ protected:
+  inline virtual bool signaled() const = 0;
+  inline virtual void post_execution() = 0;
 
-    // Check if the aggregate lambda (all or any) is already satisfied
-    if (aggregate()) {
-      executed = true;
+  // Wakes the threads waiting on the object, must be called with mutex_ held
+  // after it may have become signaled. All of them are woken because any of
+  // them may be waiting for other objects as well and not acquire this one.
+  void NotifyWaiters() {
+    for (PosixWaitBlock* wait_block : waiters_) {
+      wait_block->Wake();
+    }
+  }
+
+  // Protects the state of the object and waiters_.
+  mutable std::mutex mutex_;
+
+ private:
+  static std::pair<WaitResult, size_t> WaitLocked(
+      PosixConditionBase* const* handles, size_t handle_count, bool wait_all,
+      std::chrono::milliseconds timeout) {
+    // The objects are locked in address order so waits on multiple objects
+    // can't deadlock with each other, and a handle passed twice is locked once.
+    PosixConditionBase* single_lock_order[1];
+    std::vector<PosixConditionBase*> multiple_lock_order;
+    PosixConditionBase** lock_order;
+    size_t lock_count;
+    if (handle_count == 1) {
+      single_lock_order[0] = handles[0];
+      lock_order = single_lock_order;
+      lock_count = 1;
     } else {
-      // If the aggregate is not yet satisfied and the timeout is infinite,
-      // wait without timeout.
-      if (timeout == std::chrono::milliseconds::max()) {
-        PosixConditionBase::cond_.wait(lock, aggregate);
-        executed = true;
-      } else {
-        // Wait with timeout.
-        executed = PosixConditionBase::cond_.wait_for(lock, timeout, aggregate);
-      }
+      multiple_lock_order.assign(handles, handles + handle_count);
+      std::sort(multiple_lock_order.begin(), multiple_lock_order.end());
+      multiple_lock_order.erase(
+          std::unique(multiple_lock_order.begin(), multiple_lock_order.end()),
+          multiple_lock_order.end());
+      lock_order = multiple_lock_order.data();
+      lock_count = multiple_lock_order.size();
     }
-    if (executed) {
-      auto first_signaled = std::numeric_limits<size_t>::max();
-      for (auto i = 0u; i < handles.size(); ++i) {
-        if (handles[i]->signaled()) {
-          if (first_signaled > i) {
-            first_signaled = i;
+    auto lock_all = [&]() {
+      for (size_t i = 0; i < lock_count; ++i) {
+        lock_order[i]->mutex_.lock();
+      }
+    };
+    auto unlock_all = [&]() {
+      for (size_t i = lock_count; i-- > 0;) {
+        lock_order[i]->mutex_.unlock();
+      }
+    };
+
+    // Acquires the objects if the wait is satisfied, with all of them locked.
+    auto try_acquire = [&](size_t* out_first_signaled) {
+      if (wait_all) {
+        for (size_t i = 0; i < handle_count; ++i) {
+          if (!handles[i]->signaled()) {
+            return false;
           }
+        }
+        for (size_t i = 0; i < handle_count; ++i) {
           handles[i]->post_execution();
-          if (!wait_all) break;
         }
+        *out_first_signaled = 0;
+        return true;
       }
-      return std::make_pair(WaitResult::kSuccess, first_signaled);
-    } else {
+      for (size_t i = 0; i < handle_count; ++i) {
+        if (handles[i]->signaled()) {
+          handles[i]->post_execution();
+          *out_first_signaled = i;
+          return true;
+        }
+      }
+      return false;
+    };
+
+    timespec deadline;
+    timespec* deadline_ptr = nullptr;
+    if (timeout != std::chrono::milliseconds::max()) {
+      clock_gettime(CLOCK_MONOTONIC, &deadline);
+      timespec duration = DurationToTimeSpec(timeout);
+      deadline.tv_sec += duration.tv_sec;
+      deadline.tv_nsec += duration.tv_nsec;
+      if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_nsec -= 1000000000L;
+        ++deadline.tv_sec;
+      }
+      deadline_ptr = &deadline;
+    }
+
+    // TODO(bwrsandman, Triang3l) This is controversial, see issue #1677
+    // This will probably cause a deadlock on the next thread waiting on or
+    // signaling the same objects if the thread is suspended while holding
+    // their locks.
+    PosixWaitBlock wait_block;
+    bool registered = false;
+    size_t first_signaled = 0;
+    bool acquired;
+    lock_all();
+    while (true) {
+      acquired = try_acquire(&first_signaled);
+      if (acquired || timeout == std::chrono::milliseconds::zero()) {
+        break;
+      }
+      if (!registered) {
+        for (size_t i = 0; i < lock_count; ++i) {
+          lock_order[i]->waiters_.push_back(&wait_block);
+        }
+        registered = true;
+      }
+      // Read before unlocking so a wake between unlocking and sleeping isn't
+      // missed.
+      uint32_t wake_count = wait_block.wake_count();
+      unlock_all();
+      bool timed_out = !wait_block.WaitForWake(wake_count, deadline_ptr);
+      lock_all();
+      if (timed_out) {
+        acquired = try_acquire(&first_signaled);
+        break;
+      }
+    }
+    if (registered) {
+      for (size_t i = 0; i < lock_count; ++i) {
+        auto& waiters = lock_order[i]->waiters_;
+        waiters.erase(std::find(waiters.begin(), waiters.end(), &wait_block));
+      }
+    }
+    unlock_all();
+
+    if (!acquired) {
       return std::make_pair<WaitResult, size_t>(WaitResult::kTimeout, 0);
     }
+    return std::make_pair(WaitResult::kSuccess, first_signaled);
   }
 
-  virtual void* native_handle() const { return cond_.native_handle(); }
-
- protected:
-  inline virtual bool signaled() const = 0;
-  inline virtual void post_execution() = 0;
-  static std::condition_variable cond_;
-  static std::mutex mutex_;
+  std::vector<PosixWaitBlock*> waiters_;
 };
 
-std::condition_variable PosixConditionBase::cond_;
-std::mutex PosixConditionBase::mutex_;
-
 // There really is no native POSIX handle for a single wait/signal construct
 // pthreads is at a lower level with more handles for such a mechanism.
 // This simple wrapper class functions as our handle and uses conditional
@@ -295,13 +398,7 @@ class PosixCondition<Event> : public PosixConditionBase {
   bool Signal() override {
     auto lock = std::unique_lock<std::mutex>(mutex_);
     signal_ = true;
-    if (manual_reset_) {
-      cond_.notify_all();
-    } else {
-      // FIXME(bwrsandman): Potential cause for deadlock
-      // See issue #1678 for possible fix and discussion
-      cond_.notify_one();
-    }
+    NotifyWaiters();
     return true;
   }
 
@@ -330,11 +427,11 @@ class PosixCondition<Semaphore> : public PosixConditionBase {
   bool Signal() override { return Release(1, nullptr); }
 
   bool Release(uint32_t release_count, int* out_previous_count) {
+    auto lock = std::unique_lock<std::mutex>(mutex_);
     if (maximum_count_ - count_ >= release_count) {
-      auto lock = std::unique_lock<std::mutex>(mutex_);
       if (out_previous_count) *out_previous_count = count_;
       count_ += release_count;
-      cond_.notify_all();
+      NotifyWaiters();
       return true;
     }
     return false;
@@ -342,10 +439,7 @@ class PosixCondition<Semaphore> : public PosixConditionBase {
 
  private:
   inline bool signaled() const override { return count_ > 0; }
-  inline void post_execution() override {
-    count_--;
-    cond_.notify_all();
-  }
+  inline void post_execution() override { count_--; }
   uint32_t count_;
   const uint32_t maximum_count_;
 };
@@ -363,12 +457,12 @@ class PosixCondition<Mutant> : public PosixConditionBase {
   bool Signal() override { return Release(); }
 
   bool Release() {
+    auto lock = std::unique_lock<std::mutex>(mutex_);
     if (owner_ == std::this_thread::get_id() && count_ > 0) {
-      auto lock = std::unique_lock<std::mutex>(mutex_);
       --count_;
       // Free to be acquired by another thread
       if (count_ == 0) {
-        cond_.notify_one();
+        NotifyWaiters();
       }
       return true;
     }
@@ -437,11 +531,7 @@ class PosixCondition<Timer> : public PosixConditionBase {
       // Store callback
       if (callback_) callback = callback_;
       signal_ = true;
-      if (manual_reset_) {
-        cond_.notify_all();
-      } else {
-        cond_.notify_one();
-      }
+      NotifyWaiters();
     }
     // Call callback
     if (callback) callback();
@@ -741,7 +831,7 @@ class PosixCondition<Thread> : public PosixConditionBase {
 
     exit_code_ = exit_code;
     signaled_ = true;
-    cond_.notify_all();
+    NotifyWaiters();
 
 #ifdef XE_PLATFORM_ANDROID
     if (pthread_kill(thread, GetSystemSignal(SignalType::kThreadTerminate)) !=
@@ -1072,10 +1162,10 @@ void* PosixCondition<Thread>::ThreadStartRoutine(void* parameter) {
     thread->handle_.state_ = State::kFinished;
   }
 
-  std::unique_lock<std::mutex> lock(mutex_);
+  std::unique_lock<std::mutex> lock(thread->handle_.mutex_);
   thread->handle_.exit_code_ = 0;
   thread->handle_.signaled_ = true;
-  cond_.notify_all();
+  thread->handle_.NotifyWaiters();
 
   current_thread_ = nullptr;
   return nullptr;
@@ -10,6 +10,8 @@
 #ifndef XENIA_CPU_BACKEND_BACKEND_H_
 #define XENIA_CPU_BACKEND_BACKEND_H_
 
+#include <cstdint>
+#include <filesystem>
 #include <memory>
 
 #include "xenia/cpu/backend/machine_info.h"
@@ -54,6 +56,21 @@ class Backend {
   virtual std::unique_ptr<GuestFunction> CreateGuestFunction(
       Module* module, uint32_t address) = 0;
 
+  // Opens the persistent storage of generated code for the module with the
+  // given hash, if supported by the backend. An empty cache root disables it.
+  virtual bool InitializeCodeStorage(const std::filesystem::path& cache_root,
+                                     uint64_t module_hash) {
+    return false;
+  }
+  // Defines the function using the code generated by a previous run, if it's
+  // in the code storage. Returns false if it needs to be translated.
+  virtual bool DefineStoredFunction(GuestFunction* function) { return false; }
+  // Makes a complete recompilation of a function (translated into a code
+  // object created with CreateGuestFunction and marked as a recompilation)
+  // current, redirecting calls of the function to it.
+  virtual void PublishRecompiledFunction(
+      GuestFunction* function, std::unique_ptr<GuestFunction> code) = 0;
+
   // Calculates the next host instruction based on the current thread state and
   // current PC. This will look for branches and other control flow
   // instructions.
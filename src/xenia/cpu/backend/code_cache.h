@@ -30,7 +30,8 @@ class CodeCache {
   virtual size_t total_size() const = 0;
 
   // Finds a function based on the given host PC (that may be within a
-  // function).
+  // function). Returns the code object the PC is in, which for recompiled code
+  // is a separate object with the same address as the function in the module.
   virtual GuestFunction* LookupFunction(uint64_t host_pc) = 0;
 
   // Finds platform-specific function unwind info for the given host PC.
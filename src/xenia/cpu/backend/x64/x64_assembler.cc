@@ -91,15 +91,14 @@ bool X64Assembler::Assemble(GuestFunction* function, HIRBuilder* builder,
   }
 
   function->set_debug_info(std::move(debug_info));
-  static_cast<X64Function*>(function)->Setup(
-      reinterpret_cast<uint8_t*>(machine_code), code_size);
-
-  // Install into indirection table.
-  uint64_t host_address = reinterpret_cast<uint64_t>(machine_code);
-  assert_true((host_address >> 32) == 0);
-  reinterpret_cast<X64CodeCache*>(backend_->code_cache())
-      ->AddIndirection(function->address(),
-                       static_cast<uint32_t>(host_address));
+  auto x64_function = static_cast<X64Function*>(function);
+  x64_function->Setup(reinterpret_cast<uint8_t*>(machine_code), code_size);
+
+  // Install into indirection table and link calls, now that the function is
+  // complete. Recompilations are installed when they're published.
+  if (!function->is_recompilation()) {
+    x64_backend_->PublishGuestCode(function->address(), x64_function);
+  }
 
   return true;
 }
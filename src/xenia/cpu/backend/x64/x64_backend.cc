@@ -14,8 +14,11 @@
 #include "third_party/capstone/include/capstone/capstone.h"
 #include "third_party/capstone/include/capstone/x86.h"
 
+#include "third_party/fmt/include/fmt/format.h"
+#include "xenia/base/clock.h"
 #include "xenia/base/exception_handler.h"
 #include "xenia/base/logging.h"
+#include "xenia/base/xxhash.h"
 #include "xenia/cpu/backend/x64/x64_assembler.h"
 #include "xenia/cpu/backend/x64/x64_code_cache.h"
 #include "xenia/cpu/backend/x64/x64_emitter.h"
@@ -23,13 +26,30 @@
 #include "xenia/cpu/backend/x64/x64_sequences.h"
 #include "xenia/cpu/backend/x64/x64_stack_layout.h"
 #include "xenia/cpu/breakpoint.h"
+#include "xenia/cpu/cpu_flags.h"
 #include "xenia/cpu/processor.h"
 #include "xenia/cpu/stack_walker.h"
 
+DECLARE_bool(break_on_unimplemented_instructions);
+DECLARE_bool(debugprint_trap_log);
+DECLARE_bool(ignore_undefined_externs);
+DECLARE_bool(emit_source_annotations);
+DECLARE_bool(inline_mmio_access);
+DECLARE_bool(store_all_context_values);
+
 DEFINE_bool(
     use_haswell_instructions, true,
     "Uses the AVX2/FMA/etc instructions on Haswell processors when available.",
     "CPU");
+DEFINE_bool(store_jit_code, true,
+            "Store the generated code of the title in the cache directory to "
+            "skip translating the same functions again in later runs.",
+            "CPU");
+DEFINE_bool(link_guest_calls, true,
+            "Patch calls between guest functions into direct calls once the "
+            "callee is compiled instead of loading the target from the "
+            "indirection table on every call.",
+            "CPU");
 
 namespace xe {
 namespace cpu {
@@ -149,6 +169,127 @@ std::unique_ptr<GuestFunction> X64Backend::CreateGuestFunction(
   return std::make_unique<X64Function>(module, address);
 }
 
+bool X64Backend::InitializeCodeStorage(const std::filesystem::path& cache_root,
+                                       uint64_t module_hash) {
+  if (!cvars::store_jit_code || cache_root.empty()) {
+    return false;
+  }
+  // Code with tracing references memory of the run that has generated it, and
+  // code loaded from the storage won't have tracing.
+  if (cvars::disassemble_functions || cvars::trace_functions ||
+      cvars::trace_function_coverage || cvars::trace_function_references ||
+      cvars::trace_function_data) {
+    return false;
+  }
+
+  // Stored code references the thunks and the emitter constants directly, and
+  // may contain instructions not supported by every CPU.
+  Xbyak::util::Cpu cpu;
+  struct {
+    uint64_t host_to_guest_thunk;
+    uint64_t guest_to_host_thunk;
+    uint64_t resolve_function_thunk;
+    uint64_t emitter_data;
+    uint32_t use_haswell_instructions;
+    uint32_t supports_extended_load_store;
+    uint32_t cpu_features[6];
+  } environment = {};
+  environment.host_to_guest_thunk = uint64_t(host_to_guest_thunk_);
+  environment.guest_to_host_thunk = uint64_t(guest_to_host_thunk_);
+  environment.resolve_function_thunk = uint64_t(resolve_function_thunk_);
+  environment.emitter_data = uint64_t(emitter_data_);
+  environment.use_haswell_instructions = cvars::use_haswell_instructions;
+  environment.supports_extended_load_store =
+      machine_info_.supports_extended_load_store;
+  environment.cpu_features[0] = cpu.has(Xbyak::util::Cpu::tAVX2);
+  environment.cpu_features[1] = cpu.has(Xbyak::util::Cpu::tFMA);
+  environment.cpu_features[2] = cpu.has(Xbyak::util::Cpu::tLZCNT);
+  environment.cpu_features[3] = cpu.has(Xbyak::util::Cpu::tBMI2);
+  environment.cpu_features[4] = cpu.has(Xbyak::util::Cpu::tF16C);
+  environment.cpu_features[5] = cpu.has(Xbyak::util::Cpu::tMOVBE);
+
+  // Options changing the code generated for the same guest code.
+  struct {
+    uint64_t break_on_instruction;
+    uint64_t break_condition_value;
+    int32_t break_condition_gpr;
+    uint32_t break_condition_truncate;
+    uint32_t break_on_unimplemented_instructions;
+    uint32_t break_on_debugbreak;
+    uint32_t debugprint_trap_log;
+    uint32_t ignore_undefined_externs;
+    uint32_t emit_source_annotations;
+    uint32_t disable_global_lock;
+    uint32_t inline_mmio_access;
+    uint32_t store_all_context_values;
+    uint32_t debug;
+    uint32_t raw_clock;
+  } codegen_options = {};
+  codegen_options.break_on_instruction = cvars::break_on_instruction;
+  codegen_options.break_condition_value = cvars::break_condition_value;
+  codegen_options.break_condition_gpr = cvars::break_condition_gpr;
+  codegen_options.break_condition_truncate = cvars::break_condition_truncate;
+  codegen_options.break_on_unimplemented_instructions =
+      cvars::break_on_unimplemented_instructions;
+  codegen_options.break_on_debugbreak = cvars::break_on_debugbreak;
+  codegen_options.debugprint_trap_log = cvars::debugprint_trap_log;
+  codegen_options.ignore_undefined_externs = cvars::ignore_undefined_externs;
+  codegen_options.emit_source_annotations = cvars::emit_source_annotations;
+  codegen_options.disable_global_lock = cvars::disable_global_lock;
+  codegen_options.inline_mmio_access = cvars::inline_mmio_access;
+  codegen_options.store_all_context_values = cvars::store_all_context_values;
+  codegen_options.debug = cvars::debug;
+  codegen_options.raw_clock =
+      cvars::clock_no_scaling && cvars::clock_source_raw;
+
+  XXH3_state_t hash_state;
+  XXH3_64bits_reset(&hash_state);
+  XXH3_64bits_update(&hash_state, &environment, sizeof(environment));
+  XXH3_64bits_update(&hash_state, &codegen_options, sizeof(codegen_options));
+  // Including the terminators to separate the strings.
+  XXH3_64bits_update(&hash_state, cvars::register_allocator.c_str(),
+                     cvars::register_allocator.size() + 1);
+  XXH3_64bits_update(&hash_state, cvars::break_condition_op.c_str(),
+                     cvars::break_condition_op.size() + 1);
+
+  return code_cache_->InitializeStorage(
+      cache_root / "jit" / fmt::format("{:016X}.x64.xjit", module_hash),
+      module_hash, XXH3_64bits_digest(&hash_state));
+}
+
+bool X64Backend::DefineStoredFunction(GuestFunction* function) {
+  if (!code_cache_->has_storage()) {
+    return false;
+  }
+  size_t code_size;
+  void* machine_code = code_cache_->PlaceStoredGuestCode(
+      processor()->memory(), function, &code_size);
+  if (!machine_code) {
+    return false;
+  }
+  auto x64_function = static_cast<X64Function*>(function);
+  x64_function->Setup(reinterpret_cast<uint8_t*>(machine_code), code_size);
+  PublishGuestCode(function->address(), x64_function);
+  return true;
+}
+
+void X64Backend::PublishRecompiledFunction(
+    GuestFunction* function, std::unique_ptr<GuestFunction> code) {
+  assert_true(code->is_recompilation());
+  auto x64_code = static_cast<X64Function*>(code.get());
+  function->AddRecompiledCode(std::move(code));
+  PublishGuestCode(function->address(), x64_code);
+}
+
+void X64Backend::PublishGuestCode(uint32_t guest_address, X64Function* code) {
+  uint64_t host_address = reinterpret_cast<uint64_t>(code->machine_code());
+  assert_true((host_address >> 32) == 0);
+  code_cache_->AddIndirection(guest_address,
+                              static_cast<uint32_t>(host_address));
+  code_cache_->LinkGuestCode(guest_address, code->machine_code(),
+                             code->call_sites());
+}
+
 uint64_t ReadCapstoneReg(X64Context* context, x86_reg reg) {
   switch (reg) {
     case X86_REG_RAX:
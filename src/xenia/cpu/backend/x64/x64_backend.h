@@ -16,6 +16,8 @@
 #include "xenia/cpu/backend/backend.h"
 
 DECLARE_bool(use_haswell_instructions);
+DECLARE_bool(store_jit_code);
+DECLARE_bool(link_guest_calls);
 
 namespace xe {
 class Exception;
@@ -26,6 +28,7 @@ namespace backend {
 namespace x64 {
 
 class X64CodeCache;
+class X64Function;
 
 #define XENIA_HAS_X64_BACKEND 1
 
@@ -61,6 +64,16 @@ class X64Backend : public Backend {
   std::unique_ptr<GuestFunction> CreateGuestFunction(Module* module,
                                                      uint32_t address) override;
 
+  bool InitializeCodeStorage(const std::filesystem::path& cache_root,
+                             uint64_t module_hash) override;
+  bool DefineStoredFunction(GuestFunction* function) override;
+  void PublishRecompiledFunction(GuestFunction* function,
+                                 std::unique_ptr<GuestFunction> code) override;
+  // Makes complete code of a guest function reachable by guest calls, through
+  // the indirection table and the linked call sites. Until then, nothing can
+  // execute the code, so its source map is never read while being written.
+  void PublishGuestCode(uint32_t guest_address, X64Function* code);
+
   uint64_t CalculateNextHostInstruction(ThreadDebugInfo* thread_info,
                                         uint64_t current_pc) override;
 
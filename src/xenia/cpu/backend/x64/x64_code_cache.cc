@@ -11,18 +11,26 @@
 
 #include <cstdlib>
 #include <cstring>
+#include <filesystem>
 
 #if ENABLE_VTUNE
 #include "third_party/vtune/include/jitprofiling.h"
 #pragma comment(lib, "../third_party/vtune/lib64/jitprofiling.lib")
 #endif
 
+#include "build/version.h"
 #include "third_party/fmt/include/fmt/format.h"
 #include "xenia/base/assert.h"
 #include "xenia/base/clock.h"
+#include "xenia/base/filesystem.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/base/memory.h"
+#include "xenia/base/string.h"
+#include "xenia/base/xxhash.h"
+#include "xenia/cpu/backend/x64/x64_backend.h"
+#include "xenia/cpu/backend/x64/x64_function.h"
+#include "xenia/cpu/backend/x64/x64_sequences.h"
 #include "xenia/cpu/function.h"
 #include "xenia/cpu/module.h"
 
@@ -34,6 +42,8 @@ namespace x64 {
 X64CodeCache::X64CodeCache() = default;
 
 X64CodeCache::~X64CodeCache() {
+  ShutdownStorage();
+
   if (indirection_table_base_) {
     xe::memory::DeallocFixed(indirection_table_base_, 0,
                              xe::memory::DeallocationType::kRelease);
@@ -278,8 +288,9 @@ void X64CodeCache::PlaceGuestCode(uint32_t guest_address, void* machine_code,
 
   // Now that everything is ready, fix up the indirection table.
   // Note that we do support code that doesn't have an indirection fixup, so
-  // ignore those when we see them.
-  if (guest_address && indirection_table_base_) {
+  // ignore those when we see them. Guest functions are installed by the
+  // backend once they're complete.
+  if (guest_address && indirection_table_base_ && !function_info) {
     uint32_t* indirection_slot = reinterpret_cast<uint32_t*>(
         indirection_table_base_ + (guest_address - kIndirectionTableBase));
     *indirection_slot =
@@ -332,7 +343,389 @@ uint32_t X64CodeCache::PlaceData(const void* data, size_t length) {
   return uint32_t(uintptr_t(data_address));
 }
 
+void X64CodeCache::LinkGuestCode(uint32_t guest_address,
+                                 void* code_execute_address,
+                                 const std::vector<GuestCallSite>& call_sites) {
+  if (!cvars::link_guest_calls) {
+    return;
+  }
+  auto code = reinterpret_cast<uint8_t*>(code_execute_address);
+  std::lock_guard<std::mutex> lock(link_mutex_);
+
+  for (const GuestCallSite& call_site : call_sites) {
+    LinkedCallSite linked_call_site;
+    linked_call_site.code_execute_address = code + call_site.code_offset;
+    linked_call_site.caller_guest_address = guest_address;
+    // ModRM of call rax is 0xD0, of jmp rax is 0xE0.
+    linked_call_site.is_tail =
+        linked_call_site.code_execute_address[4] == 0xE0;
+    call_sites_[call_site.guest_address].push_back(linked_call_site);
+    auto callee_it = linked_code_.find(call_site.guest_address);
+    if (callee_it != linked_code_.end()) {
+      PatchCallSite(linked_call_site, callee_it->second);
+    }
+  }
+
+  linked_code_[guest_address] = code;
+  auto callers_it = call_sites_.find(guest_address);
+  if (callers_it != call_sites_.end()) {
+    for (const LinkedCallSite& caller_call_site : callers_it->second) {
+      PatchCallSite(caller_call_site, code);
+    }
+  }
+}
+
+void X64CodeCache::PatchCallSite(const LinkedCallSite& call_site,
+                                 const uint8_t* target_execute_address) {
+  // Another thread may be executing the call site right now, so the whole
+  // instruction is replaced with a single aligned 8-byte store, and both the
+  // original and the patched instructions leave the same return address.
+  static const size_t kCallSiteSize = 5;
+  uintptr_t qword_execute_address =
+      reinterpret_cast<uintptr_t>(call_site.code_execute_address) &
+      ~uintptr_t(7);
+  size_t qword_offset =
+      reinterpret_cast<uintptr_t>(call_site.code_execute_address) -
+      qword_execute_address;
+  assert_true(qword_offset + kCallSiteSize <= sizeof(uint64_t));
+  auto qword_write_address = reinterpret_cast<volatile uint64_t*>(
+      generated_code_write_base_ +
+      (qword_execute_address -
+       reinterpret_cast<uintptr_t>(generated_code_execute_base_)));
+
+  uint8_t qword[sizeof(uint64_t)];
+  uint64_t value = *qword_write_address;
+  std::memcpy(qword, &value, sizeof(qword));
+  uint8_t* instruction = qword + qword_offset;
+  // call/jmp rel32.
+  instruction[0] = call_site.is_tail ? 0xE9 : 0xE8;
+  int32_t displacement =
+      int32_t(target_execute_address -
+              (call_site.code_execute_address + kCallSiteSize));
+  std::memcpy(instruction + 1, &displacement, sizeof(displacement));
+  std::memcpy(&value, qword, sizeof(value));
+  *qword_write_address = value;
+}
+
+// 'XECC'.
+static const uint32_t kStorageMagic = 0x43434558;
+static const uint32_t kStorageVersion = 3;
+
+struct StorageFileHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t module_hash;
+  uint64_t build_hash;
+  uint64_t environment_hash;
+};
+
+uintptr_t X64CodeCache::GetHostImageAnchor() {
+  // Any function in the executable works as long as it's always the same one.
+  return reinterpret_cast<uintptr_t>(&X64CodeCache::Create);
+}
+
+uint64_t X64CodeCache::GetStorageBuildHash() {
+  // The generated code depends on the exact sequences and host functions of
+  // the build, so the commit and the relative layout of the executable must
+  // match. The latter also catches local builds with uncommitted changes in
+  // most cases.
+  struct {
+    char commit[64];
+    int64_t layout;
+  } build_info = {};
+  std::strncpy(build_info.commit, XE_BUILD_COMMIT,
+               xe::countof(build_info.commit) - 1);
+  build_info.layout = int64_t(reinterpret_cast<uintptr_t>(&SelectSequence) -
+                              GetHostImageAnchor());
+  return XXH3_64bits(&build_info, sizeof(build_info));
+}
+
+uint64_t X64CodeCache::HashGuestCode(Memory* memory, uint32_t guest_address,
+                                     uint32_t guest_end_address) {
+  // The end address is the address of the last instruction.
+  return XXH3_64bits(memory->TranslateVirtual(guest_address),
+                     guest_end_address + 4 - guest_address);
+}
+
+bool X64CodeCache::InitializeStorage(const std::filesystem::path& storage_path,
+                                     uint64_t module_hash,
+                                     uint64_t environment_hash) {
+  ShutdownStorage();
+
+  auto storage_root = storage_path.parent_path();
+  if (!std::filesystem::exists(storage_root)) {
+    if (!std::filesystem::create_directories(storage_root)) {
+      XELOGE(
+          "Failed to create the JIT code storage directory, persistent code "
+          "storage will be disabled: {}",
+          xe::path_to_utf8(storage_root));
+      return false;
+    }
+  }
+
+  StorageFileHeader expected_header;
+  expected_header.magic = kStorageMagic;
+  expected_header.version = kStorageVersion;
+  expected_header.module_hash = module_hash;
+  expected_header.build_hash = GetStorageBuildHash();
+  expected_header.environment_hash = environment_hash;
+
+  // Map the functions stored by previous runs, if they are compatible with this
+  // module and build, validating every record and cutting off everything after
+  // the first corrupted one (such as a record partially written on a crash).
+  std::lock_guard<std::mutex> lock(storage_mutex_);
+  auto index_stored_functions = [this]() -> uint64_t {
+    const uint8_t* storage_data = storage_mapping_->data();
+    size_t storage_size = storage_mapping_->size();
+    size_t offset = sizeof(StorageFileHeader);
+    while (offset + sizeof(StoredFunctionHeader) <= storage_size) {
+      auto header =
+          reinterpret_cast<const StoredFunctionHeader*>(storage_data + offset);
+      size_t data_size = header->code_size +
+                         sizeof(uint32_t) * header->relocation_count +
+                         sizeof(SourceMapEntry) * header->source_map_count +
+                         sizeof(GuestCallSite) * header->call_site_count;
+      size_t record_size =
+          xe::round_up(sizeof(StoredFunctionHeader) + data_size, size_t(8));
+      if (offset + record_size > storage_size ||
+          XXH3_64bits(header + 1, data_size) != header->data_hash) {
+        break;
+      }
+      stored_functions_[header->guest_address] = header;
+      stored_code_hashes_.emplace(header->guest_address, header->data_hash);
+      offset += record_size;
+    }
+    return offset;
+  };
+  uint64_t storage_valid_bytes = 0;
+  if (std::filesystem::exists(storage_path)) {
+    storage_mapping_ =
+        MappedMemory::Open(storage_path, MappedMemory::Mode::kRead);
+  }
+  if (storage_mapping_ &&
+      storage_mapping_->size() >= sizeof(StorageFileHeader) &&
+      !std::memcmp(storage_mapping_->data(), &expected_header,
+                   sizeof(StorageFileHeader))) {
+    storage_valid_bytes = index_stored_functions();
+    if (storage_valid_bytes < storage_mapping_->size()) {
+      XELOGW(
+          "JIT code storage is corrupted after {} bytes, discarding the rest",
+          storage_valid_bytes);
+      stored_functions_.clear();
+      stored_code_hashes_.clear();
+      storage_mapping_.reset();
+      FILE* truncate_file = xe::filesystem::OpenFile(storage_path, "r+b");
+      if (!truncate_file || !xe::filesystem::TruncateStdioFile(
+                                truncate_file, storage_valid_bytes)) {
+        storage_valid_bytes = 0;
+      }
+      if (truncate_file) {
+        fclose(truncate_file);
+      }
+      if (storage_valid_bytes) {
+        storage_mapping_ =
+            MappedMemory::Open(storage_path, MappedMemory::Mode::kRead);
+        storage_valid_bytes = storage_mapping_ ? index_stored_functions() : 0;
+      }
+    }
+  }
+
+  if (storage_valid_bytes) {
+    storage_file_ = xe::filesystem::OpenFile(storage_path, "ab");
+  } else {
+    // Incompatible or missing - start over.
+    stored_functions_.clear();
+    stored_code_hashes_.clear();
+    storage_mapping_.reset();
+    storage_file_ = xe::filesystem::OpenFile(storage_path, "wb");
+    if (storage_file_ &&
+        !fwrite(&expected_header, sizeof(expected_header), 1, storage_file_)) {
+      fclose(storage_file_);
+      storage_file_ = nullptr;
+    }
+  }
+  if (!storage_file_) {
+    XELOGE(
+        "Failed to open the JIT code storage file for writing, persistent "
+        "code storage will be disabled: {}",
+        xe::path_to_utf8(storage_path));
+    stored_functions_.clear();
+    stored_code_hashes_.clear();
+    storage_mapping_.reset();
+    return false;
+  }
+
+  XELOGI("Loaded {} functions from the JIT code storage {}",
+         stored_functions_.size(), xe::path_to_utf8(storage_path));
+  return true;
+}
+
+void X64CodeCache::ShutdownStorage() {
+  std::lock_guard<std::mutex> lock(storage_mutex_);
+  if (storage_file_) {
+    fclose(storage_file_);
+    storage_file_ = nullptr;
+  }
+  // Code placed from the mapping has already been copied to the code cache.
+  stored_functions_.clear();
+  stored_code_hashes_.clear();
+  storage_mapping_.reset();
+}
+
+void X64CodeCache::StoreGuestCode(
+    Memory* memory, GuestFunction* function, const void* code_execute_address,
+    const EmitFunctionInfo& func_info,
+    const std::vector<uint32_t>& host_image_relocations,
+    const std::vector<GuestCallSite>& call_sites) {
+  std::lock_guard<std::mutex> lock(storage_mutex_);
+  if (!storage_file_) {
+    return;
+  }
+
+  // Host image pointers are stored relative to the anchor.
+  std::vector<uint8_t> code(
+      reinterpret_cast<const uint8_t*>(code_execute_address),
+      reinterpret_cast<const uint8_t*>(code_execute_address) +
+          func_info.code_size.total);
+  uint64_t host_image_anchor = GetHostImageAnchor();
+  for (uint32_t relocation_offset : host_image_relocations) {
+    assert_true(relocation_offset + sizeof(uint64_t) <= code.size());
+    uint64_t value;
+    std::memcpy(&value, code.data() + relocation_offset, sizeof(value));
+    value -= host_image_anchor;
+    std::memcpy(code.data() + relocation_offset, &value, sizeof(value));
+  }
+
+  const auto& source_map = function->source_map();
+  size_t relocations_size = sizeof(uint32_t) * host_image_relocations.size();
+  size_t source_map_size = sizeof(SourceMapEntry) * source_map.size();
+  size_t call_sites_size = sizeof(GuestCallSite) * call_sites.size();
+
+  StoredFunctionHeader header = {};
+  header.guest_address = function->address();
+  header.guest_end_address = function->end_address();
+  header.code_size = uint32_t(code.size());
+  header.prolog_size = uint32_t(func_info.code_size.prolog);
+  header.body_size = uint32_t(func_info.code_size.body);
+  header.epilog_size = uint32_t(func_info.code_size.epilog);
+  header.tail_size = uint32_t(func_info.code_size.tail);
+  header.prolog_stack_alloc_offset =
+      uint32_t(func_info.prolog_stack_alloc_offset);
+  header.stack_size = uint32_t(func_info.stack_size);
+  header.relocation_count = uint32_t(host_image_relocations.size());
+  header.source_map_count = uint32_t(source_map.size());
+  header.call_site_count = uint32_t(call_sites.size());
+  header.guest_code_hash = HashGuestCode(memory, header.guest_address,
+                                         header.guest_end_address);
+  XXH3_state_t hash_state;
+  XXH3_64bits_reset(&hash_state);
+  XXH3_64bits_update(&hash_state, code.data(), code.size());
+  XXH3_64bits_update(&hash_state, host_image_relocations.data(),
+                     relocations_size);
+  XXH3_64bits_update(&hash_state, source_map.data(), source_map_size);
+  XXH3_64bits_update(&hash_state, call_sites.data(), call_sites_size);
+  header.data_hash = XXH3_64bits_digest(&hash_state);
+  if (!stored_code_hashes_.emplace(header.guest_address, header.data_hash)
+           .second) {
+    return;
+  }
+
+  size_t record_size = sizeof(header) + code.size() + relocations_size +
+                       source_map_size + call_sites_size;
+  static const uint8_t padding[8] = {};
+  fwrite(&header, sizeof(header), 1, storage_file_);
+  fwrite(code.data(), code.size(), 1, storage_file_);
+  if (relocations_size) {
+    fwrite(host_image_relocations.data(), relocations_size, 1, storage_file_);
+  }
+  if (source_map_size) {
+    fwrite(source_map.data(), source_map_size, 1, storage_file_);
+  }
+  if (call_sites_size) {
+    fwrite(call_sites.data(), call_sites_size, 1, storage_file_);
+  }
+  if (record_size & 7) {
+    fwrite(padding, 8 - (record_size & 7), 1, storage_file_);
+  }
+}
+
+void* X64CodeCache::PlaceStoredGuestCode(Memory* memory,
+                                         GuestFunction* function,
+                                         size_t* code_size_out) {
+  const StoredFunctionHeader* header;
+  {
+    std::lock_guard<std::mutex> lock(storage_mutex_);
+    auto it = stored_functions_.find(function->address());
+    if (it == stored_functions_.end()) {
+      return nullptr;
+    }
+    header = it->second;
+  }
+
+  // The storage is keyed by the main module only, so the code at the address
+  // may be from a different module or version of it, or may have been
+  // modified.
+  if (header->guest_end_address < header->guest_address ||
+      !function->module()->ContainsAddress(header->guest_end_address) ||
+      HashGuestCode(memory, header->guest_address,
+                    header->guest_end_address) != header->guest_code_hash) {
+    return nullptr;
+  }
+
+  auto code_data = reinterpret_cast<const uint8_t*>(header + 1);
+  auto relocations_data = code_data + header->code_size;
+  auto source_map_data =
+      relocations_data + sizeof(uint32_t) * header->relocation_count;
+  auto call_sites_data =
+      source_map_data + sizeof(SourceMapEntry) * header->source_map_count;
+
+  // Rebase the host image pointers in a copy of the code.
+  std::vector<uint8_t> code(code_data, code_data + header->code_size);
+  uint64_t host_image_anchor = GetHostImageAnchor();
+  for (uint32_t i = 0; i < header->relocation_count; ++i) {
+    uint32_t relocation_offset;
+    std::memcpy(&relocation_offset, relocations_data + sizeof(uint32_t) * i,
+                sizeof(relocation_offset));
+    uint64_t value;
+    std::memcpy(&value, code.data() + relocation_offset, sizeof(value));
+    value += host_image_anchor;
+    std::memcpy(code.data() + relocation_offset, &value, sizeof(value));
+  }
+
+  function->set_end_address(header->guest_end_address);
+  auto& source_map = function->source_map();
+  source_map.resize(header->source_map_count);
+  if (header->source_map_count) {
+    std::memcpy(source_map.data(), source_map_data,
+                sizeof(SourceMapEntry) * header->source_map_count);
+  }
+
+  EmitFunctionInfo func_info = {};
+  func_info.code_size.prolog = header->prolog_size;
+  func_info.code_size.body = header->body_size;
+  func_info.code_size.epilog = header->epilog_size;
+  func_info.code_size.tail = header->tail_size;
+  func_info.code_size.total = header->code_size;
+  func_info.prolog_stack_alloc_offset = header->prolog_stack_alloc_offset;
+  func_info.stack_size = header->stack_size;
+
+  void* code_execute_address;
+  void* code_write_address;
+  PlaceGuestCode(function->address(), code.data(), func_info, function,
+                 code_execute_address, code_write_address);
+  std::vector<GuestCallSite> call_sites(header->call_site_count);
+  if (header->call_site_count) {
+    std::memcpy(call_sites.data(), call_sites_data,
+                sizeof(GuestCallSite) * header->call_site_count);
+  }
+  static_cast<X64Function*>(function)->set_call_sites(call_sites);
+  *code_size_out = header->code_size;
+  return code_execute_address;
+}
+
 GuestFunction* X64CodeCache::LookupFunction(uint64_t host_pc) {
+  // Other threads may be appending to the map, which may reallocate it.
+  auto global_lock = global_critical_region_.Acquire();
   uint32_t key = uint32_t(host_pc - kGeneratedCodeExecuteBase);
   void* fn_entry = std::bsearch(
       &key, generated_code_map_.data(), generated_code_map_.size() + 1,
@@ -13,14 +13,20 @@
 #include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include <cstdio>
 #include <memory>
+#include <mutex>
+#include <set>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
+#include "xenia/base/mapped_memory.h"
 #include "xenia/base/memory.h"
 #include "xenia/base/mutex.h"
 #include "xenia/cpu/backend/code_cache.h"
+#include "xenia/memory.h"
 
 namespace xe {
 namespace cpu {
@@ -39,6 +45,15 @@ struct EmitFunctionInfo {
   size_t stack_size;
 };
 
+// A call to a guest function emitted as a load from the indirection table
+// followed by `call rax` or `jmp rax` - 5 bytes in total, not crossing a qword
+// boundary - that can be rewritten into a direct rel32 call or jump.
+struct GuestCallSite {
+  // Offset of the indirection table load from the beginning of the caller.
+  uint32_t code_offset;
+  uint32_t guest_address;
+};
+
 class X64CodeCache : public CodeCache {
  public:
   ~X64CodeCache() override;
@@ -53,7 +68,6 @@ class X64CodeCache : public CodeCache {
   }
   size_t total_size() const override { return kGeneratedCodeSize; }
 
-  // TODO(benvanik): ELF serialization/etc
   // TODO(benvanik): keep track of code blocks
   // TODO(benvanik): padding/guards/etc
 
@@ -74,8 +88,42 @@ class X64CodeCache : public CodeCache {
                       void*& code_write_address_out);
   uint32_t PlaceData(const void* data, size_t length);
 
+  // Patches the call sites in the placed code of a guest function whose
+  // callees are already linked into direct calls, and does the same for the
+  // call sites in previously linked code calling this function, which will
+  // then call this code even if the function is linked again with other code.
+  void LinkGuestCode(uint32_t guest_address, void* code_execute_address,
+                     const std::vector<GuestCallSite>& call_sites);
+
   GuestFunction* LookupFunction(uint64_t host_pc) override;
 
+  // Persistent code storage. Guest functions emitted without any
+  // non-relocatable host references are appended to a per-module file, and
+  // are placed back from it on later runs without going through translation.
+  // The storage is only valid for the exact module (by hash), the exact
+  // emulator build and the host environment (thunks, CPU features) that
+  // produced it.
+  bool InitializeStorage(const std::filesystem::path& storage_path,
+                         uint64_t module_hash, uint64_t environment_hash);
+  void ShutdownStorage();
+  bool has_storage() const { return storage_file_ != nullptr; }
+  // host_image_relocations are the offsets of 64-bit immediates within the
+  // machine code holding pointers into the emulator executable image, which
+  // are rebased when the code is loaded by a later run.
+  // The code must not be linked yet.
+  void StoreGuestCode(Memory* memory, GuestFunction* function,
+                      const void* code_execute_address,
+                      const EmitFunctionInfo& func_info,
+                      const std::vector<uint32_t>& host_image_relocations,
+                      const std::vector<GuestCallSite>& call_sites);
+  // Places previously stored code for the function, if any, setting its end
+  // address, source map and call sites, without making it reachable. Returns
+  // nullptr if the function is not stored, or if the guest code it was
+  // translated from is not the one currently in memory (another module may be
+  // loaded at the same address).
+  void* PlaceStoredGuestCode(Memory* memory, GuestFunction* function,
+                             size_t* code_size_out);
+
  protected:
   // All executable code falls within 0x80000000 to 0x9FFFFFFF, so we can
   // only map enough for lookups within that range.
@@ -141,6 +189,57 @@ class X64CodeCache : public CodeCache {
   // This can be used to bsearch on host PC to find the guest function.
   // The key is [start address | end address].
   std::vector<std::pair<uint64_t, GuestFunction*>> generated_code_map_;
+
+  // Direct call linking, see LinkGuestCode.
+  struct LinkedCallSite {
+    uint8_t* code_execute_address;
+    uint32_t caller_guest_address;
+    bool is_tail;
+  };
+  void PatchCallSite(const LinkedCallSite& call_site,
+                     const uint8_t* target_execute_address);
+  std::mutex link_mutex_;
+  // Callee guest address -> call sites calling it.
+  std::unordered_map<uint32_t, std::vector<LinkedCallSite>> call_sites_;
+  // Guest address -> latest linked code of the function.
+  std::unordered_map<uint32_t, uint8_t*> linked_code_;
+
+  // Persistent code storage, see InitializeStorage.
+  struct StoredFunctionHeader {
+    uint32_t guest_address;
+    uint32_t guest_end_address;
+    uint32_t code_size;
+    uint32_t prolog_size;
+    uint32_t body_size;
+    uint32_t epilog_size;
+    uint32_t tail_size;
+    uint32_t prolog_stack_alloc_offset;
+    uint32_t stack_size;
+    uint32_t relocation_count;
+    uint32_t source_map_count;
+    uint32_t call_site_count;
+    // XXH3 of the guest instructions from guest_address to guest_end_address.
+    uint64_t guest_code_hash;
+    // XXH3 of the code, relocations, source map and call sites following the
+    // header.
+    uint64_t data_hash;
+  };
+  static uint64_t GetStorageBuildHash();
+  static uint64_t HashGuestCode(Memory* memory, uint32_t guest_address,
+                                uint32_t guest_end_address);
+  static uintptr_t GetHostImageAnchor();
+
+  std::mutex storage_mutex_;
+  FILE* storage_file_ = nullptr;
+  // Read-only view of the functions stored by previous runs.
+  std::unique_ptr<MappedMemory> storage_mapping_;
+  // Guest address -> header of the latest stored code of the function in
+  // storage_mapping_.
+  std::unordered_map<uint32_t, const StoredFunctionHeader*>
+      stored_functions_;
+  // Guest address and data hash of every record in the storage file, including
+  // the ones written by this run, to avoid appending the same code again.
+  std::set<std::pair<uint32_t, uint64_t>> stored_code_hashes_;
 };
 
 }  // namespace x64
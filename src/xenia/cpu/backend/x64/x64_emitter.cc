@@ -101,7 +101,11 @@ bool X64Emitter::Emit(GuestFunction* function, HIRBuilder* builder,
   debug_info_ = debug_info;
   debug_info_flags_ = debug_info_flags;
   trace_data_ = &function->trace_data();
+  baseline_function_ = function->is_baseline() ? function : nullptr;
   source_map_arena_.Reset();
+  is_relocatable_ = true;
+  host_image_relocations_.clear();
+  call_sites_.clear();
 
   // Fill the generator with code.
   EmitFunctionInfo func_info = {};
@@ -116,6 +120,18 @@ bool X64Emitter::Emit(GuestFunction* function, HIRBuilder* builder,
   // Stash source map.
   source_map_arena_.CloneContents(out_source_map);
 
+  // Save the code for later runs if it doesn't depend on the state of this
+  // one. Debug info and tracing reference host memory of this run.
+  if (is_relocatable_ && !debug_info_flags_ && code_cache_->has_storage()) {
+    code_cache_->StoreGuestCode(processor_->memory(), function,
+                                *out_code_address, func_info,
+                                host_image_relocations_, call_sites_);
+  }
+
+  // Linked once the function is complete, which is after storing, as linking
+  // makes calls depend on this run's layout.
+  static_cast<X64Function*>(function)->set_call_sites(call_sites_);
+
   return true;
 }
 
@@ -147,6 +163,14 @@ void* X64Emitter::Emplace(const EmitFunctionInfo& func_info,
   return new_execute_address;
 }
 
+// Called by baseline code once it has been called enough times.
+extern "C" uint64_t RequestFunctionTierUp(void* raw_context,
+                                          uint64_t guest_address) {
+  auto thread_state = *reinterpret_cast<ThreadState**>(raw_context);
+  thread_state->processor()->RequestFunctionTierUp(uint32_t(guest_address));
+  return 0;
+}
+
 bool X64Emitter::Emit(HIRBuilder* builder, EmitFunctionInfo& func_info) {
   Xbyak::Label epilog_label;
   epilog_label_ = &epilog_label;
@@ -228,6 +252,25 @@ bool X64Emitter::Emit(HIRBuilder* builder, EmitFunctionInfo& func_info) {
     bts(qword[low_address(&trace_header->function_thread_use)], rax);
   }
 
+  // Count calls of baseline code until it's worth optimizing.
+  if (baseline_function_) {
+    // The counter lives in the function object of this run.
+    MarkNonRelocatable();
+    // Only decremented while positive, so it reaches zero exactly once - it
+    // can only go below zero when racing threads decrement it together, and
+    // then it stays there.
+    Xbyak::Label tier_up_done;
+    mov(rax,
+        reinterpret_cast<uint64_t>(baseline_function_->tier_up_countdown()));
+    cmp(dword[rax], 0);
+    jle(tier_up_done, CodeGenerator::T_NEAR);
+    lock();
+    dec(dword[rax]);
+    jnz(tier_up_done, CodeGenerator::T_NEAR);
+    CallNative(&RequestFunctionTierUp, baseline_function_->address());
+    L(tier_up_done);
+  }
+
   // Load membase.
   mov(GetMembaseReg(),
       qword[GetContextReg() + offsetof(ppc::PPCContext, virtual_membase)]);
@@ -392,7 +435,8 @@ extern "C" uint64_t ResolveFunction(void* raw_context,
   auto fn =
       thread_state->processor()->ResolveFunction((uint32_t)target_address);
   assert_not_null(fn);
-  auto x64_fn = static_cast<X64Function*>(fn);
+  auto x64_fn = static_cast<X64Function*>(
+      static_cast<GuestFunction*>(fn)->current_code());
   uint64_t addr = reinterpret_cast<uint64_t>(x64_fn->machine_code());
 
   return addr;
@@ -400,28 +444,15 @@ extern "C" uint64_t ResolveFunction(void* raw_context,
 
 void X64Emitter::Call(const hir::Instr* instr, GuestFunction* function) {
   assert_not_null(function);
-  auto fn = static_cast<X64Function*>(function);
-  // Resolve address to the function to call and store in rax.
-  if (fn->machine_code()) {
-    // TODO(benvanik): is it worth it to do this? It removes the need for
-    // a ResolveFunction call, but makes the table less useful.
-    assert_zero(uint64_t(fn->machine_code()) & 0xFFFFFFFF00000000);
-    mov(eax, uint32_t(uint64_t(fn->machine_code())));
-  } else if (code_cache_->has_indirection_table()) {
-    // Load the pointer to the indirection table maintained in X64CodeCache.
-    // The target dword will either contain the address of the generated code
-    // or a thunk to ResolveAddress.
-    mov(ebx, function->address());
-    mov(eax, dword[ebx]);
-  } else {
+  bool is_tail = (instr->flags & hir::CALL_TAIL) != 0;
+  bool has_indirection_table = code_cache_->has_indirection_table();
+  if (!has_indirection_table) {
     // Old-style resolve.
     // Not too important because indirection table is almost always available.
-    // TODO: Overwrite the call-site with a straight call.
     CallNative(&ResolveFunction, function->address());
   }
 
-  // Actually jump/call to rax.
-  if (instr->flags & hir::CALL_TAIL) {
+  if (is_tail) {
     // Since we skip the prolog we need to mark the return here.
     EmitTraceUserCallReturn();
 
@@ -429,11 +460,38 @@ void X64Emitter::Call(const hir::Instr* instr, GuestFunction* function) {
     mov(rcx, qword[rsp + StackLayout::GUEST_RET_ADDR]);
 
     add(rsp, static_cast<uint32_t>(stack_size()));
-    jmp(rax);
   } else {
     // Return address is from the previous SET_RETURN_ADDRESS.
     mov(rcx, qword[rsp + StackLayout::GUEST_CALL_RET_ADDR]);
+  }
 
+  if (has_indirection_table) {
+    // Load the pointer to the indirection table maintained in X64CodeCache.
+    // The target dword will either contain the address of the generated code
+    // or a thunk to ResolveAddress, which takes the guest address from ebx.
+    mov(ebx, function->address());
+    // Once the callee is compiled, X64CodeCache patches the load and the
+    // call/jmp into a direct rel32 call/jmp with a single 8-byte store, so the
+    // 5 bytes must not cross a qword boundary.
+    size_t qword_offset = getSize() & 7;
+    if (qword_offset > 3) {
+      nop(8 - qword_offset);
+    }
+    call_sites_.push_back({uint32_t(getSize()), function->address()});
+    // Encoded by hand as the code cache relies on these exact bytes:
+    // mov eax, dword[ebx]; call/jmp rax.
+    db(0x67);
+    db(0x8B);
+    db(0x03);
+    db(0xFF);
+    db(is_tail ? 0xE0 : 0xD0);
+    return;
+  }
+
+  // Actually jump/call to rax.
+  if (is_tail) {
+    jmp(rax);
+  } else {
     call(rax);
   }
 }
@@ -458,7 +516,7 @@ void X64Emitter::CallIndirect(const hir::Instr* instr,
     // Old-style resolve.
     // Not too important because indirection table is almost always available.
     mov(edx, reg.cvt32());
-    mov(rax, reinterpret_cast<uint64_t>(ResolveFunction));
+    MovHostImageAddress(rax, reinterpret_cast<void*>(ResolveFunction));
     mov(rcx, GetContextReg());
     call(rax);
   }
@@ -502,6 +560,8 @@ void X64Emitter::CallExtern(const hir::Instr* instr, const Function* function) {
       // rdx = arg0
       // r8  = arg1
       // r9  = arg2
+      // Builtin arguments are usually runtime objects.
+      MarkNonRelocatable();
       auto thunk = backend()->guest_to_host_thunk();
       mov(rax, reinterpret_cast<uint64_t>(thunk));
       mov(rcx, reinterpret_cast<uint64_t>(builtin_function->handler()));
@@ -520,7 +580,8 @@ void X64Emitter::CallExtern(const hir::Instr* instr, const Function* function) {
       // r9  = arg2
       auto thunk = backend()->guest_to_host_thunk();
       mov(rax, reinterpret_cast<uint64_t>(thunk));
-      mov(rcx, reinterpret_cast<uint64_t>(extern_function->extern_handler()));
+      MovHostImageAddress(
+          rcx, reinterpret_cast<void*>(extern_function->extern_handler()));
       mov(rdx,
           qword[GetContextReg() + offsetof(ppc::PPCContext, kernel_state)]);
       call(rax);
@@ -528,6 +589,7 @@ void X64Emitter::CallExtern(const hir::Instr* instr, const Function* function) {
     }
   }
   if (undefined) {
+    MarkNonRelocatable();
     CallNative(UndefinedCallExtern, reinterpret_cast<uint64_t>(function));
   }
 }
@@ -555,11 +617,21 @@ void X64Emitter::CallNativeSafe(void* fn) {
   // r9  = arg2
   auto thunk = backend()->guest_to_host_thunk();
   mov(rax, reinterpret_cast<uint64_t>(thunk));
-  mov(rcx, reinterpret_cast<uint64_t>(fn));
+  MovHostImageAddress(rcx, fn);
   call(rax);
   // rax = host return
 }
 
+void X64Emitter::MovHostImageAddress(const Xbyak::Reg64& dest,
+                                     const void* address) {
+  // Always the full mov r64, imm64 form (REX.W B8+r) so the immediate can be
+  // rebased in place regardless of its value.
+  db(0x48 | (dest.getIdx() >= 8 ? 0x01 : 0x00));
+  db(0xB8 | (dest.getIdx() & 7));
+  host_image_relocations_.push_back(uint32_t(getSize()));
+  dq(reinterpret_cast<uint64_t>(address));
+}
+
 void X64Emitter::SetReturnAddress(uint64_t value) {
   mov(rax, value);
   mov(qword[rsp + StackLayout::GUEST_CALL_RET_ADDR], rax);
@@ -40,6 +40,7 @@ class X64Backend;
 class X64CodeCache;
 
 struct EmitFunctionInfo;
+struct GuestCallSite;
 
 enum RegisterFlags {
   REG_DEST = (1 << 0),
@@ -198,6 +199,15 @@ class X64Emitter : public Xbyak::CodeGenerator {
   void CallNativeSafe(void* fn);
   void SetReturnAddress(uint64_t value);
 
+  // Loads a pointer to a function or data within the emulator executable, such
+  // as a constant table. The pointer is rebased if the code is loaded from the
+  // persistent code storage by a later run.
+  void MovHostImageAddress(const Xbyak::Reg64& dest, const void* address);
+  // Marks the function as referencing host state that can't be located again
+  // by a later run (heap objects, timing values, etc.), excluding it from the
+  // persistent code storage.
+  void MarkNonRelocatable() { is_relocatable_ = false; }
+
   Xbyak::Reg64 GetNativeParam(uint32_t param);
 
   Xbyak::Reg64 GetContextReg();
@@ -250,10 +260,15 @@ class X64Emitter : public Xbyak::CodeGenerator {
   FunctionDebugInfo* debug_info_ = nullptr;
   uint32_t debug_info_flags_ = 0;
   FunctionTraceData* trace_data_ = nullptr;
+  GuestFunction* baseline_function_ = nullptr;
   Arena source_map_arena_;
 
   size_t stack_size_ = 0;
 
+  bool is_relocatable_ = true;
+  std::vector<uint32_t> host_image_relocations_;
+  std::vector<GuestCallSite> call_sites_;
+
   static const uint32_t gpr_reg_map_[GPR_COUNT];
   static const uint32_t xmm_reg_map_[XMM_COUNT];
 };
@@ -34,7 +34,8 @@ bool X64Function::CallImpl(ThreadState* thread_state, uint32_t return_address) {
   auto backend =
       reinterpret_cast<X64Backend*>(thread_state->processor()->backend());
   auto thunk = backend->host_to_guest_thunk();
-  thunk(machine_code_, thread_state->context(),
+  auto code = static_cast<X64Function*>(current_code());
+  thunk(code->machine_code_, thread_state->context(),
         reinterpret_cast<void*>(uintptr_t(return_address)));
   return true;
 }
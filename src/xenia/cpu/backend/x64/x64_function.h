@@ -10,6 +10,9 @@
 #ifndef XENIA_CPU_BACKEND_X64_X64_FUNCTION_H_
 #define XENIA_CPU_BACKEND_X64_X64_FUNCTION_H_
 
+#include <vector>
+
+#include "xenia/cpu/backend/x64/x64_code_cache.h"
 #include "xenia/cpu/function.h"
 #include "xenia/cpu/thread_state.h"
 
@@ -28,12 +31,19 @@ class X64Function : public GuestFunction {
 
   void Setup(uint8_t* machine_code, size_t machine_code_length);
 
+  // Call sites in the code, linked when it's published.
+  const std::vector<GuestCallSite>& call_sites() const { return call_sites_; }
+  void set_call_sites(const std::vector<GuestCallSite>& call_sites) {
+    call_sites_ = call_sites;
+  }
+
  protected:
   bool CallImpl(ThreadState* thread_state, uint32_t return_address) override;
 
  private:
   uint8_t* machine_code_ = nullptr;
   size_t machine_code_length_ = 0;
+  std::vector<GuestCallSite> call_sites_;
 };
 
 }  // namespace x64
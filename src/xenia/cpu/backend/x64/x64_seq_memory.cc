@@ -15,6 +15,8 @@
 #include "xenia/base/memory.h"
 #include "xenia/cpu/backend/x64/x64_op.h"
 #include "xenia/cpu/backend/x64/x64_tracers.h"
+#include "xenia/cpu/cpu_flags.h"
+#include "xenia/cpu/mmio_handler.h"
 
 namespace xe {
 namespace cpu {
@@ -556,6 +558,7 @@ struct LOAD_MMIO_I32
     // uint64_t (context, addr)
     auto mmio_range = reinterpret_cast<MMIORange*>(i.src1.value);
     auto read_address = uint32_t(i.src2.value);
+    e.MarkNonRelocatable();
     e.mov(e.GetNativeParam(0), uint64_t(mmio_range->callback_context));
     e.mov(e.GetNativeParam(1).cvt32(), read_address);
     e.CallNativeSafe(reinterpret_cast<void*>(mmio_range->read));
@@ -581,6 +584,7 @@ struct STORE_MMIO_I32
     // void (context, addr, value)
     auto mmio_range = reinterpret_cast<MMIORange*>(i.src1.value);
     auto write_address = uint32_t(i.src2.value);
+    e.MarkNonRelocatable();
     e.mov(e.GetNativeParam(0), uint64_t(mmio_range->callback_context));
     e.mov(e.GetNativeParam(1).cvt32(), write_address);
     if (i.src3.is_constant) {
@@ -603,6 +607,156 @@ struct STORE_MMIO_I32
 };
 EMITTER_OPCODE_TABLE(OPCODE_STORE_MMIO, STORE_MMIO_I32);
 
+// ============================================================================
+// OPCODE_LOAD_MMIO_CHECKED
+// ============================================================================
+// Accesses by guest instructions that have faulted on an MMIO range before.
+// Addresses in the range go straight to its callbacks, others to memory.
+// The accesses go through these only when they're counted for profiling.
+uint32_t ReadMMIORangeCounted(void* raw_context, MMIORange* mmio_range,
+                              uint32_t address) {
+  MMIOHandler::global_handler()->CountDirectAccess();
+  return mmio_range->read(raw_context, mmio_range->callback_context, address);
+}
+void WriteMMIORangeCounted(void* raw_context, MMIORange* mmio_range,
+                           uint32_t address, uint32_t value) {
+  MMIOHandler::global_handler()->CountDirectAccess();
+  mmio_range->write(raw_context, mmio_range->callback_context, address, value);
+}
+// Jumps to not_mmio unless the address is in the range. The address is left
+// in ecx.
+template <typename T>
+void EmitMMIORangeCheck(X64Emitter& e, const T& guest,
+                        const MMIORange* mmio_range, Xbyak::Label& not_mmio) {
+  e.mov(e.ecx, guest.reg().cvt32());
+  e.mov(e.eax, e.ecx);
+  e.and_(e.eax, mmio_range->mask);
+  e.cmp(e.eax, mmio_range->address);
+  e.jne(not_mmio, CodeGenerator::T_NEAR);
+}
+struct LOAD_MMIO_CHECKED_I32
+    : Sequence<LOAD_MMIO_CHECKED_I32,
+               I<OPCODE_LOAD_MMIO_CHECKED, I32Op, I64Op, OffsetOp>> {
+  static void Emit(X64Emitter& e, const EmitArgType& i) {
+    auto mmio_range = reinterpret_cast<MMIORange*>(i.src2.value);
+    bool is_mmio = true;
+    Xbyak::Label not_mmio, done;
+    if (i.src1.is_constant) {
+      uint32_t address = static_cast<uint32_t>(i.src1.constant());
+      is_mmio = (address & mmio_range->mask) == mmio_range->address;
+      if (is_mmio) {
+        e.mov(e.ecx, address);
+      }
+    } else {
+      EmitMMIORangeCheck(e, i.src1, mmio_range, not_mmio);
+    }
+    if (is_mmio) {
+      // uint32_t (context, callback context or range, addr)
+      e.MarkNonRelocatable();
+      e.mov(e.GetNativeParam(1).cvt32(), e.ecx);
+      if (cvars::profile_mmio_accesses) {
+        e.mov(e.GetNativeParam(0), uint64_t(mmio_range));
+        e.CallNativeSafe(reinterpret_cast<void*>(ReadMMIORangeCounted));
+      } else {
+        e.mov(e.GetNativeParam(0), uint64_t(mmio_range->callback_context));
+        e.CallNativeSafe(reinterpret_cast<void*>(mmio_range->read));
+      }
+      if (!(i.instr->flags & LoadStoreFlags::LOAD_STORE_BYTE_SWAP)) {
+        e.bswap(e.eax);
+      }
+      e.mov(i.dest, e.eax);
+      if (i.src1.is_constant) {
+        return;
+      }
+      e.jmp(done, CodeGenerator::T_NEAR);
+    }
+    e.L(not_mmio);
+    auto addr = ComputeMemoryAddress(e, i.src1);
+    if (i.instr->flags & LoadStoreFlags::LOAD_STORE_BYTE_SWAP) {
+      if (e.IsFeatureEnabled(kX64EmitMovbe)) {
+        e.movbe(i.dest, e.dword[addr]);
+      } else {
+        e.mov(i.dest, e.dword[addr]);
+        e.bswap(i.dest);
+      }
+    } else {
+      e.mov(i.dest, e.dword[addr]);
+    }
+    e.L(done);
+  }
+};
+EMITTER_OPCODE_TABLE(OPCODE_LOAD_MMIO_CHECKED, LOAD_MMIO_CHECKED_I32);
+
+// ============================================================================
+// OPCODE_STORE_MMIO_CHECKED
+// ============================================================================
+struct STORE_MMIO_CHECKED_I32
+    : Sequence<STORE_MMIO_CHECKED_I32,
+               I<OPCODE_STORE_MMIO_CHECKED, VoidOp, OffsetOp, I64Op, I32Op>> {
+  static void Emit(X64Emitter& e, const EmitArgType& i) {
+    auto mmio_range = reinterpret_cast<MMIORange*>(i.src1.value);
+    bool is_byte_swapped =
+        (i.instr->flags & LoadStoreFlags::LOAD_STORE_BYTE_SWAP) != 0;
+    bool is_mmio = true;
+    Xbyak::Label not_mmio, done;
+    if (i.src2.is_constant) {
+      uint32_t address = static_cast<uint32_t>(i.src2.constant());
+      is_mmio = (address & mmio_range->mask) == mmio_range->address;
+      if (is_mmio) {
+        e.mov(e.ecx, address);
+      }
+    } else {
+      EmitMMIORangeCheck(e, i.src2, mmio_range, not_mmio);
+    }
+    if (is_mmio) {
+      // void (context, callback context or range, addr, value)
+      e.MarkNonRelocatable();
+      e.mov(e.GetNativeParam(1).cvt32(), e.ecx);
+      e.mov(e.GetNativeParam(0),
+            cvars::profile_mmio_accesses
+                ? uint64_t(mmio_range)
+                : uint64_t(mmio_range->callback_context));
+      if (i.src3.is_constant) {
+        uint32_t value = static_cast<uint32_t>(i.src3.constant());
+        e.mov(e.GetNativeParam(2).cvt32(),
+              is_byte_swapped ? value : xe::byte_swap(value));
+      } else {
+        e.mov(e.GetNativeParam(2).cvt32(), i.src3);
+        if (!is_byte_swapped) {
+          e.bswap(e.GetNativeParam(2).cvt32());
+        }
+      }
+      if (cvars::profile_mmio_accesses) {
+        e.CallNativeSafe(reinterpret_cast<void*>(WriteMMIORangeCounted));
+      } else {
+        e.CallNativeSafe(reinterpret_cast<void*>(mmio_range->write));
+      }
+      if (i.src2.is_constant) {
+        return;
+      }
+      e.jmp(done, CodeGenerator::T_NEAR);
+    }
+    e.L(not_mmio);
+    auto addr = ComputeMemoryAddress(e, i.src2);
+    if (is_byte_swapped) {
+      assert_false(i.src3.is_constant);
+      if (e.IsFeatureEnabled(kX64EmitMovbe)) {
+        e.movbe(e.dword[addr], i.src3);
+      } else {
+        assert_always("not implemented");
+      }
+    } else {
+      if (i.src3.is_constant) {
+        e.mov(e.dword[addr], i.src3.constant());
+      } else {
+        e.mov(e.dword[addr], i.src3);
+      }
+    }
+    e.L(done);
+  }
+};
+EMITTER_OPCODE_TABLE(OPCODE_STORE_MMIO_CHECKED, STORE_MMIO_CHECKED_I32);
+
 // ============================================================================
 // OPCODE_LOAD_OFFSET
 // ============================================================================
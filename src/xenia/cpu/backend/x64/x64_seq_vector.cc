@@ -154,14 +154,14 @@ struct LOAD_VECTOR_SHL_I8
     if (i.src1.is_constant) {
       auto sh = i.src1.constant();
       assert_true(sh < xe::countof(lvsl_table));
-      e.mov(e.rax, (uintptr_t)&lvsl_table[sh]);
+      e.MovHostImageAddress(e.rax, &lvsl_table[sh]);
       e.vmovaps(i.dest, e.ptr[e.rax]);
     } else {
       // TODO(benvanik): find a cheaper way of doing this.
       e.movzx(e.rdx, i.src1);
       e.and_(e.dx, 0xF);
       e.shl(e.dx, 4);
-      e.mov(e.rax, (uintptr_t)lvsl_table);
+      e.MovHostImageAddress(e.rax, lvsl_table);
       e.vmovaps(i.dest, e.ptr[e.rax + e.rdx]);
     }
   }
@@ -195,14 +195,14 @@ struct LOAD_VECTOR_SHR_I8
     if (i.src1.is_constant) {
       auto sh = i.src1.constant();
       assert_true(sh < xe::countof(lvsr_table));
-      e.mov(e.rax, (uintptr_t)&lvsr_table[sh]);
+      e.MovHostImageAddress(e.rax, &lvsr_table[sh]);
       e.vmovaps(i.dest, e.ptr[e.rax]);
     } else {
       // TODO(benvanik): find a cheaper way of doing this.
       e.movzx(e.rdx, i.src1);
       e.and_(e.dx, 0xF);
       e.shl(e.dx, 4);
-      e.mov(e.rax, (uintptr_t)lvsr_table);
+      e.MovHostImageAddress(e.rax, lvsr_table);
       e.vmovaps(i.dest, e.ptr[e.rax + e.rdx]);
     }
   }
@@ -1498,7 +1498,7 @@ struct EXTRACT_I32
       e.mov(e.al, i.src2);
       e.and_(e.al, 0x03);
       e.shl(e.al, 4);
-      e.mov(e.rdx, reinterpret_cast<uint64_t>(extract_table_32));
+      e.MovHostImageAddress(e.rdx, extract_table_32);
       e.vmovaps(e.xmm0, e.ptr[e.rdx + e.rax]);
       e.vpshufb(e.xmm0, src1, e.xmm0);
       e.vpextrd(i.dest, e.xmm0, 0);
@@ -19,7 +19,9 @@
 #include "xenia/cpu/compiler/passes/data_flow_analysis_pass.h"
 #include "xenia/cpu/compiler/passes/dead_code_elimination_pass.h"
 #include "xenia/cpu/compiler/passes/finalization_pass.h"
+#include "xenia/cpu/compiler/passes/linear_scan_allocation_pass.h"
 #include "xenia/cpu/compiler/passes/memory_sequence_combination_pass.h"
+#include "xenia/cpu/compiler/passes/mmio_access_site_pass.h"
 #include "xenia/cpu/compiler/passes/register_allocation_pass.h"
 #include "xenia/cpu/compiler/passes/simplification_pass.h"
 #include "xenia/cpu/compiler/passes/validation_pass.h"
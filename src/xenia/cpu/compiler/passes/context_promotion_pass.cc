@@ -65,10 +65,28 @@ bool ContextPromotionPass::Run(HIRBuilder* builder) {
   //   store_context +100, v1
   // This is more generally done by DSE, however if it could be done here
   // instead as it may be faster (at least on the block-level).
+  //
+  // Both are done for the whole function, following the edges found by
+  // ControlFlowAnalysisPass. Only forward edges carry information, so a block
+  // that is the target of a back edge (a loop header) starts with nothing
+  // known, as there are no phis to merge loop-carried values with. This also
+  // guarantees that a value used by a later block is defined on every path to
+  // it, which DataFlowAnalysisPass relies on when moving it into a local.
 
-  // Promote loads to values.
-  // Process each block independently, for now.
+  // Blocks are in their final order at this point, number them.
+  uint16_t block_ordinal = 0;
   auto block = builder->first_block();
+  while (block) {
+    block->ordinal = block_ordinal++;
+    block = block->next;
+  }
+  if (block_exit_values_.size() < block_ordinal) {
+    block_exit_values_.resize(block_ordinal);
+    block_entry_writes_.resize(block_ordinal);
+  }
+
+  // Promote loads to values.
+  block = builder->first_block();
   while (block) {
     PromoteBlock(block);
     block = block->next;
@@ -78,29 +96,95 @@ bool ContextPromotionPass::Run(HIRBuilder* builder) {
   // This will break debugging as we can't recover this information when
   // trying to extract stack traces/register values, so we don't do that.
   if (!cvars::debug && !cvars::store_all_context_values) {
-    block = builder->first_block();
+    block = builder->last_block();
     while (block) {
       RemoveDeadStoresBlock(block);
-      block = block->next;
+      block = block->prev;
     }
   }
 
   return true;
 }
 
-void ContextPromotionPass::PromoteBlock(Block* block) {
+static bool IsLocalBranch(const Instr* i) {
+  // Branches to labels within the function don't touch the context, even
+  // though the conditional ones are flagged as volatile.
+  return i->opcode == &OPCODE_BRANCH_info ||
+         i->opcode == &OPCODE_BRANCH_TRUE_info ||
+         i->opcode == &OPCODE_BRANCH_FALSE_info;
+}
+
+void ContextPromotionPass::InitializeBlockValues(Block* block) {
   auto& validity = context_validity_;
   validity.reset();
 
+  // Only values held at the end of all predecessors can be reused.
+  auto edge = block->incoming_edge_head;
+  if (!edge) {
+    // Function entry (or unreachable).
+    return;
+  }
+  std::vector<ContextValue> values = block_exit_values_[edge->src->ordinal];
+  while (edge) {
+    if (edge->src->ordinal >= block->ordinal) {
+      // Back edge, the predecessor hasn't been processed yet.
+      return;
+    }
+    const auto& src_values = block_exit_values_[edge->src->ordinal];
+    // Both lists are sorted by offset.
+    auto src_it = src_values.begin();
+    auto out_it = values.begin();
+    for (auto it = values.begin(); it != values.end(); ++it) {
+      while (src_it != src_values.end() && src_it->first < it->first) {
+        ++src_it;
+      }
+      if (src_it != src_values.end() && *src_it == *it) {
+        *out_it++ = *it;
+      }
+    }
+    values.erase(out_it, values.end());
+    edge = edge->incoming_next;
+  }
+
+  for (auto& value : values) {
+    context_values_[value.first] = value.second;
+    validity.set(value.first);
+  }
+}
+
+void ContextPromotionPass::InvalidateOverlapping(uint32_t offset,
+                                                 size_t size) {
+  // Values are at most 16 bytes wide, so only those starting up to 15 bytes
+  // before the offset may overlap it.
+  auto& validity = context_validity_;
+  uint32_t start = offset > 15 ? offset - 15 : 0;
+  uint32_t end = offset + static_cast<uint32_t>(size);
+  for (uint32_t n = start; n < end; n++) {
+    if (!validity.test(n)) {
+      continue;
+    }
+    if (n >= offset || n + GetTypeSize(context_values_[n]->type) > offset) {
+      validity.reset(n);
+    }
+  }
+}
+
+void ContextPromotionPass::PromoteBlock(Block* block) {
+  InitializeBlockValues(block);
+  auto& validity = context_validity_;
+
   Instr* i = block->instr_head;
   while (i) {
     auto next = i->next;
-    if (i->opcode->flags & OPCODE_FLAG_VOLATILE) {
+    if (IsLocalBranch(i)) {
+      // Values flow to the successors.
+    } else if (i->opcode->flags & OPCODE_FLAG_VOLATILE) {
       // Volatile instruction - requires all context values be flushed.
       validity.reset();
     } else if (i->opcode == &OPCODE_LOAD_CONTEXT_info) {
-      size_t offset = i->src1.offset;
-      if (validity.test(static_cast<uint32_t>(offset))) {
+      uint32_t offset = static_cast<uint32_t>(i->src1.offset);
+      if (validity.test(offset) &&
+          context_values_[offset]->type == i->dest->type) {
         // Legit previous value, reuse.
         Value* previous_value = context_values_[offset];
         i->opcode = &hir::OPCODE_ASSIGN_info;
@@ -108,36 +192,83 @@ void ContextPromotionPass::PromoteBlock(Block* block) {
       } else {
         // Store the loaded value into the table.
         context_values_[offset] = i->dest;
-        validity.set(static_cast<uint32_t>(offset));
+        validity.set(offset);
       }
     } else if (i->opcode == &OPCODE_STORE_CONTEXT_info) {
-      size_t offset = i->src1.offset;
+      uint32_t offset = static_cast<uint32_t>(i->src1.offset);
       Value* value = i->src2.value;
       // Store value into the table for later.
+      InvalidateOverlapping(offset, GetTypeSize(value->type));
       context_values_[offset] = value;
-      validity.set(static_cast<uint32_t>(offset));
+      validity.set(offset);
     }
     i = next;
   }
+
+  // Stash what's known at the end of the block for the successors.
+  auto& exit_values = block_exit_values_[block->ordinal];
+  exit_values.clear();
+  for (int offset = validity.find_first(); offset != -1;
+       offset = validity.find_next(offset)) {
+    exit_values.emplace_back(offset, context_values_[offset]);
+  }
+}
+
+void ContextPromotionPass::InitializeBlockWrites(Block* block) {
+  auto& written = context_validity_;
+  written.reset();
+
+  // Only bytes overwritten on all paths leaving the block can be dropped.
+  auto edge = block->outgoing_edge_head;
+  if (!edge) {
+    // Function exit - the caller may read anything.
+    return;
+  }
+  written.set();
+  while (edge) {
+    if (edge->dest->ordinal <= block->ordinal) {
+      // Back edge, the successor hasn't been processed yet.
+      written.reset();
+      return;
+    }
+    written &= block_entry_writes_[edge->dest->ordinal];
+    edge = edge->outgoing_next;
+  }
 }
 
 void ContextPromotionPass::RemoveDeadStoresBlock(Block* block) {
-  auto& validity = context_validity_;
-  validity.reset();
+  InitializeBlockWrites(block);
+  auto& written = context_validity_;
 
-  // Walk backwards and mark offsets that are written to.
-  // If the offset was written to earlier, ignore the store.
+  // Walk backwards and mark bytes that are written to.
+  // If all bytes were written to later, ignore the store.
   Instr* i = block->instr_tail;
   while (i) {
     Instr* prev = i->prev;
-    if (i->opcode->flags & (OPCODE_FLAG_VOLATILE | OPCODE_FLAG_BRANCH)) {
+    if (IsLocalBranch(i)) {
+      // Written bytes come from the successors.
+    } else if (i->opcode->flags & (OPCODE_FLAG_VOLATILE | OPCODE_FLAG_BRANCH)) {
       // Volatile instruction - requires all context values be flushed.
-      validity.reset();
+      written.reset();
+    } else if (i->opcode == &OPCODE_LOAD_CONTEXT_info) {
+      // Stores of the loaded bytes are needed by the load.
+      uint32_t offset = static_cast<uint32_t>(i->src1.offset);
+      written.reset(offset,
+                    offset + static_cast<uint32_t>(GetTypeSize(i->dest->type)));
     } else if (i->opcode == &OPCODE_STORE_CONTEXT_info) {
-      size_t offset = i->src1.offset;
-      if (!validity.test(static_cast<uint32_t>(offset))) {
-        // Offset not yet written, mark and continue.
-        validity.set(static_cast<uint32_t>(offset));
+      uint32_t offset = static_cast<uint32_t>(i->src1.offset);
+      uint32_t end =
+          offset + static_cast<uint32_t>(GetTypeSize(i->src2.value->type));
+      bool overwritten = true;
+      for (uint32_t n = offset; n < end; n++) {
+        if (!written.test(n)) {
+          overwritten = false;
+          break;
+        }
+      }
+      if (!overwritten) {
+        // Not yet written, mark and continue.
+        written.set(offset, end);
       } else {
         // Already written to. Remove this store.
         i->Remove();
@@ -145,6 +276,10 @@ void ContextPromotionPass::RemoveDeadStoresBlock(Block* block) {
     }
     i = prev;
   }
+
+  // Stash what's overwritten from the start of the block for the
+  // predecessors.
+  block_entry_writes_[block->ordinal] = written;
 }
 
 }  // namespace passes
@@ -11,6 +11,7 @@
 #define XENIA_CPU_COMPILER_PASSES_CONTEXT_PROMOTION_PASS_H_
 
 #include <cmath>
+#include <utility>
 #include <vector>
 
 #include "xenia/base/platform.h"
@@ -41,12 +42,24 @@ class ContextPromotionPass : public CompilerPass {
   bool Run(hir::HIRBuilder* builder) override;
 
  private:
+  // Context offset and the value it's known to hold.
+  typedef std::pair<uint32_t, hir::Value*> ContextValue;
+
   void PromoteBlock(hir::Block* block);
   void RemoveDeadStoresBlock(hir::Block* block);
 
+  void InitializeBlockValues(hir::Block* block);
+  void InvalidateOverlapping(uint32_t offset, size_t size);
+  void InitializeBlockWrites(hir::Block* block);
+
  private:
   std::vector<hir::Value*> context_values_;
   llvm::BitVector context_validity_;
+  // Values held by the context at the end of each block, by block ordinal.
+  std::vector<std::vector<ContextValue>> block_exit_values_;
+  // Context bytes overwritten before being read again on every path from the
+  // start of each block, by block ordinal.
+  std::vector<llvm::BitVector> block_entry_writes_;
 };
 
 }  // namespace passes
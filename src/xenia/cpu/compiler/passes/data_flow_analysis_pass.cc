@@ -156,8 +156,9 @@ void DataFlowAnalysisPass::AnalyzeFlow(HIRBuilder* builder,
         while (tail && tail->opcode->flags & OPCODE_FLAG_BRANCH) {
           tail = tail->prev;
         }
-        assert_not_zero(tail);
-        builder->last_instr()->MoveBefore(tail->next);
+        // The block may have nothing but branches.
+        builder->last_instr()->MoveBefore(tail ? tail->next
+                                               : block->instr_head);
       }
 
       outgoing_ordinal = outgoing_values.find_next(outgoing_ordinal);
@@ -0,0 +1,412 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2020 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/passes/linear_scan_allocation_pass.h"
+
+#include "xenia/base/assert.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/math.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::backend::MachineInfo;
+using xe::cpu::hir::Block;
+using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
+using xe::cpu::hir::TypeName;
+using xe::cpu::hir::Value;
+
+namespace {
+
+bool InstrUsesValue(const Instr* instr, const Value* value) {
+  uint32_t signature = instr->opcode->signature;
+  return (GET_OPCODE_SIG_TYPE_SRC1(signature) == OPCODE_SIG_TYPE_V &&
+          instr->src1.value == value) ||
+         (GET_OPCODE_SIG_TYPE_SRC2(signature) == OPCODE_SIG_TYPE_V &&
+          instr->src2.value == value) ||
+         (GET_OPCODE_SIG_TYPE_SRC3(signature) == OPCODE_SIG_TYPE_V &&
+          instr->src3.value == value);
+}
+
+// Nothing can be inserted between paired instructions, so values needed by
+// them must be reloaded before the whole group.
+Instr* GetReloadPoint(Instr* instr) {
+  while (instr->prev && instr->opcode->flags & OPCODE_FLAG_PAIRED_PREV) {
+    instr = instr->prev;
+  }
+  return instr;
+}
+
+}  // namespace
+
+LinearScanAllocationPass::LinearScanAllocationPass(
+    const MachineInfo* machine_info)
+    : CompilerPass() {
+  auto mi_sets = machine_info->register_sets;
+  while (set_count_ < kMaxRegisterSets && mi_sets[set_count_].count) {
+    sets_[set_count_].set = &mi_sets[set_count_];
+    ++set_count_;
+  }
+}
+
+LinearScanAllocationPass::~LinearScanAllocationPass() = default;
+
+bool LinearScanAllocationPass::Run(HIRBuilder* builder) {
+  stats_ = Stats();
+  spill_slots_.clear();
+
+  uint16_t block_ordinal = 0;
+  auto block = builder->first_block();
+  while (block) {
+    // Sequential block ordinals.
+    block->ordinal = block_ordinal++;
+
+    // All registers are free on block entry.
+    for (uint32_t n = 0; n < set_count_; ++n) {
+      auto& set = sets_[n];
+      set.free_mask = set.set->count >= 32 ? UINT32_MAX
+                                           : (1u << set.set->count) - 1;
+      set.active.clear();
+    }
+
+    BuildIntervals(builder, block);
+
+    // Scan in program order. Instructions inserted by splitting ahead of the
+    // scan are visited as well, as they define the split values.
+    auto instr = block->instr_head;
+    while (instr) {
+      uint32_t position = instr->ordinal;
+      ExpireIntervals(position);
+      if (instr->dest) {
+        if (!AllocateInterval(builder, instr,
+                              value_intervals_[instr->dest->ordinal])) {
+          XELOGE("Register allocation failed");
+          assert_always();
+          return false;
+        }
+      }
+      instr = instr->next;
+    }
+
+    block = block->next;
+  }
+
+  return true;
+}
+
+void LinearScanAllocationPass::BuildIntervals(HIRBuilder* builder,
+                                              Block* block) {
+  intervals_.clear();
+  uses_.clear();
+  if (value_intervals_.size() < builder->max_value_ordinal()) {
+    value_intervals_.resize(builder->max_value_ordinal());
+  }
+
+  // Positions are even so there's room for the reloads inserted right before
+  // the instructions needing them.
+  uint32_t position = 2;
+  auto instr = block->instr_head;
+  while (instr) {
+    instr->ordinal = position;
+
+    uint32_t signature = instr->opcode->signature;
+    Value* sources[3] = {
+        GET_OPCODE_SIG_TYPE_SRC1(signature) == OPCODE_SIG_TYPE_V
+            ? instr->src1.value
+            : nullptr,
+        GET_OPCODE_SIG_TYPE_SRC2(signature) == OPCODE_SIG_TYPE_V
+            ? instr->src2.value
+            : nullptr,
+        GET_OPCODE_SIG_TYPE_SRC3(signature) == OPCODE_SIG_TYPE_V
+            ? instr->src3.value
+            : nullptr,
+    };
+    for (Value* value : sources) {
+      // Constants and local slots don't need registers.
+      if (!value || value->IsConstant() || !value->def) {
+        continue;
+      }
+      assert_true(value->def->block == block);
+      if (value->def->block != block) {
+        continue;
+      }
+      auto& interval = intervals_[value_intervals_[value->ordinal]];
+      uint32_t use_index = static_cast<uint32_t>(uses_.size());
+      uses_.push_back({instr, position, kNoIndex});
+      if (interval.last_use == kNoIndex) {
+        interval.next_use = use_index;
+      } else {
+        uses_[interval.last_use].next = use_index;
+      }
+      interval.last_use = use_index;
+      interval.end = position;
+    }
+
+    if (instr->dest) {
+      AddInterval(instr->dest, position);
+    }
+
+    position += 2;
+    instr = instr->next;
+  }
+}
+
+uint32_t LinearScanAllocationPass::AddInterval(Value* value, uint32_t start) {
+  uint32_t interval_index = static_cast<uint32_t>(intervals_.size());
+  intervals_.push_back({value, start, start, kNoIndex, kNoIndex,
+                        SetIndexForType(value->type)});
+  value_intervals_[value->ordinal] = interval_index;
+  return interval_index;
+}
+
+void LinearScanAllocationPass::ExpireIntervals(uint32_t position) {
+  // Values last used by the instruction at the position are released before
+  // its destination is allocated, so it may reuse one of their registers.
+  for (uint32_t n = 0; n < set_count_; ++n) {
+    auto& set = sets_[n];
+    for (size_t i = 0; i < set.active.size();) {
+      const auto& interval = intervals_[set.active[i]];
+      if (interval.end <= position) {
+        set.free_mask |= 1u << interval.value->reg.index;
+        set.active[i] = set.active.back();
+        set.active.pop_back();
+      } else {
+        ++i;
+      }
+    }
+  }
+}
+
+bool LinearScanAllocationPass::AllocateInterval(HIRBuilder* builder,
+                                                Instr* instr,
+                                                uint32_t interval_index) {
+  uint32_t position = instr->ordinal;
+  uint32_t set_index = intervals_[interval_index].set_index;
+  auto& set = sets_[set_index];
+
+  if (!set.free_mask) {
+    // Split the interval that isn't needed for the longest time. Ones read by
+    // this instruction can't be split, as the freed register may be given to
+    // the destination, which may be written before all sources are read.
+    uint32_t victim = kNoIndex;
+    uint32_t victim_use = kNoIndex;
+    for (uint32_t active_index : set.active) {
+      auto& candidate = intervals_[active_index];
+      uint32_t use_index = candidate.next_use;
+      while (use_index != kNoIndex && uses_[use_index].position <= position) {
+        use_index = uses_[use_index].next;
+      }
+      candidate.next_use = use_index;
+      if (use_index == kNoIndex ||
+          GetReloadPoint(uses_[use_index].instr)->ordinal <= position ||
+          InstrUsesValue(instr, candidate.value)) {
+        continue;
+      }
+      if (victim == kNoIndex ||
+          uses_[use_index].position > uses_[victim_use].position) {
+        victim = active_index;
+        victim_use = use_index;
+      }
+    }
+    if (victim == kNoIndex) {
+      XELOGE("Unable to spill any registers");
+      return false;
+    }
+    SplitInterval(builder, victim, victim_use);
+  }
+
+  // Reuse the register of the first source if this is its last use, to help
+  // along the two operand x86 instructions.
+  Value* value = intervals_[interval_index].value;
+  uint32_t reg_index;
+  Value* src1 = GET_OPCODE_SIG_TYPE_SRC1(instr->opcode->signature) ==
+                        OPCODE_SIG_TYPE_V
+                    ? instr->src1.value
+                    : nullptr;
+  if (src1 && !src1->IsConstant() && src1->def &&
+      src1->def->block == instr->block && src1->reg.set == set.set &&
+      set.free_mask & (1u << src1->reg.index)) {
+    reg_index = src1->reg.index;
+  } else {
+    xe::bit_scan_forward(set.free_mask, &reg_index);
+  }
+  value->reg.set = set.set;
+  value->reg.index = reg_index;
+  set.free_mask &= ~(1u << reg_index);
+  set.active.push_back(interval_index);
+  return true;
+}
+
+void LinearScanAllocationPass::SplitInterval(HIRBuilder* builder,
+                                             uint32_t interval_index,
+                                             uint32_t split_use) {
+  Value* value = intervals_[interval_index].value;
+  uint32_t end = intervals_[interval_index].end;
+  uint32_t last_use = intervals_[interval_index].last_use;
+  auto& set = sets_[intervals_[interval_index].set_index];
+
+  // Get the value out of the register, unless it can be recomputed or is
+  // already in memory.
+  bool remat = IsRematerializable(value);
+  Value* slot = nullptr;
+  if (!remat) {
+    slot = value->local_slot;
+    if (!slot && value->def->opcode == &OPCODE_LOAD_LOCAL_info) {
+      slot = value->def->src1.value;
+    }
+    if (!slot) {
+      slot = AllocSpillSlot(builder, value->def->block, value, end);
+      builder->StoreLocal(slot, value);
+      auto spill_store = builder->last_instr();
+      auto def_next = value->def->next;
+      while (def_next->opcode->flags & OPCODE_FLAG_PAIRED_PREV) {
+        def_next = def_next->next;
+      }
+      spill_store->MoveBefore(def_next);
+      spill_store->ordinal = value->def->ordinal;
+      ++stats_.spill_count;
+    }
+    value->local_slot = slot;
+  }
+
+  // Reload it into a new value right before the next use.
+  Value* new_value;
+  if (remat) {
+    new_value = builder->CloneInstr(value->def)->dest;
+    ++stats_.remat_count;
+  } else {
+    new_value = builder->LoadLocal(slot);
+    new_value->local_slot = slot;
+    ++stats_.reload_count;
+  }
+  Instr* reload = new_value->def;
+  Instr* reload_point = GetReloadPoint(uses_[split_use].instr);
+  reload->MoveBefore(reload_point);
+  reload->ordinal = (reload_point->ordinal - 1) | 1;
+
+  // The new value takes over the remaining uses.
+  if (value_intervals_.size() < builder->max_value_ordinal()) {
+    value_intervals_.resize(builder->max_value_ordinal());
+  }
+  uint32_t new_interval_index = AddInterval(new_value, reload->ordinal);
+  auto& new_interval = intervals_[new_interval_index];
+  new_interval.end = end;
+  new_interval.next_use = split_use;
+  new_interval.last_use = last_use;
+  for (uint32_t use_index = split_use; use_index != kNoIndex;
+       use_index = uses_[use_index].next) {
+    Instr* instr = uses_[use_index].instr;
+    uint32_t signature = instr->opcode->signature;
+    if (GET_OPCODE_SIG_TYPE_SRC1(signature) == OPCODE_SIG_TYPE_V &&
+        instr->src1.value == value) {
+      instr->set_src1(new_value);
+    }
+    if (GET_OPCODE_SIG_TYPE_SRC2(signature) == OPCODE_SIG_TYPE_V &&
+        instr->src2.value == value) {
+      instr->set_src2(new_value);
+    }
+    if (GET_OPCODE_SIG_TYPE_SRC3(signature) == OPCODE_SIG_TYPE_V &&
+        instr->src3.value == value) {
+      instr->set_src3(new_value);
+    }
+  }
+
+  // Release the register of the old value.
+  auto& interval = intervals_[interval_index];
+  interval.next_use = kNoIndex;
+  interval.end = reload->ordinal;
+  set.free_mask |= 1u << value->reg.index;
+  for (size_t i = 0; i < set.active.size(); ++i) {
+    if (set.active[i] == interval_index) {
+      set.active[i] = set.active.back();
+      set.active.pop_back();
+      break;
+    }
+  }
+}
+
+Value* LinearScanAllocationPass::AllocSpillSlot(HIRBuilder* builder,
+                                                Block* block, Value* value,
+                                                uint32_t busy_until) {
+  // Values don't live across blocks, so slots used by other blocks are free,
+  // as are ones whose values are dead before this one is stored.
+  uint32_t store_position = value->def->ordinal;
+  for (auto& spill_slot : spill_slots_) {
+    if (spill_slot.slot->type != value->type) {
+      continue;
+    }
+    if (spill_slot.block_ordinal == block->ordinal &&
+        spill_slot.busy_until >= store_position) {
+      continue;
+    }
+    spill_slot.block_ordinal = block->ordinal;
+    spill_slot.busy_until = busy_until;
+    ++stats_.slot_reuse_count;
+    return spill_slot.slot;
+  }
+  Value* slot = builder->AllocLocal(value->type);
+  spill_slots_.push_back({slot, block->ordinal, busy_until});
+  ++stats_.slot_count;
+  return slot;
+}
+
+uint32_t LinearScanAllocationPass::SetIndexForType(TypeName type) const {
+  uint32_t types;
+  if (type <= INT64_TYPE) {
+    types = MachineInfo::RegisterSet::INT_TYPES;
+  } else if (type <= FLOAT64_TYPE) {
+    types = MachineInfo::RegisterSet::FLOAT_TYPES;
+  } else {
+    types = MachineInfo::RegisterSet::VEC_TYPES;
+  }
+  for (uint32_t n = 0; n < set_count_; ++n) {
+    if (sets_[n].set->types & types) {
+      return n;
+    }
+  }
+  assert_always();
+  return 0;
+}
+
+bool LinearScanAllocationPass::IsRematerializable(const Value* value) {
+  // Cheap computations on constants only, which are cheaper to redo than to
+  // store and load back.
+  const Instr* def = value->def;
+  auto opcode = def->opcode;
+  // ASSIGN isn't included, as its sequences can't take a constant source.
+  if (opcode != &OPCODE_CAST_info && opcode != &OPCODE_ZERO_EXTEND_info &&
+      opcode != &OPCODE_SIGN_EXTEND_info && opcode != &OPCODE_TRUNCATE_info &&
+      opcode != &OPCODE_SPLAT_info && opcode != &OPCODE_LOAD_VECTOR_SHL_info &&
+      opcode != &OPCODE_LOAD_VECTOR_SHR_info && opcode != &OPCODE_NOT_info &&
+      opcode != &OPCODE_AND_info && opcode != &OPCODE_OR_info &&
+      opcode != &OPCODE_XOR_info) {
+    return false;
+  }
+  uint32_t signature = opcode->signature;
+  if ((GET_OPCODE_SIG_TYPE_SRC1(signature) == OPCODE_SIG_TYPE_V &&
+       !def->src1.value->IsConstant()) ||
+      (GET_OPCODE_SIG_TYPE_SRC2(signature) == OPCODE_SIG_TYPE_V &&
+       !def->src2.value->IsConstant()) ||
+      (GET_OPCODE_SIG_TYPE_SRC3(signature) == OPCODE_SIG_TYPE_V &&
+       !def->src3.value->IsConstant())) {
+    return false;
+  }
+  return true;
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
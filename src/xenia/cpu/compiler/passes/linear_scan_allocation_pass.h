@@ -0,0 +1,116 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2020 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_PASSES_LINEAR_SCAN_ALLOCATION_PASS_H_
+#define XENIA_CPU_COMPILER_PASSES_LINEAR_SCAN_ALLOCATION_PASS_H_
+
+#include <vector>
+
+#include "xenia/cpu/backend/machine_info.h"
+#include "xenia/cpu/compiler/compiler_pass.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// Linear scan register allocation over the live intervals of each block.
+// Values must not be live across blocks (see DataFlowAnalysisPass).
+//
+// When a register set runs out, the interval with the furthest next use is
+// split there: its value is stored to a spill slot (unless it's already in
+// one, or can be recomputed from constants), and a new value reloaded right
+// before the next use takes over the rest of the uses. Spill slots are
+// reused once the values in them are dead.
+class LinearScanAllocationPass : public CompilerPass {
+ public:
+  struct Stats {
+    // Values stored to a spill slot.
+    uint32_t spill_count = 0;
+    // Values loaded back from a spill slot.
+    uint32_t reload_count = 0;
+    // Values recomputed instead of being loaded back.
+    uint32_t remat_count = 0;
+    // Spill slots allocated and reused.
+    uint32_t slot_count = 0;
+    uint32_t slot_reuse_count = 0;
+  };
+
+  explicit LinearScanAllocationPass(const backend::MachineInfo* machine_info);
+  ~LinearScanAllocationPass() override;
+
+  bool Run(hir::HIRBuilder* builder) override;
+
+  // Statistics of the last run.
+  const Stats& stats() const { return stats_; }
+
+ private:
+  static const uint32_t kNoIndex = UINT32_MAX;
+  static const uint32_t kMaxRegisterSets = 8;
+
+  struct Interval {
+    hir::Value* value;
+    uint32_t start;
+    uint32_t end;
+    // First use not yet passed by the scan and last use, into uses_.
+    uint32_t next_use;
+    uint32_t last_use;
+    uint32_t set_index;
+  };
+  struct Use {
+    hir::Instr* instr;
+    uint32_t position;
+    // Next use of the same interval, into uses_.
+    uint32_t next;
+  };
+  struct RegisterSet {
+    const backend::MachineInfo::RegisterSet* set = nullptr;
+    uint32_t free_mask = 0;
+    // Intervals currently holding a register, into intervals_.
+    std::vector<uint32_t> active;
+  };
+  struct SpillSlot {
+    hir::Value* slot;
+    uint16_t block_ordinal;
+    // Last position the value in the slot may be reloaded at.
+    uint32_t busy_until;
+  };
+
+  void BuildIntervals(hir::HIRBuilder* builder, hir::Block* block);
+  uint32_t AddInterval(hir::Value* value, uint32_t start);
+  void ExpireIntervals(uint32_t position);
+  bool AllocateInterval(hir::HIRBuilder* builder, hir::Instr* instr,
+                        uint32_t interval_index);
+  void SplitInterval(hir::HIRBuilder* builder, uint32_t interval_index,
+                     uint32_t split_use);
+  hir::Value* AllocSpillSlot(hir::HIRBuilder* builder, hir::Block* block,
+                             hir::Value* value, uint32_t busy_until);
+  uint32_t SetIndexForType(hir::TypeName type) const;
+  static bool IsRematerializable(const hir::Value* value);
+
+ private:
+  RegisterSet sets_[kMaxRegisterSets];
+  uint32_t set_count_ = 0;
+
+  // Flat per-block interval and use arrays, reused across blocks.
+  std::vector<Interval> intervals_;
+  std::vector<Use> uses_;
+  // Interval of each value defined in the current block, by value ordinal.
+  std::vector<uint32_t> value_intervals_;
+  std::vector<SpillSlot> spill_slots_;
+
+  Stats stats_;
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_PASSES_LINEAR_SCAN_ALLOCATION_PASS_H_
@@ -0,0 +1,111 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2020 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/passes/mmio_access_site_pass.h"
+
+#include "xenia/cpu/processor.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
+using xe::cpu::hir::Value;
+
+MMIOAccessSitePass::MMIOAccessSitePass() : CompilerPass() {}
+
+MMIOAccessSitePass::~MMIOAccessSitePass() = default;
+
+bool MMIOAccessSitePass::Run(HIRBuilder* builder) {
+  // Sites are looked up by the address of the guest instruction, as that's
+  // what the faulting host code was mapped back to.
+  uint32_t guest_address = 0;
+  auto block = builder->first_block();
+  while (block) {
+    auto i = block->instr_head;
+    while (i) {
+      auto next = i->next;
+      if (i->opcode == &OPCODE_SOURCE_OFFSET_info) {
+        guest_address = static_cast<uint32_t>(i->src1.offset);
+      } else if (i->opcode == &OPCODE_LOAD_info ||
+                 i->opcode == &OPCODE_LOAD_OFFSET_info) {
+        if (i->dest->type == INT32_TYPE) {
+          auto mmio_range = processor_->LookupMMIOAccessSite(guest_address);
+          if (mmio_range) {
+            ReplaceLoad(builder, i, mmio_range);
+          }
+        }
+      } else if (i->opcode == &OPCODE_STORE_info ||
+                 i->opcode == &OPCODE_STORE_OFFSET_info) {
+        auto value = i->opcode == &OPCODE_STORE_OFFSET_info ? i->src3.value
+                                                            : i->src2.value;
+        if (value->type == INT32_TYPE) {
+          auto mmio_range = processor_->LookupMMIOAccessSite(guest_address);
+          if (mmio_range) {
+            ReplaceStore(builder, i, mmio_range);
+          }
+        }
+      }
+      i = next;
+    }
+    block = block->next;
+  }
+  return true;
+}
+
+Value* MMIOAccessSitePass::ComputeAddress(HIRBuilder* builder, Instr* i) {
+  if (i->opcode != &OPCODE_LOAD_OFFSET_info &&
+      i->opcode != &OPCODE_STORE_OFFSET_info) {
+    return i->src1.value;
+  }
+  // The checked accesses take the full address - add the offset in front of
+  // the access (unless it folds into a constant).
+  auto last_instr = builder->last_instr();
+  Value* address = builder->Add(i->src1.value, i->src2.value);
+  if (builder->last_instr() != last_instr) {
+    builder->last_instr()->MoveBefore(i);
+  }
+  return address;
+}
+
+void MMIOAccessSitePass::ReplaceLoad(HIRBuilder* builder, Instr* i,
+                                     const MMIORange* mmio_range) {
+  // v1.i32 = load v0
+  // becomes:
+  // v1.i32 = load_mmio_checked v0, range
+  Value* address = ComputeAddress(builder, i);
+  i->Replace(&OPCODE_LOAD_MMIO_CHECKED_info, i->flags);
+  i->set_src1(address);
+  i->src2.offset = reinterpret_cast<uint64_t>(mmio_range);
+  i->src3.value = nullptr;
+}
+
+void MMIOAccessSitePass::ReplaceStore(HIRBuilder* builder, Instr* i,
+                                      const MMIORange* mmio_range) {
+  // store v0, v1.i32
+  // becomes:
+  // store_mmio_checked range, v0, v1.i32
+  Value* value = i->opcode == &OPCODE_STORE_OFFSET_info ? i->src3.value
+                                                        : i->src2.value;
+  Value* address = ComputeAddress(builder, i);
+  i->Replace(&OPCODE_STORE_MMIO_CHECKED_info, i->flags);
+  i->src1.offset = reinterpret_cast<uint64_t>(mmio_range);
+  i->set_src2(address);
+  i->set_src3(value);
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
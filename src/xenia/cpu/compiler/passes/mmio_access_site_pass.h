@@ -0,0 +1,43 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2020 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_PASSES_MMIO_ACCESS_SITE_PASS_H_
+#define XENIA_CPU_COMPILER_PASSES_MMIO_ACCESS_SITE_PASS_H_
+
+#include "xenia/cpu/compiler/compiler_pass.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// Turns loads and stores of guest instructions that have faulted on an MMIO
+// range into accesses that check the address against the range and call its
+// callbacks directly, instead of faulting every time.
+class MMIOAccessSitePass : public CompilerPass {
+ public:
+  MMIOAccessSitePass();
+  ~MMIOAccessSitePass() override;
+
+  bool Run(hir::HIRBuilder* builder) override;
+
+ private:
+  void ReplaceLoad(hir::HIRBuilder* builder, hir::Instr* i,
+                   const MMIORange* mmio_range);
+  void ReplaceStore(hir::HIRBuilder* builder, hir::Instr* i,
+                    const MMIORange* mmio_range);
+  hir::Value* ComputeAddress(hir::HIRBuilder* builder, hir::Instr* i);
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_PASSES_MMIO_ACCESS_SITE_PASS_H_
@@ -29,7 +29,8 @@ using xe::cpu::hir::Instr;
 using xe::cpu::hir::OpcodeSignatureType;
 using xe::cpu::hir::Value;
 
-ValidationPass::ValidationPass() : CompilerPass() {}
+ValidationPass::ValidationPass(bool allow_cross_block_uses)
+    : CompilerPass(), allow_cross_block_uses_(allow_cross_block_uses) {}
 
 ValidationPass::~ValidationPass() {}
 
@@ -75,10 +76,12 @@ bool ValidationPass::ValidateInstruction(Block* block, Instr* instr) {
 
   if (instr->dest) {
     assert_true(instr->dest->def == instr);
-    auto use = instr->dest->use_head;
-    while (use) {
-      assert_true(use->instr->block == block);
-      use = use->next;
+    if (!allow_cross_block_uses_) {
+      auto use = instr->dest->use_head;
+      while (use) {
+        assert_true(use->instr->block == block);
+        use = use->next;
+      }
     }
   }
 
@@ -19,7 +19,9 @@ namespace passes {
 
 class ValidationPass : public CompilerPass {
  public:
-  ValidationPass();
+  // Values defined in one block and used in another are only valid from
+  // context promotion until data flow analysis moves them into locals.
+  explicit ValidationPass(bool allow_cross_block_uses = false);
   ~ValidationPass() override;
 
   bool Run(hir::HIRBuilder* builder) override;
@@ -27,6 +29,8 @@ class ValidationPass : public CompilerPass {
  private:
   bool ValidateInstruction(hir::Block* block, hir::Instr* instr);
   bool ValidateValue(hir::Block* block, hir::Instr* instr, hir::Value* value);
+
+  bool allow_cross_block_uses_;
 };
 
 }  // namespace passes
@@ -37,6 +37,39 @@ DEFINE_bool(
 
 DEFINE_bool(validate_hir, false,
             "Perform validation checks on the HIR during compilation.", "CPU");
+DEFINE_bool(log_hir_instruction_counts, false,
+            "Log the number of HIR instructions and context accesses of every "
+            "optimized function before and after the compiler passes.",
+            "CPU");
+DEFINE_string(register_allocator, "simple",
+              "Register allocator for generated code [simple, linear_scan].",
+              "CPU");
+DEFINE_bool(log_register_allocation, false,
+            "Log the compilation time, register allocation statistics and "
+            "code size of every function, with totals for comparing register "
+            "allocators.",
+            "CPU");
+
+DEFINE_bool(tiered_jit, true,
+            "Compile functions with few optimizations on their first call and "
+            "recompile them with all optimizations in the background once "
+            "they've been called tier_up_threshold times.",
+            "CPU");
+DEFINE_int32(tier_up_threshold, 1000,
+             "Number of calls of a function compiled with few optimizations "
+             "after which it's recompiled with all optimizations.",
+             "CPU");
+DEFINE_bool(learn_mmio_access_sites, true,
+            "Recompile functions whose loads or stores fault on MMIO ranges "
+            "so those accesses call the MMIO handlers directly instead of "
+            "going through a host page fault each time.",
+            "CPU");
+DEFINE_bool(profile_mmio_accesses, false,
+            "Publish the rates of MMIO accesses going through host page faults "
+            "and of those avoided by calling the MMIO handlers directly as "
+            "profiler counters. Adds a little overhead to every direct MMIO "
+            "access.",
+            "CPU");
 
 // Breakpoints:
 DEFINE_uint64(break_on_instruction, 0,
@@ -25,6 +25,14 @@ DECLARE_bool(trace_function_data);
 DECLARE_bool(disable_global_lock);
 
 DECLARE_bool(validate_hir);
+DECLARE_bool(log_hir_instruction_counts);
+DECLARE_string(register_allocator);
+DECLARE_bool(log_register_allocation);
+
+DECLARE_bool(tiered_jit);
+DECLARE_int32(tier_up_threshold);
+DECLARE_bool(learn_mmio_access_sites);
+DECLARE_bool(profile_mmio_accesses);
 
 DECLARE_uint64(break_on_instruction);
 DECLARE_int32(break_condition_gpr);
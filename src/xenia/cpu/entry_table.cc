@@ -19,19 +19,68 @@ EntryTable::EntryTable() = default;
 
 EntryTable::~EntryTable() {
   auto global_lock = global_critical_region_.Acquire();
-  for (auto it : map_) {
-    Entry* entry = it.second;
+  for (Entry* entry : entries_) {
     delete entry;
   }
+  for (auto& page : pages_) {
+    delete page.load(std::memory_order_relaxed);
+  }
+}
+
+std::atomic<Entry*>* EntryTable::LookupSlot(uint32_t address, bool create) {
+  uint32_t table_offset = address - kTableBase;
+  if (table_offset >= kTableSize || (address & 3)) {
+    return nullptr;
+  }
+  std::atomic<Page*>& page_ref = pages_[table_offset >> kPageShift];
+  Page* page = page_ref.load(std::memory_order_acquire);
+  if (!page) {
+    if (!create) {
+      return nullptr;
+    }
+    // Several threads may race to allocate the page - only one wins.
+    Page* new_page = new Page();
+    for (auto& slot : new_page->slots) {
+      slot.store(nullptr, std::memory_order_relaxed);
+    }
+    if (page_ref.compare_exchange_strong(page, new_page,
+                                         std::memory_order_acq_rel,
+                                         std::memory_order_acquire)) {
+      page = new_page;
+    } else {
+      delete new_page;
+    }
+  }
+  return &page->slots[(table_offset & ((1 << kPageShift) - 1)) >> 2];
+}
+
+Entry::Status EntryTable::WaitForEntry(Entry* entry) {
+  Entry::Status status = entry->status.load(std::memory_order_acquire);
+  if (status == Entry::STATUS_COMPILING) {
+    // Still compiling, so spin.
+    do {
+      // TODO(benvanik): sleep for less time?
+      xe::threading::Sleep(std::chrono::microseconds(10));
+      status = entry->status.load(std::memory_order_acquire);
+    } while (status == Entry::STATUS_COMPILING);
+  }
+  return status;
 }
 
 Entry* EntryTable::Get(uint32_t address) {
-  auto global_lock = global_critical_region_.Acquire();
-  const auto& it = map_.find(address);
-  Entry* entry = it != map_.end() ? it->second : nullptr;
+  Entry* entry;
+  std::atomic<Entry*>* slot = LookupSlot(address, false);
+  if (slot) {
+    entry = slot->load(std::memory_order_acquire);
+  } else {
+    auto global_lock = global_critical_region_.Acquire();
+    const auto& it = untabled_map_.find(address);
+    entry = it != untabled_map_.end() ? it->second : nullptr;
+  }
   if (entry) {
     // TODO(benvanik): wait if needed?
-    if (entry->status != Entry::STATUS_READY) {
+    if (entry->status.load(std::memory_order_acquire) !=
+        Entry::STATUS_READY) {
       entry = nullptr;
     }
   }
@@ -39,36 +88,59 @@ Entry* EntryTable::Get(uint32_t address) {
 }
 
 Entry::Status EntryTable::GetOrCreate(uint32_t address, Entry** out_entry) {
-  // TODO(benvanik): replace with a map with wait-free for find.
-  // https://github.com/facebook/folly/blob/master/folly/AtomicHashMap.h
+  std::atomic<Entry*>* slot = LookupSlot(address, true);
+  if (!slot) {
+    return GetOrCreateUntabled(address, out_entry);
+  }
+
+  Entry* entry = slot->load(std::memory_order_acquire);
+  if (entry) {
+    *out_entry = entry;
+    return WaitForEntry(entry);
+  }
 
+  // Create and try to publish - if another thread published first, wait for
+  // its entry instead.
+  Entry* new_entry = new Entry();
+  new_entry->address = address;
+  new_entry->end_address = 0;
+  new_entry->status.store(Entry::STATUS_COMPILING, std::memory_order_relaxed);
+  new_entry->function = nullptr;
+  if (!slot->compare_exchange_strong(entry, new_entry,
+                                     std::memory_order_acq_rel,
+                                     std::memory_order_acquire)) {
+    delete new_entry;
+    *out_entry = entry;
+    return WaitForEntry(entry);
+  }
+  {
+    auto global_lock = global_critical_region_.Acquire();
+    entries_.push_back(new_entry);
+  }
+  *out_entry = new_entry;
+  return Entry::STATUS_NEW;
+}
+
+Entry::Status EntryTable::GetOrCreateUntabled(uint32_t address,
+                                              Entry** out_entry) {
   auto global_lock = global_critical_region_.Acquire();
-  const auto& it = map_.find(address);
-  Entry* entry = it != map_.end() ? it->second : nullptr;
+  const auto& it = untabled_map_.find(address);
+  Entry* entry = it != untabled_map_.end() ? it->second : nullptr;
   Entry::Status status;
   if (entry) {
-    // If we aren't ready yet spin and wait.
-    if (entry->status == Entry::STATUS_COMPILING) {
-      // Still compiling, so spin.
-      do {
-        global_lock.unlock();
-        // TODO(benvanik): sleep for less time?
-        xe::threading::Sleep(std::chrono::microseconds(10));
-        global_lock.lock();
-      } while (entry->status == Entry::STATUS_COMPILING);
-    }
-    status = entry->status;
+    global_lock.unlock();
+    status = WaitForEntry(entry);
   } else {
     // Create and return for initialization.
     entry = new Entry();
     entry->address = address;
     entry->end_address = 0;
-    entry->status = Entry::STATUS_COMPILING;
-    entry->function = 0;
-    map_[address] = entry;
+    entry->status.store(Entry::STATUS_COMPILING, std::memory_order_relaxed);
+    entry->function = nullptr;
+    untabled_map_[address] = entry;
+    entries_.push_back(entry);
     status = Entry::STATUS_NEW;
   }
-  global_lock.unlock();
   *out_entry = entry;
   return status;
 }
@@ -76,12 +148,12 @@ Entry::Status EntryTable::GetOrCreate(uint32_t address, Entry** out_entry) {
 std::vector<Function*> EntryTable::FindWithAddress(uint32_t address) {
   auto global_lock = global_critical_region_.Acquire();
   std::vector<Function*> fns;
-  for (auto& it : map_) {
-    Entry* entry = it.second;
+  for (Entry* entry : entries_) {
+    if (entry->status.load(std::memory_order_acquire) != Entry::STATUS_READY) {
+      continue;
+    }
     if (address >= entry->address && address <= entry->end_address) {
-      if (entry->status == Entry::STATUS_READY) {
-        fns.push_back(entry->function);
-      }
+      fns.push_back(entry->function);
     }
   }
   return fns;
@@ -10,6 +10,7 @@
 #ifndef XENIA_CPU_ENTRY_TABLE_H_
 #define XENIA_CPU_ENTRY_TABLE_H_
 
+#include <atomic>
 #include <unordered_map>
 #include <vector>
 
@@ -30,10 +31,18 @@ typedef struct Entry_t {
 
   uint32_t address;
   uint32_t end_address;
-  Status status;
+  // function and end_address must be written before the status is switched
+  // out of STATUS_COMPILING - readers don't take any lock.
+  std::atomic<Status> status;
   Function* function;
 } Entry;
 
+// Maps guest function addresses to their entries.
+// Addresses in the range where titles and their modules are loaded are looked
+// up in a two-level table indexed directly by the address, so lookups don't
+// take any locks and never wait unless the function is still being compiled.
+// Pages of the second level are allocated on first use and never freed until
+// the table is destroyed.
 class EntryTable {
  public:
   EntryTable();
@@ -45,9 +54,30 @@ class EntryTable {
   std::vector<Function*> FindWithAddress(uint32_t address);
 
  private:
+  static constexpr uint32_t kTableBase = 0x80000000;
+  static constexpr uint32_t kTableSize = 0x20000000;
+  // 64 KB of guest code per page, one slot for every instruction.
+  static constexpr uint32_t kPageShift = 16;
+  static constexpr uint32_t kPageCount = kTableSize >> kPageShift;
+  static constexpr uint32_t kSlotsPerPage = (1 << kPageShift) >> 2;
+
+  struct Page {
+    std::atomic<Entry*> slots[kSlotsPerPage];
+  };
+
+  std::atomic<Entry*>* LookupSlot(uint32_t address, bool create);
+  Entry::Status GetOrCreateUntabled(uint32_t address, Entry** out_entry);
+  static Entry::Status WaitForEntry(Entry* entry);
+
+  std::atomic<Page*> pages_[kPageCount] = {};
+
+  // Guards creation of entries (but not lookups in the table) and the
+  // fallback map.
   xe::global_critical_region global_critical_region_;
-  // TODO(benvanik): replace with a better data structure.
-  std::unordered_map<uint32_t, Entry*> map_;
+  // All entries for iteration and cleanup.
+  std::vector<Entry*> entries_;
+  // Entries for addresses outside the table range.
+  std::unordered_map<uint32_t, Entry*> untabled_map_;
 };
 
 }  // namespace cpu
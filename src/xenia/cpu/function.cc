@@ -60,6 +60,13 @@ GuestFunction::GuestFunction(Module* module, uint32_t address)
 
 GuestFunction::~GuestFunction() = default;
 
+void GuestFunction::AddRecompiledCode(std::unique_ptr<GuestFunction> code) {
+  GuestFunction* code_ptr = code.get();
+  recompiled_codes_.push_back(std::move(code));
+  // Everything in the code object is written before it becomes visible.
+  recompiled_code_.store(code_ptr, std::memory_order_release);
+}
+
 void GuestFunction::SetupExtern(ExternHandler handler, Export* export_data) {
   behavior_ = Behavior::kExtern;
   extern_handler_ = handler;
@@ -10,6 +10,7 @@
 #ifndef XENIA_CPU_FUNCTION_H_
 #define XENIA_CPU_FUNCTION_H_
 
+#include <atomic>
 #include <memory>
 #include <vector>
 
@@ -118,6 +119,32 @@ class GuestFunction : public Function {
   FunctionTraceData& trace_data() { return trace_data_; }
   std::vector<SourceMapEntry>& source_map() { return source_map_; }
 
+  // Whether the function is being or has been compiled with the baseline pass
+  // pipeline. Baseline code decrements the countdown on every call while it's
+  // positive, and requests recompilation with all optimizations when it
+  // reaches zero, which happens only once.
+  bool is_baseline() const { return is_baseline_; }
+  void set_baseline(bool value) { is_baseline_ = value; }
+  int32_t* tier_up_countdown() { return &tier_up_countdown_; }
+
+  // Recompilations of a defined function are translated into separate code
+  // objects with their own machine code, source map and extents, so none of
+  // these change for a function object once it's defined, while other threads
+  // may still be running its code or mapping host addresses through it.
+  // A recompilation isn't reachable by guest calls until it's published with
+  // Backend::PublishRecompiledFunction.
+  bool is_recompilation() const { return is_recompilation_; }
+  void set_recompilation(bool value) { is_recompilation_ = value; }
+  // The code object that calls of the function go to - the latest published
+  // recompilation, or the function itself.
+  GuestFunction* current_code() {
+    GuestFunction* code = recompiled_code_.load(std::memory_order_acquire);
+    return code ? code : this;
+  }
+  // Takes ownership of a complete recompilation and makes it current. Older
+  // code objects are kept alive, as threads may still be running them.
+  void AddRecompiledCode(std::unique_ptr<GuestFunction> code);
+
   ExternHandler extern_handler() const { return extern_handler_; }
   Export* export_data() const { return export_data_; }
   void SetupExtern(ExternHandler handler, Export* export_data = nullptr);
@@ -141,6 +168,12 @@ class GuestFunction : public Function {
   std::vector<SourceMapEntry> source_map_;
   ExternHandler extern_handler_ = nullptr;
   Export* export_data_ = nullptr;
+  bool is_baseline_ = false;
+  int32_t tier_up_countdown_ = 0;
+  bool is_recompilation_ = false;
+  std::atomic<GuestFunction*> recompiled_code_ = {nullptr};
+  // Only modified by the thread recompiling the function.
+  std::vector<std::unique_ptr<GuestFunction>> recompiled_codes_;
 };
 
 }  // namespace cpu
@@ -703,6 +703,29 @@ Instr* HIRBuilder::AppendInstr(const OpcodeInfo& opcode_info, uint16_t flags,
   return instr;
 }
 
+Instr* HIRBuilder::CloneInstr(const Instr* source) {
+  Instr* i = AppendInstr(
+      *source->opcode, source->flags,
+      source->dest ? AllocValue(source->dest->type) : nullptr);
+  uint32_t signature = source->opcode->signature;
+  if (GET_OPCODE_SIG_TYPE_SRC1(signature) == OPCODE_SIG_TYPE_V) {
+    i->set_src1(source->src1.value);
+  } else {
+    i->src1 = source->src1;
+  }
+  if (GET_OPCODE_SIG_TYPE_SRC2(signature) == OPCODE_SIG_TYPE_V) {
+    i->set_src2(source->src2.value);
+  } else {
+    i->src2 = source->src2;
+  }
+  if (GET_OPCODE_SIG_TYPE_SRC3(signature) == OPCODE_SIG_TYPE_V) {
+    i->set_src3(source->src3.value);
+  } else {
+    i->src3 = source->src3;
+  }
+  return i;
+}
+
 Value* HIRBuilder::AllocValue(TypeName type) {
   Value* value = arena_->Alloc<Value>();
   value->ordinal = next_value_ordinal_++;
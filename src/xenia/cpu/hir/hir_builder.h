@@ -110,6 +110,9 @@ class HIRBuilder {
 
   Value* AllocValue(TypeName type = INT64_TYPE);
   Value* CloneValue(Value* source);
+  // Appends a copy of the instruction with the same sources, defining a new
+  // value if the instruction has a destination.
+  Instr* CloneInstr(const Instr* source);
 
   // phi type_name, Block* b1, Value* v1, Block* b2, Value* v2, etc
   Value* Assign(Value* value);
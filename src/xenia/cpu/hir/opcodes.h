@@ -204,6 +204,8 @@ enum Opcode {
   OPCODE_CONTEXT_BARRIER,
   OPCODE_LOAD_MMIO,
   OPCODE_STORE_MMIO,
+  OPCODE_LOAD_MMIO_CHECKED,
+  OPCODE_STORE_MMIO_CHECKED,
   OPCODE_LOAD_OFFSET,
   OPCODE_STORE_OFFSET,
   OPCODE_LOAD,
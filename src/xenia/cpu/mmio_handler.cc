@@ -15,9 +15,12 @@
 
 #include "xenia/base/assert.h"
 #include "xenia/base/byte_order.h"
+#include "xenia/base/clock.h"
 #include "xenia/base/exception_handler.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/memory.h"
+#include "xenia/base/profiling.h"
+#include "xenia/cpu/cpu_flags.h"
 
 namespace xe {
 namespace cpu {
@@ -114,6 +117,34 @@ bool MMIOHandler::CheckStore(uint32_t virtual_address, uint32_t value) {
   return false;
 }
 
+void MMIOHandler::SetAccessSiteCallback(MMIOAccessSiteCallback callback,
+                                        void* context) {
+  auto global_lock = global_critical_region_.Acquire();
+  access_site_callback_ = callback;
+  access_site_callback_context_ = context;
+}
+
+void MMIOHandler::UpdateAccessCounters() {
+  uint64_t now_ms = Clock::QueryHostUptimeMillis();
+  uint64_t window_start_ms =
+      counter_window_start_ms_.load(std::memory_order_relaxed);
+  if (now_ms - window_start_ms < 1000) {
+    return;
+  }
+  // Only one thread publishes each window.
+  if (!counter_window_start_ms_.compare_exchange_strong(
+          window_start_ms, now_ms, std::memory_order_relaxed)) {
+    return;
+  }
+  uint64_t elapsed_ms = now_ms - window_start_ms;
+  uint64_t faults = fault_count_.exchange(0, std::memory_order_relaxed);
+  uint64_t direct_accesses =
+      direct_access_count_.exchange(0, std::memory_order_relaxed);
+  COUNT_profile_set("cpu/mmio/faults_per_second", faults * 1000 / elapsed_ms);
+  COUNT_profile_set("cpu/mmio/avoided_faults_per_second",
+                    direct_accesses * 1000 / elapsed_ms);
+}
+
 struct DecodedMov {
   size_t length;
   // Inidicates this is a load (or conversely a store).
@@ -375,6 +406,14 @@ bool MMIOHandler::ExceptionCallback(Exception* ex) {
   // Advance RIP to the next instruction so that we resume properly.
   ex->set_resume_pc(rip + mov.length);
 
+  if (cvars::profile_mmio_accesses) {
+    fault_count_.fetch_add(1, std::memory_order_relaxed);
+    UpdateAccessCounters();
+  }
+  if (access_site_callback_) {
+    access_site_callback_(access_site_callback_context_, rip, range);
+  }
+
   return true;
 }
 
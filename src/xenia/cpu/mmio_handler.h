@@ -10,6 +10,7 @@
 #ifndef XENIA_CPU_MMIO_HANDLER_H_
 #define XENIA_CPU_MMIO_HANDLER_H_
 
+#include <atomic>
 #include <memory>
 #include <mutex>
 #include <vector>
@@ -38,6 +39,12 @@ struct MMIORange {
   MMIOWriteCallback write;
 };
 
+// Called after a faulting host instruction at host_pc has been serviced by the
+// given range, so the code containing it can be recompiled to call the range
+// directly.
+typedef void (*MMIOAccessSiteCallback)(void* context, uint64_t host_pc,
+                                       const MMIORange* range);
+
 // NOTE: only one can exist at a time!
 class MMIOHandler {
  public:
@@ -68,6 +75,15 @@ class MMIOHandler {
   bool CheckLoad(uint32_t virtual_address, uint32_t* out_value);
   bool CheckStore(uint32_t virtual_address, uint32_t value);
 
+  void SetAccessSiteCallback(MMIOAccessSiteCallback callback, void* context);
+
+  // Counts an access that generated code sent straight to a range callback
+  // instead of faulting. Only called when profile_mmio_accesses is enabled.
+  void CountDirectAccess() {
+    direct_access_count_.fetch_add(1, std::memory_order_relaxed);
+    UpdateAccessCounters();
+  }
+
  protected:
   MMIOHandler(uint8_t* virtual_membase, uint8_t* physical_membase,
               uint8_t* membase_end, HostToGuestVirtual host_to_guest_virtual,
@@ -78,6 +94,9 @@ class MMIOHandler {
   static bool ExceptionCallbackThunk(Exception* ex, void* data);
   bool ExceptionCallback(Exception* ex);
 
+  // Publishes the fault and direct access rates about once per second.
+  void UpdateAccessCounters();
+
   uint8_t* virtual_membase_;
   uint8_t* physical_membase_;
   uint8_t* memory_end_;
@@ -90,6 +109,13 @@ class MMIOHandler {
   AccessViolationCallback access_violation_callback_;
   void* access_violation_callback_context_;
 
+  MMIOAccessSiteCallback access_site_callback_ = nullptr;
+  void* access_site_callback_context_ = nullptr;
+
+  std::atomic<uint32_t> fault_count_ = {0};
+  std::atomic<uint32_t> direct_access_count_ = {0};
+  std::atomic<uint64_t> counter_window_start_ms_ = {0};
+
   static MMIOHandler* global_handler_;
 
   xe::global_critical_region global_critical_region_;
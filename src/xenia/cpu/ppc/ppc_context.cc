@@ -10,6 +10,7 @@
 #include "xenia/cpu/ppc/ppc_context.h"
 
 #include <cinttypes>
+#include <cmath>
 #include <cstdlib>
 
 #include "xenia/base/assert.h"
@@ -43,6 +44,31 @@ void PPCContext::set_cr(uint64_t value) {
   assert_always("not yet implemented");
 }
 
+void PPCContext::MaterializeFPSCR() {
+  // Matches PPCHIRBuilder::MaterializeFPSCR.
+  uint32_t exceptions = 0;
+  if (std::isnan(fpscr_result)) {
+    exceptions = 0x01000000;  // VXSNAN
+  } else if (std::isinf(fpscr_result)) {
+    exceptions = 0x10000000;  // OX
+  }
+  uint32_t value = fpscr.value;
+  if (exceptions & ~value) {
+    value |= 0x80000000;  // FX
+  }
+  value = (value | exceptions) & ~uint32_t(0x60000000);
+  // VX if any invalid operation exception bit is set.
+  if (value & 0x01F80700) {
+    value |= 0x20000000;
+  }
+  // FEX if any exception bit is set along with its enable bit.
+  if ((value >> 22) & value & 0xF8) {
+    value |= 0x40000000;
+  }
+  fpscr.value = value;
+  fpscr_result = 0.0;
+}
+
 std::string PPCContext::GetRegisterName(PPCRegister reg) {
   switch (reg) {
     case PPCRegister::kLR:
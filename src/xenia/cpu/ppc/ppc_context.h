@@ -394,6 +394,10 @@ typedef struct PPCContext_s {
           fx : 1;  // FP exception summary                             -- sticky
     } bits;
   } fpscr;  // Floating-point status and control register
+  // Result of the last FPU instruction since the FPSCR was last read. The
+  // exception bits it causes are only folded into fpscr when the FPSCR or CR1
+  // is read, by MaterializeFPSCR or the equivalent generated code.
+  double fpscr_result;
 
   uint8_t vscr_sat;
 
@@ -426,6 +430,12 @@ typedef struct PPCContext_s {
   // Value of last reserved load
   uint64_t reserved_val;
 
+  // Keeps the size a multiple of 64 bytes.
+  uint8_t padding[56];
+
+  // Folds the exception bits caused by fpscr_result into fpscr.
+  void MaterializeFPSCR();
+
   static std::string GetRegisterName(PPCRegister reg);
   std::string GetStringFromValue(PPCRegister reg) const;
   void SetValueFromString(PPCRegister reg, std::string value);
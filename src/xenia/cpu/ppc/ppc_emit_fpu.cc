@@ -244,17 +244,22 @@ int InstrEmit_fctidxx_(PPCHIRBuilder& f, const InstrData& i,
                        RoundMode round_mode) {
   auto end = f.NewLabel();
   auto isnan = f.NewLabel();
+  // Loaded once, as frD may be frB.
+  Value* b = f.LoadFPR(i.X.RB);
   Value* v;
-  f.BranchTrue(f.IsNan(f.LoadFPR(i.X.RB)), isnan);
-  v = f.Convert(f.LoadFPR(i.X.RB), INT64_TYPE, round_mode);
+  f.BranchTrue(f.IsNan(b), isnan);
+  v = f.Convert(b, INT64_TYPE, round_mode);
   v = f.Cast(v, FLOAT64_TYPE);
   f.StoreFPR(i.X.RT, v);
-  f.UpdateFPSCR(v, i.X.Rc);
+  if (i.X.Rc) {
+    f.CopyFPSCRToCR1();
+  }
   f.Branch(end);
   f.MarkLabel(isnan);
   v = f.Cast(f.LoadConstantUint64(0x8000000000000000u), FLOAT64_TYPE);
   f.StoreFPR(i.X.RT, v);
-  f.UpdateFPSCR(v, i.X.Rc);
+  // Converting a NaN is an invalid operation, record it to set VX.
+  f.UpdateFPSCR(b, i.X.Rc);
   f.MarkLabel(end);
   return 0;
 }
@@ -272,17 +277,22 @@ int InstrEmit_fctiwxx_(PPCHIRBuilder& f, const InstrData& i,
                        RoundMode round_mode) {
   auto end = f.NewLabel();
   auto isnan = f.NewLabel();
+  // Loaded once, as frD may be frB.
+  Value* b = f.LoadFPR(i.X.RB);
   Value* v;
-  f.BranchTrue(f.IsNan(f.LoadFPR(i.X.RB)), isnan);
-  v = f.Convert(f.LoadFPR(i.X.RB), INT32_TYPE, round_mode);
+  f.BranchTrue(f.IsNan(b), isnan);
+  v = f.Convert(b, INT32_TYPE, round_mode);
   v = f.Cast(f.SignExtend(v, INT64_TYPE), FLOAT64_TYPE);
   f.StoreFPR(i.X.RT, v);
-  f.UpdateFPSCR(v, i.X.Rc);
+  if (i.X.Rc) {
+    f.CopyFPSCRToCR1();
+  }
   f.Branch(end);
   f.MarkLabel(isnan);
   v = f.Cast(f.LoadConstantUint32(0x80000000u), FLOAT64_TYPE);
   f.StoreFPR(i.X.RT, v);
-  f.UpdateFPSCR(v, i.X.Rc);
+  // Converting a NaN is an invalid operation, record it to set VX.
+  f.UpdateFPSCR(b, i.X.Rc);
   f.MarkLabel(end);
   return 0;
 }
@@ -351,17 +361,31 @@ int InstrEmit_fcmpu(PPCHIRBuilder& f, const InstrData& i) {
 // Floating-point status and control register (A
 
 int InstrEmit_mcrfs(PPCHIRBuilder& f, const InstrData& i) {
-  XEINSTRNOTIMPLEMENTED();
-  return 1;
+  // CR[4*crfD:4*crfD+3] <- FPSCR[4*crfS:4*crfS+3]
+  // The exception bits copied are cleared, except for FEX and VX.
+  const uint32_t crfd = i.X.RT >> 2;
+  const uint32_t crfs = i.X.RA >> 2;
+  const uint32_t shift = 28 - 4 * crfs;
+  Value* fpscr = f.LoadFPSCR();
+  for (uint32_t bit = 0; bit < 4; ++bit) {
+    f.StoreContext(offsetof(PPCContext, cr0) + (4 * crfd) + bit,
+                   f.And(f.Truncate(f.Shr(fpscr, int8_t(shift + 3 - bit)),
+                                    INT8_TYPE),
+                         f.LoadConstantInt8(1)));
+  }
+  uint32_t clear_mask = (0xF << shift) & 0x9FF80700;
+  if (clear_mask) {
+    f.StoreFPSCR(f.And(fpscr, f.LoadConstantUint32(~clear_mask)));
+  }
+  return 0;
 }
 
 int InstrEmit_mffsx(PPCHIRBuilder& f, const InstrData& i) {
-  if (i.X.Rc) {
-    XEINSTRNOTIMPLEMENTED();
-    return 1;
-  }
   Value* v = f.Cast(f.ZeroExtend(f.LoadFPSCR(), INT64_TYPE), FLOAT64_TYPE);
   f.StoreFPR(i.X.RT, v);
+  if (i.X.Rc) {
+    f.CopyFPSCRToCR1();
+  }
   return 0;
 }
 
@@ -442,7 +466,9 @@ int InstrEmit_fabsx(PPCHIRBuilder& f, const InstrData& i) {
   // frD <- abs(frB)
   Value* v = f.Abs(f.LoadFPR(i.X.RB));
   f.StoreFPR(i.X.RT, v);
-  f.UpdateFPSCR(v, i.X.Rc);
+  if (i.X.Rc) {
+    f.CopyFPSCRToCR1();
+  }
   return 0;
 }
 
@@ -450,7 +476,9 @@ int InstrEmit_fmrx(PPCHIRBuilder& f, const InstrData& i) {
   // frD <- (frB)
   Value* v = f.LoadFPR(i.X.RB);
   f.StoreFPR(i.X.RT, v);
-  f.UpdateFPSCR(v, i.X.Rc);
+  if (i.X.Rc) {
+    f.CopyFPSCRToCR1();
+  }
   return 0;
 }
 
@@ -458,7 +486,9 @@ int InstrEmit_fnabsx(PPCHIRBuilder& f, const InstrData& i) {
   // frD <- !abs(frB)
   Value* v = f.Neg(f.Abs(f.LoadFPR(i.X.RB)));
   f.StoreFPR(i.X.RT, v);
-  f.UpdateFPSCR(v, i.X.Rc);
+  if (i.X.Rc) {
+    f.CopyFPSCRToCR1();
+  }
   return 0;
 }
 
@@ -466,7 +496,9 @@ int InstrEmit_fnegx(PPCHIRBuilder& f, const InstrData& i) {
   // frD <- ¬ frB[0] || frB[1-63]
   Value* v = f.Neg(f.LoadFPR(i.X.RB));
   f.StoreFPR(i.X.RT, v);
-  f.UpdateFPSCR(v, i.X.Rc);
+  if (i.X.Rc) {
+    f.CopyFPSCRToCR1();
+  }
   return 0;
 }
 
@@ -11,6 +11,7 @@
 
 #include <stddef.h>
 #include <cstring>
+#include <limits>
 
 #include "third_party/fmt/include/fmt/format.h"
 
@@ -426,13 +427,13 @@ void PPCHIRBuilder::UpdateCR6(Value* src_value) {
   // TOOD(benvanik): trace CR.
 }
 
-Value* PPCHIRBuilder::LoadFPSCR() {
-  return LoadContext(offsetof(PPCContext, fpscr), INT32_TYPE);
-}
+Value* PPCHIRBuilder::LoadFPSCR() { return MaterializeFPSCR(); }
 
 void PPCHIRBuilder::StoreFPSCR(Value* value) {
   assert_true(value->type == INT32_TYPE);
   StoreContext(offsetof(PPCContext, fpscr), value);
+  // The written status replaces whatever the last result would have caused.
+  StoreContext(offsetof(PPCContext, fpscr_result), LoadZeroFloat64());
 
   auto& trace_reg = trace_info_.dests[trace_info_.dest_count++];
   trace_reg.reg = 67;
@@ -440,33 +441,46 @@ void PPCHIRBuilder::StoreFPSCR(Value* value) {
 }
 
 void PPCHIRBuilder::UpdateFPSCR(Value* result, bool update_cr1) {
-  // TODO(benvanik): detect overflow and nan cases.
-  // fx and vx are the most important.
-  Value* fx = LoadConstantInt8(0);
-  Value* fex = LoadConstantInt8(0);
-  Value* vx = LoadConstantInt8(0);
-  Value* ox = LoadConstantInt8(0);
-
+  assert_true(result->type == FLOAT64_TYPE);
+  // Only record the result - the exception bits are derived from it when the
+  // FPSCR or CR1 is read, and the stores of results that are replaced before
+  // that are removed as dead context stores.
+  StoreContext(offsetof(PPCContext, fpscr_result), result);
   if (update_cr1) {
-    // Store into the CR1 field.
-    // We do this instead of just calling CopyFPSCRToCR1 so that we don't
-    // have to read back the bits and do shifting work.
-    StoreContext(offsetof(PPCContext, cr1.cr1_fx), fx);
-    StoreContext(offsetof(PPCContext, cr1.cr1_fex), fex);
-    StoreContext(offsetof(PPCContext, cr1.cr1_vx), vx);
-    StoreContext(offsetof(PPCContext, cr1.cr1_ox), ox);
+    CopyFPSCRToCR1();
   }
+}
 
-  // Generate our new bits.
-  Value* new_bits = Shl(ZeroExtend(fx, INT32_TYPE), 31);
-  new_bits = Or(new_bits, Shl(ZeroExtend(fex, INT32_TYPE), 30));
-  new_bits = Or(new_bits, Shl(ZeroExtend(vx, INT32_TYPE), 29));
-  new_bits = Or(new_bits, Shl(ZeroExtend(ox, INT32_TYPE), 28));
-
-  // Mix into fpscr while preserving sticky bits (FX and OX).
-  Value* bits = LoadFPSCR();
-  bits = Or(And(bits, LoadConstantUint32(0x9FFFFFFF)), new_bits);
-  StoreFPSCR(bits);
+Value* PPCHIRBuilder::MaterializeFPSCR() {
+  // Matches PPCContext::MaterializeFPSCR.
+  // The operands aren't known here, so propagating a NaN or an infinity
+  // operand is reported as an invalid operation or an overflow too, and every
+  // invalid operation is recorded as VXSNAN.
+  Value* result =
+      LoadContext(offsetof(PPCContext, fpscr_result), FLOAT64_TYPE);
+  Value* vxsnan = ZeroExtend(IsNan(result), INT32_TYPE);
+  Value* ox = ZeroExtend(
+      CompareEQ(Abs(result),
+                LoadConstantFloat64(std::numeric_limits<double>::infinity())),
+      INT32_TYPE);
+  Value* exceptions = Or(Shl(vxsnan, 24), Shl(ox, 28));
+
+  // Set FX if any exception bit changes from 0 to 1, and recalculate the VX
+  // and FEX summaries.
+  Value* fpscr = LoadContext(offsetof(PPCContext, fpscr), INT32_TYPE);
+  Value* fx = ZeroExtend(IsTrue(And(exceptions, Not(fpscr))), INT32_TYPE);
+  fpscr = Or(Or(fpscr, exceptions), Shl(fx, 31));
+  Value* vx = ZeroExtend(IsTrue(And(fpscr, LoadConstantUint32(0x01F80700))),
+                         INT32_TYPE);
+  fpscr = Or(And(fpscr, LoadConstantUint32(0x9FFFFFFF)), Shl(vx, 29));
+  Value* fex = ZeroExtend(
+      IsTrue(And(And(Shr(fpscr, 22), fpscr), LoadConstantUint32(0xF8))),
+      INT32_TYPE);
+  fpscr = Or(fpscr, Shl(fex, 30));
+
+  StoreContext(offsetof(PPCContext, fpscr), fpscr);
+  StoreContext(offsetof(PPCContext, fpscr_result), LoadZeroFloat64());
+  return fpscr;
 }
 
 void PPCHIRBuilder::CopyFPSCRToCR1() {
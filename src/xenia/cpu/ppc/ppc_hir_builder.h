@@ -59,6 +59,7 @@ class PPCHIRBuilder : public hir::HIRBuilder {
   void UpdateCR6(Value* src_value);
   Value* LoadFPSCR();
   void StoreFPSCR(Value* value);
+  // Records the result of an FPU instruction, and updates CR1 if requested.
   void UpdateFPSCR(Value* result, bool update_cr1);
   void CopyFPSCRToCR1();
   Value* LoadXER();
@@ -84,6 +85,9 @@ class PPCHIRBuilder : public hir::HIRBuilder {
  private:
   void MaybeBreakOnInstruction(uint32_t address);
   void AnnotateLabel(uint32_t address, Label* label);
+  // Folds the exception bits caused by the last recorded FPU result into the
+  // FPSCR and returns the new FPSCR.
+  Value* MaterializeFPSCR();
 
   PPCFrontend* frontend_;
 
@@ -9,8 +9,12 @@
 
 #include "xenia/cpu/ppc/ppc_translator.h"
 
+#include <atomic>
+
 #include "xenia/base/assert.h"
 #include "xenia/base/byte_order.h"
+#include "xenia/base/clock.h"
+#include "xenia/base/logging.h"
 #include "xenia/base/memory.h"
 #include "xenia/base/profiling.h"
 #include "xenia/base/reset_scope.h"
@@ -41,24 +45,48 @@ PPCTranslator::PPCTranslator(PPCFrontend* frontend) : frontend_(frontend) {
 
   bool validate = cvars::validate_hir;
 
+  auto add_register_allocation_pass =
+      [backend](Compiler* compiler) -> passes::LinearScanAllocationPass* {
+    if (cvars::register_allocator == "simple") {
+      compiler->AddPass(std::make_unique<passes::RegisterAllocationPass>(
+          backend->machine_info()));
+      return nullptr;
+    }
+    auto pass = std::make_unique<passes::LinearScanAllocationPass>(
+        backend->machine_info());
+    auto pass_ptr = pass.get();
+    compiler->AddPass(std::move(pass));
+    return pass_ptr;
+  };
+
+  // Loads and stores are still mapped to the guest instructions they came from
+  // here, so the ones known to access MMIO can be found. Recompilation always
+  // uses this pipeline, so the baseline one doesn't need the pass.
+  compiler_->AddPass(std::make_unique<passes::MMIOAccessSitePass>());
+
   // Merge blocks early. This will let us use more context in other passes.
   // The CFG is required for simplification and dirtied by it.
   compiler_->AddPass(std::make_unique<passes::ControlFlowAnalysisPass>());
   compiler_->AddPass(std::make_unique<passes::ControlFlowSimplificationPass>());
+  compiler_->AddPass(std::make_unique<passes::ControlFlowAnalysisPass>());
 
   // Passes are executed in the order they are added. Multiple of the same
   // pass type may be used.
   if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
   compiler_->AddPass(std::make_unique<passes::ContextPromotionPass>());
-  if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  // Values are used across blocks from here until data flow analysis.
+  auto validate_cross_block = []() {
+    return std::make_unique<passes::ValidationPass>(true);
+  };
+  if (validate) compiler_->AddPass(validate_cross_block());
 
   // Grouped simplification + constant propagation.
   // Loops until no changes are made.
   auto sap = std::make_unique<passes::ConditionalGroupPass>();
   sap->AddPass(std::make_unique<passes::SimplificationPass>());
-  if (validate) sap->AddPass(std::make_unique<passes::ValidationPass>());
+  if (validate) sap->AddPass(validate_cross_block());
   sap->AddPass(std::make_unique<passes::ConstantPropagationPass>());
-  if (validate) sap->AddPass(std::make_unique<passes::ValidationPass>());
+  if (validate) sap->AddPass(validate_cross_block());
   compiler_->AddPass(std::move(sap));
 
   if (backend->machine_info()->supports_extended_load_store) {
@@ -66,15 +94,21 @@ PPCTranslator::PPCTranslator(PPCFrontend* frontend) : frontend_(frontend) {
     // These will save us a lot of HIR opcodes.
     compiler_->AddPass(
         std::make_unique<passes::MemorySequenceCombinationPass>());
-    if (validate)
-      compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+    if (validate) compiler_->AddPass(validate_cross_block());
   }
   compiler_->AddPass(std::make_unique<passes::SimplificationPass>());
-  if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  if (validate) compiler_->AddPass(validate_cross_block());
   // compiler_->AddPass(std::make_unique<passes::DeadStoreEliminationPass>());
   // if (validate)
   // compiler_->AddPass(std::make_unique<passes::ValidationPass>());
   compiler_->AddPass(std::make_unique<passes::DeadCodeEliminationPass>());
+  if (validate) compiler_->AddPass(validate_cross_block());
+
+  // Context promotion leaves values used across blocks, which the register
+  // allocator can't handle. Move them into locals, following the CFG as it
+  // is after simplification.
+  compiler_->AddPass(std::make_unique<passes::ControlFlowAnalysisPass>());
+  compiler_->AddPass(std::make_unique<passes::DataFlowAnalysisPass>());
   if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
 
   //// Removes all unneeded variables. Try not to add new ones after this.
@@ -85,16 +119,73 @@ PPCTranslator::PPCTranslator(PPCFrontend* frontend) : frontend_(frontend) {
   // Will modify the HIR to add loads/stores.
   // This should be the last pass before finalization, as after this all
   // registers are assigned and ready to be emitted.
-  compiler_->AddPass(std::make_unique<passes::RegisterAllocationPass>(
-      backend->machine_info()));
+  register_allocation_pass_ = add_register_allocation_pass(compiler_.get());
   if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
 
   // Must come last. The HIR is not really HIR after this.
   compiler_->AddPass(std::make_unique<passes::FinalizationPass>());
+
+  // Baseline tier - only what's needed to emit correct code, as most
+  // functions compiled with it are either called rarely or will be recompiled
+  // with the full pipeline soon.
+  baseline_compiler_.reset(new Compiler(frontend->processor()));
+  baseline_compiler_->AddPass(
+      std::make_unique<passes::ControlFlowAnalysisPass>());
+  // Constant propagation also turns accesses to constant MMIO addresses into
+  // direct handler calls, which would otherwise fault on every execution.
+  baseline_compiler_->AddPass(
+      std::make_unique<passes::ConstantPropagationPass>());
+  // Constant propagation may leave assignments with a constant source, which
+  // the backend can't emit, behind.
+  baseline_compiler_->AddPass(std::make_unique<passes::SimplificationPass>());
+  if (validate) {
+    baseline_compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  }
+  baseline_register_allocation_pass_ =
+      add_register_allocation_pass(baseline_compiler_.get());
+  if (validate) {
+    baseline_compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  }
+  baseline_compiler_->AddPass(std::make_unique<passes::FinalizationPass>());
 }
 
 PPCTranslator::~PPCTranslator() = default;
 
+namespace {
+
+struct HIRInstrCounts {
+  uint32_t total = 0;
+  uint32_t load_context = 0;
+  uint32_t store_context = 0;
+  uint32_t local = 0;
+};
+
+HIRInstrCounts CountHIRInstrs(hir::HIRBuilder* builder) {
+  HIRInstrCounts counts;
+  for (auto block = builder->first_block(); block; block = block->next) {
+    for (auto i = block->instr_head; i; i = i->next) {
+      ++counts.total;
+      if (i->opcode == &hir::OPCODE_LOAD_CONTEXT_info) {
+        ++counts.load_context;
+      } else if (i->opcode == &hir::OPCODE_STORE_CONTEXT_info) {
+        ++counts.store_context;
+      } else if (i->opcode == &hir::OPCODE_LOAD_LOCAL_info ||
+                 i->opcode == &hir::OPCODE_STORE_LOCAL_info) {
+        ++counts.local;
+      }
+    }
+  }
+  return counts;
+}
+
+// Totals over all functions logged so far.
+std::atomic<uint64_t> total_hir_instrs_before(0);
+std::atomic<uint64_t> total_hir_instrs_after(0);
+std::atomic<uint64_t> total_compile_ticks(0);
+std::atomic<uint64_t> total_code_size(0);
+
+}  // namespace
+
 bool PPCTranslator::Translate(GuestFunction* function,
                               uint32_t debug_info_flags) {
   SCOPE_profile_cpu_f("cpu");
@@ -102,6 +193,7 @@ bool PPCTranslator::Translate(GuestFunction* function,
   // Reset() all caching when we leave.
   xe::make_reset_scope(builder_);
   xe::make_reset_scope(compiler_);
+  xe::make_reset_scope(baseline_compiler_);
   xe::make_reset_scope(assembler_);
   xe::make_reset_scope(&string_buffer_);
 
@@ -124,6 +216,8 @@ bool PPCTranslator::Translate(GuestFunction* function,
   std::unique_ptr<FunctionDebugInfo> debug_info;
   if (debug_info_flags) {
     debug_info.reset(new FunctionDebugInfo());
+    // Debug info and tracing must describe the code that stays in use.
+    function->set_baseline(false);
   }
 
   // Scan the function to find its extents and gather debug data.
@@ -176,9 +270,32 @@ bool PPCTranslator::Translate(GuestFunction* function,
   }
 
   // Compile/optimize/etc.
-  if (!compiler_->Compile(builder_.get())) {
+  bool log_instr_counts =
+      cvars::log_hir_instruction_counts && !function->is_baseline();
+  HIRInstrCounts counts_before;
+  if (log_instr_counts) {
+    counts_before = CountHIRInstrs(builder_.get());
+  }
+  Compiler* compiler =
+      function->is_baseline() ? baseline_compiler_.get() : compiler_.get();
+  uint64_t compile_start_ticks = Clock::QueryHostTickCount();
+  if (!compiler->Compile(builder_.get())) {
     return false;
   }
+  uint64_t compile_ticks = Clock::QueryHostTickCount() - compile_start_ticks;
+  if (log_instr_counts) {
+    HIRInstrCounts counts_after = CountHIRInstrs(builder_.get());
+    uint64_t total_before = total_hir_instrs_before += counts_before.total;
+    uint64_t total_after = total_hir_instrs_after += counts_after.total;
+    XELOGI(
+        "HIR {:08X}: {} -> {} instrs, {} -> {} context loads, {} -> {} "
+        "context stores, {} local loads/stores (all functions: {} -> {} "
+        "instrs)",
+        function->address(), counts_before.total, counts_after.total,
+        counts_before.load_context, counts_after.load_context,
+        counts_before.store_context, counts_after.store_context,
+        counts_after.local, total_before, total_after);
+  }
 
   // Stash optimized HIR.
   if (debug_info_flags & DebugInfoFlags::kDebugInfoDisasmHir) {
@@ -193,6 +310,27 @@ bool PPCTranslator::Translate(GuestFunction* function,
     return false;
   }
 
+  if (cvars::log_register_allocation) {
+    passes::LinearScanAllocationPass::Stats stats;
+    auto register_allocation_pass = function->is_baseline()
+                                         ? baseline_register_allocation_pass_
+                                         : register_allocation_pass_;
+    if (register_allocation_pass) {
+      stats = register_allocation_pass->stats();
+    }
+    uint64_t tick_frequency = Clock::QueryHostTickFrequency();
+    uint64_t total_ticks = total_compile_ticks += compile_ticks;
+    uint64_t total_size = total_code_size += function->machine_code_length();
+    XELOGI(
+        "RA {:08X}{}: {} us, {} spills, {} reloads, {} remats, {} slots "
+        "({} reused), {} bytes (all functions: {} us, {} bytes)",
+        function->address(), function->is_baseline() ? " (baseline)" : "",
+        compile_ticks * 1000000 / tick_frequency, stats.spill_count,
+        stats.reload_count, stats.remat_count, stats.slot_count,
+        stats.slot_reuse_count, function->machine_code_length(),
+        total_ticks * 1000000 / tick_frequency, total_size);
+  }
+
   return true;
 }
 
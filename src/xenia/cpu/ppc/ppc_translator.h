@@ -19,6 +19,11 @@
 
 namespace xe {
 namespace cpu {
+namespace compiler {
+namespace passes {
+class LinearScanAllocationPass;
+}  // namespace passes
+}  // namespace compiler
 namespace ppc {
 
 class PPCFrontend;
@@ -39,6 +44,13 @@ class PPCTranslator {
   std::unique_ptr<PPCScanner> scanner_;
   std::unique_ptr<PPCHIRBuilder> builder_;
   std::unique_ptr<compiler::Compiler> compiler_;
+  // Minimal pipeline for the first compilation of functions when tiering.
+  std::unique_ptr<compiler::Compiler> baseline_compiler_;
+  // Owned by the compilers, null with the simple allocator.
+  compiler::passes::LinearScanAllocationPass* register_allocation_pass_ =
+      nullptr;
+  compiler::passes::LinearScanAllocationPass*
+      baseline_register_allocation_pass_ = nullptr;
   std::unique_ptr<backend::Assembler> assembler_;
 
   StringBuffer string_buffer_;
@@ -0,0 +1,85 @@
+test_mffs_1:
+  #_ REGISTER_IN f1 1.0
+  #_ REGISTER_IN f2 2.0
+  fadd f3, f1, f2
+  mffs f4
+  stfd f4, -8(r1)
+  lwz r3, -4(r1)
+  rlwinm r3, r3, 0, 0, 3
+  blr
+  #_ REGISTER_OUT f3 3.0
+  #_ REGISTER_OUT r3 0
+
+# +infinity - +infinity: FX and VX
+test_mffs_2:
+  #_ REGISTER_IN f1 0x7ff0000000000000
+  fsub f3, f1, f1
+  mffs f4
+  stfd f4, -8(r1)
+  lwz r3, -4(r1)
+  rlwinm r3, r3, 0, 0, 3
+  blr
+  #_ REGISTER_OUT r3 0xA0000000
+
+# Overflow: FX and OX
+test_mffs_3:
+  #_ REGISTER_IN f1 0x7fe0000000000000
+  fmul f3, f1, f1
+  mffs f4
+  stfd f4, -8(r1)
+  lwz r3, -4(r1)
+  rlwinm r3, r3, 0, 0, 3
+  blr
+  #_ REGISTER_OUT f3 0x7ff0000000000000
+  #_ REGISTER_OUT r3 0x90000000
+
+# CR1 from an Rc=1 instruction
+test_mffs_4:
+  #_ REGISTER_IN f1 0x7ff0000000000000
+  fsub. f3, f1, f1
+  mfcr r3
+  rlwinm r3, r3, 0, 4, 7
+  blr
+  #_ REGISTER_OUT r3 0x0A000000
+
+# mcrfs copies FX FEX VX OX and clears FX and OX
+test_mffs_5:
+  #_ REGISTER_IN f1 0x7fe0000000000000
+  fmul f3, f1, f1
+  mcrfs cr2, cr0
+  mffs f4
+  stfd f4, -8(r1)
+  lwz r3, -4(r1)
+  rlwinm r3, r3, 0, 0, 3
+  mfcr r4
+  rlwinm r4, r4, 0, 8, 11
+  blr
+  #_ REGISTER_OUT r3 0
+  #_ REGISTER_OUT r4 0x00900000
+
+# Converting a NaN in place: FX and VX
+test_mffs_6:
+  #_ REGISTER_IN f1 0x7ff8000000000000
+  fctiwz f1, f1
+  mffs f4
+  stfd f4, -8(r1)
+  lwz r3, -4(r1)
+  rlwinm r3, r3, 0, 0, 3
+  blr
+  #_ REGISTER_OUT r3 0xA0000000
+
+# VX is cleared along with the invalid operation cause bits
+test_mffs_7:
+  #_ REGISTER_IN f1 0x7ff0000000000000
+  fsub f3, f1, f1
+  mcrfs cr2, cr0
+  mcrfs cr3, cr1
+  mffs f4
+  stfd f4, -8(r1)
+  lwz r3, -4(r1)
+  rlwinm r3, r3, 0, 0, 3
+  mfcr r4
+  rlwinm r4, r4, 0, 8, 15
+  blr
+  #_ REGISTER_OUT r3 0
+  #_ REGISTER_OUT r4 0x00A10000
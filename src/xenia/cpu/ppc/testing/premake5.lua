@@ -10,6 +10,7 @@ project("xenia-cpu-ppc-tests")
     "capstone", -- cpu-backend-x64
     "fmt",
     "mspack",
+    "snappy",
     "xenia-core",
     "xenia-cpu-backend-x64",
     "xenia-cpu",
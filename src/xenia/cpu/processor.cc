@@ -9,10 +9,14 @@
 
 #include "xenia/cpu/processor.h"
 
+#include <algorithm>
+#include <chrono>
+
 #include "xenia/base/assert.h"
 #include "xenia/base/atomic.h"
 #include "xenia/base/byte_order.h"
 #include "xenia/base/byte_stream.h"
+#include "xenia/base/clock.h"
 #include "xenia/base/cvar.h"
 #include "xenia/base/debugging.h"
 #include "xenia/base/exception_handler.h"
@@ -20,6 +24,7 @@
 #include "xenia/base/memory.h"
 #include "xenia/base/profiling.h"
 #include "xenia/base/threading.h"
+#include "xenia/cpu/backend/code_cache.h"
 #include "xenia/cpu/breakpoint.h"
 #include "xenia/cpu/cpu_flags.h"
 #include "xenia/cpu/export_resolver.h"
@@ -46,6 +51,12 @@ DEFINE_path(trace_function_data_path, "", "File to write trace data to.",
             "CPU");
 DEFINE_bool(break_on_start, false, "Break into the debugger on startup.",
             "CPU");
+DEFINE_int32(precompile_threads, 0,
+             "Number of threads translating the functions of the title in the "
+             "background after it's loaded, so they're ready before their "
+             "first call. -1 to calculate automatically (75% of logical CPU "
+             "cores), 0 to disable.",
+             "CPU");
 
 namespace xe {
 namespace kernel {
@@ -82,6 +93,14 @@ Processor::Processor(xe::Memory* memory, ExportResolver* export_resolver)
     : memory_(memory), export_resolver_(export_resolver) {}
 
 Processor::~Processor() {
+  auto mmio_handler = MMIOHandler::global_handler();
+  if (mmio_handler) {
+    mmio_handler->SetAccessSiteCallback(nullptr, nullptr);
+  }
+
+  ShutdownPrecompileThreads();
+  ShutdownTierUpThread();
+
   {
     auto global_lock = global_critical_region_.Acquire();
     modules_.clear();
@@ -146,6 +165,24 @@ bool Processor::Setup(std::unique_ptr<backend::Backend> backend) {
         functions_trace_path_, 32 * 1024 * 1024, true);
   }
 
+  // Created upfront, as MMIO accesses are reported from the fault handler,
+  // which can't create threads. Guest threads calling the baseline code until
+  // it's replaced take priority.
+  if (cvars::tiered_jit || cvars::learn_mmio_access_sites) {
+    xe::threading::Thread::CreationParameters params;
+    params.initial_priority = xe::threading::ThreadPriority::kBelowNormal;
+    tier_up_thread_ = xe::threading::Thread::Create(
+        params, [this]() { TierUpThread(); });
+    tier_up_thread_->set_name("CPU Tier-up");
+  }
+
+  if (cvars::learn_mmio_access_sites) {
+    auto mmio_handler = MMIOHandler::global_handler();
+    if (mmio_handler) {
+      mmio_handler->SetAccessSiteCallback(OnMMIOAccessThunk, this);
+    }
+  }
+
   return true;
 }
 
@@ -225,17 +262,19 @@ Function* Processor::ResolveFunction(uint32_t address) {
     // Grab symbol declaration.
     auto function = LookupFunction(address);
     if (!function) {
-      entry->status = Entry::STATUS_FAILED;
+      entry->status.store(Entry::STATUS_FAILED, std::memory_order_release);
       return nullptr;
     }
 
     if (!DemandFunction(function)) {
-      entry->status = Entry::STATUS_FAILED;
+      entry->status.store(Entry::STATUS_FAILED, std::memory_order_release);
       return nullptr;
     }
     entry->function = function;
     entry->end_address = function->end_address();
-    status = entry->status = Entry::STATUS_READY;
+    // Publishes the function to threads looking the entry up without locking.
+    status = Entry::STATUS_READY;
+    entry->status.store(status, std::memory_order_release);
   }
   if (status == Entry::STATUS_READY) {
     // Ready to use.
@@ -287,6 +326,244 @@ Function* Processor::LookupFunction(Module* module, uint32_t address) {
   return function;
 }
 
+bool Processor::InitializeCodeStorage(const std::filesystem::path& cache_root,
+                                      uint64_t module_hash) {
+  return backend_->InitializeCodeStorage(cache_root, module_hash);
+}
+
+void Processor::PrecompileFunctions(const std::vector<uint32_t>& addresses) {
+  if (!cvars::precompile_threads || addresses.empty()) {
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(precompile_mutex_);
+    if (!precompile_pending_) {
+      precompile_start_time_ = Clock::QueryHostTickCount();
+    }
+    precompile_queue_.insert(precompile_queue_.end(), addresses.begin(),
+                             addresses.end());
+    precompile_pending_ += addresses.size();
+  }
+  XELOGI("Queued {} functions for precompilation", addresses.size());
+
+  if (precompile_threads_.empty()) {
+    uint32_t logical_processor_count =
+        xe::threading::logical_processor_count();
+    if (!logical_processor_count) {
+      // Pick some reasonable amount if couldn't determine the number of cores.
+      logical_processor_count = 6;
+    }
+    size_t thread_count;
+    if (cvars::precompile_threads < 0) {
+      thread_count = std::max(logical_processor_count * 3 / 4, uint32_t(1));
+    } else {
+      thread_count = std::min(uint32_t(cvars::precompile_threads),
+                              logical_processor_count);
+    }
+    for (size_t i = 0; i < thread_count; ++i) {
+      // Guest threads demanding functions themselves take priority.
+      xe::threading::Thread::CreationParameters params;
+      params.initial_priority = xe::threading::ThreadPriority::kBelowNormal;
+      auto thread = xe::threading::Thread::Create(
+          params, [this]() { PrecompileThread(); });
+      thread->set_name("CPU Precompilation");
+      precompile_threads_.push_back(std::move(thread));
+    }
+  } else {
+    precompile_cond_.notify_all();
+  }
+}
+
+void Processor::PrecompileThread() {
+  while (true) {
+    uint32_t address;
+    {
+      std::unique_lock<std::mutex> lock(precompile_mutex_);
+      precompile_cond_.wait(lock, [this]() {
+        return precompile_shutdown_ || !precompile_queue_.empty();
+      });
+      if (precompile_shutdown_) {
+        return;
+      }
+      address = precompile_queue_.front();
+      precompile_queue_.pop_front();
+    }
+
+    // The entry table makes sure every function is only translated once, with
+    // guest threads calling a function being translated here waiting for it.
+    ResolveFunction(address);
+
+    std::lock_guard<std::mutex> lock(precompile_mutex_);
+    if (!--precompile_pending_) {
+      XELOGI("Precompilation finished in {} ms",
+             (Clock::QueryHostTickCount() - precompile_start_time_) * 1000 /
+                 Clock::QueryHostTickFrequency());
+    }
+  }
+}
+
+void Processor::ShutdownPrecompileThreads() {
+  {
+    std::lock_guard<std::mutex> lock(precompile_mutex_);
+    precompile_shutdown_ = true;
+    precompile_queue_.clear();
+  }
+  precompile_cond_.notify_all();
+  for (auto& thread : precompile_threads_) {
+    xe::threading::Wait(thread.get(), false);
+  }
+  precompile_threads_.clear();
+}
+
+void Processor::RequestFunctionTierUp(uint32_t address) {
+  auto function = LookupFunction(address);
+  if (!function || !function->is_guest() ||
+      static_cast<GuestFunction*>(function)->extern_handler()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(tier_up_mutex_);
+  if (!tier_up_thread_ || tier_up_shutdown_) {
+    return;
+  }
+  auto guest_function = static_cast<GuestFunction*>(function);
+  if (std::find(tier_up_queue_.begin(), tier_up_queue_.end(),
+                guest_function) != tier_up_queue_.end()) {
+    return;
+  }
+  tier_up_queue_.push_back(guest_function);
+  tier_up_cond_.notify_one();
+}
+
+void Processor::TierUpThread() {
+  auto has_work = [this]() {
+    return tier_up_shutdown_ || !tier_up_queue_.empty();
+  };
+  while (true) {
+    GuestFunction* function = nullptr;
+    {
+      std::unique_lock<std::mutex> lock(tier_up_mutex_);
+      if (cvars::learn_mmio_access_sites) {
+        // The fault handler can't wake the thread, so its accesses are polled.
+        tier_up_cond_.wait_for(lock, std::chrono::milliseconds(50), has_work);
+      } else {
+        tier_up_cond_.wait(lock, has_work);
+      }
+      if (tier_up_shutdown_) {
+        return;
+      }
+      if (!tier_up_queue_.empty()) {
+        function = tier_up_queue_.front();
+        tier_up_queue_.pop_front();
+      }
+    }
+
+    for (auto& mmio_access : pending_mmio_accesses_) {
+      uint64_t host_pc = mmio_access.host_pc.load(std::memory_order_acquire);
+      const MMIORange* range =
+          mmio_access.range.load(std::memory_order_acquire);
+      if (!host_pc || !range) {
+        // Free, or still being filled.
+        continue;
+      }
+      mmio_access.range.store(nullptr, std::memory_order_relaxed);
+      mmio_access.host_pc.store(0, std::memory_order_release);
+      LearnMMIOAccessSite(host_pc, range);
+    }
+
+    if (!function) {
+      continue;
+    }
+
+    // Translated into a separate code object, as other threads may still be
+    // running the current code of the function or mapping host addresses
+    // through it, and only made reachable by calls once complete.
+    auto code =
+        backend_->CreateGuestFunction(function->module(), function->address());
+    code->set_recompilation(true);
+    if (!frontend_->DefineFunction(code.get(), debug_info_flags_)) {
+      XELOGE("Failed to recompile function {:08X} with all optimizations",
+             function->address());
+      continue;
+    }
+    OnFunctionDefined(code.get());
+    backend_->PublishRecompiledFunction(function, std::move(code));
+  }
+}
+
+void Processor::ShutdownTierUpThread() {
+  {
+    std::lock_guard<std::mutex> lock(tier_up_mutex_);
+    tier_up_shutdown_ = true;
+    tier_up_queue_.clear();
+  }
+  tier_up_cond_.notify_all();
+  if (tier_up_thread_) {
+    xe::threading::Wait(tier_up_thread_.get(), false);
+    tier_up_thread_.reset();
+  }
+}
+
+const MMIORange* Processor::LookupMMIOAccessSite(uint32_t guest_address) {
+  if (!has_mmio_access_sites_.load(std::memory_order_acquire)) {
+    return nullptr;
+  }
+  std::lock_guard<std::mutex> lock(mmio_access_sites_mutex_);
+  auto it = mmio_access_sites_.find(guest_address);
+  return it != mmio_access_sites_.end() ? it->second : nullptr;
+}
+
+void Processor::OnMMIOAccessThunk(void* context, uint64_t host_pc,
+                                  const MMIORange* range) {
+  reinterpret_cast<Processor*>(context)->OnMMIOAccess(host_pc, range);
+}
+
+void Processor::OnMMIOAccess(uint64_t host_pc, const MMIORange* range) {
+  // Called from the fault handler, while other threads may be placing code,
+  // so the code is looked up later by the tier-up thread. Must not lock or
+  // allocate.
+  // The same instruction keeps faulting until its function is recompiled.
+  for (const auto& mmio_access : pending_mmio_accesses_) {
+    if (mmio_access.host_pc.load(std::memory_order_relaxed) == host_pc) {
+      return;
+    }
+  }
+  for (auto& mmio_access : pending_mmio_accesses_) {
+    uint64_t free_host_pc = 0;
+    if (mmio_access.host_pc.compare_exchange_strong(
+            free_host_pc, host_pc, std::memory_order_acq_rel)) {
+      mmio_access.range.store(range, std::memory_order_release);
+      return;
+    }
+  }
+  // All slots are taken - the access will be reported again when it faults
+  // next time.
+}
+
+void Processor::LearnMMIOAccessSite(uint64_t host_pc,
+                                    const MMIORange* range) {
+  // The code object containing the address is never modified once it's
+  // reachable, and it must be to have faulted.
+  auto code = backend_->code_cache()->LookupFunction(host_pc);
+  if (!code) {
+    // Not generated code, such as a kernel export reading guest memory.
+    return;
+  }
+  uint32_t guest_address = code->MapMachineCodeToGuestAddress(host_pc);
+  {
+    std::lock_guard<std::mutex> lock(mmio_access_sites_mutex_);
+    if (!mmio_access_sites_.emplace(guest_address, range).second) {
+      // Already learned - old code still running on some thread.
+      return;
+    }
+    has_mmio_access_sites_.store(true, std::memory_order_release);
+  }
+  XELOGD("MMIO access at {:08X} in function {:08X}, recompiling to call the "
+         "handler directly",
+         guest_address, code->address());
+  RequestFunctionTierUp(code->address());
+}
+
 bool Processor::DemandFunction(Function* function) {
   // Lock function for generation. If it's already being generated
   // by another thread this will block and return DECLARED.
@@ -295,10 +572,22 @@ bool Processor::DemandFunction(Function* function) {
   if (symbol_status == Symbol::Status::kNew) {
     // Symbol is undefined, so define now.
     assert_true(function->is_guest());
-    if (!frontend_->DefineFunction(static_cast<GuestFunction*>(function),
-                                   debug_info_flags_)) {
-      function->set_status(Symbol::Status::kFailed);
-      return false;
+    auto guest_function = static_cast<GuestFunction*>(function);
+    // Reuse the code generated by a previous run if possible.
+    bool defined = !debug_info_flags_ &&
+                   backend_->DefineStoredFunction(guest_function);
+    if (!defined) {
+      // Get the function running quickly, and optimize it only if it's hot.
+      if (cvars::tiered_jit && !debug_info_flags_ &&
+          !guest_function->extern_handler()) {
+        guest_function->set_baseline(true);
+        *guest_function->tier_up_countdown() =
+            std::max(cvars::tier_up_threshold, 1);
+      }
+      if (!frontend_->DefineFunction(guest_function, debug_info_flags_)) {
+        function->set_status(Symbol::Status::kFailed);
+        return false;
+      }
     }
 
     // Before we give the symbol back to the rest, let the debugger know.
@@ -10,19 +10,27 @@
 #ifndef XENIA_CPU_PROCESSOR_H_
 #define XENIA_CPU_PROCESSOR_H_
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include "xenia/base/cvar.h"
 #include "xenia/base/mapped_memory.h"
 #include "xenia/base/mutex.h"
+#include "xenia/base/threading.h"
 #include "xenia/cpu/backend/backend.h"
 #include "xenia/cpu/debug_listener.h"
 #include "xenia/cpu/entry_table.h"
 #include "xenia/cpu/export_resolver.h"
 #include "xenia/cpu/function.h"
+#include "xenia/cpu/mmio_handler.h"
 #include "xenia/cpu/module.h"
 #include "xenia/cpu/ppc/ppc_frontend.h"
 #include "xenia/cpu/thread_debug_info.h"
@@ -114,6 +122,26 @@ class Processor {
   Function* LookupFunction(Module* module, uint32_t address);
   Function* ResolveFunction(uint32_t address);
 
+  // Opens the persistent storage of generated code for the module with the
+  // given hash, so functions translated by previous runs can be reused.
+  bool InitializeCodeStorage(const std::filesystem::path& cache_root,
+                             uint64_t module_hash);
+
+  // Queues the functions at the given addresses for translation on background
+  // threads, so guest threads rarely have to stall on the first call to a
+  // function. Does nothing if precompilation is disabled.
+  void PrecompileFunctions(const std::vector<uint32_t>& addresses);
+
+  // Queues recompilation of a function compiled with the baseline pass
+  // pipeline with all optimizations, after which calls are switched to the
+  // new code. Called from the baseline code itself when it gets hot.
+  void RequestFunctionTierUp(uint32_t address);
+
+  // Returns the MMIO range a load or store by the guest instruction at the
+  // given address has faulted on before, or null if it never has. Compiled
+  // code calls the range for these accesses instead of faulting again.
+  const MMIORange* LookupMMIOAccessSite(uint32_t guest_address);
+
   bool Execute(ThreadState* thread_state, uint32_t address);
   bool ExecuteRaw(ThreadState* thread_state, uint32_t address);
   uint64_t Execute(ThreadState* thread_state, uint32_t address, uint64_t args[],
@@ -235,6 +263,17 @@ class Processor {
 
   bool DemandFunction(Function* function);
 
+  void PrecompileThread();
+  void ShutdownPrecompileThreads();
+
+  void TierUpThread();
+  void ShutdownTierUpThread();
+
+  static void OnMMIOAccessThunk(void* context, uint64_t host_pc,
+                                const MMIORange* range);
+  void OnMMIOAccess(uint64_t host_pc, const MMIORange* range);
+  void LearnMMIOAccessSite(uint64_t host_pc, const MMIORange* range);
+
   Memory* memory_ = nullptr;
   std::unique_ptr<StackWalker> stack_walker_;
 
@@ -265,6 +304,37 @@ class Processor {
   // TODO(benvanik): cleanup/change structures.
   std::vector<Breakpoint*> breakpoints_;
 
+  // Background translation of functions ahead of their first call.
+  std::mutex precompile_mutex_;
+  std::condition_variable precompile_cond_;
+  std::deque<uint32_t> precompile_queue_;
+  size_t precompile_pending_ = 0;
+  uint64_t precompile_start_time_ = 0;
+  bool precompile_shutdown_ = false;
+  std::vector<std::unique_ptr<xe::threading::Thread>> precompile_threads_;
+
+  // Background recompilation of hot baseline functions.
+  std::mutex tier_up_mutex_;
+  std::condition_variable tier_up_cond_;
+  std::deque<GuestFunction*> tier_up_queue_;
+  bool tier_up_shutdown_ = false;
+  // Host addresses of faulting MMIO accesses, added by the fault handler
+  // without locking or allocating, and polled and resolved by the tier-up
+  // thread. A slot is free when its host_pc is 0. Accesses not fitting are
+  // dropped, as they will fault again.
+  struct PendingMMIOAccess {
+    std::atomic<uint64_t> host_pc = {0};
+    std::atomic<const MMIORange*> range = {nullptr};
+  };
+  static constexpr size_t kPendingMMIOAccessCount = 64;
+  PendingMMIOAccess pending_mmio_accesses_[kPendingMMIOAccessCount];
+  std::unique_ptr<xe::threading::Thread> tier_up_thread_;
+
+  // Guest addresses of loads and stores that faulted on MMIO ranges.
+  std::mutex mmio_access_sites_mutex_;
+  std::unordered_map<uint32_t, const MMIORange*> mmio_access_sites_;
+  std::atomic<bool> has_mmio_access_sites_ = {false};
+
   Irql irql_;
 };
 
@@ -50,6 +50,8 @@ TestModule::TestModule(Processor* processor, const std::string_view name,
   compiler_->AddPass(std::make_unique<passes::SimplificationPass>());
   // compiler_->AddPass(std::make_unique<passes::DeadStoreEliminationPass>());
   compiler_->AddPass(std::make_unique<passes::DeadCodeEliminationPass>());
+  compiler_->AddPass(std::make_unique<passes::ControlFlowAnalysisPass>());
+  compiler_->AddPass(std::make_unique<passes::DataFlowAnalysisPass>());
 
   //// Removes all unneeded variables. Try not to add new ones after this.
   // compiler_->AddPass(new passes::ValueReductionPass());
@@ -58,7 +60,7 @@ TestModule::TestModule(Processor* processor, const std::string_view name,
   // Will modify the HIR to add loads/stores.
   // This should be the last pass before finalization, as after this all
   // registers are assigned and ready to be emitted.
-  compiler_->AddPass(std::make_unique<passes::RegisterAllocationPass>(
+  compiler_->AddPass(std::make_unique<passes::LinearScanAllocationPass>(
       processor->backend()->machine_info()));
 
   // Must come last. The HIR is not really HIR after this.
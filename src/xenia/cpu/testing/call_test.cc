@@ -0,0 +1,117 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2020 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <chrono>
+#include <cstdio>
+
+#include "xenia/cpu/testing/util.h"
+#include "xenia/cpu/thread_state.h"
+
+using namespace xe::cpu::hir;
+using namespace xe::cpu;
+using namespace xe::cpu::testing;
+using xe::cpu::ppc::PPCContext;
+
+namespace {
+
+constexpr uint32_t kCallerAddress = 0x80000000;
+constexpr uint32_t kCalleeAddress = 0x80001000;
+
+// A caller calling a callee r4 times in a loop, with the callee incrementing
+// r3 on every call.
+class CallLoop {
+ public:
+  CallLoop() {
+    memory_.reset(new Memory());
+    memory_->Initialize();
+
+    processor_ = std::make_unique<Processor>(memory_.get(), nullptr);
+    processor_->Setup(std::make_unique<backend::x64::X64Backend>());
+    processor_->AddModule(std::make_unique<TestModule>(
+        processor_.get(), "Callee",
+        [](uint32_t address) { return address == kCalleeAddress; },
+        [](HIRBuilder& b) {
+          StoreGPR(b, 3, b.Add(LoadGPR(b, 3), b.LoadConstantUint64(1)));
+          b.Return();
+          return true;
+        }));
+    Processor* processor = processor_.get();
+    processor_->AddModule(std::make_unique<TestModule>(
+        processor_.get(), "Caller",
+        [](uint32_t address) { return address == kCallerAddress; },
+        [processor](HIRBuilder& b) {
+          auto loop_label = b.NewLabel();
+          b.MarkLabel(loop_label);
+          b.SetReturnAddress(b.LoadConstantUint64(kCallerAddress + 4));
+          b.Call(processor->LookupFunction(kCalleeAddress));
+          auto remaining = b.Sub(LoadGPR(b, 4), b.LoadConstantUint64(1));
+          StoreGPR(b, 4, remaining);
+          b.BranchTrue(b.CompareNE(remaining, b.LoadZeroInt64()), loop_label);
+          b.Return();
+          return true;
+        }));
+    processor_->backend()->CommitExecutableRange(0x80000000, 0x80010000);
+    thread_state_ = std::make_unique<ThreadState>(processor_.get(), 0x100);
+  }
+
+  ~CallLoop() {
+    thread_state_.reset();
+    processor_.reset();
+    memory_.reset();
+  }
+
+  uint64_t Run(uint64_t call_count) {
+    auto fn = processor_->ResolveFunction(kCallerAddress);
+    auto ctx = thread_state_->context();
+    ctx->lr = 0xBCBCBCBC;
+    ctx->r[3] = 0;
+    ctx->r[4] = call_count;
+    fn->Call(thread_state_.get(), uint32_t(ctx->lr));
+    return ctx->r[3];
+  }
+
+ private:
+  std::unique_ptr<Memory> memory_;
+  std::unique_ptr<Processor> processor_;
+  std::unique_ptr<ThreadState> thread_state_;
+};
+
+}  // namespace
+
+TEST_CASE("CALL_LINKED", "[call]") {
+  bool link_guest_calls = cvars::link_guest_calls;
+  for (bool link : {false, true}) {
+    cvars::link_guest_calls = link;
+    CallLoop call_loop;
+    REQUIRE(call_loop.Run(1) == 1);
+    REQUIRE(call_loop.Run(1000) == 1000);
+  }
+  cvars::link_guest_calls = link_guest_calls;
+}
+
+// Not run by default - reports the cost of guest to guest calls going through
+// the indirection table versus linked direct calls.
+TEST_CASE("CALL_LINKED_BENCHMARK", "[.][call][benchmark]") {
+  const uint64_t kCallCount = 100000000;
+  bool link_guest_calls = cvars::link_guest_calls;
+  for (bool link : {false, true}) {
+    cvars::link_guest_calls = link;
+    CallLoop call_loop;
+    // Warm up and compile.
+    call_loop.Run(1);
+    auto start = std::chrono::steady_clock::now();
+    REQUIRE(call_loop.Run(kCallCount) == kCallCount);
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    std::printf("%s calls: %.2f ns/call\n", link ? "Linked" : "Indirect",
+                seconds * 1e9 / double(kCallCount));
+  }
+  cvars::link_guest_calls = link_guest_calls;
+}
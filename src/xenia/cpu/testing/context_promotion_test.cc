@@ -0,0 +1,114 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2020 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/testing/util.h"
+
+using namespace xe::cpu::hir;
+using namespace xe::cpu;
+using namespace xe::cpu::testing;
+using xe::cpu::ppc::PPCContext;
+
+TEST_CASE("CONTEXT_PROMOTION_BRANCHES", "[context]") {
+  TestFunction test([](HIRBuilder& b) {
+    StoreGPR(b, 3, b.Add(LoadGPR(b, 4), LoadGPR(b, 5)));
+    auto else_label = b.NewLabel();
+    auto end_label = b.NewLabel();
+    b.BranchTrue(b.CompareEQ(LoadGPR(b, 6), b.LoadZeroInt64()), else_label);
+    StoreGPR(b, 3, b.Add(LoadGPR(b, 3), b.LoadConstantUint64(1)));
+    b.Branch(end_label);
+    b.MarkLabel(else_label);
+    StoreGPR(b, 7, LoadGPR(b, 3));
+    b.MarkLabel(end_label);
+    StoreGPR(b, 4, b.Add(LoadGPR(b, 3), LoadGPR(b, 4)));
+    b.Return();
+  });
+  test.Run(
+      [](PPCContext* ctx) {
+        ctx->r[4] = 1;
+        ctx->r[5] = 2;
+        ctx->r[6] = 1;
+        ctx->r[7] = 0;
+      },
+      [](PPCContext* ctx) {
+        REQUIRE(ctx->r[3] == 4);
+        REQUIRE(ctx->r[4] == 5);
+        REQUIRE(ctx->r[7] == 0);
+      });
+  test.Run(
+      [](PPCContext* ctx) {
+        ctx->r[4] = 1;
+        ctx->r[5] = 2;
+        ctx->r[6] = 0;
+        ctx->r[7] = 0;
+      },
+      [](PPCContext* ctx) {
+        REQUIRE(ctx->r[3] == 3);
+        REQUIRE(ctx->r[4] == 4);
+        REQUIRE(ctx->r[7] == 3);
+      });
+}
+
+TEST_CASE("CONTEXT_PROMOTION_LOOP", "[context]") {
+  TestFunction test([](HIRBuilder& b) {
+    auto loop_label = b.NewLabel();
+    b.MarkLabel(loop_label);
+    StoreGPR(b, 3, b.Add(LoadGPR(b, 3), LoadGPR(b, 5)));
+    auto remaining = b.Sub(LoadGPR(b, 4), b.LoadConstantUint64(1));
+    StoreGPR(b, 4, remaining);
+    b.BranchTrue(b.CompareNE(remaining, b.LoadZeroInt64()), loop_label);
+    StoreGPR(b, 6, LoadGPR(b, 3));
+    b.Return();
+  });
+  test.Run(
+      [](PPCContext* ctx) {
+        ctx->r[3] = 0;
+        ctx->r[4] = 10;
+        ctx->r[5] = 3;
+        ctx->r[6] = 0;
+      },
+      [](PPCContext* ctx) {
+        REQUIRE(ctx->r[3] == 30);
+        REQUIRE(ctx->r[4] == 0);
+        REQUIRE(ctx->r[6] == 30);
+      });
+}
+
+TEST_CASE("CONTEXT_DEAD_STORES", "[context]") {
+  // The first store to r3 is overwritten on both paths, but one of them reads
+  // it first.
+  TestFunction test([](HIRBuilder& b) {
+    StoreGPR(b, 3, b.LoadConstantUint64(1));
+    auto skip_label = b.NewLabel();
+    b.BranchTrue(b.CompareEQ(LoadGPR(b, 4), b.LoadZeroInt64()), skip_label);
+    StoreGPR(b, 5, LoadGPR(b, 3));
+    b.MarkLabel(skip_label);
+    StoreGPR(b, 3, b.LoadConstantUint64(2));
+    b.Return();
+  });
+  test.Run(
+      [](PPCContext* ctx) {
+        ctx->r[3] = 0;
+        ctx->r[4] = 1;
+        ctx->r[5] = 99;
+      },
+      [](PPCContext* ctx) {
+        REQUIRE(ctx->r[3] == 2);
+        REQUIRE(ctx->r[5] == 1);
+      });
+  test.Run(
+      [](PPCContext* ctx) {
+        ctx->r[3] = 0;
+        ctx->r[4] = 0;
+        ctx->r[5] = 99;
+      },
+      [](PPCContext* ctx) {
+        REQUIRE(ctx->r[3] == 2);
+        REQUIRE(ctx->r[5] == 99);
+      });
+}
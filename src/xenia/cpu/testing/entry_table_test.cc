@@ -0,0 +1,143 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2020 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "xenia/cpu/entry_table.h"
+
+#include "third_party/catch/single_include/catch.hpp"
+
+namespace xe {
+namespace cpu {
+namespace test {
+
+// Entries are only compared, never called.
+static Function* FakeFunction(uint32_t address) {
+  return reinterpret_cast<Function*>(uintptr_t(address));
+}
+
+// Does what Processor::ResolveFunction does with a new entry.
+static Entry* Resolve(EntryTable& table, uint32_t address,
+                      std::atomic<uint32_t>* created_count = nullptr) {
+  Entry* entry;
+  Entry::Status status = table.GetOrCreate(address, &entry);
+  if (status == Entry::STATUS_NEW) {
+    if (created_count) {
+      created_count->fetch_add(1, std::memory_order_relaxed);
+    }
+    entry->function = FakeFunction(address);
+    entry->end_address = address + 0x10;
+    entry->status.store(Entry::STATUS_READY, std::memory_order_release);
+  }
+  return entry;
+}
+
+TEST_CASE("ENTRY_TABLE_GET_OR_CREATE", "[entry_table]") {
+  EntryTable table;
+  for (uint32_t address : {0x82000000u, 0x9FFFFFFCu, 0x00001000u}) {
+    REQUIRE(table.Get(address) == nullptr);
+    Entry* entry;
+    REQUIRE(table.GetOrCreate(address, &entry) == Entry::STATUS_NEW);
+    REQUIRE(entry->address == address);
+    // Not visible to Get until ready.
+    REQUIRE(table.Get(address) == nullptr);
+    entry->function = FakeFunction(address);
+    entry->end_address = address + 0x10;
+    entry->status.store(Entry::STATUS_READY, std::memory_order_release);
+    REQUIRE(table.Get(address) == entry);
+    Entry* existing_entry;
+    REQUIRE(table.GetOrCreate(address, &existing_entry) ==
+            Entry::STATUS_READY);
+    REQUIRE(existing_entry == entry);
+  }
+  auto functions = table.FindWithAddress(0x82000008);
+  REQUIRE(functions.size() == 1);
+  REQUIRE(functions[0] == FakeFunction(0x82000000));
+}
+
+TEST_CASE("ENTRY_TABLE_CONCURRENT_CREATE", "[entry_table]") {
+  EntryTable table;
+  const uint32_t kFunctionCount = 4096;
+  std::atomic<uint32_t> created_count(0);
+  // Catch assertions aren't thread-safe.
+  std::atomic<uint32_t> failures(0);
+  std::vector<std::thread> threads;
+  for (uint32_t i = 0; i < 8; ++i) {
+    threads.emplace_back([&, i]() {
+      // Different starting points so threads collide on different entries.
+      for (uint32_t j = 0; j < kFunctionCount; ++j) {
+        uint32_t address =
+            0x82000000 + ((j + i * 512) % kFunctionCount) * 0x40;
+        Entry* entry = Resolve(table, address, &created_count);
+        if (entry->status.load() != Entry::STATUS_READY ||
+            entry->function != FakeFunction(address)) {
+          failures.fetch_add(1, std::memory_order_relaxed);
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  REQUIRE(failures.load() == 0);
+  REQUIRE(created_count.load() == kFunctionCount);
+}
+
+// Not run by default - reports how resolving already compiled functions scales
+// with the number of guest threads doing it at once.
+TEST_CASE("ENTRY_TABLE_RESOLVE_BENCHMARK", "[.][entry_table][benchmark]") {
+  EntryTable table;
+  const uint32_t kFunctionCount = 16384;
+  const uint32_t kResolvesPerThread = 4 * 1024 * 1024;
+  std::vector<uint32_t> addresses;
+  // Spread over the typical title code range, a few KB apart.
+  for (uint32_t i = 0; i < kFunctionCount; ++i) {
+    addresses.push_back(0x82000000 + i * 0x1A4);
+    Resolve(table, addresses.back());
+  }
+
+  uint32_t max_thread_count =
+      std::max(std::thread::hardware_concurrency(), 1u) * 2;
+  for (uint32_t thread_count = 1; thread_count <= max_thread_count;
+       thread_count *= 2) {
+    std::atomic<uint32_t> failures(0);
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < thread_count; ++i) {
+      threads.emplace_back([&, i]() {
+        uint32_t index = i * 7919;
+        for (uint32_t j = 0; j < kResolvesPerThread; ++j) {
+          index = (index + 40503) % kFunctionCount;
+          if (Resolve(table, addresses[index])->function !=
+              FakeFunction(addresses[index])) {
+            failures.fetch_add(1, std::memory_order_relaxed);
+          }
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    REQUIRE(failures.load() == 0);
+    std::printf("%u threads: %.1f M resolves/s\n", thread_count,
+                double(kResolvesPerThread) * thread_count / seconds / 1e6);
+  }
+}
+
+}  // namespace test
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,127 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2020 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <algorithm>
+
+#include "xenia/cpu/testing/util.h"
+
+using namespace xe;
+using namespace xe::cpu::hir;
+using namespace xe::cpu;
+using namespace xe::cpu::testing;
+using xe::cpu::ppc::PPCContext;
+
+// More values are live at once than there are registers, so some of them
+// have to be spilled and reloaded.
+TEST_CASE("REGISTER_PRESSURE_GPR", "[regalloc]") {
+  TestFunction test([](HIRBuilder& b) {
+    Value* values[24];
+    for (int i = 0; i < 24; ++i) {
+      values[i] = LoadGPR(b, 3 + i);
+    }
+    Value* sum = b.LoadZeroInt64();
+    for (int i = 23; i >= 0; --i) {
+      sum = b.Add(sum, b.Mul(values[i], b.LoadConstantUint64(i + 1)));
+    }
+    StoreGPR(b, 3, sum);
+    b.Return();
+  });
+  test.Run(
+      [](PPCContext* ctx) {
+        for (int i = 0; i < 24; ++i) {
+          ctx->r[3 + i] = 100 + i;
+        }
+      },
+      [](PPCContext* ctx) {
+        uint64_t expected = 0;
+        for (int i = 0; i < 24; ++i) {
+          expected += (100 + i) * (i + 1);
+        }
+        REQUIRE(ctx->r[3] == expected);
+        REQUIRE(ctx->r[4] == 101);
+        REQUIRE(ctx->r[26] == 123);
+      });
+}
+
+TEST_CASE("REGISTER_PRESSURE_VEC", "[regalloc]") {
+  TestFunction test([](HIRBuilder& b) {
+    Value* values[20];
+    for (int i = 0; i < 20; ++i) {
+      values[i] = LoadVR(b, 3 + i);
+    }
+    // Use every value twice, far apart, so they stay live across spills.
+    Value* sum = b.LoadZeroVec128();
+    for (int i = 19; i >= 0; --i) {
+      sum = b.VectorAdd(sum, values[i], INT32_TYPE);
+    }
+    for (int i = 0; i < 20; ++i) {
+      sum = b.Xor(sum, values[i]);
+    }
+    StoreVR(b, 3, sum);
+    b.Return();
+  });
+  test.Run(
+      [](PPCContext* ctx) {
+        for (int i = 0; i < 20; ++i) {
+          ctx->v[3 + i] = vec128i(i, i * 2, i * 3, i * 4);
+        }
+      },
+      [](PPCContext* ctx) {
+        vec128_t expected = vec128i(0);
+        for (int i = 0; i < 20; ++i) {
+          for (int j = 0; j < 4; ++j) {
+            expected.u32[j] += i * (j + 1);
+          }
+        }
+        for (int i = 0; i < 20; ++i) {
+          for (int j = 0; j < 4; ++j) {
+            expected.u32[j] ^= i * (j + 1);
+          }
+        }
+        REQUIRE(ctx->v[3] == expected);
+      });
+}
+
+// Instructions with multiple sources under pressure must keep all of their
+// sources intact when something has to be spilled to allocate the result.
+TEST_CASE("REGISTER_PRESSURE_MULTIPLE_SOURCES", "[regalloc]") {
+  TestFunction test([](HIRBuilder& b) {
+    Value* values[24];
+    for (int i = 0; i < 24; ++i) {
+      values[i] = LoadGPR(b, 3 + i);
+    }
+    Value* sum = b.LoadZeroInt64();
+    for (int i = 0; i < 24; ++i) {
+      Value* other = values[(i + 1) % 24];
+      sum = b.Add(sum, b.Select(b.CompareUGT(values[i], other), values[i],
+                                other));
+    }
+    for (int i = 0; i < 24; ++i) {
+      sum = b.Add(sum, values[i]);
+    }
+    StoreGPR(b, 3, sum);
+    b.Return();
+  });
+  test.Run(
+      [](PPCContext* ctx) {
+        for (int i = 0; i < 24; ++i) {
+          ctx->r[3 + i] = 100 + i;
+        }
+      },
+      [](PPCContext* ctx) {
+        uint64_t expected = 0;
+        for (int i = 0; i < 24; ++i) {
+          expected += std::max(100 + i, 100 + (i + 1) % 24);
+        }
+        for (int i = 0; i < 24; ++i) {
+          expected += 100 + i;
+        }
+        REQUIRE(ctx->r[3] == expected);
+      });
+}
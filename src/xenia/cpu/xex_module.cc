@@ -17,6 +17,7 @@
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/base/memory.h"
+#include "xenia/base/xxhash.h"
 #include "xenia/cpu/cpu_flags.h"
 #include "xenia/cpu/export_resolver.h"
 #include "xenia/cpu/lzx.h"
@@ -1056,6 +1057,17 @@ bool XexModule::LoadContinue() {
     }
   }
 
+  // Identify the final code for caching of the translated functions.
+  XXH3_state_t hash_state;
+  XXH3_64bits_reset(&hash_state);
+  XXH3_64bits_update(&hash_state, xex_header_mem_.data(),
+                     xex_header_mem_.size());
+  if (high_address_ > low_address_) {
+    XXH3_64bits_update(&hash_state, memory()->TranslateVirtual(low_address_),
+                       high_address_ - low_address_);
+  }
+  module_hash_ = XXH3_64bits_digest(&hash_state);
+
   // Setup memory protection.
   for (uint32_t i = 0, page = 0; i < sec_header->page_descriptor_count; i++) {
     // Byteswap the bitfield manually.
@@ -1277,6 +1289,65 @@ bool XexModule::SetupLibraryImports(const std::string_view name,
   return true;
 }
 
+std::vector<uint32_t> XexModule::FindFunctionStarts() {
+  std::vector<uint32_t> function_starts;
+
+  // Data in the code sections may decode as calls to anywhere in the image, so
+  // only take addresses in the code sections.
+  auto is_code_address = [this](uint32_t address) {
+    for (const PESection& section : pe_sections_) {
+      if ((section.flags & kXEPESectionContainsCode) &&
+          address >= section.address &&
+          address - section.address < section.size) {
+        return true;
+      }
+    }
+    return false;
+  };
+
+  // Every non-leaf function has an entry in the exception directory, with the
+  // begin address in the first word and the packed lengths in the second.
+  const PESection* pdata = GetPESection(".pdata");
+  if (pdata) {
+    auto entries = memory()->TranslateVirtual<const xe::be<uint32_t>*>(
+        pdata->address);
+    for (uint32_t i = 0; i + 1 < pdata->size / sizeof(uint32_t); i += 2) {
+      uint32_t address = entries[i];
+      if (!(address & 3) && is_code_address(address)) {
+        function_starts.push_back(address);
+      }
+    }
+  }
+
+  // Leaf functions are only discoverable through the calls to them.
+  for (const PESection& section : pe_sections_) {
+    if (!(section.flags & kXEPESectionContainsCode)) {
+      continue;
+    }
+    auto code = memory()->TranslateVirtual<const xe::be<uint32_t>*>(
+        section.address);
+    for (uint32_t i = 0; i < section.size / sizeof(uint32_t); ++i) {
+      uint32_t instruction = code[i];
+      // bl - not bla or a plain branch.
+      if ((instruction & 0xFC000003) != 0x48000001) {
+        continue;
+      }
+      int32_t offset = int32_t(instruction & 0x03FFFFFC) << 6 >> 6;
+      uint32_t address =
+          section.address + i * uint32_t(sizeof(uint32_t)) + offset;
+      if (is_code_address(address)) {
+        function_starts.push_back(address);
+      }
+    }
+  }
+
+  std::sort(function_starts.begin(), function_starts.end());
+  function_starts.erase(
+      std::unique(function_starts.begin(), function_starts.end()),
+      function_starts.end());
+  return function_starts;
+}
+
 bool XexModule::ContainsAddress(uint32_t address) {
   return address >= low_address_ && address < high_address_;
 }
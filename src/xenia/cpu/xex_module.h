@@ -104,6 +104,8 @@ class XexModule : public xe::cpu::Module {
   }
 
   const uint32_t base_address() const { return base_address_; }
+  // Hash of the headers and the code of the loaded (and patched) module.
+  uint64_t module_hash() const { return module_hash_; }
   const bool is_dev_kit() const { return is_dev_kit_; }
 
   // Gets an optional header. Returns NULL if not found.
@@ -131,6 +133,11 @@ class XexModule : public xe::cpu::Module {
 
   const PESection* GetPESection(const char* name);
 
+  // Gathers the addresses of the functions in the module that can be found
+  // statically - from the exception directory (.pdata) and the targets of
+  // relative calls in the code sections. Must be called after LoadContinue.
+  std::vector<uint32_t> FindFunctionStarts();
+
   uint32_t GetProcAddress(uint16_t ordinal) const;
   uint32_t GetProcAddress(const std::string_view name) const;
 
@@ -203,6 +210,7 @@ class XexModule : public xe::cpu::Module {
   uint32_t base_address_ = 0;
   uint32_t low_address_ = 0;
   uint32_t high_address_ = 0;
+  uint64_t module_hash_ = 0;
 
   XexFormat xex_format_ = kFormatUnknown;
   SecurityInfoContext security_info_ = {};
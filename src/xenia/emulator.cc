@@ -9,6 +9,7 @@
 
 #include "xenia/emulator.h"
 
+#include <chrono>
 #include <cinttypes>
 
 #include "config.h"
@@ -54,6 +55,14 @@ DEFINE_string(
     "or the module specified by the game. Leave blank to launch the default "
     "module.",
     "General");
+DEFINE_bool(save_state_in_background, true,
+            "Only pause the emulation while copying the changed guest memory "
+            "when saving a state, and compress and write the file in the "
+            "background. Keeps a copy of the committed guest memory between "
+            "saves.",
+            "General");
+DEFINE_int32(rewind_capacity, 8,
+             "Number of in-memory save states kept for rewinding.", "General");
 
 namespace xe {
 
@@ -84,6 +93,8 @@ Emulator::Emulator(const std::filesystem::path& command_line,
       restore_fence_() {}
 
 Emulator::~Emulator() {
+  WaitForBackgroundSave();
+
   // Note that we delete things in the reverse order they were initialized.
 
   // Give the systems time to shutdown before we delete them.
@@ -331,7 +342,9 @@ X_STATUS Emulator::LaunchStfsContainer(const std::filesystem::path& path) {
   auto mount_path = "\\Device\\Cdrom0";
 
   // Register the container in the virtual filesystem.
-  auto device = std::make_unique<vfs::StfsContainerDevice>(mount_path, path);
+  auto device = std::make_unique<vfs::StfsContainerDevice>(
+      mount_path, path,
+      cache_root_.empty() ? std::filesystem::path() : cache_root_ / "stfs");
   if (!device->Initialize()) {
     xe::FatalError(
         "Unable to mount STFS container; file not found or corrupt.");
@@ -406,41 +419,20 @@ void Emulator::Resume() {
   }
 }
 
-bool Emulator::SaveToFile(const std::filesystem::path& path) {
-  Pause();
-
-  filesystem::CreateFile(path);
-  auto map = MappedMemory::Open(path, MappedMemory::Mode::kReadWrite, 0,
-                                1024ull * 1024ull * 1024ull * 2ull);
-  if (!map) {
-    return false;
-  }
-
-  // Save the emulator state to a file
-  ByteStream stream(map->data(), map->size());
-  stream.Write('XSAV');
-  stream.Write(title_id_);
+void Emulator::SaveState(ByteStream* stream) {
+  stream->Write('XSAV');
+  stream->Write(title_id_);
 
   // It's important we don't hold the global lock here! XThreads need to step
   // forward (possibly through guarded regions) without worry!
-  processor_->Save(&stream);
-  graphics_system_->Save(&stream);
-  audio_system_->Save(&stream);
-  kernel_state_->Save(&stream);
-  memory_->Save(&stream);
-  map->Close(stream.offset());
-
-  Resume();
-  return true;
+  processor_->Save(stream);
+  graphics_system_->Save(stream);
+  audio_system_->Save(stream);
+  kernel_state_->Save(stream);
 }
 
-bool Emulator::RestoreFromFile(const std::filesystem::path& path) {
-  // Restore the emulator state from a file
-  auto map = MappedMemory::Open(path, MappedMemory::Mode::kReadWrite);
-  if (!map) {
-    return false;
-  }
-
+bool Emulator::RestoreState(ByteStream* stream,
+                            const Memory::Snapshot* memory_snapshot) {
   restoring_ = true;
 
   // Terminate any loaded titles.
@@ -448,35 +440,35 @@ bool Emulator::RestoreFromFile(const std::filesystem::path& path) {
   kernel_state_->TerminateTitle();
 
   auto lock = global_critical_region::AcquireDirect();
-  ByteStream stream(map->data(), map->size());
-  if (stream.Read<uint32_t>() != 'XSAV') {
+  if (stream->Read<uint32_t>() != 'XSAV') {
     return false;
   }
 
-  auto title_id = stream.Read<uint32_t>();
+  auto title_id = stream->Read<uint32_t>();
   if (title_id != title_id_) {
     // Swapping between titles is unsupported at the moment.
     assert_always();
     return false;
   }
 
-  if (!processor_->Restore(&stream)) {
+  if (!processor_->Restore(stream)) {
     XELOGE("Could not restore processor!");
     return false;
   }
-  if (!graphics_system_->Restore(&stream)) {
+  if (!graphics_system_->Restore(stream)) {
     XELOGE("Could not restore graphics system!");
     return false;
   }
-  if (!audio_system_->Restore(&stream)) {
+  if (!audio_system_->Restore(stream)) {
     XELOGE("Could not restore audio system!");
     return false;
   }
-  if (!kernel_state_->Restore(&stream)) {
+  if (!kernel_state_->Restore(stream)) {
     XELOGE("Could not restore kernel state!");
     return false;
   }
-  if (!memory_->Restore(&stream)) {
+  if (memory_snapshot ? !memory_->RestoreSnapshot(*memory_snapshot)
+                      : !memory_->Restore(stream)) {
     XELOGE("Could not restore memory!");
     return false;
   }
@@ -499,6 +491,173 @@ bool Emulator::RestoreFromFile(const std::filesystem::path& path) {
   return true;
 }
 
+bool Emulator::WriteStateFile(const std::filesystem::path& path,
+                              const uint8_t* state, size_t state_size,
+                              const Memory::Snapshot* memory_snapshot) {
+  auto start = std::chrono::steady_clock::now();
+
+  filesystem::CreateFile(path);
+  auto map = MappedMemory::Open(path, MappedMemory::Mode::kReadWrite, 0,
+                                1024ull * 1024ull * 1024ull * 2ull);
+  if (!map) {
+    return false;
+  }
+
+  // Save the emulator state to a file
+  ByteStream stream(map->data(), map->size());
+  stream.Write(state, state_size);
+  bool memory_saved = memory_snapshot
+                          ? memory_->SaveSnapshot(*memory_snapshot, &stream)
+                          : memory_->Save(&stream);
+  map->Close(stream.offset());
+
+  if (!memory_saved) {
+    XELOGE("Could not save memory!");
+    return false;
+  }
+  XELOGI("Saved state to {}: {} bytes in {:.3f} ms", xe::path_to_utf8(path),
+         stream.offset(),
+         std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+             .count());
+  return true;
+}
+
+bool Emulator::SaveToFile(const std::filesystem::path& path) {
+  // The previous background save may still be reading the memory snapshot.
+  WaitForBackgroundSave();
+
+  Pause();
+  auto start = std::chrono::steady_clock::now();
+
+  if (state_scratch_.empty()) {
+    state_scratch_.resize(kStateScratchSize);
+  }
+  ByteStream stream(state_scratch_.data(), state_scratch_.size());
+  SaveState(&stream);
+
+  if (!cvars::save_state_in_background) {
+    bool saved = WriteStateFile(path, state_scratch_.data(), stream.offset(),
+                                nullptr);
+    Resume();
+    on_state_saved(path, saved);
+    return saved;
+  }
+
+  // Copy the changed guest memory while paused, and compress and write it
+  // while the emulation goes on.
+  save_state_.assign(state_scratch_.data(),
+                     state_scratch_.data() + stream.offset());
+  Memory::SnapshotDelta replaced_pages;
+  memory_->CaptureSnapshot(save_memory_, replaced_pages);
+  Resume();
+  XELOGI("Captured state for {}: {} changed pages, paused for {:.3f} ms",
+         xe::path_to_utf8(path), replaced_pages.page_count(),
+         std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+             .count());
+
+  save_thread_ = threading::Thread::Create({}, [this, path]() {
+    bool saved = WriteStateFile(path, save_state_.data(), save_state_.size(),
+                                &save_memory_);
+    on_state_saved(path, saved);
+  });
+  save_thread_->set_name("Save State Writer");
+  return true;
+}
+
+void Emulator::WaitForBackgroundSave() {
+  if (save_thread_) {
+    threading::Wait(save_thread_.get(), false);
+    save_thread_.reset();
+  }
+}
+
+bool Emulator::RestoreFromFile(const std::filesystem::path& path) {
+  // The file may still be being written in the background.
+  WaitForBackgroundSave();
+
+  // Restore the emulator state from a file
+  auto map = MappedMemory::Open(path, MappedMemory::Mode::kReadWrite);
+  if (!map) {
+    return false;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  ByteStream stream(map->data(), map->size());
+  if (!RestoreState(&stream, nullptr)) {
+    return false;
+  }
+  XELOGI("Restored state from {}: {} bytes in {:.3f} ms",
+         xe::path_to_utf8(path), stream.offset(),
+         std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+             .count());
+
+  return true;
+}
+
+bool Emulator::SaveRewindState() {
+  if (cvars::rewind_capacity <= 0) {
+    return false;
+  }
+  Pause();
+  auto start = std::chrono::steady_clock::now();
+
+  // Everything but the guest memory is small, serialize it in full.
+  if (state_scratch_.empty()) {
+    state_scratch_.resize(kStateScratchSize);
+  }
+  ByteStream stream(state_scratch_.data(), state_scratch_.size());
+  SaveState(&stream);
+  RewindState state;
+  state.state.assign(state_scratch_.data(),
+                     state_scratch_.data() + stream.offset());
+
+  // The pages changed since the previous state let going back to it.
+  Memory::SnapshotDelta initial_delta;
+  Memory::SnapshotDelta& delta = rewind_states_.empty()
+                                     ? initial_delta
+                                     : rewind_states_.back().memory_delta;
+  memory_->CaptureSnapshot(rewind_memory_, delta);
+  rewind_states_.push_back(std::move(state));
+  while (rewind_states_.size() > size_t(cvars::rewind_capacity)) {
+    rewind_states_.pop_front();
+  }
+
+  XELOGI("Saved rewind state {}: {} changed pages ({} bytes) in {:.3f} ms",
+         rewind_states_.size(), delta.page_count(), delta.data_size(),
+         std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+             .count());
+
+  Resume();
+  return true;
+}
+
+bool Emulator::Rewind(size_t steps) {
+  if (steps >= rewind_states_.size()) {
+    return false;
+  }
+  auto start = std::chrono::steady_clock::now();
+
+  for (size_t i = 0; i < steps; ++i) {
+    rewind_states_.pop_back();
+    rewind_states_.back().memory_delta.Undo(rewind_memory_);
+  }
+  RewindState& state = rewind_states_.back();
+  ByteStream stream(state.state.data(), state.state.size());
+  if (!RestoreState(&stream, &rewind_memory_)) {
+    return false;
+  }
+  XELOGI("Rewound {} states in {:.3f} ms", steps,
+         std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+             .count());
+
+  return true;
+}
+
 bool Emulator::TitleRequested() {
   auto xam = kernel_state()->GetKernelModule<kernel::xam::XamModule>("xam.xex");
   return xam->loader_data().launch_data_present;
@@ -686,6 +845,12 @@ X_STATUS Emulator::CompleteLaunch(const std::filesystem::path& path,
     }
   }
 
+  // Reuse the code generated for this exact executable by previous runs.
+  processor_->InitializeCodeStorage(cache_root_,
+                                    module->xex_module()->module_hash());
+  // Translate what's statically known to be code while the title starts up.
+  processor_->PrecompileFunctions(module->xex_module()->FindFunctionStarts());
+
   // Initializing the shader storage in a blocking way so the user doesn't miss
   // the initial seconds - for instance, sound from an intro video may start
   // playing before the video can be seen if doing this in parallel with the
@@ -10,8 +10,10 @@
 #ifndef XENIA_EMULATOR_H_
 #define XENIA_EMULATOR_H_
 
+#include <deque>
 #include <functional>
 #include <string>
+#include <vector>
 
 #include "xenia/base/delegate.h"
 #include "xenia/base/exception_handler.h"
@@ -143,9 +145,21 @@ class Emulator {
   void Resume();
   bool is_paused() const { return paused_; }
 
+  // Returns false if the state couldn't be saved. With
+  // save_state_in_background, the file is written after returning, and
+  // whether that succeeded is only reported through on_state_saved.
   bool SaveToFile(const std::filesystem::path& path);
   bool RestoreFromFile(const std::filesystem::path& path);
 
+  // Takes an in-memory save state for Rewind. Guest memory is stored as the
+  // pages changed since the previous state, and only the last rewind_capacity
+  // states are kept.
+  bool SaveRewindState();
+  size_t rewind_state_count() const { return rewind_states_.size(); }
+  // Restores the in-memory save state taken the given number of states before
+  // the newest one, discarding the newer states.
+  bool Rewind(size_t steps);
+
   // The game can request another title to be loaded.
   bool TitleRequested();
   void LaunchNextTitle();
@@ -155,6 +169,9 @@ class Emulator {
  public:
   xe::Delegate<uint32_t, const std::string_view> on_launch;
   xe::Delegate<bool> on_shader_storage_initialization;
+  // Called with whether the state file was written, on the writer thread for
+  // background saves.
+  xe::Delegate<const std::filesystem::path&, bool> on_state_saved;
   xe::Delegate<> on_terminate;
   xe::Delegate<> on_exit;
 
@@ -164,6 +181,18 @@ class Emulator {
 
   std::string FindLaunchModule();
 
+  // Writes or reads everything but the guest memory.
+  void SaveState(ByteStream* stream);
+  // Writes a save state file from the output of SaveState and either the
+  // snapshot or, if it's null, the live guest memory.
+  bool WriteStateFile(const std::filesystem::path& path, const uint8_t* state,
+                      size_t state_size,
+                      const Memory::Snapshot* memory_snapshot);
+  void WaitForBackgroundSave();
+  // Takes the guest memory from the stream if memory_snapshot is null.
+  bool RestoreState(ByteStream* stream,
+                    const Memory::Snapshot* memory_snapshot);
+
   X_STATUS CompleteLaunch(const std::filesystem::path& path,
                           const std::string_view module_path);
 
@@ -193,6 +222,26 @@ class Emulator {
   bool paused_;
   bool restoring_;
   threading::Fence restore_fence_;  // Fired on restore finish.
+
+  struct RewindState {
+    // Everything but the guest memory, as written by SaveState.
+    std::vector<uint8_t> state;
+    // Pages taking the guest memory of the next newer state back to this one.
+    Memory::SnapshotDelta memory_delta;
+  };
+  // Oldest first.
+  std::deque<RewindState> rewind_states_;
+  // Guest memory of the newest rewind state.
+  Memory::Snapshot rewind_memory_;
+
+  // Space for serializing the state other than the guest memory.
+  static constexpr size_t kStateScratchSize = 16 * 1024 * 1024;
+  std::vector<uint8_t> state_scratch_;
+
+  // State being written by save_thread_ when saving in the background.
+  std::unique_ptr<threading::Thread> save_thread_;
+  std::vector<uint8_t> save_state_;
+  Memory::Snapshot save_memory_;
 };
 
 }  // namespace xe
@@ -141,7 +141,10 @@ void CommandProcessor::CallInThread(std::function<void()> fn) {
 void CommandProcessor::ClearCaches() {}
 
 void CommandProcessor::WorkerThreadMain() {
-  context_->MakeCurrent();
+  // Headless command processors have no context.
+  if (context_) {
+    context_->MakeCurrent();
+  }
   if (!SetupContext()) {
     xe::FatalError("Unable to setup command processor internal state");
     return;
@@ -311,6 +314,30 @@ void CommandProcessor::WriteRegister(uint32_t index, uint32_t value) {
   }
 }
 
+void CommandProcessor::RestoreTraceRegisters(const TraceRegisterValue* values,
+                                             size_t count) {
+  RegisterFile* regs = register_file_;
+  for (size_t i = 0; i < count; ++i) {
+    uint32_t index = values[i].index;
+    if (index >= RegisterFile::kRegisterCount) {
+      continue;
+    }
+    // Writes to these act on other state, such as guest memory or the gamma
+    // ramp, and doing that again out of order would clobber it, so only their
+    // values are restored. Others go through WriteRegister for the backend to
+    // invalidate what depends on them.
+    if (index == XE_GPU_REG_COHER_STATUS_HOST ||
+        (index >= XE_GPU_REG_SCRATCH_REG0 &&
+         index <= XE_GPU_REG_SCRATCH_REG7) ||
+        index == XE_GPU_REG_DC_LUT_PWL_DATA ||
+        index == XE_GPU_REG_DC_LUT_30_COLOR) {
+      regs->values[index].u32 = values[i].value;
+      continue;
+    }
+    WriteRegister(index, values[i].value);
+  }
+}
+
 void CommandProcessor::UpdateGammaRampValue(GammaRampType type,
                                             uint32_t value) {
   RegisterFile* regs = register_file_;
@@ -144,6 +144,10 @@ class CommandProcessor {
 
   virtual void RestoreEdramSnapshot(const void* snapshot) = 0;
 
+  // Writes register values from a trace checkpoint as if the guest wrote them,
+  // except for not repeating the side effects of the writes.
+  void RestoreTraceRegisters(const TraceRegisterValue* values, size_t count);
+
   void InitializeRingBuffer(uint32_t ptr, uint32_t page_count);
   void EnableReadPointerWriteBack(uint32_t ptr, uint32_t block_size);
 
@@ -29,7 +29,7 @@ class NullCommandProcessor : public CommandProcessor {
 
   void RestoreEdramSnapshot(const void* snapshot) override;
 
- private:
+ protected:
   bool SetupContext() override;
   void ShutdownContext() override;
 
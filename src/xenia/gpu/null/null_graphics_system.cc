@@ -25,8 +25,11 @@ X_STATUS NullGraphicsSystem::Setup(cpu::Processor* processor,
                                    kernel::KernelState* kernel_state,
                                    ui::Window* target_window) {
   // This is a null graphics system, but we still setup vulkan because UI needs
-  // it through us :|
-  provider_ = xe::ui::vulkan::VulkanProvider::Create(target_window);
+  // it through us :| Without a window, nothing needs it, and the command
+  // processor runs without a context, so no GPU is required.
+  if (target_window) {
+    provider_ = xe::ui::vulkan::VulkanProvider::Create(target_window);
+  }
 
   return GraphicsSystem::Setup(processor, kernel_state, target_window);
 }
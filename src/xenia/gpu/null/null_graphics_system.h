@@ -32,7 +32,7 @@ class NullGraphicsSystem : public GraphicsSystem {
                  ui::Window* target_window) override;
   void Shutdown() override;
 
- private:
+ protected:
   std::unique_ptr<CommandProcessor> CreateCommandProcessor() override;
 
   void Swap(xe::ui::UIEvent* e) override;
@@ -0,0 +1,480 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2020 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/cvar.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/main.h"
+#include "xenia/base/platform.h"
+#include "xenia/base/string.h"
+#include "xenia/base/string_buffer.h"
+#include "xenia/base/threading.h"
+#include "xenia/base/xxhash.h"
+#include "xenia/emulator.h"
+#include "xenia/gpu/command_processor.h"
+#include "xenia/gpu/draw_util.h"
+#include "xenia/gpu/graphics_system.h"
+#include "xenia/gpu/null/null_command_processor.h"
+#include "xenia/gpu/null/null_graphics_system.h"
+#include "xenia/gpu/packet_disassembler.h"
+#include "xenia/gpu/trace_reader.h"
+#include "xenia/memory.h"
+
+#if XE_PLATFORM_WIN32
+#include "xenia/base/platform_win.h"
+// Must be after windows.h.
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif  // XE_PLATFORM_WIN32
+
+DEFINE_transient_path(trace_bench_input, "", "Trace file to play.", "GPU");
+DEFINE_int32(trace_bench_iterations, 5,
+             "Number of times to play the whole trace.", "GPU");
+DEFINE_bool(trace_bench_clear_caches, true,
+            "Clear the command processor caches before every iteration, so "
+            "shaders are loaded in each of them.",
+            "GPU");
+
+namespace xe {
+namespace gpu {
+namespace null {
+
+// Peak resident memory of the process, or 0 if unknown.
+uint64_t GetPeakResidentBytes() {
+#if XE_PLATFORM_WIN32
+  PROCESS_MEMORY_COUNTERS counters;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters,
+                            sizeof(counters))) {
+    return 0;
+  }
+  return counters.PeakWorkingSetSize;
+#else
+  rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage)) {
+    return 0;
+  }
+  // Kilobytes on Linux.
+  return uint64_t(usage.ru_maxrss) * 1024;
+#endif  // XE_PLATFORM_WIN32
+}
+
+// Null command processor that still pays the backend-independent cost of
+// loading shaders and deriving the draw state, so the benchmark measures the
+// command processor rather than an empty stub. Shaders are analyzed, but
+// nothing is translated or submitted.
+class BenchCommandProcessor : public NullCommandProcessor {
+ public:
+  using NullCommandProcessor::NullCommandProcessor;
+
+  // Counted so the derived state is used, and reported with the results.
+  uint64_t pixel_shader_draw_count() const { return pixel_shader_draw_count_; }
+  uint64_t visible_draw_count() const { return visible_draw_count_; }
+
+  void ClearCaches() override {
+    NullCommandProcessor::ClearCaches();
+    active_vertex_shader_ = nullptr;
+    active_pixel_shader_ = nullptr;
+    shaders_.clear();
+  }
+
+ protected:
+  void ShutdownContext() override {
+    shaders_.clear();
+    NullCommandProcessor::ShutdownContext();
+  }
+
+  Shader* LoadShader(xenos::ShaderType shader_type, uint32_t guest_address,
+                     const uint32_t* host_address,
+                     uint32_t dword_count) override {
+    uint64_t data_hash =
+        XXH3_64bits(host_address, dword_count * sizeof(uint32_t));
+    auto it = shaders_.find(data_hash);
+    if (it != shaders_.end()) {
+      return it->second.get();
+    }
+    auto shader = std::make_unique<Shader>(shader_type, data_hash,
+                                           host_address, dword_count);
+    Shader* shader_ptr = shader.get();
+    shaders_.emplace(data_hash, std::move(shader));
+    return shader_ptr;
+  }
+
+  bool IssueDraw(xenos::PrimitiveType prim_type, uint32_t index_count,
+                 IndexBufferInfo* index_buffer_info,
+                 bool major_mode_explicit) override {
+    const RegisterFile& regs = *register_file_;
+
+    Shader* vertex_shader = active_vertex_shader();
+    if (!vertex_shader) {
+      return false;
+    }
+    if (!vertex_shader->is_ucode_analyzed()) {
+      vertex_shader->AnalyzeUcode(ucode_disasm_buffer_);
+    }
+
+    // Tessellation is not emulated here, only reject what can't be drawn.
+    bool primitive_polygonal = xenos::IsPrimitivePolygonal(false, prim_type);
+    Shader* pixel_shader = nullptr;
+    if (draw_util::IsRasterizationPotentiallyDone(regs, primitive_polygonal) &&
+        regs.Get<reg::RB_MODECONTROL>().edram_mode ==
+            xenos::ModeControl::kColorDepth) {
+      pixel_shader = active_pixel_shader();
+      if (pixel_shader) {
+        if (!pixel_shader->is_ucode_analyzed()) {
+          pixel_shader->AnalyzeUcode(ucode_disasm_buffer_);
+        }
+        if (!draw_util::IsPixelShaderNeededWithRasterization(*pixel_shader,
+                                                             regs)) {
+          pixel_shader = nullptr;
+        }
+      }
+    }
+
+    draw_util::ViewportInfo viewport_info;
+    draw_util::GetHostViewportInfo(regs, 1.0f, 1.0f, true, 16384.0f,
+                                   16384.0f, false, false, viewport_info);
+    draw_util::Scissor scissor;
+    draw_util::GetScissor(regs, scissor);
+    if (pixel_shader) {
+      ++pixel_shader_draw_count_;
+    }
+    if (scissor.width && scissor.height) {
+      ++visible_draw_count_;
+    }
+    return true;
+  }
+
+  bool IssueCopy() override {
+    draw_util::ResolveInfo resolve_info;
+    return draw_util::GetResolveInfo(*register_file_, *memory_, trace_writer_,
+                                     1, false, resolve_info);
+  }
+
+ private:
+  std::unordered_map<uint64_t, std::unique_ptr<Shader>> shaders_;
+  StringBuffer ucode_disasm_buffer_;
+  uint64_t pixel_shader_draw_count_ = 0;
+  uint64_t visible_draw_count_ = 0;
+};
+
+class BenchGraphicsSystem : public NullGraphicsSystem {
+ protected:
+  std::unique_ptr<CommandProcessor> CreateCommandProcessor() override {
+    return std::make_unique<BenchCommandProcessor>(this, kernel_state_);
+  }
+};
+
+// Plays traces through the null command processor as fast as possible,
+// timing every packet.
+class NullTraceBench : public TraceReader {
+ public:
+  // Execution times are bucketed in powers of 4, from under 256 ns.
+  static constexpr uint32_t kHistogramBucketCount = 8;
+  static constexpr uint32_t kHistogramFirstBucketLog2 = 8;
+
+  struct PacketTypeStats {
+    uint64_t count = 0;
+    std::chrono::nanoseconds total_time{0};
+    std::array<uint64_t, kHistogramBucketCount> histogram = {};
+  };
+
+  explicit NullTraceBench(GraphicsSystem* graphics_system)
+      : graphics_system_(graphics_system),
+        playback_event_(xe::threading::Event::CreateAutoResetEvent(false)) {}
+
+  int Run(uint32_t iteration_count, bool clear_caches);
+
+ private:
+  // Returns false if the trace is malformed.
+  bool PlayOnThread(bool clear_caches);
+  void ExecutePacketOnThread(const PacketStartCommand* cmd);
+  void PrintResults(std::chrono::nanoseconds play_time,
+                    uint32_t iteration_count) const;
+
+  GraphicsSystem* graphics_system_;
+  std::unique_ptr<xe::threading::Event> playback_event_;
+  std::vector<uint8_t> edram_snapshot_;
+
+  std::map<std::string, PacketTypeStats> packet_type_stats_;
+  uint64_t packet_count_ = 0;
+  std::chrono::nanoseconds packet_time_{0};
+};
+
+int NullTraceBench::Run(uint32_t iteration_count, bool clear_caches) {
+  if (!frame_count()) {
+    XELOGE("The trace has no frames");
+    return 1;
+  }
+  auto command_processor = graphics_system_->command_processor();
+  std::chrono::nanoseconds play_time{0};
+  for (uint32_t i = 0; i < iteration_count; ++i) {
+    auto start = std::chrono::steady_clock::now();
+    bool played = false;
+    command_processor->CallInThread([this, clear_caches, &played]() {
+      played = PlayOnThread(clear_caches);
+      playback_event_->Set();
+    });
+    xe::threading::Wait(playback_event_.get(), false);
+    play_time += std::chrono::steady_clock::now() - start;
+    if (!played) {
+      return 1;
+    }
+  }
+  PrintResults(play_time, iteration_count);
+  return 0;
+}
+
+bool NullTraceBench::PlayOnThread(bool clear_caches) {
+  auto memory = graphics_system_->memory();
+  auto command_processor = graphics_system_->command_processor();
+
+  if (clear_caches) {
+    command_processor->ClearCaches();
+  }
+  command_processor->set_swap_mode(SwapMode::kIgnored);
+
+  const PacketStartCommand* pending_packet = nullptr;
+  for (int i = 0; i < frame_count(); ++i) {
+    const Frame* frame = this->frame(i);
+    const uint8_t* trace_ptr = frame->start_ptr;
+    while (trace_ptr < frame->end_ptr) {
+      auto type = static_cast<TraceCommandType>(xe::load<uint32_t>(trace_ptr));
+      switch (type) {
+        case TraceCommandType::kPrimaryBufferStart: {
+          auto cmd =
+              reinterpret_cast<const PrimaryBufferStartCommand*>(trace_ptr);
+          trace_ptr += sizeof(*cmd) + cmd->count * 4;
+          break;
+        }
+        case TraceCommandType::kPrimaryBufferEnd: {
+          trace_ptr += sizeof(PrimaryBufferEndCommand);
+          break;
+        }
+        case TraceCommandType::kIndirectBufferStart: {
+          auto cmd =
+              reinterpret_cast<const IndirectBufferStartCommand*>(trace_ptr);
+          trace_ptr += sizeof(*cmd) + cmd->count * 4;
+          break;
+        }
+        case TraceCommandType::kIndirectBufferEnd: {
+          trace_ptr += sizeof(IndirectBufferEndCommand);
+          break;
+        }
+        case TraceCommandType::kPacketStart: {
+          auto cmd = reinterpret_cast<const PacketStartCommand*>(trace_ptr);
+          trace_ptr += sizeof(*cmd);
+          std::memcpy(memory->TranslatePhysical(cmd->base_ptr), trace_ptr,
+                      cmd->count * 4);
+          trace_ptr += cmd->count * 4;
+          pending_packet = cmd;
+          break;
+        }
+        case TraceCommandType::kPacketEnd: {
+          trace_ptr += sizeof(PacketEndCommand);
+          if (pending_packet) {
+            ExecutePacketOnThread(pending_packet);
+            pending_packet = nullptr;
+          }
+          break;
+        }
+        case TraceCommandType::kMemoryRead: {
+          auto cmd = reinterpret_cast<const MemoryCommand*>(trace_ptr);
+          trace_ptr += sizeof(*cmd);
+          DecompressMemory(cmd->encoding_format, trace_ptr,
+                           cmd->encoded_length,
+                           memory->TranslatePhysical(cmd->base_ptr),
+                           cmd->decoded_length);
+          trace_ptr += cmd->encoded_length;
+          command_processor->TracePlaybackWroteMemory(cmd->base_ptr,
+                                                      cmd->decoded_length);
+          break;
+        }
+        case TraceCommandType::kMemoryWrite: {
+          auto cmd = reinterpret_cast<const MemoryCommand*>(trace_ptr);
+          trace_ptr += sizeof(*cmd) + cmd->encoded_length;
+          break;
+        }
+        case TraceCommandType::kEdramSnapshot: {
+          auto cmd = reinterpret_cast<const EdramSnapshotCommand*>(trace_ptr);
+          trace_ptr += sizeof(*cmd);
+          edram_snapshot_.resize(xenos::kEdramSizeBytes);
+          DecompressMemory(cmd->encoding_format, trace_ptr,
+                           cmd->encoded_length, edram_snapshot_.data(),
+                           xenos::kEdramSizeBytes);
+          trace_ptr += cmd->encoded_length;
+          command_processor->RestoreEdramSnapshot(edram_snapshot_.data());
+          break;
+        }
+        case TraceCommandType::kEvent: {
+          trace_ptr += sizeof(EventCommand);
+          break;
+        }
+        case TraceCommandType::kIndex: {
+          // Frames end before the index.
+          assert_always();
+          trace_ptr = frame->end_ptr;
+          break;
+        }
+        default: {
+          // The size of unknown commands isn't known, so there's no way to
+          // continue past them.
+          XELOGE("Unknown trace command {:08X} at offset {}", uint32_t(type),
+                 trace_ptr - trace_data_);
+          command_processor->set_swap_mode(SwapMode::kNormal);
+          return false;
+        }
+      }
+    }
+  }
+
+  command_processor->set_swap_mode(SwapMode::kNormal);
+  return true;
+}
+
+void NullTraceBench::ExecutePacketOnThread(const PacketStartCommand* cmd) {
+  // Classify from the copy in the trace, the guest memory may be overwritten by
+  // the packet itself.
+  PacketInfo packet_info;
+  const char* type_name = "PM4_UNKNOWN";
+  if (PacketDisassembler::DisasmPacket(
+          reinterpret_cast<const uint8_t*>(cmd + 1), &packet_info)) {
+    type_name = packet_info.type_info->name;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  graphics_system_->command_processor()->ExecutePacket(cmd->base_ptr,
+                                                       cmd->count);
+  auto time = std::chrono::steady_clock::now() - start;
+
+  PacketTypeStats& stats = packet_type_stats_[type_name];
+  ++stats.count;
+  stats.total_time += time;
+  uint64_t time_ns = uint64_t(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(time).count());
+  uint32_t bucket = 0;
+  while (bucket + 1 < kHistogramBucketCount &&
+         time_ns >= (uint64_t(1) << (kHistogramFirstBucketLog2 + bucket * 2))) {
+    ++bucket;
+  }
+  ++stats.histogram[bucket];
+  ++packet_count_;
+  packet_time_ += time;
+}
+
+void NullTraceBench::PrintResults(std::chrono::nanoseconds play_time,
+                                  uint32_t iteration_count) const {
+  double play_seconds = std::chrono::duration<double>(play_time).count();
+  double packet_seconds = std::chrono::duration<double>(packet_time_).count();
+  std::printf("%d frames, %u iterations, %.3f s\n", frame_count(),
+              iteration_count, play_seconds);
+  std::printf("%.1f K packets/s (%.1f K packets/s executing)\n",
+              packet_count_ / play_seconds / 1e3,
+              packet_count_ / packet_seconds / 1e3);
+  std::printf("Peak resident memory: %.1f MB\n",
+              GetPeakResidentBytes() / (1024.0 * 1024.0));
+  auto command_processor = static_cast<const BenchCommandProcessor*>(
+      graphics_system_->command_processor());
+  std::printf("Draws with a pixel shader: %llu, with a non-empty scissor: "
+              "%llu\n",
+              static_cast<unsigned long long>(
+                  command_processor->pixel_shader_draw_count()),
+              static_cast<unsigned long long>(
+                  command_processor->visible_draw_count()));
+
+  // Sorted by the total time.
+  std::vector<std::pair<const std::string*, const PacketTypeStats*>> types;
+  for (const auto& it : packet_type_stats_) {
+    types.emplace_back(&it.first, &it.second);
+  }
+  std::sort(types.begin(), types.end(), [](const auto& a, const auto& b) {
+    return a.second->total_time > b.second->total_time;
+  });
+
+  std::printf("\nPacket execution time histograms, in ns:\n");
+  std::printf("%-28s %10s %10s %9s %5s", "Packet type", "Count", "Total ms",
+              "Mean ns", "Time%");
+  for (uint32_t i = 0; i < kHistogramBucketCount; ++i) {
+    uint64_t limit = uint64_t(1) << (kHistogramFirstBucketLog2 + i * 2);
+    std::string label;
+    if (i + 1 == kHistogramBucketCount) {
+      label = ">=" + std::to_string(limit / 4);
+    } else {
+      label = "<" + std::to_string(limit);
+    }
+    std::printf(" %10s", label.c_str());
+  }
+  std::printf("\n");
+  for (const auto& type : types) {
+    const PacketTypeStats& stats = *type.second;
+    double total_ms =
+        std::chrono::duration<double, std::milli>(stats.total_time).count();
+    std::printf("%-28s %10llu %10.3f %9.0f %5.1f", type.first->c_str(),
+                static_cast<unsigned long long>(stats.count), total_ms,
+                total_ms * 1e6 / stats.count,
+                100.0 * (stats.total_time.count() /
+                         std::max(double(packet_time_.count()), 1.0)));
+    for (uint64_t bucket_count : stats.histogram) {
+      std::printf(" %10llu", static_cast<unsigned long long>(bucket_count));
+    }
+    std::printf("\n");
+  }
+}
+
+int trace_bench_main(const std::vector<std::string>& args) {
+  std::filesystem::path path = cvars::trace_bench_input;
+  if (path.empty()) {
+    XELOGE("No trace file specified");
+    return 1;
+  }
+  if (cvars::trace_bench_iterations <= 0) {
+    XELOGE("--trace_bench_iterations must be positive");
+    return 1;
+  }
+
+  // No window, so nothing needs a host GPU.
+  auto emulator = std::make_unique<Emulator>("", "", "", "");
+  X_STATUS result = emulator->Setup(
+      nullptr, nullptr,
+      []() -> std::unique_ptr<GraphicsSystem> {
+        return std::make_unique<BenchGraphicsSystem>();
+      },
+      nullptr);
+  if (XFAILED(result)) {
+    XELOGE("Failed to setup emulator: {:08X}", result);
+    return 1;
+  }
+
+  NullTraceBench bench(emulator->graphics_system());
+  if (!bench.Open(path)) {
+    XELOGE("Failed to open trace {}", xe::path_to_utf8(path));
+    return 1;
+  }
+  return bench.Run(uint32_t(cvars::trace_bench_iterations),
+                   cvars::trace_bench_clear_caches);
+}
+
+}  // namespace null
+}  // namespace gpu
+}  // namespace xe
+
+DEFINE_ENTRY_POINT("xenia-gpu-null-trace-bench",
+                   xe::gpu::null::trace_bench_main, "some.xtr",
+                   "trace_bench_input");
@@ -16,3 +16,58 @@ project("xenia-gpu-null")
   defines({
   })
   local_platform_files()
+
+group("src")
+project("xenia-gpu-null-trace-bench")
+  uuid("8c3f5e27-1a94-4d6b-b0e2-96d1c4a7f358")
+  kind("ConsoleApp")
+  language("C++")
+  links({
+    "xenia-apu",
+    "xenia-apu-nop",
+    "xenia-base",
+    "xenia-core",
+    "xenia-cpu",
+    "xenia-cpu-backend-x64",
+    "xenia-gpu",
+    "xenia-gpu-null",
+    "xenia-hid",
+    "xenia-hid-nop",
+    "xenia-kernel",
+    "xenia-ui",
+    "xenia-ui-vulkan",
+    "xenia-vfs",
+  })
+  links({
+    "aes_128",
+    "capstone",
+    "fmt",
+    "glslang-spirv",
+    "imgui",
+    "libavcodec",
+    "libavutil",
+    "mspack",
+    "snappy",
+    "spirv-tools",
+    "volk",
+    "xxhash",
+  })
+  defines({
+  })
+  files({
+    "null_trace_bench_main.cc",
+    "../../base/main_"..platform_suffix..".cc",
+  })
+
+  filter("platforms:Linux")
+    links({
+      "X11",
+      "xcb",
+      "X11-xcb",
+      "vulkan",
+    })
+
+  filter("platforms:Windows")
+    links({
+      "psapi",
+    })
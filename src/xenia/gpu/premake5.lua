@@ -57,3 +57,39 @@ project("xenia-gpu-shader-compiler")
         "1>scratch/stdout-shader-compiler.txt",
       })
     end
+
+group("src")
+project("xenia-gpu-trace-index")
+  uuid("5b0c6f4a-3d2e-4b8f-9a61-7e4f2c9d1a35")
+  kind("ConsoleApp")
+  language("C++")
+  links({
+    "fmt",
+    "snappy",
+    "xenia-base",
+    "xenia-gpu",
+  })
+  defines({
+  })
+  files({
+    "trace_index_main.cc",
+    "../base/main_"..platform_suffix..".cc",
+  })
+
+group("src")
+project("xenia-gpu-texture-conversion-bench")
+  uuid("c2e8a4d1-6f3b-4a07-8d95-1b7e3f0a6c48")
+  kind("ConsoleApp")
+  language("C++")
+  links({
+    "fmt",
+    "xenia-base",
+    "xenia-gpu",
+    "xxhash",
+  })
+  defines({
+  })
+  files({
+    "texture_conversion_bench_main.cc",
+    "../base/main_"..platform_suffix..".cc",
+  })
@@ -753,6 +753,15 @@ class Shader {
     // This is only valid if it is actually text.
     std::string GetTranslatedBinaryString() const;
 
+    // For backends storing translated shaders persistently - marks the
+    // translation as valid and translated into the binary from a previous
+    // translation with the same modification, without invoking the translator.
+    void SetStoredTranslatedBinary(std::vector<uint8_t> binary) {
+      translated_binary_ = std::move(binary);
+      is_translated_ = true;
+      is_valid_ = true;
+    }
+
     // Disassembly of the translated from the host graphics layer.
     // May be empty if the host does not support disassembly.
     const std::string& host_disassembly() const { return host_disassembly_; }
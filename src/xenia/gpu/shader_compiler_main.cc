@@ -7,18 +7,32 @@
  ******************************************************************************
  */
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cinttypes>
 #include <cstring>
+#include <functional>
+#include <memory>
 #include <string>
+#include <unordered_set>
 #include <vector>
 
+#include "build/version.h"
+#include "xenia/base/byte_order.h"
 #include "xenia/base/cvar.h"
+#include "xenia/base/filesystem.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/main.h"
 #include "xenia/base/platform.h"
 #include "xenia/base/string.h"
 #include "xenia/base/string_buffer.h"
+#include "xenia/base/string_util.h"
+#include "xenia/base/threading.h"
+#include "xenia/base/utf8.h"
+#include "xenia/base/xxhash.h"
 #include "xenia/gpu/dxbc_shader_translator.h"
+#include "xenia/gpu/shader_storage.h"
 #include "xenia/gpu/shader_translator.h"
 #include "xenia/gpu/spirv_shader_translator.h"
 #include "xenia/ui/spirv/spirv_disassembler.h"
@@ -28,11 +42,18 @@
 #include "xenia/ui/d3d12/d3d12_api.h"
 #endif  // XE_PLATFORM_WIN32
 
-DEFINE_path(shader_input, "", "Input shader binary file path.", "GPU");
+DEFINE_path(shader_input, "",
+            "Input shader binary file path. For batch translation, a directory "
+            "of shader binaries (.vs, .ps or dumped .ucode.bin.vert and "
+            ".ucode.bin.frag files) or a guest shader storage (.xsh) file.",
+            "GPU");
 DEFINE_string(shader_input_type, "",
               "'vs', 'ps', or unspecified to infer from the given filename.",
               "GPU");
-DEFINE_path(shader_output, "", "Output shader file path.", "GPU");
+DEFINE_path(shader_output, "",
+            "Output shader file path. For batch translation, the cache root to "
+            "write the shader storage to, or unspecified to only translate.",
+            "GPU");
 DEFINE_string(shader_output_type, "ucode",
               "Translator to use: [ucode, spirv, spirvtext, dxbc, dxbctext].",
               "GPU");
@@ -47,11 +68,411 @@ DEFINE_bool(shader_output_bindless_resources, false,
 DEFINE_bool(shader_output_dxbc_rov, false,
             "Output ROV-based output-merger code in DXBC pixel shaders.",
             "GPU");
+DEFINE_string(shader_storage_title_id, "00000000",
+              "Title ID (hexadecimal) naming the shader storage files written "
+              "by batch translation.",
+              "GPU");
+DEFINE_int32(shader_batch_threads, -1,
+             "Number of threads for batch translation, or -1 for the number of "
+             "logical processors.",
+             "GPU");
 
 namespace xe {
 namespace gpu {
 
+Shader::HostVertexShaderType GetHostVertexShaderType() {
+  if (cvars::vertex_shader_output_type == "linedomaincp") {
+    return Shader::HostVertexShaderType::kLineDomainCPIndexed;
+  }
+  if (cvars::vertex_shader_output_type == "linedomainpatch") {
+    return Shader::HostVertexShaderType::kLineDomainPatchIndexed;
+  }
+  if (cvars::vertex_shader_output_type == "triangledomaincp") {
+    return Shader::HostVertexShaderType::kTriangleDomainCPIndexed;
+  }
+  if (cvars::vertex_shader_output_type == "triangledomainpatch") {
+    return Shader::HostVertexShaderType::kTriangleDomainPatchIndexed;
+  }
+  if (cvars::vertex_shader_output_type == "quaddomaincp") {
+    return Shader::HostVertexShaderType::kQuadDomainCPIndexed;
+  }
+  if (cvars::vertex_shader_output_type == "quaddomainpatch") {
+    return Shader::HostVertexShaderType::kQuadDomainPatchIndexed;
+  }
+  return Shader::HostVertexShaderType::kVertex;
+}
+
+// A shader translated in batch mode.
+struct BatchShader {
+  std::string name;
+  std::unique_ptr<Shader> shader;
+  Shader::Translation* translation = nullptr;
+  // Analysis and translation time.
+  double milliseconds = 0.0;
+};
+
+class BatchShaderLoader {
+ public:
+  explicit BatchShaderLoader(std::vector<BatchShader>& shaders)
+      : shaders_(shaders) {}
+
+  // ucode is in guest byte order, as hashed and stored by the emulator.
+  void AddShader(std::string name, xenos::ShaderType type,
+                 const uint32_t* ucode, uint32_t ucode_dword_count) {
+    uint64_t ucode_data_hash =
+        XXH3_64bits(ucode, ucode_dword_count * sizeof(uint32_t));
+    if (!hashes_.insert(ucode_data_hash).second) {
+      return;
+    }
+    BatchShader batch_shader;
+    batch_shader.name = std::move(name);
+    batch_shader.shader = std::make_unique<Shader>(type, ucode_data_hash, ucode,
+                                                   ucode_dword_count);
+    shaders_.push_back(std::move(batch_shader));
+  }
+
+  // Loads .vs and .ps files in guest byte order, and files dumped by
+  // Shader::DumpUcode in host byte order.
+  void LoadDirectory(const std::filesystem::path& path) {
+    std::vector<xe::filesystem::FileInfo> files =
+        xe::filesystem::ListFiles(path);
+    std::sort(files.begin(), files.end(),
+              [](const xe::filesystem::FileInfo& a,
+                 const xe::filesystem::FileInfo& b) {
+                return a.name < b.name;
+              });
+    for (const xe::filesystem::FileInfo& file : files) {
+      if (file.type != xe::filesystem::FileInfo::Type::kFile) {
+        continue;
+      }
+      std::string name = xe::path_to_utf8(file.name);
+      xenos::ShaderType type;
+      bool host_endian;
+      if (xe::utf8::ends_with(name, ".vs")) {
+        type = xenos::ShaderType::kVertex;
+        host_endian = false;
+      } else if (xe::utf8::ends_with(name, ".ps")) {
+        type = xenos::ShaderType::kPixel;
+        host_endian = false;
+      } else if (xe::utf8::ends_with(name, ".ucode.bin.vert")) {
+        type = xenos::ShaderType::kVertex;
+        host_endian = true;
+      } else if (xe::utf8::ends_with(name, ".ucode.bin.frag")) {
+        type = xenos::ShaderType::kPixel;
+        host_endian = true;
+      } else {
+        continue;
+      }
+      FILE* input_file = xe::filesystem::OpenFile(path / file.name, "rb");
+      if (!input_file) {
+        XELOGE("Unable to open input file: {}",
+               xe::path_to_utf8(path / file.name));
+        continue;
+      }
+      std::vector<uint32_t> ucode(file.total_size / sizeof(uint32_t));
+      ucode.resize(fread(ucode.data(), sizeof(uint32_t), ucode.size(),
+                         input_file));
+      fclose(input_file);
+      if (host_endian) {
+        xe::copy_and_swap(ucode.data(), ucode.data(), ucode.size());
+      }
+      AddShader(std::move(name), type, ucode.data(), uint32_t(ucode.size()));
+    }
+  }
+
+  // Loads shaders from guest shader storage until the end or the first
+  // corrupted record, like the emulator does.
+  void LoadStorage(const std::filesystem::path& path) {
+    FILE* file = xe::filesystem::OpenFile(path, "rb");
+    if (!file) {
+      return;
+    }
+    ShaderStorageFileHeader file_header;
+    if (!fread(&file_header, sizeof(file_header), 1, file) ||
+        file_header.magic != kShaderStorageMagic ||
+        xe::byte_swap(file_header.version_swapped) !=
+            ShaderStoredHeader::kVersion) {
+      XELOGE("{} is not a compatible shader storage file",
+             xe::path_to_utf8(path));
+      fclose(file);
+      return;
+    }
+    ShaderStoredHeader shader_header;
+    std::vector<uint32_t> ucode;
+    size_t record_count = 0;
+    while (fread(&shader_header, sizeof(shader_header), 1, file)) {
+      ucode.resize(shader_header.ucode_dword_count);
+      if (!ucode.empty() &&
+          !fread(ucode.data(), ucode.size() * sizeof(uint32_t), 1, file)) {
+        break;
+      }
+      if (XXH3_64bits(ucode.data(), ucode.size() * sizeof(uint32_t)) !=
+          shader_header.ucode_data_hash) {
+        XELOGW("{} is corrupted after {} shaders", xe::path_to_utf8(path),
+               record_count);
+        break;
+      }
+      ++record_count;
+      AddShader(fmt::format("{:016X}", uint64_t(shader_header.ucode_data_hash)),
+                shader_header.type, ucode.data(), uint32_t(ucode.size()));
+    }
+    fclose(file);
+  }
+
+ private:
+  std::vector<BatchShader>& shaders_;
+  std::unordered_set<uint64_t> hashes_;
+};
+
+bool WriteBatchShaderStorage(const std::filesystem::path& path,
+                             const std::vector<BatchShader>& shaders) {
+  FILE* file = xe::filesystem::OpenFile(path, "wb");
+  if (!file) {
+    XELOGE("Unable to open the shader storage file for writing: {}",
+           xe::path_to_utf8(path));
+    return false;
+  }
+  ShaderStorageFileHeader file_header;
+  file_header.magic = kShaderStorageMagic;
+  file_header.version_swapped = xe::byte_swap(ShaderStoredHeader::kVersion);
+  fwrite(&file_header, sizeof(file_header), 1, file);
+  ShaderStoredHeader shader_header;
+  // Don't leak anything in unused bits.
+  std::memset(&shader_header, 0, sizeof(shader_header));
+  std::vector<uint32_t> ucode_guest_endian;
+  for (const BatchShader& batch_shader : shaders) {
+    const Shader& shader = *batch_shader.shader;
+    shader_header.ucode_data_hash = shader.ucode_data_hash();
+    shader_header.ucode_dword_count = uint32_t(shader.ucode_dword_count());
+    shader_header.type = shader.type();
+    fwrite(&shader_header, sizeof(shader_header), 1, file);
+    ucode_guest_endian.resize(shader.ucode_dword_count());
+    xe::copy_and_swap(ucode_guest_endian.data(), shader.ucode_dwords(),
+                      ucode_guest_endian.size());
+    fwrite(ucode_guest_endian.data(), sizeof(uint32_t),
+           ucode_guest_endian.size(), file);
+  }
+  fclose(file);
+  return true;
+}
+
+bool WriteBatchSpirvStorage(const std::filesystem::path& path,
+                            const std::vector<BatchShader>& shaders) {
+  FILE* file = xe::filesystem::OpenFile(path, "wb");
+  if (!file) {
+    XELOGE("Unable to open the SPIR-V storage file for writing: {}",
+           xe::path_to_utf8(path));
+    return false;
+  }
+  SpirvStorageFileHeader file_header;
+  file_header.magic = kSpirvStorageMagic;
+  file_header.version_swapped = xe::byte_swap(SpirvStoredHeader::kVersion);
+  std::memcpy(file_header.build_commit, XE_BUILD_COMMIT,
+              sizeof(file_header.build_commit));
+  fwrite(&file_header, sizeof(file_header), 1, file);
+  SpirvStoredHeader spirv_header;
+  std::memset(&spirv_header, 0, sizeof(spirv_header));
+  for (const BatchShader& batch_shader : shaders) {
+    const Shader::Translation* translation = batch_shader.translation;
+    if (!translation || !translation->is_valid()) {
+      continue;
+    }
+    const std::vector<uint8_t>& spirv = translation->translated_binary();
+    spirv_header.ucode_data_hash = batch_shader.shader->ucode_data_hash();
+    spirv_header.modification = translation->modification();
+    spirv_header.spirv_hash = XXH3_64bits(spirv.data(), spirv.size());
+    spirv_header.spirv_dword_count = uint32_t(spirv.size() / sizeof(uint32_t));
+    fwrite(&spirv_header, sizeof(spirv_header), 1, file);
+    fwrite(spirv.data(), 1, spirv.size(), file);
+  }
+  fclose(file);
+  return true;
+}
+
+// Translates a directory of shaders or a shader storage file on all cores and
+// writes the shader storage the emulator loads on startup.
+int shader_compiler_batch_main() {
+  std::function<std::unique_ptr<ShaderTranslator>()> create_translator;
+  if (cvars::shader_output_type == "spirv") {
+    create_translator = []() {
+      return std::make_unique<SpirvShaderTranslator>();
+    };
+  } else if (cvars::shader_output_type == "dxbc") {
+    create_translator = []() {
+      return std::make_unique<DxbcShaderTranslator>(
+          0, cvars::shader_output_bindless_resources,
+          cvars::shader_output_dxbc_rov);
+    };
+  } else if (cvars::shader_output_type != "ucode") {
+    XELOGE("Batch translation supports only ucode, spirv and dxbc output.");
+    return 1;
+  }
+
+  uint32_t title_id =
+      xe::string_util::from_string<uint32_t>(cvars::shader_storage_title_id,
+                                             true);
+  std::filesystem::path shareable_root, local_root;
+  if (!cvars::shader_output.empty()) {
+    shareable_root = cvars::shader_output / "shaders" / "shareable";
+    local_root = cvars::shader_output / "shaders" / "local";
+    for (const std::filesystem::path& root : {shareable_root, local_root}) {
+      if (!std::filesystem::exists(root) &&
+          !std::filesystem::create_directories(root)) {
+        XELOGE("Unable to create the output directory: {}",
+               xe::path_to_utf8(root));
+        return 1;
+      }
+    }
+  }
+  std::filesystem::path shader_storage_path =
+      shareable_root.empty()
+          ? std::filesystem::path()
+          : shareable_root / fmt::format("{:08X}.xsh", title_id);
+
+  std::vector<BatchShader> shaders;
+  BatchShaderLoader loader(shaders);
+  if (std::filesystem::is_directory(cvars::shader_input)) {
+    loader.LoadDirectory(cvars::shader_input);
+  } else {
+    loader.LoadStorage(cvars::shader_input);
+  }
+  // Keep the shaders already in the output storage as it's rewritten.
+  if (!shader_storage_path.empty() &&
+      std::filesystem::exists(shader_storage_path)) {
+    loader.LoadStorage(shader_storage_path);
+  }
+  if (shaders.empty()) {
+    XELOGE("No shaders found in {}", xe::path_to_utf8(cvars::shader_input));
+    return 1;
+  }
+
+  uint32_t thread_count = cvars::shader_batch_threads > 0
+                              ? uint32_t(cvars::shader_batch_threads)
+                              : xe::threading::logical_processor_count();
+  thread_count = std::min(std::max(thread_count, uint32_t(1)),
+                          uint32_t(shaders.size()));
+  Shader::HostVertexShaderType host_vertex_shader_type =
+      GetHostVertexShaderType();
+
+  // Each thread takes the next shader and uses its own translator.
+  std::atomic<size_t> next_shader_index(0);
+  auto translation_thread_function = [&]() {
+    std::unique_ptr<ShaderTranslator> translator;
+    if (create_translator) {
+      translator = create_translator();
+    }
+    StringBuffer ucode_disasm_buffer;
+    for (;;) {
+      size_t shader_index = next_shader_index++;
+      if (shader_index >= shaders.size()) {
+        return;
+      }
+      BatchShader& batch_shader = shaders[shader_index];
+      Shader& shader = *batch_shader.shader;
+      auto start = std::chrono::steady_clock::now();
+      shader.AnalyzeUcode(ucode_disasm_buffer);
+      if (translator) {
+        // The SQ_PROGRAM_CNTL register count is not known offline - assume the
+        // shader doesn't dynamically address more registers than it addresses
+        // statically, which gives the modification the emulator uses for the
+        // shaders not using dynamic addressing.
+        uint64_t modification = translator->GetDefaultModification(
+            shader.type(), shader.GetDynamicAddressableRegisterCount(0x80),
+            shader.type() == xenos::ShaderType::kVertex
+                ? host_vertex_shader_type
+                : Shader::HostVertexShaderType::kVertex);
+        batch_shader.translation = shader.GetOrCreateTranslation(modification);
+        translator->TranslateAnalyzedShader(*batch_shader.translation);
+      }
+      batch_shader.milliseconds =
+          std::chrono::duration<double, std::milli>(
+              std::chrono::steady_clock::now() - start)
+              .count();
+    }
+  };
+  auto batch_start = std::chrono::steady_clock::now();
+  std::vector<std::unique_ptr<xe::threading::Thread>> translation_threads;
+  while (translation_threads.size() + 1 < thread_count) {
+    translation_threads.push_back(
+        xe::threading::Thread::Create({}, translation_thread_function));
+    translation_threads.back()->set_name("Shader Translation");
+  }
+  translation_thread_function();
+  for (auto& translation_thread : translation_threads) {
+    xe::threading::Wait(translation_thread.get(), false);
+  }
+  double batch_milliseconds =
+      std::chrono::duration<double, std::milli>(
+          std::chrono::steady_clock::now() - batch_start)
+          .count();
+
+  size_t translations_failed = 0;
+  size_t ucode_bytes = 0, translated_bytes = 0;
+  double shader_milliseconds = 0.0;
+  for (const BatchShader& batch_shader : shaders) {
+    const Shader& shader = *batch_shader.shader;
+    size_t shader_ucode_bytes = shader.ucode_dword_count() * sizeof(uint32_t);
+    ucode_bytes += shader_ucode_bytes;
+    shader_milliseconds += batch_shader.milliseconds;
+    if (!batch_shader.translation) {
+      XELOGI("{} ({} shader {:016X}): {} bytes analyzed in {:.3f} ms",
+             batch_shader.name,
+             shader.type() == xenos::ShaderType::kVertex ? "vertex" : "pixel",
+             shader.ucode_data_hash(), shader_ucode_bytes,
+             batch_shader.milliseconds);
+      continue;
+    }
+    if (!batch_shader.translation->is_valid()) {
+      ++translations_failed;
+      XELOGE("{} ({} shader {:016X}): translation failed in {:.3f} ms",
+             batch_shader.name,
+             shader.type() == xenos::ShaderType::kVertex ? "vertex" : "pixel",
+             shader.ucode_data_hash(), batch_shader.milliseconds);
+      continue;
+    }
+    size_t shader_translated_bytes =
+        batch_shader.translation->translated_binary().size();
+    translated_bytes += shader_translated_bytes;
+    XELOGI("{} ({} shader {:016X}): {} bytes translated to {} bytes in "
+           "{:.3f} ms",
+           batch_shader.name,
+           shader.type() == xenos::ShaderType::kVertex ? "vertex" : "pixel",
+           shader.ucode_data_hash(), shader_ucode_bytes,
+           shader_translated_bytes, batch_shader.milliseconds);
+  }
+  XELOGI(
+      "{} shaders ({} bytes of ucode) processed on {} threads in {:.3f} ms "
+      "({:.3f} ms of work, {:.1f} shaders/s), {} bytes translated, {} failed",
+      shaders.size(), ucode_bytes, thread_count, batch_milliseconds,
+      shader_milliseconds, shaders.size() * 1000.0 / batch_milliseconds,
+      translated_bytes, translations_failed);
+
+  if (shader_storage_path.empty()) {
+    return translations_failed ? 1 : 0;
+  }
+  if (!WriteBatchShaderStorage(shader_storage_path, shaders)) {
+    return 1;
+  }
+  XELOGI("Wrote {}", xe::path_to_utf8(shader_storage_path));
+  // Direct3D 12 translates the guest shader storage on startup, only the
+  // Vulkan backend stores the translated shaders.
+  if (cvars::shader_output_type == "spirv") {
+    std::filesystem::path spirv_storage_path =
+        local_root / fmt::format("{:08X}.vulkan.xspv", title_id);
+    if (!WriteBatchSpirvStorage(spirv_storage_path, shaders)) {
+      return 1;
+    }
+    XELOGI("Wrote {}", xe::path_to_utf8(spirv_storage_path));
+  }
+  return translations_failed ? 1 : 0;
+}
+
 int shader_compiler_main(const std::vector<std::string>& args) {
+  if (std::filesystem::is_directory(cvars::shader_input) ||
+      cvars::shader_input.extension() == ".xsh") {
+    return shader_compiler_batch_main();
+  }
+
   xenos::ShaderType shader_type;
   if (!cvars::shader_input_type.empty()) {
     if (cvars::shader_input_type == "vs") {
@@ -130,28 +551,9 @@ int shader_compiler_main(const std::vector<std::string>& args) {
   }
 
   Shader::HostVertexShaderType host_vertex_shader_type =
-      Shader::HostVertexShaderType::kVertex;
-  if (shader_type == xenos::ShaderType::kVertex) {
-    if (cvars::vertex_shader_output_type == "linedomaincp") {
-      host_vertex_shader_type =
-          Shader::HostVertexShaderType::kLineDomainCPIndexed;
-    } else if (cvars::vertex_shader_output_type == "linedomainpatch") {
-      host_vertex_shader_type =
-          Shader::HostVertexShaderType::kLineDomainPatchIndexed;
-    } else if (cvars::vertex_shader_output_type == "triangledomaincp") {
-      host_vertex_shader_type =
-          Shader::HostVertexShaderType::kTriangleDomainCPIndexed;
-    } else if (cvars::vertex_shader_output_type == "triangledomainpatch") {
-      host_vertex_shader_type =
-          Shader::HostVertexShaderType::kTriangleDomainPatchIndexed;
-    } else if (cvars::vertex_shader_output_type == "quaddomaincp") {
-      host_vertex_shader_type =
-          Shader::HostVertexShaderType::kQuadDomainCPIndexed;
-    } else if (cvars::vertex_shader_output_type == "quaddomainpatch") {
-      host_vertex_shader_type =
-          Shader::HostVertexShaderType::kQuadDomainPatchIndexed;
-    }
-  }
+      shader_type == xenos::ShaderType::kVertex
+          ? GetHostVertexShaderType()
+          : Shader::HostVertexShaderType::kVertex;
   uint64_t modification = translator->GetDefaultModification(
       shader_type, 64, host_vertex_shader_type);
 
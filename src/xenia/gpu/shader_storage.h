@@ -0,0 +1,70 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2020 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_GPU_SHADER_STORAGE_H_
+#define XENIA_GPU_SHADER_STORAGE_H_
+
+#include <cstdint>
+
+#include "xenia/base/platform.h"
+#include "xenia/gpu/xenos.h"
+
+namespace xe {
+namespace gpu {
+
+// Formats of the persistent shader storage files, shared by the GPU backends
+// and the offline shader compiler.
+
+// Guest shader storage (.xsh), shared between the backends. The file header is
+// followed by ShaderStoredHeader records, each followed by the ucode in guest
+// byte order.
+// 'XESH'.
+constexpr uint32_t kShaderStorageMagic = 0x48534558;
+
+XEPACKEDSTRUCT(ShaderStorageFileHeader, {
+  uint32_t magic;
+  uint32_t version_swapped;
+});
+
+XEPACKEDSTRUCT(ShaderStoredHeader, {
+  uint64_t ucode_data_hash;
+
+  uint32_t ucode_dword_count : 31;
+  xenos::ShaderType type : 1;
+
+  static constexpr uint32_t kVersion = 0x20201219;
+});
+
+// Vulkan SPIR-V storage (.vulkan.xspv). The file header is followed by
+// SpirvStoredHeader records, each followed by the SPIR-V in host byte order.
+// The storage is invalidated when the build changes as the translator may have
+// changed.
+// 'XESV'.
+constexpr uint32_t kSpirvStorageMagic = 0x56534558;
+
+XEPACKEDSTRUCT(SpirvStorageFileHeader, {
+  uint32_t magic;
+  uint32_t version_swapped;
+  // XE_BUILD_COMMIT, not null-terminated.
+  char build_commit[40];
+});
+
+XEPACKEDSTRUCT(SpirvStoredHeader, {
+  uint64_t ucode_data_hash;
+  uint64_t modification;
+  uint64_t spirv_hash;
+  uint32_t spirv_dword_count;
+
+  static constexpr uint32_t kVersion = 0x20201222;
+});
+
+}  // namespace gpu
+}  // namespace xe
+
+#endif  // XENIA_GPU_SHADER_STORAGE_H_
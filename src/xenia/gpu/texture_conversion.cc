@@ -14,30 +14,226 @@
 #include <cstring>
 #include <functional>
 
+#include "xenia/base/byte_order.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/base/memory.h"
 #include "xenia/base/profiling.h"
 #include "xenia/base/xxhash.h"
 
+#if XE_ARCH_AMD64 && XE_COMPILER_MSVC
+#include <intrin.h>
+#endif
+
+// Functions using AVX2 intrinsics. The project is built for AVX, so AVX2 has to
+// be enabled per function on GCC and Clang and checked at runtime.
+#if XE_COMPILER_MSVC
+#define XE_GPU_TARGET_AVX2
+#else
+#define XE_GPU_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
 namespace xe {
 namespace gpu {
 namespace texture_conversion {
 
 using namespace xe::gpu::xenos;
 
+namespace {
+
+// Swaps the whole 2 or 4 byte units in length bytes, copies the rest.
+template <Endian endian>
+void CopySwapScalar(uint8_t* output, const uint8_t* input, size_t length) {
+  size_t i = 0;
+  switch (endian) {
+    case Endian::k8in16:
+      for (; i + 2 <= length; i += 2) {
+        xe::store<uint16_t>(output + i,
+                            xe::byte_swap(xe::load<uint16_t>(input + i)));
+      }
+      break;
+    case Endian::k8in32:
+      for (; i + 4 <= length; i += 4) {
+        xe::store<uint32_t>(output + i,
+                            xe::byte_swap(xe::load<uint32_t>(input + i)));
+      }
+      break;
+    case Endian::k16in32:
+      for (; i + 4 <= length; i += 4) {
+        uint32_t value = xe::load<uint32_t>(input + i);
+        xe::store<uint32_t>(output + i, (value >> 16) | (value << 16));
+      }
+      break;
+    default:
+      break;
+  }
+  std::memcpy(output + i, input + i, length - i);
+}
+
+#if XE_ARCH_AMD64
+
+template <Endian endian>
+inline __m128i SwapMask() {
+  switch (endian) {
+    case Endian::k8in16:
+      return _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15,
+                           14);
+    case Endian::k8in32:
+      return _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13,
+                           12);
+    case Endian::k16in32:
+      return _mm_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12,
+                           13);
+    default:
+      return _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14,
+                           15);
+  }
+}
+
+template <Endian endian>
+inline __m128i SwapVector(__m128i value) {
+  if (endian == Endian::kNone) {
+    return value;
+  }
+  return _mm_shuffle_epi8(value, SwapMask<endian>());
+}
+
+template <Endian endian>
+void CopySwapSSE(uint8_t* output, const uint8_t* input, size_t length) {
+  size_t i = 0;
+  for (; i + 16 <= length; i += 16) {
+    __m128i value =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(output + i),
+                     SwapVector<endian>(value));
+  }
+  CopySwapScalar<endian>(output + i, input + i, length - i);
+}
+
+template <Endian endian>
+XE_GPU_TARGET_AVX2 void CopySwapAVX2(uint8_t* output, const uint8_t* input,
+                                     size_t length) {
+  if (endian == Endian::kNone) {
+    std::memcpy(output, input, length);
+    return;
+  }
+  size_t i = 0;
+  __m256i swap_mask = _mm256_broadcastsi128_si256(SwapMask<endian>());
+  for (; i + 32 <= length; i += 32) {
+    __m256i value =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(input + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(output + i),
+                        _mm256_shuffle_epi8(value, swap_mask));
+  }
+  CopySwapSSE<endian>(output + i, input + i, length - i);
+}
+
+bool IsAVX2Supported() {
+  // The OS must already support saving the AVX state for the AVX build.
+#if XE_COMPILER_MSVC
+  int cpu_info[4];
+  __cpuidex(cpu_info, 7, 0);
+  return (cpu_info[1] & (1 << 5)) != 0;
+#else
+  return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+
+// Copies a run of 8 or 16 bytes.
+template <Endian endian>
+inline void CopySwapRun(uint8_t* output, const uint8_t* input,
+                        uint32_t length) {
+  if (length == 16) {
+    __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(output),
+                     SwapVector<endian>(value));
+  } else {
+    __m128i value = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(input));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(output),
+                     SwapVector<endian>(value));
+  }
+}
+
+#else
+
+template <Endian endian>
+inline void CopySwapRun(uint8_t* output, const uint8_t* input,
+                        uint32_t length) {
+  CopySwapScalar<endian>(output, input, length);
+}
+
+#endif  // XE_ARCH_AMD64
+
+template <Endian endian>
+void CopySwap(uint8_t* output, const uint8_t* input, size_t length) {
+#if XE_ARCH_AMD64
+  static const auto copy_swap =
+      IsAVX2Supported() ? CopySwapAVX2<endian> : CopySwapSSE<endian>;
+  copy_swap(output, input, length);
+#else
+  CopySwapScalar<endian>(output, input, length);
+#endif  // XE_ARCH_AMD64
+}
+
+// Untiles blocks that are copied without conversion. The tiling keeps runs of
+// 16 bytes (8 for 8bpp) contiguous, so they are copied and swapped at once.
+template <Endian endian>
+void UntileCopySwap(uint8_t* output_buffer, const uint8_t* input_buffer,
+                    const UntileInfo* untile_info) {
+  uint32_t bytes_per_block = untile_info->input_format_info->bytes_per_block();
+  uint32_t log2_bpp = GetTiledLog2BytesPerBlock(bytes_per_block);
+  uint32_t output_pitch = untile_info->output_pitch * bytes_per_block;
+  uint32_t run_length = bytes_per_block == 1 ? 8 : 16;
+  uint32_t run_blocks = run_length >> log2_bpp;
+
+  uint8_t partial_run[16];
+  for (uint32_t y = 0; y < untile_info->height; ++y) {
+    uint32_t input_y = untile_info->offset_y + y;
+    uint32_t input_row_offset =
+        TiledOffset2DRow(input_y, untile_info->input_pitch, log2_bpp);
+    uint8_t* output_row = output_buffer + y * output_pitch;
+    uint32_t x = 0;
+    while (x < untile_info->width) {
+      uint32_t input_x = untile_info->offset_x + x;
+      uint32_t run_first_block = input_x & (run_blocks - 1);
+      uint32_t block_count =
+          std::min(run_blocks - run_first_block, untile_info->width - x);
+      uint32_t input_offset =
+          TiledOffset2DColumn(input_x - run_first_block, input_y, log2_bpp,
+                              input_row_offset) &
+          ~(bytes_per_block - 1);
+      uint8_t* output = output_row + x * bytes_per_block;
+      if (block_count == run_blocks) {
+        CopySwapRun<endian>(output, input_buffer + input_offset, run_length);
+      } else {
+        // Edge of the region - swap the whole run, as blocks may be smaller
+        // than the endian swap unit.
+        CopySwapRun<endian>(partial_run, input_buffer + input_offset,
+                            run_length);
+        std::memcpy(output, partial_run + run_first_block * bytes_per_block,
+                    block_count * bytes_per_block);
+      }
+      x += block_count;
+    }
+  }
+}
+
+}  // namespace
+
 void CopySwapBlock(xenos::Endian endian, void* output, const void* input,
                    size_t length) {
+  auto output_bytes = static_cast<uint8_t*>(output);
+  auto input_bytes = static_cast<const uint8_t*>(input);
   switch (endian) {
     case xenos::Endian::k8in16:
-      xe::copy_and_swap_16_unaligned(output, input, length / 2);
+      CopySwap<Endian::k8in16>(output_bytes, input_bytes, length);
       break;
     case xenos::Endian::k8in32:
-      xe::copy_and_swap_32_unaligned(output, input, length / 4);
+      CopySwap<Endian::k8in32>(output_bytes, input_bytes, length);
       break;
     case xenos::Endian::k16in32:  // Swap high and low 16 bits within a 32 bit
                                   // word
-      xe::copy_and_swap_16_in_32_unaligned(output, input, length);
+      CopySwap<Endian::k16in32>(output_bytes, input_bytes, length);
       break;
     default:
     case xenos::Endian::kNone:
@@ -89,25 +285,6 @@ void ConvertTexelDXT3AToDXT3(xenos::Endian endian, void* output,
   std::memset(&output_bytes[8], 0, 8);
 }
 
-// https://github.com/BinomialLLC/crunch/blob/ea9b8d8c00c8329791256adafa8cf11e4e7942a2/inc/crn_decomp.h#L4108
-static uint32_t TiledOffset2DRow(uint32_t y, uint32_t width,
-                                 uint32_t log2_bpp) {
-  uint32_t macro = ((y / 32) * (width / 32)) << (log2_bpp + 7);
-  uint32_t micro = ((y & 6) << 2) << log2_bpp;
-  return macro + ((micro & ~0xF) << 1) + (micro & 0xF) +
-         ((y & 8) << (3 + log2_bpp)) + ((y & 1) << 4);
-}
-
-static uint32_t TiledOffset2DColumn(uint32_t x, uint32_t y, uint32_t log2_bpp,
-                                    uint32_t base_offset) {
-  uint32_t macro = (x / 32) << (log2_bpp + 7);
-  uint32_t micro = (x & 7) << log2_bpp;
-  uint32_t offset =
-      base_offset + (macro + ((micro & ~0xF) << 1) + (micro & 0xF));
-  return ((offset & ~0x1FF) << 3) + ((offset & 0x1C0) << 2) + (offset & 0x3F) +
-         ((y & 16) << 7) + (((((y & 8) >> 2) + (x >> 3)) & 3) << 6);
-}
-
 void Untile(uint8_t* output_buffer, const uint8_t* input_buffer,
             const UntileInfo* untile_info) {
   SCOPE_profile_cpu_f("gpu");
@@ -115,40 +292,123 @@ void Untile(uint8_t* output_buffer, const uint8_t* input_buffer,
   assert_not_null(untile_info->input_format_info);
   assert_not_null(untile_info->output_format_info);
 
-  uint32_t input_bytes_per_block =
-      untile_info->input_format_info->bytes_per_block();
-  uint32_t output_bytes_per_block =
-      untile_info->output_format_info->bytes_per_block();
-  uint32_t output_pitch = untile_info->output_pitch * output_bytes_per_block;
-
-  // Bytes per pixel
-  auto log2_bpp = (input_bytes_per_block / 4) +
-                  ((input_bytes_per_block / 2) >> (input_bytes_per_block / 4));
-
-  // Offset to the current row, in bytes.
-  uint32_t output_row_offset = 0;
-  for (uint32_t y = 0; y < untile_info->height; y++) {
-    auto input_row_offset = TiledOffset2DRow(
-        untile_info->offset_y + y, untile_info->input_pitch, log2_bpp);
-
-    // Go block-by-block on this row.
-    uint32_t output_offset = output_row_offset;
-
-    for (uint32_t x = 0; x < untile_info->width; x++) {
-      auto input_offset = TiledOffset2DColumn(untile_info->offset_x + x,
-                                              untile_info->offset_y + y,
-                                              log2_bpp, input_row_offset);
-      input_offset >>= log2_bpp;
-
-      untile_info->copy_callback(
-          &output_buffer[output_offset],
-          &input_buffer[input_offset * input_bytes_per_block],
-          output_bytes_per_block);
-
-      output_offset += output_bytes_per_block;
+  xenos::Endian endian = untile_info->endian;
+  CopyBlockCallback copy_block = untile_info->copy_block;
+  if (copy_block == CopySwapBlock &&
+      untile_info->input_format_info->bytes_per_block() ==
+          untile_info->output_format_info->bytes_per_block()) {
+    switch (endian) {
+      case xenos::Endian::k8in16:
+        UntileCopySwap<Endian::k8in16>(output_buffer, input_buffer,
+                                       untile_info);
+        break;
+      case xenos::Endian::k8in32:
+        UntileCopySwap<Endian::k8in32>(output_buffer, input_buffer,
+                                       untile_info);
+        break;
+      case xenos::Endian::k16in32:
+        UntileCopySwap<Endian::k16in32>(output_buffer, input_buffer,
+                                        untile_info);
+        break;
+      default:
+        UntileCopySwap<Endian::kNone>(output_buffer, input_buffer,
+                                      untile_info);
+        break;
+    }
+  } else if (copy_block == ConvertTexelCTX1ToR8G8) {
+    UntileBlocks(output_buffer, input_buffer, untile_info,
+                 [endian](void* output, const void* input, size_t length) {
+                   ConvertTexelCTX1ToR8G8(endian, output, input, length);
+                 });
+  } else if (copy_block == ConvertTexelDXT3AToDXT3) {
+    UntileBlocks(output_buffer, input_buffer, untile_info,
+                 [endian](void* output, const void* input, size_t length) {
+                   ConvertTexelDXT3AToDXT3(endian, output, input, length);
+                 });
+  } else {
+    UntileBlocks(output_buffer, input_buffer, untile_info,
+                 [endian, copy_block](void* output, const void* input,
+                                      size_t length) {
+                   copy_block(endian, output, input, length);
+                 });
+  }
+}
+
+ConversionWorkers::ConversionWorkers(uint32_t thread_count) {
+  for (uint32_t i = 0; i < thread_count; ++i) {
+    auto thread = xe::threading::Thread::Create(
+        {}, [this]() { WorkerThreadMain(); });
+    if (!thread) {
+      XELOGE("Failed to create a texture conversion thread");
+      break;
+    }
+    thread->set_name("Texture Conversion");
+    threads_.push_back(std::move(thread));
+  }
+}
+
+ConversionWorkers::~ConversionWorkers() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    shutting_down_ = true;
+  }
+  work_cond_.notify_all();
+  for (auto& thread : threads_) {
+    xe::threading::Wait(thread.get(), false);
+  }
+}
+
+void ConversionWorkers::Run(size_t job_count, const Job& job) {
+  if (threads_.empty() || job_count <= 1) {
+    for (size_t i = 0; i < job_count; ++i) {
+      job(i);
     }
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    job_ = &job;
+    job_count_ = job_count;
+    next_job_index_.store(0, std::memory_order_relaxed);
+    ++generation_;
+  }
+  work_cond_.notify_all();
+  RunJobs(job, job_count);
+  // All jobs have been taken, wait for the ones still being done.
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_cond_.wait(lock, [this]() { return !active_thread_count_; });
+  job_ = nullptr;
+}
+
+void ConversionWorkers::WorkerThreadMain() {
+  uint64_t last_generation = 0;
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    // Threads waking up after Run has returned must not take jobs.
+    work_cond_.wait(lock, [this, last_generation]() {
+      return shutting_down_ || (job_ && generation_ != last_generation);
+    });
+    if (shutting_down_) {
+      break;
+    }
+    last_generation = generation_;
+    const Job& job = *job_;
+    size_t job_count = job_count_;
+    ++active_thread_count_;
+    lock.unlock();
+    RunJobs(job, job_count);
+    lock.lock();
+    if (!--active_thread_count_) {
+      done_cond_.notify_all();
+    }
+  }
+}
 
-    output_row_offset += output_pitch;
+void ConversionWorkers::RunJobs(const Job& job, size_t job_count) {
+  size_t job_index;
+  while ((job_index = next_job_index_.fetch_add(
+              1, std::memory_order_relaxed)) < job_count) {
+    job(job_index);
   }
 }
 
@@ -10,11 +10,16 @@
 #ifndef XENIA_GPU_TEXTURE_CONVERSION_H_
 #define XENIA_GPU_TEXTURE_CONVERSION_H_
 
+#include <atomic>
+#include <condition_variable>
 #include <cstring>
 #include <functional>
 #include <memory>
+#include <mutex>
+#include <vector>
 
 #include "xenia/base/assert.h"
+#include "xenia/base/threading.h"
 #include "xenia/gpu/texture_info.h"
 #include "xenia/gpu/xenos.h"
 
@@ -22,9 +27,10 @@ namespace xe {
 namespace gpu {
 namespace texture_conversion {
 
-typedef std::function<void(xenos::Endian, void*, const void*, size_t)>
-    CopyBlockCallback;
+typedef void (*CopyBlockCallback)(xenos::Endian endian, void* output,
+                                  const void* input, size_t length);
 
+// Copies length bytes, swapping them to little endian. Uses AVX2 if available.
 void CopySwapBlock(xenos::Endian endian, void* output, const void* input,
                    size_t length);
 void ConvertTexelCTX1ToR8G8(xenos::Endian endian, void* output,
@@ -32,8 +38,6 @@ void ConvertTexelCTX1ToR8G8(xenos::Endian endian, void* output,
 void ConvertTexelDXT3AToDXT3(xenos::Endian endian, void* output,
                              const void* input, size_t length);
 
-typedef std::function<void(void*, const void*, size_t)> UntileCopyBlockCallback;
-
 typedef struct UntileInfo {
   uint32_t offset_x;
   uint32_t offset_y;
@@ -43,12 +47,115 @@ typedef struct UntileInfo {
   uint32_t output_pitch;
   const FormatInfo* input_format_info;
   const FormatInfo* output_format_info;
-  UntileCopyBlockCallback copy_callback;
+  xenos::Endian endian;
+  CopyBlockCallback copy_block;
 } UntileInfo;
 
+// https://github.com/BinomialLLC/crunch/blob/ea9b8d8c00c8329791256adafa8cf11e4e7942a2/inc/crn_decomp.h#L4108
+inline uint32_t TiledOffset2DRow(uint32_t y, uint32_t width,
+                                 uint32_t log2_bpp) {
+  uint32_t macro = ((y / 32) * (width / 32)) << (log2_bpp + 7);
+  uint32_t micro = ((y & 6) << 2) << log2_bpp;
+  return macro + ((micro & ~0xF) << 1) + (micro & 0xF) +
+         ((y & 8) << (3 + log2_bpp)) + ((y & 1) << 4);
+}
+
+inline uint32_t TiledOffset2DColumn(uint32_t x, uint32_t y, uint32_t log2_bpp,
+                                    uint32_t base_offset) {
+  uint32_t macro = (x / 32) << (log2_bpp + 7);
+  uint32_t micro = (x & 7) << log2_bpp;
+  uint32_t offset =
+      base_offset + (macro + ((micro & ~0xF) << 1) + (micro & 0xF));
+  return ((offset & ~0x1FF) << 3) + ((offset & 0x1C0) << 2) + (offset & 0x3F) +
+         ((y & 16) << 7) + (((((y & 8) >> 2) + (x >> 3)) & 3) << 6);
+}
+
+// Log2 of the bytes per block, for blocks of 1 to 16 bytes.
+inline uint32_t GetTiledLog2BytesPerBlock(uint32_t bytes_per_block) {
+  return (bytes_per_block / 4) +
+         ((bytes_per_block / 2) >> (bytes_per_block / 4));
+}
+
+// The known copy_block functions are inlined. CopySwapBlock is done on whole
+// runs of blocks that the tiling keeps contiguous, with SSSE3 on x86-64.
 void Untile(uint8_t* output_buffer, const uint8_t* input_buffer,
             const UntileInfo* untile_info);
 
+// Untiles calling copy_block(output, input, output_bytes_per_block) for every
+// block, for conversions other than the ones Untile knows.
+template <typename CopyBlock>
+void UntileBlocks(uint8_t* output_buffer, const uint8_t* input_buffer,
+                  const UntileInfo* untile_info, CopyBlock&& copy_block) {
+  assert_not_null(untile_info);
+  assert_not_null(untile_info->input_format_info);
+  assert_not_null(untile_info->output_format_info);
+
+  uint32_t input_bytes_per_block =
+      untile_info->input_format_info->bytes_per_block();
+  uint32_t output_bytes_per_block =
+      untile_info->output_format_info->bytes_per_block();
+  uint32_t output_pitch = untile_info->output_pitch * output_bytes_per_block;
+  uint32_t log2_bpp = GetTiledLog2BytesPerBlock(input_bytes_per_block);
+
+  // Offset to the current row, in bytes.
+  uint32_t output_row_offset = 0;
+  for (uint32_t y = 0; y < untile_info->height; y++) {
+    auto input_row_offset = TiledOffset2DRow(
+        untile_info->offset_y + y, untile_info->input_pitch, log2_bpp);
+
+    // Go block-by-block on this row.
+    uint32_t output_offset = output_row_offset;
+
+    for (uint32_t x = 0; x < untile_info->width; x++) {
+      auto input_offset = TiledOffset2DColumn(untile_info->offset_x + x,
+                                              untile_info->offset_y + y,
+                                              log2_bpp, input_row_offset);
+      input_offset >>= log2_bpp;
+
+      copy_block(&output_buffer[output_offset],
+                 &input_buffer[input_offset * input_bytes_per_block],
+                 output_bytes_per_block);
+
+      output_offset += output_bytes_per_block;
+    }
+
+    output_row_offset += output_pitch;
+  }
+}
+
+// Worker threads for splitting the conversion of textures, the calling thread
+// takes jobs too.
+class ConversionWorkers {
+ public:
+  typedef std::function<void(size_t job_index)> Job;
+
+  explicit ConversionWorkers(uint32_t thread_count);
+  ~ConversionWorkers();
+
+  uint32_t thread_count() const { return uint32_t(threads_.size()); }
+
+  // Calls job for every index below job_count, returns when all are done. Must
+  // not be called from multiple threads at once.
+  void Run(size_t job_count, const Job& job);
+
+ private:
+  void WorkerThreadMain();
+  void RunJobs(const Job& job, size_t job_count);
+
+  std::mutex mutex_;
+  std::condition_variable work_cond_;
+  std::condition_variable done_cond_;
+  // Protected by mutex_. job_ is null when not running.
+  const Job* job_ = nullptr;
+  size_t job_count_ = 0;
+  uint64_t generation_ = 0;
+  uint32_t active_thread_count_ = 0;
+  bool shutting_down_ = false;
+
+  std::atomic<size_t> next_job_index_ = {0};
+  std::vector<std::unique_ptr<xe::threading::Thread>> threads_;
+};
+
 }  // namespace texture_conversion
 }  // namespace gpu
 }  // namespace xe
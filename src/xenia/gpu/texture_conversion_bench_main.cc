@@ -0,0 +1,177 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2020 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "xenia/base/cvar.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/main.h"
+#include "xenia/base/math.h"
+#include "xenia/base/threading.h"
+#include "xenia/gpu/texture_conversion.h"
+#include "xenia/gpu/texture_info.h"
+#include "xenia/gpu/xenos.h"
+
+DEFINE_int32(texture_conversion_bench_size, 2048,
+             "Width and height of the synthetic textures, in texels.", "GPU");
+DEFINE_int32(texture_conversion_bench_iterations, 10,
+             "Number of times each texture is converted.", "GPU");
+DEFINE_int32(texture_conversion_bench_threads, -1,
+             "Number of conversion threads besides the main thread, or -1 for "
+             "the number of logical processors minus one.",
+             "GPU");
+
+namespace xe {
+namespace gpu {
+namespace texture_conversion {
+
+struct BenchTexture {
+  const char* name;
+  xenos::TextureFormat format;
+  xenos::Endian endian;
+};
+
+// Untiles a texture in bands of rows like the Vulkan texture cache does.
+class TextureConversionBench {
+ public:
+  TextureConversionBench(const BenchTexture& texture, uint32_t size)
+      : texture_(texture) {
+    const FormatInfo* format_info = FormatInfo::Get(texture.format);
+    // Tiled textures are in 32x32 block tiles.
+    uint32_t blocks = size / format_info->block_width;
+    pitch_ = xe::round_up(blocks, 32u);
+    untile_info_.offset_x = 0;
+    untile_info_.offset_y = 0;
+    untile_info_.width = blocks;
+    untile_info_.height = blocks;
+    untile_info_.input_pitch = pitch_;
+    untile_info_.output_pitch = pitch_;
+    untile_info_.input_format_info = format_info;
+    untile_info_.output_format_info = format_info;
+    untile_info_.endian = texture.endian;
+    untile_info_.copy_block = CopySwapBlock;
+
+    size_t length = size_t(pitch_) * pitch_ * format_info->bytes_per_block();
+    input_.resize(length);
+    output_.resize(length);
+    std::mt19937 random(uint32_t(texture.format));
+    for (auto& value : input_) {
+      value = uint8_t(random());
+    }
+  }
+
+  size_t length() const { return input_.size(); }
+
+  // Calls the block copy function for every block, like Untile used to.
+  void RunPerBlock() {
+    std::function<void(xenos::Endian, void*, const void*, size_t)>
+        copy_block = CopySwapBlock;
+    xenos::Endian endian = texture_.endian;
+    UntileBlocks(output_.data(), input_.data(), &untile_info_,
+                 [&](void* output, const void* input, size_t length) {
+                   copy_block(endian, output, input, length);
+                 });
+  }
+
+  void Run(ConversionWorkers& workers) {
+    uint32_t row_length =
+        pitch_ * untile_info_.output_format_info->bytes_per_block();
+    uint32_t job_row_count = std::max(64u * 1024u / row_length, 1u);
+    size_t job_count =
+        (untile_info_.height + job_row_count - 1) / job_row_count;
+    workers.Run(job_count, [&](size_t job_index) {
+      UntileInfo untile_info = untile_info_;
+      uint32_t first_row = uint32_t(job_index) * job_row_count;
+      untile_info.offset_y = first_row;
+      untile_info.height =
+          std::min(job_row_count, untile_info_.height - first_row);
+      Untile(output_.data() + size_t(first_row) * row_length, input_.data(),
+             &untile_info);
+    });
+  }
+
+ private:
+  BenchTexture texture_;
+  uint32_t pitch_;
+  UntileInfo untile_info_;
+  std::vector<uint8_t> input_;
+  std::vector<uint8_t> output_;
+};
+
+// Returns MB/s of texture data converted by fn.
+double Measure(size_t length, uint32_t iterations,
+               const std::function<void()>& fn) {
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < iterations; ++i) {
+    fn();
+  }
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  return double(length) * iterations / seconds / (1024.0 * 1024.0);
+}
+
+int texture_conversion_bench_main(const std::vector<std::string>& args) {
+  if (cvars::texture_conversion_bench_size < 32 ||
+      cvars::texture_conversion_bench_iterations <= 0) {
+    XELOGE("The size must be at least 32 and the iteration count positive");
+    return 1;
+  }
+  uint32_t size = uint32_t(cvars::texture_conversion_bench_size);
+  uint32_t iterations = uint32_t(cvars::texture_conversion_bench_iterations);
+  int32_t thread_count = cvars::texture_conversion_bench_threads;
+  if (thread_count < 0) {
+    thread_count = int32_t(xe::threading::logical_processor_count()) - 1;
+  }
+
+  ConversionWorkers single_thread(0);
+  ConversionWorkers workers(uint32_t(std::max(thread_count, 0)));
+
+  const BenchTexture textures[] = {
+      {"8_8_8_8 8in32", xenos::TextureFormat::k_8_8_8_8,
+       xenos::Endian::k8in32},
+      {"5_6_5 8in16", xenos::TextureFormat::k_5_6_5, xenos::Endian::k8in16},
+      {"DXT1 8in16", xenos::TextureFormat::k_DXT1, xenos::Endian::k8in16},
+      {"DXT4_5 8in16", xenos::TextureFormat::k_DXT4_5,
+       xenos::Endian::k8in16},
+      {"16_16_16_16 8in16", xenos::TextureFormat::k_16_16_16_16,
+       xenos::Endian::k8in16},
+  };
+  std::printf("%ux%u texels, %u iterations, MB/s:\n", size, size, iterations);
+  std::string threaded_label =
+      std::to_string(workers.thread_count() + 1) + " threads";
+  std::printf("%-20s %12s %12s %12s\n", "Texture", "Per block", "Runs",
+              threaded_label.c_str());
+  for (const BenchTexture& texture : textures) {
+    TextureConversionBench bench(texture, size);
+    double per_block = Measure(bench.length(), iterations,
+                               [&]() { bench.RunPerBlock(); });
+    double runs = Measure(bench.length(), iterations,
+                          [&]() { bench.Run(single_thread); });
+    double threaded = Measure(bench.length(), iterations,
+                              [&]() { bench.Run(workers); });
+    std::printf("%-20s %12.1f %12.1f %12.1f\n", texture.name, per_block, runs,
+                threaded);
+  }
+  return 0;
+}
+
+}  // namespace texture_conversion
+}  // namespace gpu
+}  // namespace xe
+
+DEFINE_ENTRY_POINT("xenia-gpu-texture-conversion-bench",
+                   xe::gpu::texture_conversion::texture_conversion_bench_main,
+                   "");
@@ -28,6 +28,11 @@
 
 DEFINE_path(target_trace_file, "", "Specifies the trace file to load.", "GPU");
 DEFINE_path(trace_dump_path, "", "Output path for dumped files.", "GPU");
+DEFINE_int32(trace_dump_frame, 0,
+             "Index of the frame to dump. The state at the start of the frame "
+             "is only restored if the trace has an index, created with "
+             "xenia-gpu-trace-index.",
+             "GPU");
 
 namespace xe {
 namespace gpu {
@@ -116,8 +121,15 @@ bool TraceDump::Load(const std::filesystem::path& trace_file_path) {
 }
 
 int TraceDump::Run() {
+  if (cvars::trace_dump_frame < 0 ||
+      cvars::trace_dump_frame >= player_->frame_count()) {
+    XELOGE("Frame {} is out of range, the trace has {} frames",
+           cvars::trace_dump_frame, player_->frame_count());
+    return 1;
+  }
+
   BeginHostCapture();
-  player_->SeekFrame(0);
+  player_->SeekFrame(cvars::trace_dump_frame);
   player_->SeekCommand(
       static_cast<int>(player_->current_frame()->commands.size() - 1));
   player_->WaitOnPlayback();
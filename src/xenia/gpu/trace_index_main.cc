@@ -0,0 +1,104 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2020 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "xenia/base/cvar.h"
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/main.h"
+#include "xenia/base/string.h"
+#include "xenia/gpu/trace_indexer.h"
+#include "xenia/gpu/trace_protocol.h"
+
+DEFINE_transient_path(trace_index_input, "",
+                      "Trace file to add the index to.", "GPU");
+DEFINE_bool(trace_index_rebuild, false,
+            "Rebuild the index of traces that already have one.", "GPU");
+
+namespace xe {
+namespace gpu {
+
+// Version 2 traces only differ from version 3 ones by never having an index.
+constexpr uint32_t kUnindexedTraceFormatVersion = 2;
+
+bool UpgradeTraceVersion(const std::filesystem::path& path) {
+  FILE* file = xe::filesystem::OpenFile(path, "r+b");
+  if (!file) {
+    XELOGE("Failed to open {}", xe::path_to_utf8(path));
+    return false;
+  }
+  uint32_t version;
+  bool result = fread(&version, sizeof(version), 1, file) == 1;
+  if (result && version == kUnindexedTraceFormatVersion) {
+    XELOGI("Upgrading trace from version {} to {}", version,
+           kTraceFormatVersion);
+    version = kTraceFormatVersion;
+    result = xe::filesystem::Seek(file, 0, SEEK_SET) &&
+             fwrite(&version, sizeof(version), 1, file) == 1;
+  }
+  fclose(file);
+  return result;
+}
+
+int trace_index_main(const std::vector<std::string>& args) {
+  std::filesystem::path path = cvars::trace_index_input;
+  if (path.empty()) {
+    XELOGE("No trace file specified");
+    return 1;
+  }
+  if (!UpgradeTraceVersion(path)) {
+    return 1;
+  }
+
+  std::vector<uint8_t> index;
+  size_t commands_size;
+  {
+    TraceIndexer indexer;
+    if (!indexer.Open(path)) {
+      XELOGE("Failed to open trace {}", xe::path_to_utf8(path));
+      return 1;
+    }
+    if (indexer.has_index() && !cvars::trace_index_rebuild) {
+      XELOGI("Trace already has an index, use --trace_index_rebuild to "
+             "rebuild it");
+      return 0;
+    }
+    if (!indexer.BuildIndex(&index)) {
+      XELOGE("Failed to build the trace index");
+      return 1;
+    }
+    commands_size = indexer.commands_size();
+  }
+
+  // Replace the old index, if there is one.
+  FILE* file = xe::filesystem::OpenFile(path, "r+b");
+  if (!file) {
+    XELOGE("Failed to open {} for writing", xe::path_to_utf8(path));
+    return 1;
+  }
+  bool written = xe::filesystem::TruncateStdioFile(file, commands_size) &&
+                 xe::filesystem::Seek(file, int64_t(commands_size), SEEK_SET) &&
+                 fwrite(index.data(), 1, index.size(), file) == index.size();
+  fclose(file);
+  if (!written) {
+    XELOGE("Failed to write the trace index");
+    return 1;
+  }
+  XELOGI("Wrote {} byte index", index.size());
+  return 0;
+}
+
+}  // namespace gpu
+}  // namespace xe
+
+DEFINE_ENTRY_POINT("xenia-gpu-trace-index", xe::gpu::trace_index_main,
+                   "some.xtr", "trace_index_input");
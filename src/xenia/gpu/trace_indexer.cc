@@ -0,0 +1,341 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2020 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/gpu/trace_indexer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+
+#include "third_party/snappy/snappy.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/memory.h"
+#include "xenia/gpu/packet_disassembler.h"
+#include "xenia/gpu/register_file.h"
+#include "xenia/gpu/xenos.h"
+
+namespace xe {
+namespace gpu {
+
+namespace {
+
+template <typename T>
+void AppendIndexData(std::vector<uint8_t>* data, const T& value) {
+  auto bytes = reinterpret_cast<const uint8_t*>(&value);
+  data->insert(data->end(), bytes, bytes + sizeof(T));
+}
+
+}  // namespace
+
+bool TraceIndexer::BuildIndex(std::vector<uint8_t>* out_index) {
+  if (!trace_data_) {
+    return false;
+  }
+
+  std::vector<TraceIndexFrame> index_frames;
+  std::vector<TraceIndexPrimaryBuffer> index_primary_buffers;
+  std::vector<TraceIndexCheckpoint> index_checkpoints;
+  std::vector<std::string> checkpoint_data;
+  auto add_checkpoint = [&](const std::vector<TraceRegisterValue>& registers,
+                            std::vector<uint64_t>& memory_read_offsets,
+                            uint64_t edram_snapshot_offset,
+                            uint32_t base_checkpoint) {
+    std::sort(memory_read_offsets.begin(), memory_read_offsets.end());
+    std::vector<uint8_t> data;
+    TraceCheckpointHeader header;
+    header.register_count = uint32_t(registers.size());
+    header.memory_read_count = uint32_t(memory_read_offsets.size());
+    header.edram_snapshot_offset = edram_snapshot_offset;
+    AppendIndexData(&data, header);
+    for (const TraceRegisterValue& register_value : registers) {
+      AppendIndexData(&data, register_value);
+    }
+    uint64_t previous_offset = 0;
+    for (uint64_t offset : memory_read_offsets) {
+      AppendIndexData(&data, offset - previous_offset);
+      previous_offset = offset;
+    }
+    std::string encoded_data;
+    snappy::Compress(reinterpret_cast<const char*>(data.data()), data.size(),
+                     &encoded_data);
+    TraceIndexCheckpoint index_checkpoint;
+    // The offset is only known once all the tables are built.
+    index_checkpoint.offset = 0;
+    index_checkpoint.encoded_length = uint32_t(encoded_data.size());
+    index_checkpoint.decoded_length = uint32_t(data.size());
+    index_checkpoint.base_checkpoint = base_checkpoint;
+    index_checkpoint.reserved = 0;
+    index_checkpoints.push_back(index_checkpoint);
+    checkpoint_data.push_back(std::move(encoded_data));
+    return uint32_t(index_checkpoints.size() - 1);
+  };
+
+  // Current state.
+  std::vector<uint32_t> registers(RegisterFile::kRegisterCount, 0);
+  std::vector<bool> registers_written(RegisterFile::kRegisterCount, false);
+  // Offsets of the last kMemoryRead of each base_ptr and length.
+  std::unordered_map<uint64_t, uint64_t> latest_memory_reads;
+  uint64_t edram_snapshot_offset = 0;
+  // Whether the state has changed since the last frame checkpoint.
+  bool state_changed = true;
+
+  // State at the start of the current frame, primary buffer checkpoints only
+  // store the changes from it.
+  std::vector<uint32_t> frame_registers;
+  std::vector<bool> frame_registers_written;
+  // Memory reads (key and offset) done since the start of the frame.
+  std::vector<std::pair<uint64_t, uint64_t>> frame_memory_reads;
+  uint64_t frame_edram_snapshot_offset = 0;
+  uint32_t frame_checkpoint = kTraceNoCheckpoint;
+
+  size_t frame_index = 0;
+  auto begin_frames = [&](const uint8_t* trace_ptr) {
+    while (frame_index < frames_.size() &&
+           frames_[frame_index].start_ptr == trace_ptr) {
+      if (state_changed) {
+        std::vector<TraceRegisterValue> checkpoint_registers;
+        for (uint32_t i = 0; i < RegisterFile::kRegisterCount; ++i) {
+          if (registers_written[i]) {
+            checkpoint_registers.push_back({i, registers[i]});
+          }
+        }
+        std::vector<uint64_t> memory_read_offsets;
+        memory_read_offsets.reserve(latest_memory_reads.size());
+        for (const auto& memory_read : latest_memory_reads) {
+          memory_read_offsets.push_back(memory_read.second);
+        }
+        frame_checkpoint =
+            add_checkpoint(checkpoint_registers, memory_read_offsets,
+                           edram_snapshot_offset, kTraceNoCheckpoint);
+        state_changed = false;
+      }
+      const Frame& frame = frames_[frame_index];
+      TraceIndexFrame index_frame;
+      index_frame.start_offset = uint64_t(frame.start_ptr - trace_data_);
+      index_frame.end_offset = uint64_t(frame.end_ptr - trace_data_);
+      index_frame.checkpoint = frame_checkpoint;
+      index_frame.first_primary_buffer = uint32_t(index_primary_buffers.size());
+      index_frames.push_back(index_frame);
+
+      frame_registers = registers;
+      frame_registers_written = registers_written;
+      frame_memory_reads.clear();
+      frame_edram_snapshot_offset = edram_snapshot_offset;
+      ++frame_index;
+    }
+  };
+
+  // Registers loaded by a PM4_LOAD_ALU_CONSTANT packet, from the memory read
+  // recorded while executing it.
+  uint32_t alu_constant_index = 0;
+  uint32_t alu_constant_count = 0;
+  std::vector<uint8_t> alu_constant_data;
+
+  const uint8_t* trace_ptr = trace_data_ + sizeof(TraceHeader);
+  const uint8_t* commands_end = trace_data_ + commands_size_;
+  while (trace_ptr < commands_end) {
+    begin_frames(trace_ptr);
+    uint64_t offset = uint64_t(trace_ptr - trace_data_);
+    auto type = static_cast<TraceCommandType>(xe::load<uint32_t>(trace_ptr));
+    switch (type) {
+      case TraceCommandType::kPrimaryBufferStart: {
+        auto cmd =
+            reinterpret_cast<const PrimaryBufferStartCommand*>(trace_ptr);
+        trace_ptr += sizeof(*cmd) + cmd->count * 4;
+        if (!frame_index) {
+          break;
+        }
+        std::vector<TraceRegisterValue> checkpoint_registers;
+        for (uint32_t i = 0; i < RegisterFile::kRegisterCount; ++i) {
+          if (registers_written[i] && (!frame_registers_written[i] ||
+                                       registers[i] != frame_registers[i])) {
+            checkpoint_registers.push_back({i, registers[i]});
+          }
+        }
+        std::vector<uint64_t> memory_read_offsets;
+        for (const auto& memory_read : frame_memory_reads) {
+          if (latest_memory_reads[memory_read.first] == memory_read.second) {
+            memory_read_offsets.push_back(memory_read.second);
+          }
+        }
+        uint32_t checkpoint = frame_checkpoint;
+        if (!checkpoint_registers.empty() || !memory_read_offsets.empty() ||
+            edram_snapshot_offset != frame_edram_snapshot_offset) {
+          checkpoint = add_checkpoint(
+              checkpoint_registers, memory_read_offsets,
+              edram_snapshot_offset != frame_edram_snapshot_offset
+                  ? edram_snapshot_offset
+                  : 0,
+              frame_checkpoint);
+        }
+        TraceIndexPrimaryBuffer index_primary_buffer;
+        index_primary_buffer.offset = offset;
+        index_primary_buffer.checkpoint = checkpoint;
+        index_primary_buffer.frame = uint32_t(frame_index - 1);
+        index_primary_buffers.push_back(index_primary_buffer);
+        break;
+      }
+      case TraceCommandType::kPrimaryBufferEnd: {
+        auto cmd = reinterpret_cast<const PrimaryBufferEndCommand*>(trace_ptr);
+        trace_ptr += sizeof(*cmd);
+        break;
+      }
+      case TraceCommandType::kIndirectBufferStart: {
+        auto cmd =
+            reinterpret_cast<const IndirectBufferStartCommand*>(trace_ptr);
+        trace_ptr += sizeof(*cmd) + cmd->count * 4;
+        break;
+      }
+      case TraceCommandType::kIndirectBufferEnd: {
+        auto cmd = reinterpret_cast<const IndirectBufferEndCommand*>(trace_ptr);
+        trace_ptr += sizeof(*cmd);
+        break;
+      }
+      case TraceCommandType::kPacketStart: {
+        auto cmd = reinterpret_cast<const PacketStartCommand*>(trace_ptr);
+        const uint8_t* packet_ptr = trace_ptr + sizeof(*cmd);
+        trace_ptr += sizeof(*cmd) + cmd->count * 4;
+        if (!cmd->count) {
+          break;
+        }
+        PacketInfo packet_info;
+        if (!PacketDisassembler::DisasmPacket(packet_ptr, &packet_info)) {
+          break;
+        }
+        uint32_t packet = xe::load_and_swap<uint32_t>(packet_ptr);
+        bool load_alu_constant =
+            (packet >> 30) == 0x03 &&
+            ((packet >> 8) & 0x7F) == xenos::PM4_LOAD_ALU_CONSTANT;
+        if (load_alu_constant) {
+          // The disassembler doesn't know the values loaded from memory.
+          if (!packet_info.actions.empty()) {
+            alu_constant_index =
+                packet_info.actions.front().register_write.index;
+            alu_constant_count = uint32_t(packet_info.actions.size());
+          }
+          break;
+        }
+        for (const PacketAction& action : packet_info.actions) {
+          if (action.type != PacketAction::Type::kRegisterWrite ||
+              action.register_write.index >= RegisterFile::kRegisterCount) {
+            continue;
+          }
+          registers[action.register_write.index] =
+              action.register_write.value.u32;
+          registers_written[action.register_write.index] = true;
+          state_changed = true;
+        }
+        break;
+      }
+      case TraceCommandType::kPacketEnd: {
+        auto cmd = reinterpret_cast<const PacketEndCommand*>(trace_ptr);
+        trace_ptr += sizeof(*cmd);
+        alu_constant_count = 0;
+        break;
+      }
+      case TraceCommandType::kMemoryRead: {
+        auto cmd = reinterpret_cast<const MemoryCommand*>(trace_ptr);
+        trace_ptr += sizeof(*cmd) + cmd->encoded_length;
+        uint64_t key = uint64_t(cmd->base_ptr) << 32 | cmd->decoded_length;
+        latest_memory_reads[key] = offset;
+        frame_memory_reads.emplace_back(key, offset);
+        state_changed = true;
+        if (alu_constant_count &&
+            cmd->decoded_length == alu_constant_count * sizeof(uint32_t)) {
+          alu_constant_data.resize(cmd->decoded_length);
+          if (DecompressMemory(cmd->encoding_format,
+                               reinterpret_cast<const uint8_t*>(cmd + 1),
+                               cmd->encoded_length, alu_constant_data.data(),
+                               alu_constant_data.size())) {
+            for (uint32_t i = 0; i < alu_constant_count &&
+                                 alu_constant_index + i <
+                                     RegisterFile::kRegisterCount;
+                 ++i) {
+              registers[alu_constant_index + i] = xe::load_and_swap<uint32_t>(
+                  alu_constant_data.data() + i * sizeof(uint32_t));
+              registers_written[alu_constant_index + i] = true;
+            }
+          }
+          alu_constant_count = 0;
+        }
+        break;
+      }
+      case TraceCommandType::kMemoryWrite: {
+        auto cmd = reinterpret_cast<const MemoryCommand*>(trace_ptr);
+        trace_ptr += sizeof(*cmd) + cmd->encoded_length;
+        break;
+      }
+      case TraceCommandType::kEdramSnapshot: {
+        auto cmd = reinterpret_cast<const EdramSnapshotCommand*>(trace_ptr);
+        trace_ptr += sizeof(*cmd) + cmd->encoded_length;
+        edram_snapshot_offset = offset;
+        state_changed = true;
+        break;
+      }
+      case TraceCommandType::kEvent: {
+        auto cmd = reinterpret_cast<const EventCommand*>(trace_ptr);
+        trace_ptr += sizeof(*cmd);
+        break;
+      }
+      default:
+        XELOGE("Unknown trace command {} at {}", uint32_t(type), offset);
+        return false;
+    }
+  }
+  begin_frames(trace_ptr);
+  if (trace_ptr != commands_end || frame_index != frames_.size()) {
+    XELOGE("Trace commands don't end at the end of the trace");
+    return false;
+  }
+
+  // Checkpoint data is stored after the tables.
+  IndexCommand index;
+  index.type = TraceCommandType::kIndex;
+  index.frame_count = uint32_t(index_frames.size());
+  index.primary_buffer_count = uint32_t(index_primary_buffers.size());
+  index.checkpoint_count = uint32_t(index_checkpoints.size());
+  uint64_t data_offset =
+      commands_size_ + sizeof(index) +
+      index_frames.size() * sizeof(TraceIndexFrame) +
+      index_primary_buffers.size() * sizeof(TraceIndexPrimaryBuffer) +
+      index_checkpoints.size() * sizeof(TraceIndexCheckpoint);
+  for (size_t i = 0; i < index_checkpoints.size(); ++i) {
+    index_checkpoints[i].offset = data_offset;
+    data_offset += checkpoint_data[i].size();
+  }
+  index.length = data_offset + sizeof(TraceIndexTrailer) - commands_size_ -
+                 sizeof(index);
+
+  out_index->clear();
+  out_index->reserve(size_t(sizeof(index) + index.length));
+  AppendIndexData(out_index, index);
+  for (const TraceIndexFrame& index_frame : index_frames) {
+    AppendIndexData(out_index, index_frame);
+  }
+  for (const TraceIndexPrimaryBuffer& index_primary_buffer :
+       index_primary_buffers) {
+    AppendIndexData(out_index, index_primary_buffer);
+  }
+  for (const TraceIndexCheckpoint& index_checkpoint : index_checkpoints) {
+    AppendIndexData(out_index, index_checkpoint);
+  }
+  for (const std::string& data : checkpoint_data) {
+    out_index->insert(out_index->end(), data.begin(), data.end());
+  }
+  TraceIndexTrailer trailer;
+  trailer.index_offset = commands_size_;
+  trailer.magic = kTraceIndexMagic;
+  trailer.reserved = 0;
+  AppendIndexData(out_index, trailer);
+  return true;
+}
+
+}  // namespace gpu
+}  // namespace xe
@@ -0,0 +1,39 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2020 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_GPU_TRACE_INDEXER_H_
+#define XENIA_GPU_TRACE_INDEXER_H_
+
+#include <vector>
+
+#include "xenia/gpu/trace_reader.h"
+
+namespace xe {
+namespace gpu {
+
+// Builds the IndexCommand of a trace by walking its commands once, tracking
+// the register writes done by the packets and the memory reads.
+//
+// Register state is approximate: only what the packets write directly is
+// tracked, and predication of packets is ignored.
+class TraceIndexer : public TraceReader {
+ public:
+  // Builds the index of the opened trace, including its trailer, to be
+  // written at the end of the command stream (replacing the existing index,
+  // if there is one).
+  bool BuildIndex(std::vector<uint8_t>* out_index);
+
+  // Size of the trace without the index.
+  size_t commands_size() const { return commands_size_; }
+};
+
+}  // namespace gpu
+}  // namespace xe
+
+#endif  // XENIA_GPU_TRACE_INDEXER_H_
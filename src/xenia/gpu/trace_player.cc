@@ -9,6 +9,7 @@
 
 #include "xenia/gpu/trace_player.h"
 
+#include "xenia/base/logging.h"
 #include "xenia/gpu/command_processor.h"
 #include "xenia/gpu/graphics_system.h"
 #include "xenia/gpu/xenos.h"
@@ -51,8 +52,10 @@ void TracePlayer::SeekFrame(int target_frame) {
   current_command_index_ = int(frame->commands.size()) - 1;
 
   assert_true(frame->start_ptr <= frame->end_ptr);
+  // With an index, the state left by the previous frames is restored instead
+  // of depending on which frames were played before.
   PlayTrace(frame->start_ptr, frame->end_ptr - frame->start_ptr,
-            TracePlaybackMode::kBreakOnSwap, false);
+            TracePlaybackMode::kBreakOnSwap, false, frame->checkpoint);
 }
 
 void TracePlayer::SeekCommand(int target_command) {
@@ -72,11 +75,21 @@ void TracePlayer::SeekCommand(int target_command) {
     const auto& previous_command = frame->commands[previous_command_index];
     PlayTrace(previous_command.end_ptr,
               command.end_ptr - previous_command.end_ptr,
-              TracePlaybackMode::kBreakOnSwap, false);
+              TracePlaybackMode::kBreakOnSwap, false, kTraceNoCheckpoint);
   } else {
-    // Full playback from frame start.
-    PlayTrace(frame->start_ptr, command.end_ptr - frame->start_ptr,
-              TracePlaybackMode::kBreakOnSwap, true);
+    // Full playback from frame start, or, with an index, from the state at the
+    // start of the last primary buffer before the command.
+    const uint8_t* start_ptr = frame->start_ptr;
+    uint32_t checkpoint = frame->checkpoint;
+    for (const auto& primary_buffer : frame->primary_buffers) {
+      if (primary_buffer.start_ptr >= command.end_ptr) {
+        break;
+      }
+      start_ptr = primary_buffer.start_ptr;
+      checkpoint = primary_buffer.checkpoint;
+    }
+    PlayTrace(start_ptr, command.end_ptr - start_ptr,
+              TracePlaybackMode::kBreakOnSwap, true, checkpoint);
   }
 }
 
@@ -85,18 +98,51 @@ void TracePlayer::WaitOnPlayback() {
 }
 
 void TracePlayer::PlayTrace(const uint8_t* trace_data, size_t trace_size,
-                            TracePlaybackMode playback_mode,
-                            bool clear_caches) {
+                            TracePlaybackMode playback_mode, bool clear_caches,
+                            uint32_t checkpoint) {
   playing_trace_ = true;
   graphics_system_->command_processor()->CallInThread([=]() {
-    PlayTraceOnThread(trace_data, trace_size, playback_mode, clear_caches);
+    PlayTraceOnThread(trace_data, trace_size, playback_mode, clear_caches,
+                      checkpoint);
   });
 }
 
+void TracePlayer::RestoreCheckpointOnThread(uint32_t checkpoint) {
+  auto memory = graphics_system_->memory();
+  auto command_processor = graphics_system_->command_processor();
+
+  Checkpoint state;
+  if (!LoadCheckpoint(checkpoint, &state)) {
+    XELOGW("Failed to load trace checkpoint {}", checkpoint);
+    return;
+  }
+  for (const MemoryCommand* cmd : state.memory_reads) {
+    DecompressMemory(cmd->encoding_format,
+                     reinterpret_cast<const uint8_t*>(cmd + 1),
+                     cmd->encoded_length,
+                     memory->TranslatePhysical(cmd->base_ptr),
+                     cmd->decoded_length);
+    command_processor->TracePlaybackWroteMemory(cmd->base_ptr,
+                                                cmd->decoded_length);
+  }
+  if (state.edram_snapshot) {
+    if (!edram_snapshot_) {
+      edram_snapshot_ = new uint8_t[xenos::kEdramSizeBytes];
+    }
+    DecompressMemory(state.edram_snapshot->encoding_format,
+                     reinterpret_cast<const uint8_t*>(state.edram_snapshot + 1),
+                     state.edram_snapshot->encoded_length, edram_snapshot_,
+                     xenos::kEdramSizeBytes);
+    command_processor->RestoreEdramSnapshot(edram_snapshot_);
+  }
+  command_processor->RestoreTraceRegisters(state.registers.data(),
+                                           state.registers.size());
+}
+
 void TracePlayer::PlayTraceOnThread(const uint8_t* trace_data,
                                     size_t trace_size,
                                     TracePlaybackMode playback_mode,
-                                    bool clear_caches) {
+                                    bool clear_caches, uint32_t checkpoint) {
   auto memory = graphics_system_->memory();
   auto command_processor = graphics_system_->command_processor();
 
@@ -104,6 +150,10 @@ void TracePlayer::PlayTraceOnThread(const uint8_t* trace_data,
     command_processor->ClearCaches();
   }
 
+  if (checkpoint != kTraceNoCheckpoint) {
+    RestoreCheckpointOnThread(checkpoint);
+  }
+
   command_processor->set_swap_mode(SwapMode::kIgnored);
   playback_percent_ = 0;
   auto trace_end = trace_data + trace_size;
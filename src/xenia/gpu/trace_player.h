@@ -49,10 +49,15 @@ class TracePlayer : public TraceReader {
   void WaitOnPlayback();
 
  private:
+  // If the checkpoint is not kTraceNoCheckpoint, the state is restored from it
+  // before playing.
   void PlayTrace(const uint8_t* trace_data, size_t trace_size,
-                 TracePlaybackMode playback_mode, bool clear_caches);
+                 TracePlaybackMode playback_mode, bool clear_caches,
+                 uint32_t checkpoint);
   void PlayTraceOnThread(const uint8_t* trace_data, size_t trace_size,
-                         TracePlaybackMode playback_mode, bool clear_caches);
+                         TracePlaybackMode playback_mode, bool clear_caches,
+                         uint32_t checkpoint);
+  void RestoreCheckpointOnThread(uint32_t checkpoint);
 
   xe::ui::Loop* loop_;
   GraphicsSystem* graphics_system_;
@@ -23,7 +23,7 @@ static const char kTraceExtension[] = "xtr";
 // Other changes besides the file format may require bumps, such as
 // anything that changes what is recorded into the files (new GPU
 // command processor commands, etc).
-constexpr uint32_t kTraceFormatVersion = 1;
+constexpr uint32_t kTraceFormatVersion = 3;
 
 // Trace file header identifying information about the trace.
 // This must be positioned at the start of the file and must only occur once.
@@ -53,6 +53,7 @@ enum class TraceCommandType : uint32_t {
   kMemoryWrite,
   kEdramSnapshot,
   kEvent,
+  kIndex,
 };
 
 struct PrimaryBufferStartCommand {
@@ -93,6 +94,19 @@ enum class MemoryEncodingFormat {
   kNone,
   // Data is compressed with third_party/snappy.
   kSnappy,
+  // Data is identical to data stored earlier in the file, and is a
+  // MemoryReference to it. encoded_length == sizeof(MemoryReference).
+  kReference,
+};
+
+// Data of MemoryEncodingFormat::kReference commands.
+struct MemoryReference {
+  // Encoding format of the referenced data, never kReference.
+  MemoryEncodingFormat encoding_format;
+  // Number of bytes the referenced data occupies in the trace file.
+  uint32_t encoded_length;
+  // Offset of the referenced data from the start of the trace file.
+  uint64_t offset;
 };
 
 // Represents the GPU reading or writing data from or to memory.
@@ -134,6 +148,87 @@ struct EventCommand {
   Type event_type;
 };
 
+// Optional index of the trace for seeking to frames without replaying
+// everything before them. If present, it's the last command in the file, and
+// the file ends with its TraceIndexTrailer. Added by xenia-gpu-trace-index.
+//
+// Followed by:
+// - TraceIndexFrame[frame_count].
+// - TraceIndexPrimaryBuffer[primary_buffer_count].
+// - TraceIndexCheckpoint[checkpoint_count].
+// - Checkpoint data.
+// - TraceIndexTrailer.
+struct IndexCommand {
+  TraceCommandType type;
+  uint32_t frame_count;
+  uint32_t primary_buffer_count;
+  uint32_t checkpoint_count;
+  // Number of bytes following the command, including the trailer.
+  uint64_t length;
+};
+
+constexpr uint32_t kTraceNoCheckpoint = UINT32_MAX;
+
+struct TraceIndexFrame {
+  // Offsets from the start of the file of the first command of the frame and
+  // of the end of its last command.
+  uint64_t start_offset;
+  uint64_t end_offset;
+  // Checkpoint of the state at the start of the frame.
+  uint32_t checkpoint;
+  // Index of the first primary buffer started in the frame.
+  uint32_t first_primary_buffer;
+};
+
+struct TraceIndexPrimaryBuffer {
+  // Offset of the PrimaryBufferStartCommand from the start of the file.
+  uint64_t offset;
+  // Checkpoint of the state at the start of the primary buffer.
+  uint32_t checkpoint;
+  // Index of the frame the primary buffer is started in.
+  uint32_t frame;
+};
+
+struct TraceIndexCheckpoint {
+  // Offset of the checkpoint data, compressed with third_party/snappy, from
+  // the start of the file.
+  uint64_t offset;
+  uint32_t encoded_length;
+  uint32_t decoded_length;
+  // Checkpoint this one only contains the changes from, or kTraceNoCheckpoint.
+  uint32_t base_checkpoint;
+  uint32_t reserved;
+};
+
+// Decoded checkpoint data, followed by:
+// - TraceRegisterValue[register_count].
+// - uint64_t[memory_read_count] - offsets of the kMemoryRead commands needing
+//   to be replayed to restore the memory state, in increasing order, each
+//   stored as the difference from the previous one.
+struct TraceCheckpointHeader {
+  uint32_t register_count;
+  uint32_t memory_read_count;
+  // Offset of the last EdramSnapshotCommand before the checkpoint, or 0 if
+  // there's none (or it's the same as in the base checkpoint).
+  uint64_t edram_snapshot_offset;
+};
+
+struct TraceRegisterValue {
+  uint32_t index;
+  uint32_t value;
+};
+
+// "XTRI".
+constexpr uint32_t kTraceIndexMagic = 0x49525458;
+
+struct TraceIndexTrailer {
+  // Offset of the IndexCommand from the start of the file.
+  uint64_t index_offset;
+  // Set to kTraceIndexMagic.
+  uint32_t magic;
+  uint32_t reserved;
+};
+
 }  // namespace gpu
 }  // namespace xe
 
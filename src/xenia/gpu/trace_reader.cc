@@ -10,6 +10,7 @@
 #include "xenia/gpu/trace_reader.h"
 
 #include <cinttypes>
+#include <cstring>
 
 #include "third_party/snappy/snappy.h"
 #include "xenia/base/filesystem.h"
@@ -17,6 +18,7 @@
 #include "xenia/base/mapped_memory.h"
 #include "xenia/base/math.h"
 #include "xenia/gpu/packet_disassembler.h"
+#include "xenia/gpu/register_file.h"
 #include "xenia/gpu/trace_protocol.h"
 #include "xenia/memory.h"
 
@@ -52,8 +54,23 @@ bool TraceReader::Open(const std::filesystem::path& path) {
   XELOGI("    Commit: {}", commit_str);
   XELOGI("  Title ID: {}", header->title_id);
 
+  commands_size_ = trace_size_;
+  const IndexCommand* index = FindIndex();
+  if (index) {
+    commands_size_ = reinterpret_cast<const uint8_t*>(index) - trace_data_;
+  }
+
   ParseTrace();
 
+  if (index) {
+    if (ReadIndex(index)) {
+      XELOGI("     Index: {} frames, {} checkpoints", index->frame_count,
+             index->checkpoint_count);
+    } else {
+      XELOGW("Trace index doesn't match the trace, ignoring it");
+    }
+  }
+
   return true;
 }
 
@@ -61,6 +78,172 @@ void TraceReader::Close() {
   mmap_.reset();
   trace_data_ = nullptr;
   trace_size_ = 0;
+  commands_size_ = 0;
+  frames_.clear();
+  index_ = nullptr;
+  index_checkpoints_ = nullptr;
+}
+
+const IndexCommand* TraceReader::FindIndex() const {
+  if (trace_size_ < sizeof(TraceHeader) + sizeof(IndexCommand) +
+                        sizeof(TraceIndexTrailer)) {
+    return nullptr;
+  }
+  auto trailer = reinterpret_cast<const TraceIndexTrailer*>(
+      trace_data_ + trace_size_ - sizeof(TraceIndexTrailer));
+  if (trailer->magic != kTraceIndexMagic ||
+      trailer->index_offset < sizeof(TraceHeader) ||
+      trailer->index_offset > trace_size_ - sizeof(IndexCommand) -
+                                  sizeof(TraceIndexTrailer)) {
+    return nullptr;
+  }
+  auto index = reinterpret_cast<const IndexCommand*>(trace_data_ +
+                                                     trailer->index_offset);
+  if (index->type != TraceCommandType::kIndex ||
+      index->length != trace_size_ - trailer->index_offset - sizeof(*index)) {
+    return nullptr;
+  }
+  return index;
+}
+
+bool TraceReader::ReadIndex(const IndexCommand* index) {
+  uint64_t tables_length =
+      uint64_t(index->frame_count) * sizeof(TraceIndexFrame) +
+      uint64_t(index->primary_buffer_count) * sizeof(TraceIndexPrimaryBuffer) +
+      uint64_t(index->checkpoint_count) * sizeof(TraceIndexCheckpoint);
+  if (tables_length + sizeof(TraceIndexTrailer) > index->length ||
+      index->frame_count != frames_.size()) {
+    return false;
+  }
+  auto index_frames = reinterpret_cast<const TraceIndexFrame*>(index + 1);
+  auto index_primary_buffers = reinterpret_cast<const TraceIndexPrimaryBuffer*>(
+      index_frames + index->frame_count);
+  auto index_checkpoints = reinterpret_cast<const TraceIndexCheckpoint*>(
+      index_primary_buffers + index->primary_buffer_count);
+
+  for (uint32_t i = 0; i < index->frame_count; ++i) {
+    const TraceIndexFrame& index_frame = index_frames[i];
+    if (index_frame.start_offset !=
+            uint64_t(frames_[i].start_ptr - trace_data_) ||
+        index_frame.checkpoint >= index->checkpoint_count) {
+      return false;
+    }
+  }
+  for (uint32_t i = 0; i < index->primary_buffer_count; ++i) {
+    const TraceIndexPrimaryBuffer& primary_buffer = index_primary_buffers[i];
+    if (primary_buffer.offset + sizeof(PrimaryBufferStartCommand) >
+            commands_size_ ||
+        primary_buffer.checkpoint >= index->checkpoint_count ||
+        primary_buffer.frame >= index->frame_count) {
+      return false;
+    }
+  }
+
+  for (uint32_t i = 0; i < index->frame_count; ++i) {
+    frames_[i].checkpoint = index_frames[i].checkpoint;
+  }
+  for (uint32_t i = 0; i < index->primary_buffer_count; ++i) {
+    const TraceIndexPrimaryBuffer& primary_buffer = index_primary_buffers[i];
+    frames_[primary_buffer.frame].primary_buffers.push_back(
+        {trace_data_ + primary_buffer.offset, primary_buffer.checkpoint});
+  }
+  index_ = index;
+  index_checkpoints_ = index_checkpoints;
+  return true;
+}
+
+bool TraceReader::LoadCheckpoint(uint32_t checkpoint,
+                                 Checkpoint* out_checkpoint) const {
+  if (!index_ || checkpoint >= index_->checkpoint_count) {
+    return false;
+  }
+  const TraceIndexCheckpoint& index_checkpoint = index_checkpoints_[checkpoint];
+  if (index_checkpoint.base_checkpoint != kTraceNoCheckpoint) {
+    // Bases are always stored first, so there are no loops.
+    if (index_checkpoint.base_checkpoint >= checkpoint ||
+        !LoadCheckpoint(index_checkpoint.base_checkpoint, out_checkpoint)) {
+      return false;
+    }
+  } else {
+    out_checkpoint->registers.clear();
+    out_checkpoint->memory_reads.clear();
+    out_checkpoint->edram_snapshot = nullptr;
+  }
+
+  if (index_checkpoint.offset > trace_size_ ||
+      index_checkpoint.encoded_length >
+          trace_size_ - index_checkpoint.offset) {
+    return false;
+  }
+  auto encoded_data =
+      reinterpret_cast<const char*>(trace_data_ + index_checkpoint.offset);
+  size_t decoded_length;
+  if (!snappy::GetUncompressedLength(encoded_data,
+                                     index_checkpoint.encoded_length,
+                                     &decoded_length) ||
+      decoded_length != index_checkpoint.decoded_length ||
+      decoded_length < sizeof(TraceCheckpointHeader)) {
+    return false;
+  }
+  std::vector<uint8_t> data(decoded_length);
+  if (!snappy::RawUncompress(encoded_data, index_checkpoint.encoded_length,
+                             reinterpret_cast<char*>(data.data()))) {
+    return false;
+  }
+  TraceCheckpointHeader header;
+  std::memcpy(&header, data.data(), sizeof(header));
+  if (decoded_length != sizeof(header) +
+                            size_t(header.register_count) *
+                                sizeof(TraceRegisterValue) +
+                            size_t(header.memory_read_count) *
+                                sizeof(uint64_t)) {
+    return false;
+  }
+  const uint8_t* data_ptr = data.data() + sizeof(header);
+
+  for (uint32_t i = 0; i < header.register_count; ++i) {
+    TraceRegisterValue register_value;
+    std::memcpy(&register_value, data_ptr, sizeof(register_value));
+    data_ptr += sizeof(register_value);
+    if (register_value.index >= RegisterFile::kRegisterCount) {
+      return false;
+    }
+    out_checkpoint->registers.push_back(register_value);
+  }
+
+  uint64_t offset = 0;
+  for (uint32_t i = 0; i < header.memory_read_count; ++i) {
+    uint64_t offset_delta;
+    std::memcpy(&offset_delta, data_ptr, sizeof(offset_delta));
+    data_ptr += sizeof(offset_delta);
+    offset += offset_delta;
+    if (offset + sizeof(MemoryCommand) > commands_size_) {
+      return false;
+    }
+    auto cmd = reinterpret_cast<const MemoryCommand*>(trace_data_ + offset);
+    if (cmd->type != TraceCommandType::kMemoryRead ||
+        cmd->encoded_length >
+            commands_size_ - offset - sizeof(MemoryCommand)) {
+      return false;
+    }
+    out_checkpoint->memory_reads.push_back(cmd);
+  }
+
+  if (header.edram_snapshot_offset) {
+    if (header.edram_snapshot_offset + sizeof(EdramSnapshotCommand) >
+        commands_size_) {
+      return false;
+    }
+    auto cmd = reinterpret_cast<const EdramSnapshotCommand*>(
+        trace_data_ + header.edram_snapshot_offset);
+    if (cmd->type != TraceCommandType::kEdramSnapshot ||
+        cmd->encoded_length > commands_size_ - header.edram_snapshot_offset -
+                                  sizeof(EdramSnapshotCommand)) {
+      return false;
+    }
+    out_checkpoint->edram_snapshot = cmd;
+  }
+  return true;
 }
 
 void TraceReader::ParseTrace() {
@@ -78,7 +261,7 @@ void TraceReader::ParseTrace() {
   current_frame.command_tree =
       std::unique_ptr<CommandBuffer>(current_command_buffer);
 
-  while (trace_ptr < trace_data_ + trace_size_) {
+  while (trace_ptr < trace_data_ + commands_size_) {
     ++current_frame.command_count;
     auto type = static_cast<TraceCommandType>(xe::load<uint32_t>(trace_ptr));
     switch (type) {
@@ -205,6 +388,11 @@ void TraceReader::ParseTrace() {
         }
         break;
       }
+      case TraceCommandType::kIndex: {
+        auto cmd = reinterpret_cast<const IndexCommand*>(trace_ptr);
+        trace_ptr += sizeof(*cmd) + cmd->length;
+        break;
+      }
       default:
         // Broken trace file?
         assert_unhandled_case(type);
@@ -228,6 +416,19 @@ bool TraceReader::DecompressMemory(MemoryEncodingFormat encoding_format,
     case MemoryEncodingFormat::kSnappy:
       return snappy::RawUncompress(reinterpret_cast<const char*>(src), src_size,
                                    reinterpret_cast<char*>(dest));
+    case MemoryEncodingFormat::kReference: {
+      assert_true(src_size == sizeof(MemoryReference));
+      auto reference = reinterpret_cast<const MemoryReference*>(src);
+      if (reference->encoding_format == MemoryEncodingFormat::kReference ||
+          reference->offset + reference->encoded_length > trace_size_) {
+        XELOGE("Trace memory reference to {} bytes at {} is invalid",
+               reference->encoded_length, reference->offset);
+        return false;
+      }
+      return DecompressMemory(reference->encoding_format,
+                              trace_data_ + reference->offset,
+                              reference->encoded_length, dest, dest_size);
+    }
     default:
       assert_unhandled_case(encoding_format);
       return false;
@@ -117,6 +117,22 @@ class TraceReader {
 
     // Tree of all command buffers
     std::unique_ptr<CommandBuffer> command_tree;
+
+    // From the trace index, if the trace has one.
+    struct PrimaryBuffer {
+      const uint8_t* start_ptr;
+      uint32_t checkpoint;
+    };
+    uint32_t checkpoint = kTraceNoCheckpoint;
+    std::vector<PrimaryBuffer> primary_buffers;
+  };
+
+  // State to restore before playing from a point of an indexed trace.
+  struct Checkpoint {
+    std::vector<TraceRegisterValue> registers;
+    // Memory reads to replay, in file order.
+    std::vector<const MemoryCommand*> memory_reads;
+    const EdramSnapshotCommand* edram_snapshot = nullptr;
   };
 
   TraceReader() = default;
@@ -133,7 +149,13 @@ class TraceReader {
 
   void Close();
 
+  bool has_index() const { return index_ != nullptr; }
+  // Loads a checkpoint from the trace index.
+  bool LoadCheckpoint(uint32_t checkpoint, Checkpoint* out_checkpoint) const;
+
  protected:
+  const IndexCommand* FindIndex() const;
+  bool ReadIndex(const IndexCommand* index);
   void ParseTrace();
   bool DecompressMemory(MemoryEncodingFormat encoding_format,
                         const uint8_t* src, size_t src_size, uint8_t* dest,
@@ -142,7 +164,12 @@ class TraceReader {
   std::unique_ptr<MappedMemory> mmap_;
   const uint8_t* trace_data_ = nullptr;
   size_t trace_size_ = 0;
+  // Size of the command stream, excluding the index.
+  size_t commands_size_ = 0;
   std::vector<Frame> frames_;
+
+  const IndexCommand* index_ = nullptr;
+  const TraceIndexCheckpoint* index_checkpoints_ = nullptr;
 };
 
 }  // namespace gpu
@@ -11,7 +11,6 @@
 
 #include <cstring>
 
-#include "third_party/snappy/snappy-sinksource.h"
 #include "third_party/snappy/snappy.h"
 
 #include "build/version.h"
@@ -19,6 +18,7 @@
 #include "xenia/base/filesystem.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/string.h"
+#include "xenia/base/xxhash.h"
 #include "xenia/gpu/xenos.h"
 
 namespace xe {
@@ -27,7 +27,7 @@ namespace gpu {
 TraceWriter::TraceWriter(uint8_t* membase)
     : membase_(membase), file_(nullptr) {}
 
-TraceWriter::~TraceWriter() = default;
+TraceWriter::~TraceWriter() { Close(); }
 
 bool TraceWriter::Open(const std::filesystem::path& path, uint32_t title_id) {
   Close();
@@ -42,6 +42,7 @@ bool TraceWriter::Open(const std::filesystem::path& path, uint32_t title_id) {
   if (!file_) {
     return false;
   }
+  file_offset_ = 0;
 
   // Write header first. Must be at the top of the file.
   TraceHeader header;
@@ -49,21 +50,53 @@ bool TraceWriter::Open(const std::filesystem::path& path, uint32_t title_id) {
   std::memcpy(header.build_commit_sha, XE_BUILD_COMMIT,
               sizeof(header.build_commit_sha));
   header.title_id = title_id;
-  fwrite(&header, sizeof(header), 1, file_);
+  WriteFile(&header, sizeof(header));
 
   cached_memory_reads_.clear();
+  ClearSubmittedBlobs();
+  stored_blobs_.clear();
+  for (uint32_t i = 0; i < kBufferCount; ++i) {
+    buffers_[i].data.clear();
+  }
+  submitted_buffer_count_ = 0;
+  completed_buffer_count_ = 0;
+  flush_submitted_ = true;
+
+  buffer_submitted_event_ = xe::threading::Event::CreateAutoResetEvent(false);
+  buffer_completed_event_ = xe::threading::Event::CreateAutoResetEvent(false);
+  writer_thread_running_ = true;
+  writer_thread_ = xe::threading::Thread::Create(
+      {}, [this]() { WriterThreadMain(); });
+  writer_thread_->set_name("GPU Trace Writer");
   return true;
 }
 
 void TraceWriter::Flush() {
   if (file_) {
-    fflush(file_);
+    SubmitBuffer(true);
   }
 }
 
 void TraceWriter::Close() {
   if (file_) {
+    // Write everything still pending and wait for the writer thread to exit.
+    SubmitBuffer(true);
+    writer_thread_running_ = false;
+    buffer_submitted_event_->Set();
+    xe::threading::Wait(writer_thread_.get(), false);
+    writer_thread_.reset();
+    buffer_submitted_event_.reset();
+    buffer_completed_event_.reset();
+
     cached_memory_reads_.clear();
+    ClearSubmittedBlobs();
+    stored_blobs_.clear();
+    for (uint32_t i = 0; i < kBufferCount; ++i) {
+      buffers_[i].data.clear();
+      buffers_[i].data.shrink_to_fit();
+    }
+    compression_buffer_.clear();
+    compression_buffer_.shrink_to_fit();
 
     fflush(file_);
     fclose(file_);
@@ -80,7 +113,7 @@ void TraceWriter::WritePrimaryBufferStart(uint32_t base_ptr, uint32_t count) {
       base_ptr,
       0,
   };
-  fwrite(&cmd, 1, sizeof(cmd), file_);
+  AppendRaw(&cmd, sizeof(cmd));
 }
 
 void TraceWriter::WritePrimaryBufferEnd() {
@@ -90,7 +123,7 @@ void TraceWriter::WritePrimaryBufferEnd() {
   PrimaryBufferEndCommand cmd = {
       TraceCommandType::kPrimaryBufferEnd,
   };
-  fwrite(&cmd, 1, sizeof(cmd), file_);
+  AppendRaw(&cmd, sizeof(cmd));
 }
 
 void TraceWriter::WriteIndirectBufferStart(uint32_t base_ptr, uint32_t count) {
@@ -102,7 +135,7 @@ void TraceWriter::WriteIndirectBufferStart(uint32_t base_ptr, uint32_t count) {
       base_ptr,
       0,
   };
-  fwrite(&cmd, 1, sizeof(cmd), file_);
+  AppendRaw(&cmd, sizeof(cmd));
 }
 
 void TraceWriter::WriteIndirectBufferEnd() {
@@ -112,7 +145,7 @@ void TraceWriter::WriteIndirectBufferEnd() {
   IndirectBufferEndCommand cmd = {
       TraceCommandType::kIndirectBufferEnd,
   };
-  fwrite(&cmd, 1, sizeof(cmd), file_);
+  AppendRaw(&cmd, sizeof(cmd));
 }
 
 void TraceWriter::WritePacketStart(uint32_t base_ptr, uint32_t count) {
@@ -124,8 +157,11 @@ void TraceWriter::WritePacketStart(uint32_t base_ptr, uint32_t count) {
       base_ptr,
       count,
   };
-  fwrite(&cmd, 1, sizeof(cmd), file_);
-  fwrite(membase_ + base_ptr, 4, count, file_);
+  uint8_t* record =
+      AppendRecord(RecordType::kRaw, sizeof(cmd) + count * sizeof(uint32_t));
+  std::memcpy(record, &cmd, sizeof(cmd));
+  std::memcpy(record + sizeof(cmd), membase_ + base_ptr,
+              count * sizeof(uint32_t));
 }
 
 void TraceWriter::WritePacketEnd() {
@@ -135,7 +171,7 @@ void TraceWriter::WritePacketEnd() {
   PacketEndCommand cmd = {
       TraceCommandType::kPacketEnd,
   };
-  fwrite(&cmd, 1, sizeof(cmd), file_);
+  AppendRaw(&cmd, sizeof(cmd));
 }
 
 void TraceWriter::WriteMemoryRead(uint32_t base_ptr, size_t length,
@@ -180,85 +216,20 @@ void TraceWriter::WriteMemoryWrite(uint32_t base_ptr, size_t length,
                      host_ptr);
 }
 
-class SnappySink : public snappy::Sink {
- public:
-  SnappySink(FILE* file) : file_(file) {}
-
-  void Append(const char* bytes, size_t n) override {
-    fwrite(bytes, 1, n, file_);
-  }
-
- private:
-  FILE* file_ = nullptr;
-};
-
 void TraceWriter::WriteMemoryCommand(TraceCommandType type, uint32_t base_ptr,
                                      size_t length, const void* host_ptr) {
-  MemoryCommand cmd;
-  cmd.type = type;
-  cmd.base_ptr = base_ptr;
-  cmd.encoding_format = MemoryEncodingFormat::kNone;
-  cmd.encoded_length = cmd.decoded_length = static_cast<uint32_t>(length);
-
   if (!host_ptr) {
-    host_ptr = membase_ + cmd.base_ptr;
-  }
-
-  bool compress = compress_output_ && length > compression_threshold_;
-  if (compress) {
-    // Write the header now so we reserve space in the buffer.
-    long header_position = std::ftell(file_);
-    cmd.encoding_format = MemoryEncodingFormat::kSnappy;
-    fwrite(&cmd, 1, sizeof(cmd), file_);
-
-    // Stream the content right to the buffer.
-    snappy::ByteArraySource snappy_source(
-        reinterpret_cast<const char*>(host_ptr), cmd.decoded_length);
-    SnappySink snappy_sink(file_);
-    cmd.encoded_length =
-        static_cast<uint32_t>(snappy::Compress(&snappy_source, &snappy_sink));
-
-    // Seek back and overwrite the header with our final size.
-    std::fseek(file_, header_position, SEEK_SET);
-    fwrite(&cmd, 1, sizeof(cmd), file_);
-    std::fseek(file_, header_position + sizeof(cmd) + cmd.encoded_length,
-               SEEK_SET);
-  } else {
-    // Uncompressed - write buffer directly to the file.
-    cmd.encoding_format = MemoryEncodingFormat::kNone;
-    fwrite(&cmd, 1, sizeof(cmd), file_);
-    fwrite(host_ptr, 1, cmd.decoded_length, file_);
+    host_ptr = membase_ + base_ptr;
   }
+  WriteBlob(type, base_ptr, length, host_ptr);
 }
 
 void TraceWriter::WriteEdramSnapshot(const void* snapshot) {
-  EdramSnapshotCommand cmd;
-  cmd.type = TraceCommandType::kEdramSnapshot;
-  if (compress_output_) {
-    // Write the header now so we reserve space in the buffer.
-    long header_position = std::ftell(file_);
-    cmd.encoding_format = MemoryEncodingFormat::kSnappy;
-    fwrite(&cmd, 1, sizeof(cmd), file_);
-
-    // Stream the content right to the buffer.
-    snappy::ByteArraySource snappy_source(
-        reinterpret_cast<const char*>(snapshot), xenos::kEdramSizeBytes);
-    SnappySink snappy_sink(file_);
-    cmd.encoded_length =
-        static_cast<uint32_t>(snappy::Compress(&snappy_source, &snappy_sink));
-
-    // Seek back and overwrite the header with our final size.
-    std::fseek(file_, header_position, SEEK_SET);
-    fwrite(&cmd, 1, sizeof(cmd), file_);
-    std::fseek(file_, header_position + sizeof(cmd) + cmd.encoded_length,
-               SEEK_SET);
-  } else {
-    // Uncompressed - write buffer directly to the file.
-    cmd.encoding_format = MemoryEncodingFormat::kNone;
-    cmd.encoded_length = xenos::kEdramSizeBytes;
-    fwrite(&cmd, 1, sizeof(cmd), file_);
-    fwrite(snapshot, 1, xenos::kEdramSizeBytes, file_);
+  if (!file_) {
+    return;
   }
+  WriteBlob(TraceCommandType::kEdramSnapshot, 0, xenos::kEdramSizeBytes,
+            snapshot);
 }
 
 void TraceWriter::WriteEvent(EventCommand::Type event_type) {
@@ -269,7 +240,215 @@ void TraceWriter::WriteEvent(EventCommand::Type event_type) {
       TraceCommandType::kEvent,
       event_type,
   };
-  fwrite(&cmd, 1, sizeof(cmd), file_);
+  AppendRaw(&cmd, sizeof(cmd));
+}
+
+void TraceWriter::WriteBlob(TraceCommandType type, uint32_t base_ptr,
+                            size_t length, const void* data) {
+  BlobRecord blob;
+  blob.command_type = type;
+  blob.base_ptr = base_ptr;
+  blob.decoded_length = static_cast<uint32_t>(length);
+  blob.hash = 0;
+  if (length >= kMinDedupLength) {
+    // Hashing here rather than on the writer thread avoids copying contents
+    // that are already in the file to the buffers.
+    blob.hash = XXH3_64bits(data, length);
+    BlobKey key{blob.hash, blob.decoded_length};
+    auto it = submitted_blobs_.find(key);
+    if (it != submitted_blobs_.end()) {
+      if (!std::memcmp(it->second.data.data(), data, length)) {
+        submitted_blobs_lru_.splice(submitted_blobs_lru_.begin(),
+                                    submitted_blobs_lru_, it->second.lru_it);
+        std::memcpy(AppendRecord(RecordType::kBlobReference, sizeof(blob)),
+                    &blob, sizeof(blob));
+        return;
+      }
+      // Hash collision - the blob written below replaces the referenced one.
+      submitted_blob_bytes_ -= it->second.data.size();
+      submitted_blobs_lru_.erase(it->second.lru_it);
+      submitted_blobs_.erase(it);
+    }
+    if (length <= kMaxSubmittedBlobBytes) {
+      while (submitted_blob_bytes_ + length > kMaxSubmittedBlobBytes) {
+        auto lru_it = submitted_blobs_.find(submitted_blobs_lru_.back());
+        submitted_blob_bytes_ -= lru_it->second.data.size();
+        submitted_blobs_.erase(lru_it);
+        submitted_blobs_lru_.pop_back();
+      }
+      submitted_blobs_lru_.push_front(key);
+      SubmittedBlob& submitted_blob = submitted_blobs_[key];
+      auto data_bytes = reinterpret_cast<const uint8_t*>(data);
+      submitted_blob.data.assign(data_bytes, data_bytes + length);
+      submitted_blob.lru_it = submitted_blobs_lru_.begin();
+      submitted_blob_bytes_ += length;
+    }
+  }
+  uint8_t* record = AppendRecord(RecordType::kBlob, sizeof(blob) + length);
+  std::memcpy(record, &blob, sizeof(blob));
+  std::memcpy(record + sizeof(blob), data, length);
+}
+
+void TraceWriter::ClearSubmittedBlobs() {
+  submitted_blobs_.clear();
+  submitted_blobs_lru_.clear();
+  submitted_blob_bytes_ = 0;
+}
+
+uint8_t* TraceWriter::AppendRecord(RecordType type, size_t length) {
+  Buffer& buffer = buffers_[submitted_buffer_count_ % kBufferCount];
+  if (buffer.data.size() >= kBufferSubmitSize) {
+    SubmitBuffer(false);
+    return AppendRecord(type, length);
+  }
+  RecordHeader header;
+  header.type = type;
+  header.length = static_cast<uint32_t>(length);
+  size_t offset = buffer.data.size();
+  buffer.data.resize(offset + sizeof(header) + length);
+  std::memcpy(buffer.data.data() + offset, &header, sizeof(header));
+  return buffer.data.data() + offset + sizeof(header);
+}
+
+void TraceWriter::AppendRaw(const void* data, size_t length) {
+  std::memcpy(AppendRecord(RecordType::kRaw, length), data, length);
+}
+
+void TraceWriter::SubmitBuffer(bool flush) {
+  uint64_t buffer_index = submitted_buffer_count_;
+  Buffer& buffer = buffers_[buffer_index % kBufferCount];
+  if (buffer.data.empty() && (!flush || flush_submitted_)) {
+    return;
+  }
+  buffer.flush = flush;
+  flush_submitted_ = flush;
+  submitted_buffer_count_.store(buffer_index + 1, std::memory_order_release);
+  buffer_submitted_event_->Set();
+
+  // Wait for the writer thread to release the next buffer, if it's still
+  // writing it.
+  while (buffer_index + 1 - completed_buffer_count_ >= kBufferCount) {
+    xe::threading::Wait(buffer_completed_event_.get(), false);
+  }
+}
+
+void TraceWriter::WriterThreadMain() {
+  while (true) {
+    uint64_t buffer_index =
+        completed_buffer_count_.load(std::memory_order_relaxed);
+    if (buffer_index ==
+        submitted_buffer_count_.load(std::memory_order_acquire)) {
+      if (!writer_thread_running_) {
+        // Check again, the last buffer may be submitted right before exiting.
+        if (buffer_index ==
+            submitted_buffer_count_.load(std::memory_order_acquire)) {
+          break;
+        }
+        continue;
+      }
+      xe::threading::Wait(buffer_submitted_event_.get(), false);
+      continue;
+    }
+    Buffer& buffer = buffers_[buffer_index % kBufferCount];
+    WriteBuffer(buffer);
+    buffer.data.clear();
+    completed_buffer_count_.store(buffer_index + 1, std::memory_order_release);
+    buffer_completed_event_->Set();
+  }
+}
+
+void TraceWriter::WriteBuffer(const Buffer& buffer) {
+  const uint8_t* ptr = buffer.data.data();
+  const uint8_t* end = ptr + buffer.data.size();
+  while (ptr < end) {
+    RecordHeader header;
+    std::memcpy(&header, ptr, sizeof(header));
+    ptr += sizeof(header);
+    switch (header.type) {
+      case RecordType::kRaw:
+        WriteFile(ptr, header.length);
+        break;
+      case RecordType::kBlob:
+      case RecordType::kBlobReference: {
+        BlobRecord blob;
+        std::memcpy(&blob, ptr, sizeof(blob));
+        if (header.type == RecordType::kBlob) {
+          WriteBlobRecord(blob, ptr + sizeof(blob));
+        } else {
+          WriteBlobReferenceRecord(blob);
+        }
+        break;
+      }
+      default:
+        assert_unhandled_case(header.type);
+        break;
+    }
+    ptr += header.length;
+  }
+  if (buffer.flush) {
+    fflush(file_);
+  }
+}
+
+void TraceWriter::WriteBlobCommand(const BlobRecord& blob,
+                                   MemoryEncodingFormat encoding_format,
+                                   uint32_t encoded_length) {
+  if (blob.command_type == TraceCommandType::kEdramSnapshot) {
+    EdramSnapshotCommand cmd;
+    cmd.type = blob.command_type;
+    cmd.encoding_format = encoding_format;
+    cmd.encoded_length = encoded_length;
+    WriteFile(&cmd, sizeof(cmd));
+  } else {
+    MemoryCommand cmd;
+    cmd.type = blob.command_type;
+    cmd.base_ptr = blob.base_ptr;
+    cmd.encoding_format = encoding_format;
+    cmd.encoded_length = encoded_length;
+    cmd.decoded_length = blob.decoded_length;
+    WriteFile(&cmd, sizeof(cmd));
+  }
+}
+
+void TraceWriter::WriteBlobRecord(const BlobRecord& blob, const uint8_t* data) {
+  MemoryEncodingFormat encoding_format = MemoryEncodingFormat::kNone;
+  const void* encoded_data = data;
+  uint32_t encoded_length = blob.decoded_length;
+  // EDRAM snapshots are always worth compressing.
+  bool compress = compress_output_ &&
+                  (blob.command_type == TraceCommandType::kEdramSnapshot ||
+                   blob.decoded_length > compression_threshold_);
+  if (compress) {
+    snappy::Compress(reinterpret_cast<const char*>(data), blob.decoded_length,
+                     &compression_buffer_);
+    encoding_format = MemoryEncodingFormat::kSnappy;
+    encoded_data = compression_buffer_.data();
+    encoded_length = static_cast<uint32_t>(compression_buffer_.size());
+  }
+  WriteBlobCommand(blob, encoding_format, encoded_length);
+  if (blob.decoded_length >= kMinDedupLength) {
+    stored_blobs_[BlobKey{blob.hash, blob.decoded_length}] =
+        StoredBlob{encoding_format, encoded_length, file_offset_};
+  }
+  WriteFile(encoded_data, encoded_length);
+}
+
+void TraceWriter::WriteBlobReferenceRecord(const BlobRecord& blob) {
+  // Blobs are written in submission order, so the referenced one is always
+  // already in the file.
+  auto it = stored_blobs_.find(BlobKey{blob.hash, blob.decoded_length});
+  assert_true(it != stored_blobs_.end());
+  MemoryReference reference;
+  reference.encoding_format = it->second.encoding_format;
+  reference.encoded_length = it->second.encoded_length;
+  reference.offset = it->second.offset;
+  WriteBlobCommand(blob, MemoryEncodingFormat::kReference, sizeof(reference));
+  WriteFile(&reference, sizeof(reference));
+}
+
+void TraceWriter::WriteFile(const void* data, size_t length) {
+  fwrite(data, 1, length, file_);
+  file_offset_ += length;
 }
 
 }  //  namespace gpu
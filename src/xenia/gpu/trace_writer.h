@@ -10,15 +10,28 @@
 #ifndef XENIA_GPU_TRACE_WRITER_H_
 #define XENIA_GPU_TRACE_WRITER_H_
 
+#include <atomic>
 #include <filesystem>
+#include <list>
+#include <memory>
 #include <set>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
+#include "xenia/base/threading.h"
 #include "xenia/gpu/trace_protocol.h"
 
 namespace xe {
 namespace gpu {
 
+// Records GPU commands and the memory they use into a trace file.
+//
+// Commands are serialized into one of two buffers on the calling thread, and
+// compressed and written to the file on a separate writer thread, so tracing
+// doesn't stall the command processor on compression and file I/O. Memory
+// contents are hashed and stored once, later commands with identical contents
+// only reference them.
 class TraceWriter {
  public:
   explicit TraceWriter(uint8_t* membase);
@@ -46,8 +59,69 @@ class TraceWriter {
   void WriteEvent(EventCommand::Type event_type);
 
  private:
+  // Types of the records in buffers passed to the writer thread.
+  enum class RecordType : uint32_t {
+    // Data written to the file as is.
+    kRaw,
+    // BlobRecord followed by the data of a memory or EDRAM snapshot command.
+    kBlob,
+    // BlobRecord of a memory or EDRAM snapshot command with data identical to
+    // an earlier kBlob.
+    kBlobReference,
+  };
+  struct RecordHeader {
+    RecordType type;
+    // Number of bytes following the header.
+    uint32_t length;
+  };
+  struct BlobRecord {
+    TraceCommandType command_type;
+    uint32_t base_ptr;
+    uint32_t decoded_length;
+    uint64_t hash;
+  };
+
+  struct BlobKey {
+    uint64_t hash;
+    uint32_t length;
+    bool operator==(const BlobKey& other) const {
+      return hash == other.hash && length == other.length;
+    }
+  };
+  struct BlobKeyHasher {
+    size_t operator()(const BlobKey& key) const { return size_t(key.hash); }
+  };
+
+  struct Buffer {
+    std::vector<uint8_t> data;
+    // Whether to flush the file after writing the buffer.
+    bool flush = false;
+  };
+  static constexpr uint32_t kBufferCount = 2;
+  // Buffers are passed to the writer thread once they reach this size.
+  static constexpr size_t kBufferSubmitSize = 4 * 1024 * 1024;
+  // Blobs smaller than this aren't worth hashing and referencing.
+  static constexpr size_t kMinDedupLength = 64;
+  // Total size of the recently written blob contents kept for referencing.
+  static constexpr size_t kMaxSubmittedBlobBytes = 64 * 1024 * 1024;
+
   void WriteMemoryCommand(TraceCommandType type, uint32_t base_ptr,
                           size_t length, const void* host_ptr = nullptr);
+  void WriteBlob(TraceCommandType type, uint32_t base_ptr, size_t length,
+                 const void* data);
+  void ClearSubmittedBlobs();
+  uint8_t* AppendRecord(RecordType type, size_t length);
+  void AppendRaw(const void* data, size_t length);
+  void SubmitBuffer(bool flush);
+
+  void WriterThreadMain();
+  void WriteBuffer(const Buffer& buffer);
+  void WriteBlobCommand(const BlobRecord& blob,
+                        MemoryEncodingFormat encoding_format,
+                        uint32_t encoded_length);
+  void WriteBlobRecord(const BlobRecord& blob, const uint8_t* data);
+  void WriteBlobReferenceRecord(const BlobRecord& blob);
+  void WriteFile(const void* data, size_t length);
 
   std::set<uint64_t> cached_memory_reads_;
   uint8_t* membase_;
@@ -55,6 +129,42 @@ class TraceWriter {
 
   bool compress_output_ = true;
   size_t compression_threshold_ = 1024;  // Min. number of bytes to compress.
+
+  // Buffers are filled by the calling thread in order, the writer thread owns
+  // the ones that have been submitted but not completed.
+  Buffer buffers_[kBufferCount];
+  std::atomic<uint64_t> submitted_buffer_count_ = {0};
+  std::atomic<uint64_t> completed_buffer_count_ = {0};
+  std::atomic<bool> writer_thread_running_ = {false};
+  std::unique_ptr<xe::threading::Event> buffer_submitted_event_;
+  std::unique_ptr<xe::threading::Event> buffer_completed_event_;
+  std::unique_ptr<xe::threading::Thread> writer_thread_;
+  // Contents of the latest blob written in full for each key, as seen by the
+  // calling thread, kept to check that blobs with the same hash are actually
+  // identical before referencing. Least recently used contents are dropped
+  // when they exceed kMaxSubmittedBlobBytes, and are written in full again
+  // when they're seen next time.
+  struct SubmittedBlob {
+    std::vector<uint8_t> data;
+    std::list<BlobKey>::iterator lru_it;
+  };
+  std::unordered_map<BlobKey, SubmittedBlob, BlobKeyHasher> submitted_blobs_;
+  // Most recently used first.
+  std::list<BlobKey> submitted_blobs_lru_;
+  size_t submitted_blob_bytes_ = 0;
+  // Whether a flush has been requested after the last submitted buffer.
+  bool flush_submitted_ = true;
+
+  // Writer thread state. Location of the latest blob written in full for each
+  // key, which is what references to the key point to.
+  struct StoredBlob {
+    MemoryEncodingFormat encoding_format;
+    uint32_t encoded_length;
+    uint64_t offset;
+  };
+  std::unordered_map<BlobKey, StoredBlob, BlobKeyHasher> stored_blobs_;
+  uint64_t file_offset_ = 0;
+  std::string compression_buffer_;
 };
 
 }  // namespace gpu
@@ -9,16 +9,26 @@
 
 #include "xenia/gpu/vulkan/pipeline_cache.h"
 
+#include "build/version.h"
+#include "xenia/base/byte_order.h"
+#include "xenia/base/clock.h"
+#include "xenia/base/filesystem.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/base/memory.h"
 #include "xenia/base/profiling.h"
+#include "xenia/base/string.h"
 #include "xenia/base/xxhash.h"
 #include "xenia/gpu/gpu_flags.h"
 #include "xenia/gpu/vulkan/vulkan_gpu_flags.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cinttypes>
+#include <map>
+#include <set>
 #include <string>
+#include <utility>
 
 namespace xe {
 namespace gpu {
@@ -34,9 +44,13 @@ using xe::ui::vulkan::CheckResult;
 #include "xenia/gpu/vulkan/shaders/bin/rect_list_geom.h"
 
 PipelineCache::PipelineCache(RegisterFile* register_file,
-                             ui::vulkan::VulkanDevice* device)
-    : register_file_(register_file), device_(device) {
+                             ui::vulkan::VulkanDevice* device,
+                             RenderCache* render_cache)
+    : register_file_(register_file),
+      device_(device),
+      render_cache_(render_cache) {
   shader_translator_.reset(new SpirvShaderTranslator());
+  std::memset(&update_description_, 0, sizeof(update_description_));
 }
 
 PipelineCache::~PipelineCache() { Shutdown(); }
@@ -47,10 +61,8 @@ VkResult PipelineCache::Initialize(
     VkDescriptorSetLayout vertex_descriptor_set_layout) {
   VkResult status;
 
-  // Initialize the shared driver pipeline cache.
-  // We'll likely want to serialize this and reuse it, if that proves to be
-  // useful. If the shaders are expensive and this helps we could do it per
-  // game, otherwise a single shared cache for render state/etc.
+  // Initialize the shared driver pipeline cache. The data from the previous
+  // runs of the title is merged into it when the shader storage is opened.
   VkPipelineCacheCreateInfo pipeline_cache_info;
   pipeline_cache_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
   pipeline_cache_info.pNext = nullptr;
@@ -169,7 +181,7 @@ VkResult PipelineCache::Initialize(
 }
 
 void PipelineCache::Shutdown() {
-  ClearCache();
+  ClearCache(true);
 
   // Destroy geometry shaders.
   if (geometry_shaders_.line_quad_list) {
@@ -203,13 +215,698 @@ void PipelineCache::Shutdown() {
   }
 }
 
+void PipelineCache::InitializeShaderStorage(
+    const std::filesystem::path& cache_root, uint32_t title_id, bool blocking) {
+  ShutdownShaderStorage();
+
+  auto shader_storage_root = cache_root / "shaders";
+  // For files that can be moved between different hosts.
+  auto shader_storage_shareable_root = shader_storage_root / "shareable";
+  // For the SPIR-V, which depends on the build, and the driver pipeline cache,
+  // which depends on the device and the driver.
+  auto shader_storage_local_root = shader_storage_root / "local";
+  for (const std::filesystem::path& storage_root :
+       {shader_storage_shareable_root, shader_storage_local_root}) {
+    if (!std::filesystem::exists(storage_root) &&
+        !std::filesystem::create_directories(storage_root)) {
+      XELOGE(
+          "Failed to create a shader storage directory, persistent shader "
+          "storage will be disabled: {}",
+          xe::path_to_utf8(storage_root));
+      return;
+    }
+  }
+
+  // Let the driver skip compilation of the pipelines it has seen before.
+  LoadPipelineCacheData(shader_storage_local_root /
+                        fmt::format("{:08X}.vulkan.vkpc", title_id));
+
+  // Initialize the pipeline storage stream - read pipeline descriptions and
+  // collect used shader modifications to translate.
+  std::vector<PipelineStoredDescription> pipeline_stored_descriptions;
+  // <Shader hash, modification bits>.
+  std::set<std::pair<uint64_t, uint64_t>> shader_translations_needed;
+  auto pipeline_storage_file_path =
+      shader_storage_shareable_root /
+      fmt::format("{:08X}.vulkan.xpso", title_id);
+  pipeline_storage_file_ =
+      xe::filesystem::OpenFile(pipeline_storage_file_path, "a+b");
+  if (!pipeline_storage_file_) {
+    XELOGE(
+        "Failed to open the Vulkan pipeline description storage file for "
+        "writing, persistent shader storage will be disabled: {}",
+        xe::path_to_utf8(pipeline_storage_file_path));
+    return;
+  }
+  // 'XEPS'.
+  const uint32_t pipeline_storage_magic = 0x53504558;
+  // 'VKSP'.
+  const uint32_t pipeline_storage_magic_api = 0x50534B56;
+  const uint32_t pipeline_storage_version_swapped =
+      xe::byte_swap(PipelineDescription::kVersion);
+  struct {
+    uint32_t magic;
+    uint32_t magic_api;
+    uint32_t version_swapped;
+  } pipeline_storage_file_header;
+  if (fread(&pipeline_storage_file_header, sizeof(pipeline_storage_file_header),
+            1, pipeline_storage_file_) &&
+      pipeline_storage_file_header.magic == pipeline_storage_magic &&
+      pipeline_storage_file_header.magic_api == pipeline_storage_magic_api &&
+      pipeline_storage_file_header.version_swapped ==
+          pipeline_storage_version_swapped) {
+    xe::filesystem::Seek(pipeline_storage_file_, 0, SEEK_END);
+    int64_t pipeline_storage_told_end =
+        xe::filesystem::Tell(pipeline_storage_file_);
+    size_t pipeline_storage_told_count =
+        size_t(pipeline_storage_told_end >=
+                       int64_t(sizeof(pipeline_storage_file_header))
+                   ? (uint64_t(pipeline_storage_told_end) -
+                      sizeof(pipeline_storage_file_header)) /
+                         sizeof(PipelineStoredDescription)
+                   : 0);
+    if (pipeline_storage_told_count &&
+        xe::filesystem::Seek(pipeline_storage_file_,
+                             int64_t(sizeof(pipeline_storage_file_header)),
+                             SEEK_SET)) {
+      pipeline_stored_descriptions.resize(pipeline_storage_told_count);
+      pipeline_stored_descriptions.resize(
+          fread(pipeline_stored_descriptions.data(),
+                sizeof(PipelineStoredDescription), pipeline_storage_told_count,
+                pipeline_storage_file_));
+      size_t pipeline_storage_read_count = pipeline_stored_descriptions.size();
+      for (size_t i = 0; i < pipeline_storage_read_count; ++i) {
+        const PipelineStoredDescription& pipeline_stored_description =
+            pipeline_stored_descriptions[i];
+        // Validate file integrity, stop and truncate the stream if data is
+        // corrupted.
+        if (XXH3_64bits(&pipeline_stored_description.description,
+                        sizeof(pipeline_stored_description.description)) !=
+            pipeline_stored_description.description_hash) {
+          pipeline_stored_descriptions.resize(i);
+          break;
+        }
+        // Mark the shader modifications as needed for translation.
+        shader_translations_needed.emplace(
+            pipeline_stored_description.description.vertex_shader_hash,
+            pipeline_stored_description.description.vertex_shader_modification);
+        if (pipeline_stored_description.description.pixel_shader_hash) {
+          shader_translations_needed.emplace(
+              pipeline_stored_description.description.pixel_shader_hash,
+              pipeline_stored_description.description
+                  .pixel_shader_modification);
+        }
+      }
+    }
+  }
+
+  // Initialize the SPIR-V storage stream - read the translations done by the
+  // previous runs, which are also needed as they've been used.
+  // <Shader hash, modification bits> -> SPIR-V.
+  std::map<std::pair<uint64_t, uint64_t>, std::vector<uint8_t>> stored_spirv;
+  auto spirv_storage_file_path =
+      shader_storage_local_root / fmt::format("{:08X}.vulkan.xspv", title_id);
+  spirv_storage_file_ =
+      xe::filesystem::OpenFile(spirv_storage_file_path, "a+b");
+  if (!spirv_storage_file_) {
+    XELOGE(
+        "Failed to open the SPIR-V storage file for writing, persistent "
+        "shader storage will be disabled: {}",
+        xe::path_to_utf8(spirv_storage_file_path));
+    fclose(pipeline_storage_file_);
+    pipeline_storage_file_ = nullptr;
+    return;
+  }
+  SpirvStorageFileHeader spirv_storage_file_header;
+  if (fread(&spirv_storage_file_header, sizeof(spirv_storage_file_header), 1,
+            spirv_storage_file_) &&
+      spirv_storage_file_header.magic == kSpirvStorageMagic &&
+      xe::byte_swap(spirv_storage_file_header.version_swapped) ==
+          SpirvStoredHeader::kVersion &&
+      !std::memcmp(spirv_storage_file_header.build_commit, XE_BUILD_COMMIT,
+                   sizeof(spirv_storage_file_header.build_commit))) {
+    uint64_t spirv_storage_valid_bytes = sizeof(spirv_storage_file_header);
+    SpirvStoredHeader spirv_header;
+    while (fread(&spirv_header, sizeof(spirv_header), 1,
+                 spirv_storage_file_)) {
+      size_t spirv_byte_count =
+          spirv_header.spirv_dword_count * sizeof(uint32_t);
+      std::vector<uint8_t> spirv(spirv_byte_count);
+      if (spirv_byte_count &&
+          !fread(spirv.data(), spirv_byte_count, 1, spirv_storage_file_)) {
+        break;
+      }
+      if (XXH3_64bits(spirv.data(), spirv_byte_count) !=
+          spirv_header.spirv_hash) {
+        // Validation failed.
+        break;
+      }
+      spirv_storage_valid_bytes += sizeof(spirv_header) + spirv_byte_count;
+      std::pair<uint64_t, uint64_t> translation_key;
+      translation_key.first = spirv_header.ucode_data_hash;
+      translation_key.second = spirv_header.modification;
+      shader_translations_needed.insert(translation_key);
+      stored_spirv[translation_key] = std::move(spirv);
+    }
+    xe::filesystem::TruncateStdioFile(spirv_storage_file_,
+                                      spirv_storage_valid_bytes);
+  } else {
+    xe::filesystem::TruncateStdioFile(spirv_storage_file_, 0);
+    spirv_storage_file_header.magic = kSpirvStorageMagic;
+    spirv_storage_file_header.version_swapped =
+        xe::byte_swap(SpirvStoredHeader::kVersion);
+    std::memcpy(spirv_storage_file_header.build_commit, XE_BUILD_COMMIT,
+                sizeof(spirv_storage_file_header.build_commit));
+    fwrite(&spirv_storage_file_header, sizeof(spirv_storage_file_header), 1,
+           spirv_storage_file_);
+  }
+
+  size_t logical_processor_count = xe::threading::logical_processor_count();
+  if (!logical_processor_count) {
+    // Pick some reasonable amount if couldn't determine the number of cores.
+    logical_processor_count = 6;
+  }
+
+  // Initialize the Xenos shader storage stream.
+  uint64_t shader_storage_initialization_start =
+      xe::Clock::QueryHostTickCount();
+  auto shader_storage_file_path =
+      shader_storage_shareable_root / fmt::format("{:08X}.xsh", title_id);
+  shader_storage_file_ =
+      xe::filesystem::OpenFile(shader_storage_file_path, "a+b");
+  if (!shader_storage_file_) {
+    XELOGE(
+        "Failed to open the guest shader storage file for writing, persistent "
+        "shader storage will be disabled: {}",
+        xe::path_to_utf8(shader_storage_file_path));
+    fclose(spirv_storage_file_);
+    spirv_storage_file_ = nullptr;
+    fclose(pipeline_storage_file_);
+    pipeline_storage_file_ = nullptr;
+    return;
+  }
+  ++shader_storage_index_;
+  storage_file_flush_needed_ = false;
+  // Translations not loaded from the SPIR-V storage, to write there.
+  std::vector<VulkanShader::VulkanTranslation*> translations_to_store;
+  ShaderStorageFileHeader shader_storage_file_header;
+  if (fread(&shader_storage_file_header, sizeof(shader_storage_file_header), 1,
+            shader_storage_file_) &&
+      shader_storage_file_header.magic == kShaderStorageMagic &&
+      xe::byte_swap(shader_storage_file_header.version_swapped) ==
+          ShaderStoredHeader::kVersion) {
+    uint64_t shader_storage_valid_bytes = sizeof(shader_storage_file_header);
+    // Load and translate shaders written by previous Xenia executions until the
+    // end of the file or until a corrupted one is detected.
+    ShaderStoredHeader shader_header;
+    std::vector<uint32_t> ucode_dwords;
+    ucode_dwords.reserve(0xFFFF);
+    size_t shaders_loaded = 0;
+    std::atomic<size_t> translations_loaded(0);
+
+    // Threads overlapping file reading.
+    std::mutex shaders_translation_thread_mutex;
+    std::condition_variable shaders_translation_thread_cond;
+    std::deque<VulkanShader*> shaders_to_translate;
+    size_t shader_translation_threads_busy = 0;
+    bool shader_translation_threads_shutdown = false;
+    std::mutex shaders_translated_mutex;
+    std::vector<VulkanShader::VulkanTranslation*> shaders_failed_to_translate;
+    auto shader_translation_thread_function = [&]() {
+      SpirvShaderTranslator translator;
+      StringBuffer ucode_disasm_buffer;
+      for (;;) {
+        VulkanShader* shader_to_translate;
+        for (;;) {
+          std::unique_lock<std::mutex> lock(shaders_translation_thread_mutex);
+          if (shaders_to_translate.empty()) {
+            if (shader_translation_threads_shutdown) {
+              return;
+            }
+            shaders_translation_thread_cond.wait(lock);
+            continue;
+          }
+          shader_to_translate = shaders_to_translate.front();
+          shaders_to_translate.pop_front();
+          ++shader_translation_threads_busy;
+          break;
+        }
+        shader_to_translate->AnalyzeUcode(ucode_disasm_buffer);
+        // Load or translate each needed modification on this thread after
+        // performing modification-independent analysis of the whole shader.
+        uint64_t ucode_data_hash = shader_to_translate->ucode_data_hash();
+        for (auto modification_it = shader_translations_needed.lower_bound(
+                 std::make_pair(ucode_data_hash, uint64_t(0)));
+             modification_it != shader_translations_needed.end() &&
+             modification_it->first == ucode_data_hash;
+             ++modification_it) {
+          VulkanShader::VulkanTranslation* translation =
+              static_cast<VulkanShader::VulkanTranslation*>(
+                  shader_to_translate->GetOrCreateTranslation(
+                      modification_it->second));
+          // Only try (and delete in case of failure) if it's a new translation.
+          // If it's a shader previously encountered in the game, translation of
+          // which has failed, and the shader storage is loaded later, keep it
+          // this way not to try to translate it again.
+          if (translation->is_translated()) {
+            continue;
+          }
+          // Only the elements, not the map itself, are modified here, and each
+          // translation is only handled by one thread.
+          auto spirv_it = stored_spirv.find(*modification_it);
+          if (spirv_it != stored_spirv.end()) {
+            if (LoadStoredTranslation(*translation,
+                                      std::move(spirv_it->second))) {
+              ++translations_loaded;
+              continue;
+            }
+          } else if (TranslateAnalyzedShader(translator, *translation)) {
+            std::lock_guard<std::mutex> lock(shaders_translated_mutex);
+            translations_to_store.push_back(translation);
+            continue;
+          }
+          std::lock_guard<std::mutex> lock(shaders_translated_mutex);
+          shaders_failed_to_translate.push_back(translation);
+        }
+        {
+          std::lock_guard<std::mutex> lock(shaders_translation_thread_mutex);
+          --shader_translation_threads_busy;
+        }
+      }
+    };
+    std::vector<std::unique_ptr<xe::threading::Thread>>
+        shader_translation_threads;
+
+    while (true) {
+      if (!fread(&shader_header, sizeof(shader_header), 1,
+                 shader_storage_file_)) {
+        break;
+      }
+      size_t ucode_byte_count =
+          shader_header.ucode_dword_count * sizeof(uint32_t);
+      ucode_dwords.resize(shader_header.ucode_dword_count);
+      if (shader_header.ucode_dword_count &&
+          !fread(ucode_dwords.data(), ucode_byte_count, 1,
+                 shader_storage_file_)) {
+        break;
+      }
+      uint64_t ucode_data_hash =
+          XXH3_64bits(ucode_dwords.data(), ucode_byte_count);
+      if (shader_header.ucode_data_hash != ucode_data_hash) {
+        // Validation failed.
+        break;
+      }
+      shader_storage_valid_bytes += sizeof(shader_header) + ucode_byte_count;
+      VulkanShader* shader =
+          LoadShader(shader_header.type, ucode_dwords.data(),
+                     shader_header.ucode_dword_count, ucode_data_hash);
+      if (shader->ucode_storage_index() == shader_storage_index_) {
+        // Appeared twice in this file for some reason - skip, otherwise race
+        // condition will be caused by translating twice in parallel.
+        continue;
+      }
+      // Loaded from the current storage - don't write again.
+      shader->set_ucode_storage_index(shader_storage_index_);
+      // Create new threads if the currently existing threads can't keep up
+      // with file reading, but not more than the number of logical processors
+      // minus one.
+      size_t shader_translation_threads_needed;
+      {
+        std::lock_guard<std::mutex> lock(shaders_translation_thread_mutex);
+        shader_translation_threads_needed =
+            std::min(shader_translation_threads_busy +
+                         shaders_to_translate.size() + size_t(1),
+                     logical_processor_count - size_t(1));
+      }
+      while (shader_translation_threads.size() <
+             shader_translation_threads_needed) {
+        shader_translation_threads.push_back(xe::threading::Thread::Create(
+            {}, shader_translation_thread_function));
+        shader_translation_threads.back()->set_name("Shader Translation");
+      }
+      // Request ucode information gathering and translation of all the needed
+      // shaders.
+      {
+        std::lock_guard<std::mutex> lock(shaders_translation_thread_mutex);
+        shaders_to_translate.push_back(shader);
+      }
+      shaders_translation_thread_cond.notify_one();
+      ++shaders_loaded;
+    }
+    if (!shader_translation_threads.empty()) {
+      {
+        std::lock_guard<std::mutex> lock(shaders_translation_thread_mutex);
+        shader_translation_threads_shutdown = true;
+      }
+      shaders_translation_thread_cond.notify_all();
+      for (auto& shader_translation_thread : shader_translation_threads) {
+        xe::threading::Wait(shader_translation_thread.get(), false);
+      }
+      shader_translation_threads.clear();
+      for (VulkanShader::VulkanTranslation* translation :
+           shaders_failed_to_translate) {
+        VulkanShader* shader =
+            static_cast<VulkanShader*>(&translation->shader());
+        shader->DestroyTranslation(translation->modification());
+        if (shader->translations().empty()) {
+          shader_map_.erase(shader->ucode_data_hash());
+          delete shader;
+        }
+      }
+    }
+    XELOGGPU(
+        "Loaded {} shaders from the storage, with {} translations loaded and "
+        "{} translated, in {} milliseconds",
+        shaders_loaded, translations_loaded.load(),
+        translations_to_store.size(),
+        (xe::Clock::QueryHostTickCount() -
+         shader_storage_initialization_start) *
+            1000 / xe::Clock::QueryHostTickFrequency());
+    xe::filesystem::TruncateStdioFile(shader_storage_file_,
+                                      shader_storage_valid_bytes);
+  } else {
+    xe::filesystem::TruncateStdioFile(shader_storage_file_, 0);
+    shader_storage_file_header.magic = kShaderStorageMagic;
+    shader_storage_file_header.version_swapped =
+        xe::byte_swap(ShaderStoredHeader::kVersion);
+    fwrite(&shader_storage_file_header, sizeof(shader_storage_file_header), 1,
+           shader_storage_file_);
+  }
+
+  // Create the pipelines.
+  if (!pipeline_stored_descriptions.empty()) {
+    uint64_t pipeline_creation_start = xe::Clock::QueryHostTickCount();
+
+    struct PipelineCreation {
+      uint64_t description_hash;
+      const PipelineDescription* description;
+      VkShaderModule vertex_shader;
+      VkShaderModule pixel_shader;
+      VkRenderPass render_pass;
+      VkPipeline pipeline;
+    };
+    std::vector<PipelineCreation> pipeline_creations;
+    pipeline_creations.reserve(pipeline_stored_descriptions.size());
+    auto get_shader_module = [this](uint64_t hash,
+                                    uint64_t modification) -> VkShaderModule {
+      auto shader_it = shader_map_.find(hash);
+      if (shader_it == shader_map_.end()) {
+        return nullptr;
+      }
+      auto translation = static_cast<VulkanShader::VulkanTranslation*>(
+          shader_it->second->GetTranslation(modification));
+      if (!translation || !translation->is_valid()) {
+        return nullptr;
+      }
+      return translation->shader_module();
+    };
+    for (const PipelineStoredDescription& pipeline_stored_description :
+         pipeline_stored_descriptions) {
+      const PipelineDescription& pipeline_description =
+          pipeline_stored_description.description;
+      // Skip already known pipelines, as well as duplicates in the file.
+      if (cached_pipelines_.count(
+              pipeline_stored_description.description_hash)) {
+        continue;
+      }
+      PipelineCreation pipeline_creation;
+      pipeline_creation.description_hash =
+          pipeline_stored_description.description_hash;
+      pipeline_creation.description = &pipeline_description;
+      pipeline_creation.vertex_shader =
+          get_shader_module(pipeline_description.vertex_shader_hash,
+                            pipeline_description.vertex_shader_modification);
+      if (!pipeline_creation.vertex_shader) {
+        continue;
+      }
+      if (pipeline_description.pixel_shader_hash) {
+        pipeline_creation.pixel_shader =
+            get_shader_module(pipeline_description.pixel_shader_hash,
+                              pipeline_description.pixel_shader_modification);
+        if (!pipeline_creation.pixel_shader) {
+          continue;
+        }
+      } else {
+        pipeline_creation.pixel_shader = dummy_pixel_shader_;
+      }
+      // Only the formats and the sample count matter for compatibility.
+      RenderConfiguration render_configuration;
+      std::memset(&render_configuration, 0, sizeof(render_configuration));
+      render_configuration.surface_msaa = pipeline_description.msaa_samples;
+      for (uint32_t i = 0; i < 4; ++i) {
+        render_configuration.color[i].format =
+            pipeline_description.color_formats[i];
+      }
+      render_configuration.depth_stencil.format =
+          pipeline_description.depth_format;
+      pipeline_creation.render_pass =
+          render_cache_->GetRenderPass(render_configuration);
+      if (!pipeline_creation.render_pass) {
+        continue;
+      }
+      pipeline_creation.pipeline = nullptr;
+      pipeline_creations.push_back(pipeline_creation);
+      cached_pipelines_.emplace(pipeline_creation.description_hash, nullptr);
+    }
+
+    // Create the pipelines on this thread and additional threads to use all
+    // cores.
+    std::atomic<size_t> next_pipeline_creation(0);
+    auto pipeline_creation_thread_function = [&]() {
+      for (;;) {
+        size_t pipeline_creation_index = next_pipeline_creation++;
+        if (pipeline_creation_index >= pipeline_creations.size()) {
+          return;
+        }
+        PipelineCreation& pipeline_creation =
+            pipeline_creations[pipeline_creation_index];
+        pipeline_creation.pipeline = CreateVulkanPipeline(
+            *pipeline_creation.description, pipeline_creation.vertex_shader,
+            pipeline_creation.pixel_shader, pipeline_creation.render_pass);
+      }
+    };
+    std::vector<std::unique_ptr<xe::threading::Thread>>
+        pipeline_creation_threads;
+    size_t pipeline_creation_thread_count =
+        std::min(pipeline_creations.size(), logical_processor_count);
+    while (pipeline_creation_threads.size() + 1 <
+           pipeline_creation_thread_count) {
+      pipeline_creation_threads.push_back(xe::threading::Thread::Create(
+          {}, pipeline_creation_thread_function));
+      pipeline_creation_threads.back()->set_name("Vulkan Pipelines");
+    }
+    pipeline_creation_thread_function();
+    for (auto& pipeline_creation_thread : pipeline_creation_threads) {
+      xe::threading::Wait(pipeline_creation_thread.get(), false);
+    }
+
+    size_t pipelines_created = 0;
+    for (const PipelineCreation& pipeline_creation : pipeline_creations) {
+      if (pipeline_creation.pipeline) {
+        cached_pipelines_[pipeline_creation.description_hash] =
+            pipeline_creation.pipeline;
+        ++pipelines_created;
+      } else {
+        cached_pipelines_.erase(pipeline_creation.description_hash);
+      }
+    }
+    COUNT_profile_set("gpu/pipeline_cache/pipelines", cached_pipelines_.size());
+
+    XELOGGPU(
+        "Created {} graphics pipelines (not including reading the "
+        "descriptions) from the storage in {} milliseconds",
+        pipelines_created,
+        (xe::Clock::QueryHostTickCount() - pipeline_creation_start) * 1000 /
+            xe::Clock::QueryHostTickFrequency());
+    // If any pipeline descriptions were corrupted (or the whole file has excess
+    // bytes in the end), truncate to the last valid pipeline description.
+    xe::filesystem::TruncateStdioFile(
+        pipeline_storage_file_,
+        uint64_t(sizeof(pipeline_storage_file_header) +
+                 sizeof(PipelineStoredDescription) *
+                     pipeline_stored_descriptions.size()));
+  } else {
+    xe::filesystem::TruncateStdioFile(pipeline_storage_file_, 0);
+    pipeline_storage_file_header.magic = pipeline_storage_magic;
+    pipeline_storage_file_header.magic_api = pipeline_storage_magic_api;
+    pipeline_storage_file_header.version_swapped =
+        pipeline_storage_version_swapped;
+    fwrite(&pipeline_storage_file_header, sizeof(pipeline_storage_file_header),
+           1, pipeline_storage_file_);
+  }
+
+  shader_storage_cache_root_ = cache_root;
+  shader_storage_title_id_ = title_id;
+
+  // Start the storage writing thread.
+  storage_write_flush_ = false;
+  storage_write_thread_shutdown_ = false;
+  storage_write_thread_ =
+      xe::threading::Thread::Create({}, [this]() { StorageWriteThread(); });
+  storage_write_thread_->set_name("Vulkan Shader Storage");
+
+  // Translations which couldn't be loaded from the SPIR-V storage.
+  if (!translations_to_store.empty()) {
+    storage_file_flush_needed_ = true;
+    {
+      std::lock_guard<std::mutex> lock(storage_write_request_lock_);
+      storage_write_spirv_queue_.insert(storage_write_spirv_queue_.end(),
+                                        translations_to_store.cbegin(),
+                                        translations_to_store.cend());
+    }
+    storage_write_request_cond_.notify_all();
+  }
+}
+
+void PipelineCache::ShutdownShaderStorage() {
+  if (storage_write_thread_) {
+    {
+      std::lock_guard<std::mutex> lock(storage_write_request_lock_);
+      storage_write_thread_shutdown_ = true;
+    }
+    storage_write_request_cond_.notify_all();
+    xe::threading::Wait(storage_write_thread_.get(), false);
+    storage_write_thread_.reset();
+  }
+  storage_write_shader_queue_.clear();
+  storage_write_spirv_queue_.clear();
+  storage_write_pipeline_queue_.clear();
+
+  if (!shader_storage_cache_root_.empty()) {
+    SavePipelineCacheData(shader_storage_cache_root_ / "shaders" / "local" /
+                          fmt::format("{:08X}.vulkan.vkpc",
+                                      shader_storage_title_id_));
+  }
+
+  if (pipeline_storage_file_) {
+    fclose(pipeline_storage_file_);
+    pipeline_storage_file_ = nullptr;
+  }
+  if (spirv_storage_file_) {
+    fclose(spirv_storage_file_);
+    spirv_storage_file_ = nullptr;
+  }
+  if (shader_storage_file_) {
+    fclose(shader_storage_file_);
+    shader_storage_file_ = nullptr;
+  }
+  storage_file_flush_needed_ = false;
+
+  shader_storage_cache_root_.clear();
+  shader_storage_title_id_ = 0;
+}
+
+void PipelineCache::EndSubmission() {
+  if (storage_file_flush_needed_) {
+    {
+      std::lock_guard<std::mutex> lock(storage_write_request_lock_);
+      storage_write_flush_ = true;
+    }
+    storage_write_request_cond_.notify_one();
+    storage_file_flush_needed_ = false;
+  }
+}
+
+void PipelineCache::LoadPipelineCacheData(const std::filesystem::path& path) {
+  FILE* file = xe::filesystem::OpenFile(path, "rb");
+  if (!file) {
+    return;
+  }
+  std::vector<uint8_t> data;
+  if (xe::filesystem::Seek(file, 0, SEEK_END)) {
+    int64_t size = xe::filesystem::Tell(file);
+    if (size > 0 && xe::filesystem::Seek(file, 0, SEEK_SET)) {
+      data.resize(size_t(size));
+      if (!fread(data.data(), data.size(), 1, file)) {
+        data.clear();
+      }
+    }
+  }
+  fclose(file);
+
+  // Check the header before giving the data to the driver, so caches from a
+  // different device or driver version are dropped explicitly.
+  struct {
+    uint32_t header_size;
+    uint32_t header_version;
+    uint32_t vendor_id;
+    uint32_t device_id;
+    uint8_t pipeline_cache_uuid[VK_UUID_SIZE];
+  } header;
+  if (data.size() < sizeof(header)) {
+    return;
+  }
+  std::memcpy(&header, data.data(), sizeof(header));
+  const VkPhysicalDeviceProperties& device_properties =
+      device_->device_info().properties;
+  if (header.header_version != VK_PIPELINE_CACHE_HEADER_VERSION_ONE ||
+      header.vendor_id != device_properties.vendorID ||
+      header.device_id != device_properties.deviceID ||
+      std::memcmp(header.pipeline_cache_uuid,
+                  device_properties.pipelineCacheUUID, VK_UUID_SIZE)) {
+    XELOGGPU(
+        "Ignoring the driver pipeline cache created by a different device or "
+        "driver");
+    return;
+  }
+
+  VkPipelineCacheCreateInfo pipeline_cache_info;
+  pipeline_cache_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+  pipeline_cache_info.pNext = nullptr;
+  pipeline_cache_info.flags = 0;
+  pipeline_cache_info.initialDataSize = data.size();
+  pipeline_cache_info.pInitialData = data.data();
+  VkPipelineCache loaded_pipeline_cache;
+  if (vkCreatePipelineCache(*device_, &pipeline_cache_info, nullptr,
+                            &loaded_pipeline_cache) != VK_SUCCESS) {
+    return;
+  }
+  VkResult status = vkMergePipelineCaches(*device_, pipeline_cache_, 1,
+                                          &loaded_pipeline_cache);
+  vkDestroyPipelineCache(*device_, loaded_pipeline_cache, nullptr);
+  if (status == VK_SUCCESS) {
+    XELOGGPU("Loaded {} bytes of the driver pipeline cache", data.size());
+  }
+}
+
+void PipelineCache::SavePipelineCacheData(const std::filesystem::path& path) {
+  if (!pipeline_cache_) {
+    return;
+  }
+  size_t data_size = 0;
+  if (vkGetPipelineCacheData(*device_, pipeline_cache_, &data_size, nullptr) !=
+          VK_SUCCESS ||
+      !data_size) {
+    return;
+  }
+  std::vector<uint8_t> data(data_size);
+  if (vkGetPipelineCacheData(*device_, pipeline_cache_, &data_size,
+                             data.data()) != VK_SUCCESS) {
+    return;
+  }
+  FILE* file = xe::filesystem::OpenFile(path, "wb");
+  if (!file) {
+    XELOGE("Failed to open the driver pipeline cache file for writing: {}",
+           xe::path_to_utf8(path));
+    return;
+  }
+  fwrite(data.data(), 1, data_size, file);
+  fclose(file);
+}
+
 VulkanShader* PipelineCache::LoadShader(xenos::ShaderType shader_type,
                                         uint32_t guest_address,
                                         const uint32_t* host_address,
                                         uint32_t dword_count) {
   // Hash the input memory and lookup the shader.
-  uint64_t data_hash =
-      XXH3_64bits(host_address, dword_count * sizeof(uint32_t));
+  return LoadShader(shader_type, host_address, dword_count,
+                    XXH3_64bits(host_address, dword_count * sizeof(uint32_t)));
+}
+
+VulkanShader* PipelineCache::LoadShader(xenos::ShaderType shader_type,
+                                        const uint32_t* host_address,
+                                        uint32_t dword_count,
+                                        uint64_t data_hash) {
   auto it = shader_map_.find(data_hash);
   if (it != shader_map_.end()) {
     // Shader has been previously loaded.
@@ -240,7 +937,8 @@ PipelineCache::UpdateStatus PipelineCache::ConfigurePipeline(
   // This will tell us if anything has changed that requires us to either build
   // a new pipeline or use an existing one.
   VkPipeline pipeline = nullptr;
-  auto update_status = UpdateState(vertex_shader, pixel_shader, primitive_type);
+  auto update_status =
+      UpdateState(render_state, vertex_shader, pixel_shader, primitive_type);
   switch (update_status) {
     case UpdateStatus::kCompatible:
       // Requested pipeline is compatible with our previous one, so use that.
@@ -259,9 +957,10 @@ PipelineCache::UpdateStatus PipelineCache::ConfigurePipeline(
       return update_status;
   }
   if (!pipeline) {
-    // Should have a hash key produced by the UpdateState pass.
-    uint64_t hash_key = XXH3_64bits_digest(&hash_state_);
-    pipeline = GetPipeline(render_state, hash_key);
+    // The description produced by the UpdateState pass is the key.
+    uint64_t hash_key =
+        XXH3_64bits(&update_description_, sizeof(update_description_));
+    pipeline = GetPipeline(render_state->render_pass_handle, hash_key);
     current_pipeline_ = pipeline;
     if (!pipeline) {
       // Unable to create pipeline.
@@ -273,7 +972,20 @@ PipelineCache::UpdateStatus PipelineCache::ConfigurePipeline(
   return update_status;
 }
 
-void PipelineCache::ClearCache() {
+void PipelineCache::ClearCache(bool shutting_down) {
+  bool reinitialize_shader_storage =
+      !shutting_down && storage_write_thread_ != nullptr;
+  std::filesystem::path shader_storage_cache_root;
+  uint32_t shader_storage_title_id = shader_storage_title_id_;
+  if (reinitialize_shader_storage) {
+    shader_storage_cache_root = shader_storage_cache_root_;
+  }
+  ShutdownShaderStorage();
+
+  // Remove references to the current pipeline and shaders.
+  current_pipeline_ = nullptr;
+  ResetUpdateState();
+
   // Destroy all pipelines.
   for (auto it : cached_pipelines_) {
     vkDestroyPipeline(*device_, it.second, nullptr);
@@ -286,9 +998,15 @@ void PipelineCache::ClearCache() {
     delete it.second;
   }
   shader_map_.clear();
+  shader_storage_index_ = 0;
+
+  if (reinitialize_shader_storage) {
+    InitializeShaderStorage(shader_storage_cache_root, shader_storage_title_id,
+                            false);
+  }
 }
 
-VkPipeline PipelineCache::GetPipeline(const RenderState* render_state,
+VkPipeline PipelineCache::GetPipeline(VkRenderPass render_pass,
                                       uint64_t hash_key) {
   // Lookup the pipeline in the cache.
   auto it = cached_pipelines_.find(hash_key);
@@ -297,6 +1015,228 @@ VkPipeline PipelineCache::GetPipeline(const RenderState* render_state,
     return it->second;
   }
 
+  VkPipeline pipeline = CreateVulkanPipeline(
+      update_description_, update_vertex_shader_translation_->shader_module(),
+      update_pixel_shader_translation_
+          ? update_pixel_shader_translation_->shader_module()
+          : dummy_pixel_shader_,
+      render_pass);
+  if (!pipeline) {
+    return nullptr;
+  }
+
+  // Add to cache with the hash key for reuse.
+  cached_pipelines_.insert({hash_key, pipeline});
+  COUNT_profile_set("gpu/pipeline_cache/pipelines", cached_pipelines_.size());
+
+  // Save the description for creating the pipeline in the next runs.
+  if (pipeline_storage_file_) {
+    assert_not_null(storage_write_thread_);
+    storage_file_flush_needed_ = true;
+    {
+      std::lock_guard<std::mutex> lock(storage_write_request_lock_);
+      storage_write_pipeline_queue_.emplace_back();
+      PipelineStoredDescription& stored_description =
+          storage_write_pipeline_queue_.back();
+      stored_description.description_hash = hash_key;
+      std::memcpy(&stored_description.description, &update_description_,
+                  sizeof(update_description_));
+    }
+    storage_write_request_cond_.notify_all();
+  }
+
+  return pipeline;
+}
+
+VkPipeline PipelineCache::CreateVulkanPipeline(
+    const PipelineDescription& description, VkShaderModule vertex_shader,
+    VkShaderModule pixel_shader, VkRenderPass render_pass) {
+  VkPipelineShaderStageCreateInfo shader_stages[3];
+  uint32_t shader_stage_count = 0;
+
+  auto& vertex_pipeline_stage = shader_stages[shader_stage_count++];
+  vertex_pipeline_stage.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  vertex_pipeline_stage.pNext = nullptr;
+  vertex_pipeline_stage.flags = 0;
+  vertex_pipeline_stage.stage = VK_SHADER_STAGE_VERTEX_BIT;
+  vertex_pipeline_stage.module = vertex_shader;
+  vertex_pipeline_stage.pName = "main";
+  vertex_pipeline_stage.pSpecializationInfo = nullptr;
+
+  VkShaderModule geometry_shader =
+      GetGeometryShader(description.geometry_shader);
+  if (geometry_shader) {
+    auto& geometry_pipeline_stage = shader_stages[shader_stage_count++];
+    geometry_pipeline_stage.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    geometry_pipeline_stage.pNext = nullptr;
+    geometry_pipeline_stage.flags = 0;
+    geometry_pipeline_stage.stage = VK_SHADER_STAGE_GEOMETRY_BIT;
+    geometry_pipeline_stage.module = geometry_shader;
+    geometry_pipeline_stage.pName = "main";
+    geometry_pipeline_stage.pSpecializationInfo = nullptr;
+  }
+
+  auto& pixel_pipeline_stage = shader_stages[shader_stage_count++];
+  pixel_pipeline_stage.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  pixel_pipeline_stage.pNext = nullptr;
+  pixel_pipeline_stage.flags = 0;
+  pixel_pipeline_stage.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+  pixel_pipeline_stage.module = pixel_shader;
+  pixel_pipeline_stage.pName = "main";
+  pixel_pipeline_stage.pSpecializationInfo = nullptr;
+
+  // We don't use vertex inputs.
+  VkPipelineVertexInputStateCreateInfo vertex_input_state_info;
+  vertex_input_state_info.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+  vertex_input_state_info.pNext = nullptr;
+  vertex_input_state_info.flags = 0;
+  vertex_input_state_info.vertexBindingDescriptionCount = 0;
+  vertex_input_state_info.pVertexBindingDescriptions = nullptr;
+  vertex_input_state_info.vertexAttributeDescriptionCount = 0;
+  vertex_input_state_info.pVertexAttributeDescriptions = nullptr;
+
+  VkPipelineInputAssemblyStateCreateInfo input_assembly_state_info;
+  input_assembly_state_info.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+  input_assembly_state_info.pNext = nullptr;
+  input_assembly_state_info.flags = 0;
+  input_assembly_state_info.topology =
+      VkPrimitiveTopology(description.primitive_topology);
+  input_assembly_state_info.primitiveRestartEnable =
+      description.primitive_restart ? VK_TRUE : VK_FALSE;
+
+  VkPipelineViewportStateCreateInfo viewport_state_info;
+  viewport_state_info.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+  viewport_state_info.pNext = nullptr;
+  viewport_state_info.flags = 0;
+  viewport_state_info.viewportCount = 1;
+  // Ignored; set dynamically.
+  viewport_state_info.pViewports = nullptr;
+  viewport_state_info.scissorCount = 1;
+  viewport_state_info.pScissors = nullptr;
+
+  VkPipelineRasterizationStateCreateInfo rasterization_state_info;
+  rasterization_state_info.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+  rasterization_state_info.pNext = nullptr;
+  rasterization_state_info.flags = 0;
+  rasterization_state_info.depthClampEnable =
+      description.depth_clamp_enable ? VK_TRUE : VK_FALSE;
+  rasterization_state_info.rasterizerDiscardEnable = VK_FALSE;
+  rasterization_state_info.polygonMode =
+      VkPolygonMode(description.polygon_mode);
+  rasterization_state_info.cullMode = VkCullModeFlags(description.cull_mode);
+  rasterization_state_info.frontFace = description.front_face_clockwise
+                                           ? VK_FRONT_FACE_CLOCKWISE
+                                           : VK_FRONT_FACE_COUNTER_CLOCKWISE;
+  rasterization_state_info.depthBiasEnable =
+      description.depth_bias_enable ? VK_TRUE : VK_FALSE;
+  // Ignored; set dynamically:
+  rasterization_state_info.depthBiasConstantFactor = 0;
+  rasterization_state_info.depthBiasClamp = 0;
+  rasterization_state_info.depthBiasSlopeFactor = 0;
+  rasterization_state_info.lineWidth = 1.0f;
+
+  VkPipelineMultisampleStateCreateInfo multisample_state_info;
+  multisample_state_info.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+  multisample_state_info.pNext = nullptr;
+  multisample_state_info.flags = 0;
+  switch (description.msaa_samples) {
+    case xenos::MsaaSamples::k2X:
+      multisample_state_info.rasterizationSamples = VK_SAMPLE_COUNT_2_BIT;
+      break;
+    case xenos::MsaaSamples::k4X:
+      multisample_state_info.rasterizationSamples = VK_SAMPLE_COUNT_4_BIT;
+      break;
+    default:
+      multisample_state_info.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+      break;
+  }
+  multisample_state_info.sampleShadingEnable = VK_FALSE;
+  multisample_state_info.minSampleShading = 0;
+  multisample_state_info.pSampleMask = nullptr;
+  multisample_state_info.alphaToCoverageEnable = VK_FALSE;
+  multisample_state_info.alphaToOneEnable = VK_FALSE;
+
+  VkPipelineDepthStencilStateCreateInfo depth_stencil_state_info;
+  depth_stencil_state_info.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+  depth_stencil_state_info.pNext = nullptr;
+  depth_stencil_state_info.flags = 0;
+  depth_stencil_state_info.depthTestEnable =
+      description.depth_test_enable ? VK_TRUE : VK_FALSE;
+  depth_stencil_state_info.depthWriteEnable =
+      description.depth_write_enable ? VK_TRUE : VK_FALSE;
+  depth_stencil_state_info.depthCompareOp =
+      VkCompareOp(description.depth_compare_op);
+  depth_stencil_state_info.depthBoundsTestEnable = VK_FALSE;
+  depth_stencil_state_info.stencilTestEnable =
+      description.stencil_test_enable ? VK_TRUE : VK_FALSE;
+  depth_stencil_state_info.front.failOp =
+      VkStencilOp(description.stencil_front_fail_op);
+  depth_stencil_state_info.front.passOp =
+      VkStencilOp(description.stencil_front_pass_op);
+  depth_stencil_state_info.front.depthFailOp =
+      VkStencilOp(description.stencil_front_depth_fail_op);
+  depth_stencil_state_info.front.compareOp =
+      VkCompareOp(description.stencil_front_compare_op);
+  depth_stencil_state_info.back.failOp =
+      VkStencilOp(description.stencil_back_fail_op);
+  depth_stencil_state_info.back.passOp =
+      VkStencilOp(description.stencil_back_pass_op);
+  depth_stencil_state_info.back.depthFailOp =
+      VkStencilOp(description.stencil_back_depth_fail_op);
+  depth_stencil_state_info.back.compareOp =
+      VkCompareOp(description.stencil_back_compare_op);
+  // Ignored; set dynamically.
+  depth_stencil_state_info.front.compareMask = 0;
+  depth_stencil_state_info.front.writeMask = 0;
+  depth_stencil_state_info.front.reference = 0;
+  depth_stencil_state_info.back.compareMask = 0;
+  depth_stencil_state_info.back.writeMask = 0;
+  depth_stencil_state_info.back.reference = 0;
+  depth_stencil_state_info.minDepthBounds = 0;
+  depth_stencil_state_info.maxDepthBounds = 0;
+
+  VkPipelineColorBlendAttachmentState attachment_states[4];
+  for (uint32_t i = 0; i < 4; ++i) {
+    const PipelineRenderTarget& render_target = description.render_targets[i];
+    auto& attachment_state = attachment_states[i];
+    attachment_state.blendEnable =
+        render_target.blend_enable ? VK_TRUE : VK_FALSE;
+    attachment_state.srcColorBlendFactor =
+        VkBlendFactor(render_target.src_color_blend_factor);
+    attachment_state.dstColorBlendFactor =
+        VkBlendFactor(render_target.dst_color_blend_factor);
+    attachment_state.colorBlendOp = VkBlendOp(render_target.color_blend_op);
+    attachment_state.srcAlphaBlendFactor =
+        VkBlendFactor(render_target.src_alpha_blend_factor);
+    attachment_state.dstAlphaBlendFactor =
+        VkBlendFactor(render_target.dst_alpha_blend_factor);
+    attachment_state.alphaBlendOp = VkBlendOp(render_target.alpha_blend_op);
+    attachment_state.colorWriteMask = render_target.color_write_mask;
+  }
+  VkPipelineColorBlendStateCreateInfo color_blend_state_info;
+  color_blend_state_info.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+  color_blend_state_info.pNext = nullptr;
+  color_blend_state_info.flags = 0;
+  color_blend_state_info.logicOpEnable = VK_FALSE;
+  color_blend_state_info.logicOp = VK_LOGIC_OP_NO_OP;
+  color_blend_state_info.attachmentCount = 4;
+  color_blend_state_info.pAttachments = attachment_states;
+  // Ignored; set dynamically.
+  color_blend_state_info.blendConstants[0] = 0.0f;
+  color_blend_state_info.blendConstants[1] = 0.0f;
+  color_blend_state_info.blendConstants[2] = 0.0f;
+  color_blend_state_info.blendConstants[3] = 0.0f;
+
   VkPipelineDynamicStateCreateInfo dynamic_state_info;
   dynamic_state_info.sType =
       VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
@@ -321,23 +1261,24 @@ VkPipeline PipelineCache::GetPipeline(const RenderState* render_state,
   pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
   pipeline_info.pNext = nullptr;
   pipeline_info.flags = VK_PIPELINE_CREATE_DISABLE_OPTIMIZATION_BIT;
-  pipeline_info.stageCount = update_shader_stages_stage_count_;
-  pipeline_info.pStages = update_shader_stages_info_;
-  pipeline_info.pVertexInputState = &update_vertex_input_state_info_;
-  pipeline_info.pInputAssemblyState = &update_input_assembly_state_info_;
+  pipeline_info.stageCount = shader_stage_count;
+  pipeline_info.pStages = shader_stages;
+  pipeline_info.pVertexInputState = &vertex_input_state_info;
+  pipeline_info.pInputAssemblyState = &input_assembly_state_info;
   pipeline_info.pTessellationState = nullptr;
-  pipeline_info.pViewportState = &update_viewport_state_info_;
-  pipeline_info.pRasterizationState = &update_rasterization_state_info_;
-  pipeline_info.pMultisampleState = &update_multisample_state_info_;
-  pipeline_info.pDepthStencilState = &update_depth_stencil_state_info_;
-  pipeline_info.pColorBlendState = &update_color_blend_state_info_;
+  pipeline_info.pViewportState = &viewport_state_info;
+  pipeline_info.pRasterizationState = &rasterization_state_info;
+  pipeline_info.pMultisampleState = &multisample_state_info;
+  pipeline_info.pDepthStencilState = &depth_stencil_state_info;
+  pipeline_info.pColorBlendState = &color_blend_state_info;
   pipeline_info.pDynamicState = &dynamic_state_info;
   pipeline_info.layout = pipeline_layout_;
-  pipeline_info.renderPass = render_state->render_pass_handle;
+  pipeline_info.renderPass = render_pass;
   pipeline_info.subpass = 0;
   pipeline_info.basePipelineHandle = nullptr;
   pipeline_info.basePipelineIndex = -1;
   VkPipeline pipeline = nullptr;
+  // The pipeline cache is internally synchronized.
   auto result = vkCreateGraphicsPipelines(*device_, pipeline_cache_, 1,
                                           &pipeline_info, nullptr, &pipeline);
   if (result != VK_SUCCESS) {
@@ -356,27 +1297,31 @@ VkPipeline PipelineCache::GetPipeline(const RenderState* render_state,
     }
   }
 
-  // Add to cache with the hash key for reuse.
-  cached_pipelines_.insert({hash_key, pipeline});
-  COUNT_profile_set("gpu/pipeline_cache/pipelines", cached_pipelines_.size());
-
   return pipeline;
 }
 
 bool PipelineCache::TranslateShader(
     VulkanShader::VulkanTranslation& translation) {
   translation.shader().AnalyzeUcode(ucode_disasm_buffer_);
+  return TranslateAnalyzedShader(*shader_translator_, translation);
+}
+
+bool PipelineCache::TranslateAnalyzedShader(
+    ShaderTranslator& translator,
+    VulkanShader::VulkanTranslation& translation) {
   // Perform translation.
   // If this fails the shader will be marked as invalid and ignored later.
-  if (!shader_translator_->TranslateAnalyzedShader(translation)) {
-    XELOGE("Shader translation failed; marking shader as ignored");
+  if (!translator.TranslateAnalyzedShader(translation)) {
+    XELOGE("Shader {:016X} translation failed; marking as ignored",
+           translation.shader().ucode_data_hash());
     return false;
   }
 
   // Prepare the shader for use (creates our VkShaderModule).
   // It could still fail at this point.
   if (!translation.Prepare()) {
-    XELOGE("Shader preparation failed; marking shader as ignored");
+    XELOGE("Shader {:016X} preparation failed; marking as ignored",
+           translation.shader().ucode_data_hash());
     return false;
   }
 
@@ -398,6 +1343,135 @@ bool PipelineCache::TranslateShader(
   return translation.is_valid();
 }
 
+bool PipelineCache::LoadStoredTranslation(
+    VulkanShader::VulkanTranslation& translation, std::vector<uint8_t> spirv) {
+  translation.SetStoredTranslatedBinary(std::move(spirv));
+  if (!translation.Prepare()) {
+    XELOGE("Stored shader {:016X} preparation failed; marking as ignored",
+           translation.shader().ucode_data_hash());
+    return false;
+  }
+  return true;
+}
+
+void PipelineCache::StoreTranslation(
+    VulkanShader::VulkanTranslation& translation) {
+  if (!shader_storage_file_) {
+    return;
+  }
+  assert_not_null(storage_write_thread_);
+  Shader& shader = translation.shader();
+  bool store_ucode = shader.ucode_storage_index() != shader_storage_index_;
+  shader.set_ucode_storage_index(shader_storage_index_);
+  storage_file_flush_needed_ = true;
+  {
+    std::lock_guard<std::mutex> lock(storage_write_request_lock_);
+    if (store_ucode) {
+      storage_write_shader_queue_.push_back(&shader);
+    }
+    storage_write_spirv_queue_.push_back(&translation);
+  }
+  storage_write_request_cond_.notify_all();
+}
+
+void PipelineCache::StorageWriteThread() {
+  ShaderStoredHeader shader_header;
+  // Don't leak anything in unused bits.
+  std::memset(&shader_header, 0, sizeof(shader_header));
+  SpirvStoredHeader spirv_header;
+  std::memset(&spirv_header, 0, sizeof(spirv_header));
+
+  std::vector<uint32_t> ucode_guest_endian;
+  ucode_guest_endian.reserve(0xFFFF);
+
+  bool flush = false;
+
+  while (true) {
+    if (flush) {
+      flush = false;
+      assert_not_null(shader_storage_file_);
+      fflush(shader_storage_file_);
+      assert_not_null(spirv_storage_file_);
+      fflush(spirv_storage_file_);
+      assert_not_null(pipeline_storage_file_);
+      fflush(pipeline_storage_file_);
+    }
+
+    const Shader* shader = nullptr;
+    const VulkanShader::VulkanTranslation* translation = nullptr;
+    PipelineStoredDescription pipeline_description;
+    bool write_pipeline = false;
+    {
+      std::unique_lock<std::mutex> lock(storage_write_request_lock_);
+      if (storage_write_thread_shutdown_) {
+        return;
+      }
+      if (!storage_write_shader_queue_.empty()) {
+        shader = storage_write_shader_queue_.front();
+        storage_write_shader_queue_.pop_front();
+      }
+      if (!storage_write_spirv_queue_.empty()) {
+        translation = storage_write_spirv_queue_.front();
+        storage_write_spirv_queue_.pop_front();
+      }
+      if (!storage_write_pipeline_queue_.empty()) {
+        std::memcpy(&pipeline_description,
+                    &storage_write_pipeline_queue_.front(),
+                    sizeof(pipeline_description));
+        storage_write_pipeline_queue_.pop_front();
+        write_pipeline = true;
+      }
+      if (!shader && !translation && !write_pipeline) {
+        if (storage_write_flush_) {
+          storage_write_flush_ = false;
+          flush = true;
+          continue;
+        }
+        storage_write_request_cond_.wait(lock);
+        continue;
+      }
+    }
+
+    if (shader) {
+      shader_header.ucode_data_hash = shader->ucode_data_hash();
+      shader_header.ucode_dword_count = shader->ucode_dword_count();
+      shader_header.type = shader->type();
+      assert_not_null(shader_storage_file_);
+      fwrite(&shader_header, sizeof(shader_header), 1, shader_storage_file_);
+      if (shader_header.ucode_dword_count) {
+        ucode_guest_endian.resize(shader_header.ucode_dword_count);
+        // Need to swap because the hash is calculated for the shader with guest
+        // endianness.
+        xe::copy_and_swap(ucode_guest_endian.data(), shader->ucode_dwords(),
+                          shader_header.ucode_dword_count);
+        fwrite(ucode_guest_endian.data(),
+               shader_header.ucode_dword_count * sizeof(uint32_t), 1,
+               shader_storage_file_);
+      }
+    }
+
+    if (translation) {
+      const std::vector<uint8_t>& spirv = translation->translated_binary();
+      spirv_header.ucode_data_hash = translation->shader().ucode_data_hash();
+      spirv_header.modification = translation->modification();
+      spirv_header.spirv_hash = XXH3_64bits(spirv.data(), spirv.size());
+      spirv_header.spirv_dword_count =
+          uint32_t(spirv.size() / sizeof(uint32_t));
+      assert_not_null(spirv_storage_file_);
+      fwrite(&spirv_header, sizeof(spirv_header), 1, spirv_storage_file_);
+      if (!spirv.empty()) {
+        fwrite(spirv.data(), spirv.size(), 1, spirv_storage_file_);
+      }
+    }
+
+    if (write_pipeline) {
+      assert_not_null(pipeline_storage_file_);
+      fwrite(&pipeline_description, sizeof(pipeline_description), 1,
+             pipeline_storage_file_);
+    }
+  }
+}
+
 static void DumpShaderStatisticsAMD(const VkShaderStatisticsInfoAMD& stats) {
   XELOGI(" - resource usage:");
   XELOGI("   numUsedVgprs: {}", stats.resourceUsage.numUsedVgprs);
@@ -534,7 +1608,7 @@ void PipelineCache::DumpShaderDisasmNV(
   vkDestroyPipelineCache(*device_, dummy_pipeline_cache, nullptr);
 }
 
-VkShaderModule PipelineCache::GetGeometryShader(
+PipelineCache::PipelineGeometryShader PipelineCache::GetGeometryShaderType(
     xenos::PrimitiveType primitive_type, bool is_line_mode) {
   switch (primitive_type) {
     case xenos::PrimitiveType::kLineList:
@@ -544,27 +1618,43 @@ VkShaderModule PipelineCache::GetGeometryShader(
     case xenos::PrimitiveType::kTriangleFan:
     case xenos::PrimitiveType::kTriangleStrip:
       // Supported directly - no need to emulate.
-      return nullptr;
+      return PipelineGeometryShader::kNone;
     case xenos::PrimitiveType::kPointList:
-      return geometry_shaders_.point_list;
+      return PipelineGeometryShader::kPointList;
     case xenos::PrimitiveType::kTriangleWithWFlags:
       assert_always("Unknown geometry type");
-      return nullptr;
+      return PipelineGeometryShader::kNone;
     case xenos::PrimitiveType::kRectangleList:
-      return geometry_shaders_.rect_list;
+      return PipelineGeometryShader::kRectangleList;
     case xenos::PrimitiveType::kQuadList:
-      return is_line_mode ? geometry_shaders_.line_quad_list
-                          : geometry_shaders_.quad_list;
+      return is_line_mode ? PipelineGeometryShader::kLineQuadList
+                          : PipelineGeometryShader::kQuadList;
     case xenos::PrimitiveType::kQuadStrip:
       // TODO(benvanik): quad strip geometry shader.
       assert_always("Quad strips not implemented");
-      return nullptr;
+      return PipelineGeometryShader::kNone;
     case xenos::PrimitiveType::kTrianglePatch:
     case xenos::PrimitiveType::kQuadPatch:
       assert_always("Tessellation is not implemented");
-      return nullptr;
+      return PipelineGeometryShader::kNone;
     default:
       assert_unhandled_case(primitive_type);
+      return PipelineGeometryShader::kNone;
+  }
+}
+
+VkShaderModule PipelineCache::GetGeometryShader(
+    PipelineGeometryShader geometry_shader) {
+  switch (geometry_shader) {
+    case PipelineGeometryShader::kPointList:
+      return geometry_shaders_.point_list;
+    case PipelineGeometryShader::kRectangleList:
+      return geometry_shaders_.rect_list;
+    case PipelineGeometryShader::kQuadList:
+      return geometry_shaders_.quad_list;
+    case PipelineGeometryShader::kLineQuadList:
+      return geometry_shaders_.line_quad_list;
+    default:
       return nullptr;
   }
 }
@@ -957,14 +2047,23 @@ bool PipelineCache::SetShadowRegisterArray(uint32_t* dest, uint32_t num,
   return dirty;
 }
 
+void PipelineCache::ResetUpdateState() {
+  update_shader_stages_regs_.Reset();
+  update_input_assembly_state_regs_.Reset();
+  update_rasterization_state_regs_.Reset();
+  update_multisample_state_regs_.Reset();
+  update_depth_stencil_state_regs_.Reset();
+  update_color_blend_state_regs_.Reset();
+  std::memset(&update_description_, 0, sizeof(update_description_));
+  update_vertex_shader_translation_ = nullptr;
+  update_pixel_shader_translation_ = nullptr;
+}
+
 PipelineCache::UpdateStatus PipelineCache::UpdateState(
-    VulkanShader* vertex_shader, VulkanShader* pixel_shader,
-    xenos::PrimitiveType primitive_type) {
+    const RenderState* render_state, VulkanShader* vertex_shader,
+    VulkanShader* pixel_shader, xenos::PrimitiveType primitive_type) {
   bool mismatch = false;
 
-  // Reset hash so we can build it up.
-  XXH3_64bits_reset(&hash_state_);
-
 #define CHECK_UPDATE_STATUS(status, mismatch, error_message) \
   {                                                          \
     if (status == UpdateStatus::kError) {                    \
@@ -976,17 +2075,13 @@ PipelineCache::UpdateStatus PipelineCache::UpdateState(
   }
 
   UpdateStatus status;
-  status = UpdateRenderTargetState();
+  status = UpdateRenderTargetState(render_state);
   CHECK_UPDATE_STATUS(status, mismatch, "Unable to update render target state");
   status = UpdateShaderStages(vertex_shader, pixel_shader, primitive_type);
   CHECK_UPDATE_STATUS(status, mismatch, "Unable to update shader stages");
-  status = UpdateVertexInputState(vertex_shader);
-  CHECK_UPDATE_STATUS(status, mismatch, "Unable to update vertex input state");
   status = UpdateInputAssemblyState(primitive_type);
   CHECK_UPDATE_STATUS(status, mismatch,
                       "Unable to update input assembly state");
-  status = UpdateViewportState();
-  CHECK_UPDATE_STATUS(status, mismatch, "Unable to update viewport state");
   status = UpdateRasterizationState(primitive_type);
   CHECK_UPDATE_STATUS(status, mismatch, "Unable to update rasterization state");
   status = UpdateMultisampleState();
@@ -999,38 +2094,19 @@ PipelineCache::UpdateStatus PipelineCache::UpdateState(
   return mismatch ? UpdateStatus::kMismatch : UpdateStatus::kCompatible;
 }
 
-PipelineCache::UpdateStatus PipelineCache::UpdateRenderTargetState() {
-  auto& regs = update_render_targets_regs_;
-  bool dirty = false;
-
-  // Check the render target formats
-  struct {
-    reg::RB_COLOR_INFO rb_color_info;
-    reg::RB_DEPTH_INFO rb_depth_info;
-    reg::RB_COLOR_INFO rb_color1_info;
-    reg::RB_COLOR_INFO rb_color2_info;
-    reg::RB_COLOR_INFO rb_color3_info;
-  }* cur_regs = reinterpret_cast<decltype(cur_regs)>(
-      &register_file_->values[XE_GPU_REG_RB_COLOR_INFO].u32);
+PipelineCache::UpdateStatus PipelineCache::UpdateRenderTargetState(
+    const RenderState* render_state) {
+  auto& description = update_description_;
+  const RenderConfiguration& config = render_state->config;
 
-  dirty |=
-      regs.rb_color_info.color_format != cur_regs->rb_color_info.color_format;
-  dirty |=
-      regs.rb_depth_info.depth_format != cur_regs->rb_depth_info.depth_format;
-  dirty |=
-      regs.rb_color1_info.color_format != cur_regs->rb_color1_info.color_format;
-  dirty |=
-      regs.rb_color2_info.color_format != cur_regs->rb_color2_info.color_format;
-  dirty |=
-      regs.rb_color3_info.color_format != cur_regs->rb_color3_info.color_format;
-
-  // And copy the regs over.
-  regs.rb_color_info.color_format = cur_regs->rb_color_info.color_format;
-  regs.rb_depth_info.depth_format = cur_regs->rb_depth_info.depth_format;
-  regs.rb_color1_info.color_format = cur_regs->rb_color1_info.color_format;
-  regs.rb_color2_info.color_format = cur_regs->rb_color2_info.color_format;
-  regs.rb_color3_info.color_format = cur_regs->rb_color3_info.color_format;
-  XXH3_64bits_update(&hash_state_, &regs, sizeof(regs));
+  // Only the formats affect render pass compatibility.
+  bool dirty = false;
+  for (uint32_t i = 0; i < 4; ++i) {
+    dirty |= description.color_formats[i] != config.color[i].format;
+    description.color_formats[i] = config.color[i].format;
+  }
+  dirty |= description.depth_format != config.depth_stencil.format;
+  description.depth_format = config.depth_stencil.format;
   if (!dirty) {
     return UpdateStatus::kCompatible;
   }
@@ -1042,6 +2118,7 @@ PipelineCache::UpdateStatus PipelineCache::UpdateShaderStages(
     VulkanShader* vertex_shader, VulkanShader* pixel_shader,
     xenos::PrimitiveType primitive_type) {
   auto& regs = update_shader_stages_regs_;
+  auto& description = update_description_;
 
   // These are the constant base addresses/ranges for shaders.
   // We have these hardcoded right now cause nothing seems to differ.
@@ -1063,11 +2140,13 @@ PipelineCache::UpdateStatus PipelineCache::UpdateShaderStages(
   regs.vertex_shader = vertex_shader;
   regs.pixel_shader = pixel_shader;
   regs.primitive_type = primitive_type;
-  XXH3_64bits_update(&hash_state_, &regs, sizeof(regs));
   if (!dirty) {
     return UpdateStatus::kCompatible;
   }
 
+  // The modification depends on the register count, which is only known after
+  // the analysis.
+  vertex_shader->AnalyzeUcode(ucode_disasm_buffer_);
   VulkanShader::VulkanTranslation* vertex_shader_translation =
       static_cast<VulkanShader::VulkanTranslation*>(
           vertex_shader->GetOrCreateTranslation(
@@ -1075,39 +2154,51 @@ PipelineCache::UpdateStatus PipelineCache::UpdateShaderStages(
                   xenos::ShaderType::kVertex,
                   vertex_shader->GetDynamicAddressableRegisterCount(
                       regs.sq_program_cntl.vs_num_reg))));
-  if (!vertex_shader_translation->is_translated() &&
-      !TranslateShader(*vertex_shader_translation)) {
+  if (!vertex_shader_translation->is_translated()) {
+    if (TranslateShader(*vertex_shader_translation)) {
+      StoreTranslation(*vertex_shader_translation);
+    }
+  }
+  if (!vertex_shader_translation->is_valid()) {
     XELOGE("Failed to translate the vertex shader!");
+    regs.vertex_shader = nullptr;
     return UpdateStatus::kError;
   }
 
   VulkanShader::VulkanTranslation* pixel_shader_translation = nullptr;
   if (pixel_shader) {
+    pixel_shader->AnalyzeUcode(ucode_disasm_buffer_);
     pixel_shader_translation = static_cast<VulkanShader::VulkanTranslation*>(
         pixel_shader->GetOrCreateTranslation(
             shader_translator_->GetDefaultModification(
                 xenos::ShaderType::kPixel,
                 pixel_shader->GetDynamicAddressableRegisterCount(
                     regs.sq_program_cntl.ps_num_reg))));
-    if (!pixel_shader_translation->is_translated() &&
-        !TranslateShader(*pixel_shader_translation)) {
+    if (!pixel_shader_translation->is_translated()) {
+      if (TranslateShader(*pixel_shader_translation)) {
+        StoreTranslation(*pixel_shader_translation);
+      }
+    }
+    if (!pixel_shader_translation->is_valid()) {
       XELOGE("Failed to translate the pixel shader!");
+      regs.pixel_shader = nullptr;
       return UpdateStatus::kError;
     }
   }
 
-  update_shader_stages_stage_count_ = 0;
-
-  auto& vertex_pipeline_stage =
-      update_shader_stages_info_[update_shader_stages_stage_count_++];
-  vertex_pipeline_stage.sType =
-      VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-  vertex_pipeline_stage.pNext = nullptr;
-  vertex_pipeline_stage.flags = 0;
-  vertex_pipeline_stage.stage = VK_SHADER_STAGE_VERTEX_BIT;
-  vertex_pipeline_stage.module = vertex_shader_translation->shader_module();
-  vertex_pipeline_stage.pName = "main";
-  vertex_pipeline_stage.pSpecializationInfo = nullptr;
+  update_vertex_shader_translation_ = vertex_shader_translation;
+  update_pixel_shader_translation_ = pixel_shader_translation;
+  description.vertex_shader_hash = vertex_shader->ucode_data_hash();
+  description.vertex_shader_modification =
+      vertex_shader_translation->modification();
+  if (pixel_shader_translation) {
+    description.pixel_shader_hash = pixel_shader->ucode_data_hash();
+    description.pixel_shader_modification =
+        pixel_shader_translation->modification();
+  } else {
+    description.pixel_shader_hash = 0;
+    description.pixel_shader_modification = 0;
+  }
 
   bool is_line_mode = false;
   if (((regs.pa_su_sc_mode_cntl >> 3) & 0x3) != 0) {
@@ -1116,65 +2207,16 @@ PipelineCache::UpdateStatus PipelineCache::UpdateShaderStages(
       is_line_mode = true;
     }
   }
-  auto geometry_shader = GetGeometryShader(primitive_type, is_line_mode);
-  if (geometry_shader) {
-    auto& geometry_pipeline_stage =
-        update_shader_stages_info_[update_shader_stages_stage_count_++];
-    geometry_pipeline_stage.sType =
-        VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    geometry_pipeline_stage.pNext = nullptr;
-    geometry_pipeline_stage.flags = 0;
-    geometry_pipeline_stage.stage = VK_SHADER_STAGE_GEOMETRY_BIT;
-    geometry_pipeline_stage.module = geometry_shader;
-    geometry_pipeline_stage.pName = "main";
-    geometry_pipeline_stage.pSpecializationInfo = nullptr;
-  }
-
-  auto& pixel_pipeline_stage =
-      update_shader_stages_info_[update_shader_stages_stage_count_++];
-  pixel_pipeline_stage.sType =
-      VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-  pixel_pipeline_stage.pNext = nullptr;
-  pixel_pipeline_stage.flags = 0;
-  pixel_pipeline_stage.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-  pixel_pipeline_stage.module = pixel_shader_translation
-                                    ? pixel_shader_translation->shader_module()
-                                    : dummy_pixel_shader_;
-  pixel_pipeline_stage.pName = "main";
-  pixel_pipeline_stage.pSpecializationInfo = nullptr;
+  description.geometry_shader =
+      GetGeometryShaderType(primitive_type, is_line_mode);
 
   return UpdateStatus::kMismatch;
 }
 
-PipelineCache::UpdateStatus PipelineCache::UpdateVertexInputState(
-    VulkanShader* vertex_shader) {
-  auto& regs = update_vertex_input_state_regs_;
-  auto& state_info = update_vertex_input_state_info_;
-
-  bool dirty = false;
-  dirty |= vertex_shader != regs.vertex_shader;
-  regs.vertex_shader = vertex_shader;
-  XXH3_64bits_update(&hash_state_, &regs, sizeof(regs));
-  if (!dirty) {
-    return UpdateStatus::kCompatible;
-  }
-
-  // We don't use vertex inputs.
-  state_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-  state_info.pNext = nullptr;
-  state_info.flags = 0;
-  state_info.vertexBindingDescriptionCount = 0;
-  state_info.vertexAttributeDescriptionCount = 0;
-  state_info.pVertexBindingDescriptions = nullptr;
-  state_info.pVertexAttributeDescriptions = nullptr;
-
-  return UpdateStatus::kCompatible;
-}
-
 PipelineCache::UpdateStatus PipelineCache::UpdateInputAssemblyState(
     xenos::PrimitiveType primitive_type) {
   auto& regs = update_input_assembly_state_regs_;
-  auto& state_info = update_input_assembly_state_info_;
+  auto& description = update_description_;
 
   bool dirty = false;
   dirty |= primitive_type != regs.primitive_type;
@@ -1183,50 +2225,47 @@ PipelineCache::UpdateStatus PipelineCache::UpdateInputAssemblyState(
   dirty |= SetShadowRegister(&regs.multi_prim_ib_reset_index,
                              XE_GPU_REG_VGT_MULTI_PRIM_IB_RESET_INDX);
   regs.primitive_type = primitive_type;
-  XXH3_64bits_update(&hash_state_, &regs, sizeof(regs));
   if (!dirty) {
     return UpdateStatus::kCompatible;
   }
 
-  state_info.sType =
-      VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-  state_info.pNext = nullptr;
-  state_info.flags = 0;
-
+  VkPrimitiveTopology topology;
   switch (primitive_type) {
     case xenos::PrimitiveType::kPointList:
-      state_info.topology = VK_PRIMITIVE_TOPOLOGY_POINT_LIST;
+      topology = VK_PRIMITIVE_TOPOLOGY_POINT_LIST;
       break;
     case xenos::PrimitiveType::kLineList:
-      state_info.topology = VK_PRIMITIVE_TOPOLOGY_LINE_LIST;
+      topology = VK_PRIMITIVE_TOPOLOGY_LINE_LIST;
       break;
     case xenos::PrimitiveType::kLineStrip:
-      state_info.topology = VK_PRIMITIVE_TOPOLOGY_LINE_STRIP;
+      topology = VK_PRIMITIVE_TOPOLOGY_LINE_STRIP;
       break;
     case xenos::PrimitiveType::kLineLoop:
-      state_info.topology = VK_PRIMITIVE_TOPOLOGY_LINE_STRIP;
+      topology = VK_PRIMITIVE_TOPOLOGY_LINE_STRIP;
       break;
     case xenos::PrimitiveType::kTriangleList:
-      state_info.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+      topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
       break;
     case xenos::PrimitiveType::kTriangleStrip:
-      state_info.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP;
+      topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP;
       break;
     case xenos::PrimitiveType::kTriangleFan:
-      state_info.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_FAN;
+      topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_FAN;
       break;
     case xenos::PrimitiveType::kRectangleList:
-      state_info.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+      topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
       break;
     case xenos::PrimitiveType::kQuadList:
-      state_info.topology = VK_PRIMITIVE_TOPOLOGY_LINE_LIST_WITH_ADJACENCY;
+      topology = VK_PRIMITIVE_TOPOLOGY_LINE_LIST_WITH_ADJACENCY;
       break;
     default:
     case xenos::PrimitiveType::kTriangleWithWFlags:
       XELOGE("unsupported primitive type {}", primitive_type);
       assert_unhandled_case(primitive_type);
+      regs.primitive_type = xenos::PrimitiveType::kNone;
       return UpdateStatus::kError;
   }
+  description.primitive_topology = uint32_t(topology);
 
   // TODO(benvanik): anything we can do about this? Vulkan seems to only support
   // first.
@@ -1238,36 +2277,15 @@ PipelineCache::UpdateStatus PipelineCache::UpdateInputAssemblyState(
   // }
 
   // Primitive restart index is handled in the buffer cache.
-  if (regs.pa_su_sc_mode_cntl & (1 << 21)) {
-    state_info.primitiveRestartEnable = VK_TRUE;
-  } else {
-    state_info.primitiveRestartEnable = VK_FALSE;
-  }
+  description.primitive_restart = (regs.pa_su_sc_mode_cntl & (1 << 21)) ? 1 : 0;
 
   return UpdateStatus::kMismatch;
 }
 
-PipelineCache::UpdateStatus PipelineCache::UpdateViewportState() {
-  auto& state_info = update_viewport_state_info_;
-
-  state_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-  state_info.pNext = nullptr;
-  state_info.flags = 0;
-
-  state_info.viewportCount = 1;
-  state_info.scissorCount = 1;
-
-  // Ignored; set dynamically.
-  state_info.pViewports = nullptr;
-  state_info.pScissors = nullptr;
-
-  return UpdateStatus::kCompatible;
-}
-
 PipelineCache::UpdateStatus PipelineCache::UpdateRasterizationState(
     xenos::PrimitiveType primitive_type) {
   auto& regs = update_rasterization_state_regs_;
-  auto& state_info = update_rasterization_state_info_;
+  auto& description = update_description_;
 
   bool dirty = false;
   dirty |= regs.primitive_type != primitive_type;
@@ -1309,24 +2327,19 @@ PipelineCache::UpdateStatus PipelineCache::UpdateRasterizationState(
     dirty = true;
   }
 
-  XXH3_64bits_update(&hash_state_, &regs, sizeof(regs));
   if (!dirty) {
     return UpdateStatus::kCompatible;
   }
 
-  state_info.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-  state_info.pNext = nullptr;
-  state_info.flags = 0;
-
   // ZCLIP_NEAR_DISABLE
-  // state_info.depthClampEnable = !(regs.pa_cl_clip_cntl & (1 << 26));
+  // depth_clamp_enable = !(regs.pa_cl_clip_cntl & (1 << 26));
   // RASTERIZER_DISABLE
-  // state_info.rasterizerDiscardEnable = !!(regs.pa_cl_clip_cntl & (1 << 22));
+  // rasterizer_discard_enable = !!(regs.pa_cl_clip_cntl & (1 << 22));
 
   // CLIP_DISABLE
-  state_info.depthClampEnable = !!(regs.pa_cl_clip_cntl & (1 << 16));
-  state_info.rasterizerDiscardEnable = VK_FALSE;
+  description.depth_clamp_enable = (regs.pa_cl_clip_cntl & (1 << 16)) ? 1 : 0;
 
+  VkPolygonMode polygon_mode = VK_POLYGON_MODE_FILL;
   bool poly_mode = ((regs.pa_su_sc_mode_cntl >> 3) & 0x3) != 0;
   if (poly_mode) {
     uint32_t front_poly_mode = (regs.pa_su_sc_mode_cntl >> 5) & 0x7;
@@ -1338,68 +2351,51 @@ PipelineCache::UpdateStatus PipelineCache::UpdateRasterizationState(
         VK_POLYGON_MODE_LINE,
         VK_POLYGON_MODE_FILL,
     };
-    state_info.polygonMode = kFillModes[front_poly_mode];
-  } else {
-    state_info.polygonMode = VK_POLYGON_MODE_FILL;
+    polygon_mode = kFillModes[std::min(front_poly_mode, uint32_t(2))];
   }
+  description.polygon_mode = uint32_t(polygon_mode);
 
+  VkCullModeFlags vulkan_cull_mode = VK_CULL_MODE_NONE;
   switch (cull_mode) {
-    case 0:
-      state_info.cullMode = VK_CULL_MODE_NONE;
-      break;
     case 1:
-      state_info.cullMode = VK_CULL_MODE_FRONT_BIT;
+      vulkan_cull_mode = VK_CULL_MODE_FRONT_BIT;
       break;
     case 2:
-      state_info.cullMode = VK_CULL_MODE_BACK_BIT;
+      vulkan_cull_mode = VK_CULL_MODE_BACK_BIT;
       break;
     case 3:
       // Cull both sides?
       assert_always();
       break;
   }
-  if (regs.pa_su_sc_mode_cntl & 0x4) {
-    state_info.frontFace = VK_FRONT_FACE_CLOCKWISE;
-  } else {
-    state_info.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
-  }
   if (primitive_type == xenos::PrimitiveType::kRectangleList) {
     // Rectangle lists aren't culled. There may be other things they skip too.
-    state_info.cullMode = VK_CULL_MODE_NONE;
+    vulkan_cull_mode = VK_CULL_MODE_NONE;
   } else if (primitive_type == xenos::PrimitiveType::kPointList) {
     // Face culling doesn't apply to point primitives.
-    state_info.cullMode = VK_CULL_MODE_NONE;
+    vulkan_cull_mode = VK_CULL_MODE_NONE;
   }
+  description.cull_mode = uint32_t(vulkan_cull_mode);
+  description.front_face_clockwise = (regs.pa_su_sc_mode_cntl & 0x4) ? 1 : 0;
 
-  state_info.depthBiasEnable = depth_bias_enable ? VK_TRUE : VK_FALSE;
-
-  // Ignored; set dynamically:
-  state_info.depthBiasConstantFactor = 0;
-  state_info.depthBiasClamp = 0;
-  state_info.depthBiasSlopeFactor = 0;
-  state_info.lineWidth = 1.0f;
+  description.depth_bias_enable = depth_bias_enable ? 1 : 0;
 
   return UpdateStatus::kMismatch;
 }
 
 PipelineCache::UpdateStatus PipelineCache::UpdateMultisampleState() {
   auto& regs = update_multisample_state_regs_;
-  auto& state_info = update_multisample_state_info_;
+  auto& description = update_description_;
 
   bool dirty = false;
   dirty |= SetShadowRegister(&regs.pa_sc_aa_config, XE_GPU_REG_PA_SC_AA_CONFIG);
   dirty |= SetShadowRegister(&regs.pa_su_sc_mode_cntl,
                              XE_GPU_REG_PA_SU_SC_MODE_CNTL);
   dirty |= SetShadowRegister(&regs.rb_surface_info, XE_GPU_REG_RB_SURFACE_INFO);
-  XXH3_64bits_update(&hash_state_, &regs, sizeof(regs));
   if (!dirty) {
     return UpdateStatus::kCompatible;
   }
 
-  state_info.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-  state_info.pNext = nullptr;
-  state_info.flags = 0;
-
   // PA_SC_AA_CONFIG MSAA_NUM_SAMPLES (0x7)
   // PA_SC_AA_MASK (0xFFFF)
   // PA_SU_SC_MODE_CNTL MSAA_ENABLE (0x10000)
@@ -1410,48 +2406,34 @@ PipelineCache::UpdateStatus PipelineCache::UpdateMultisampleState() {
         static_cast<xenos::MsaaSamples>((regs.rb_surface_info >> 16) & 0x3);
     switch (msaa_num_samples) {
       case xenos::MsaaSamples::k1X:
-        state_info.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-        break;
       case xenos::MsaaSamples::k2X:
-        state_info.rasterizationSamples = VK_SAMPLE_COUNT_2_BIT;
-        break;
       case xenos::MsaaSamples::k4X:
-        state_info.rasterizationSamples = VK_SAMPLE_COUNT_4_BIT;
+        description.msaa_samples = msaa_num_samples;
         break;
       default:
         assert_unhandled_case(msaa_num_samples);
+        description.msaa_samples = xenos::MsaaSamples::k1X;
         break;
     }
   } else {
-    state_info.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+    description.msaa_samples = xenos::MsaaSamples::k1X;
   }
 
-  state_info.sampleShadingEnable = VK_FALSE;
-  state_info.minSampleShading = 0;
-  state_info.pSampleMask = nullptr;
-  state_info.alphaToCoverageEnable = VK_FALSE;
-  state_info.alphaToOneEnable = VK_FALSE;
-
   return UpdateStatus::kMismatch;
 }
 
 PipelineCache::UpdateStatus PipelineCache::UpdateDepthStencilState() {
   auto& regs = update_depth_stencil_state_regs_;
-  auto& state_info = update_depth_stencil_state_info_;
+  auto& description = update_description_;
 
   bool dirty = false;
   dirty |= SetShadowRegister(&regs.rb_depthcontrol, XE_GPU_REG_RB_DEPTHCONTROL);
   dirty |=
       SetShadowRegister(&regs.rb_stencilrefmask, XE_GPU_REG_RB_STENCILREFMASK);
-  XXH3_64bits_update(&hash_state_, &regs, sizeof(regs));
   if (!dirty) {
     return UpdateStatus::kCompatible;
   }
 
-  state_info.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
-  state_info.pNext = nullptr;
-  state_info.flags = 0;
-
   static const VkCompareOp compare_func_map[] = {
       /*  0 */ VK_COMPARE_OP_NEVER,
       /*  1 */ VK_COMPARE_OP_LESS,
@@ -1475,51 +2457,48 @@ PipelineCache::UpdateStatus PipelineCache::UpdateDepthStencilState() {
 
   // Depth state
   // TODO: EARLY_Z_ENABLE (needs to be enabled in shaders)
-  state_info.depthWriteEnable = !!(regs.rb_depthcontrol & 0x4);
-  state_info.depthTestEnable = !!(regs.rb_depthcontrol & 0x2);
-  state_info.stencilTestEnable = !!(regs.rb_depthcontrol & 0x1);
+  description.depth_write_enable = (regs.rb_depthcontrol & 0x4) ? 1 : 0;
+  description.depth_test_enable = (regs.rb_depthcontrol & 0x2) ? 1 : 0;
+  description.stencil_test_enable = (regs.rb_depthcontrol & 0x1) ? 1 : 0;
 
-  state_info.depthCompareOp =
+  description.depth_compare_op =
       compare_func_map[(regs.rb_depthcontrol >> 4) & 0x7];
-  state_info.depthBoundsTestEnable = VK_FALSE;
 
   // Stencil state
-  state_info.front.compareOp =
+  description.stencil_front_compare_op =
       compare_func_map[(regs.rb_depthcontrol >> 8) & 0x7];
-  state_info.front.failOp = stencil_op_map[(regs.rb_depthcontrol >> 11) & 0x7];
-  state_info.front.passOp = stencil_op_map[(regs.rb_depthcontrol >> 14) & 0x7];
-  state_info.front.depthFailOp =
+  description.stencil_front_fail_op =
+      stencil_op_map[(regs.rb_depthcontrol >> 11) & 0x7];
+  description.stencil_front_pass_op =
+      stencil_op_map[(regs.rb_depthcontrol >> 14) & 0x7];
+  description.stencil_front_depth_fail_op =
       stencil_op_map[(regs.rb_depthcontrol >> 17) & 0x7];
 
   // BACKFACE_ENABLE
   if (!!(regs.rb_depthcontrol & 0x80)) {
-    state_info.back.compareOp =
+    description.stencil_back_compare_op =
         compare_func_map[(regs.rb_depthcontrol >> 20) & 0x7];
-    state_info.back.failOp = stencil_op_map[(regs.rb_depthcontrol >> 23) & 0x7];
-    state_info.back.passOp = stencil_op_map[(regs.rb_depthcontrol >> 26) & 0x7];
-    state_info.back.depthFailOp =
+    description.stencil_back_fail_op =
+        stencil_op_map[(regs.rb_depthcontrol >> 23) & 0x7];
+    description.stencil_back_pass_op =
+        stencil_op_map[(regs.rb_depthcontrol >> 26) & 0x7];
+    description.stencil_back_depth_fail_op =
         stencil_op_map[(regs.rb_depthcontrol >> 29) & 0x7];
   } else {
     // Back state is identical to front state.
-    std::memcpy(&state_info.back, &state_info.front, sizeof(VkStencilOpState));
+    description.stencil_back_compare_op = description.stencil_front_compare_op;
+    description.stencil_back_fail_op = description.stencil_front_fail_op;
+    description.stencil_back_pass_op = description.stencil_front_pass_op;
+    description.stencil_back_depth_fail_op =
+        description.stencil_front_depth_fail_op;
   }
 
-  // Ignored; set dynamically.
-  state_info.minDepthBounds = 0;
-  state_info.maxDepthBounds = 0;
-  state_info.front.compareMask = 0;
-  state_info.front.writeMask = 0;
-  state_info.front.reference = 0;
-  state_info.back.compareMask = 0;
-  state_info.back.writeMask = 0;
-  state_info.back.reference = 0;
-
   return UpdateStatus::kMismatch;
 }
 
 PipelineCache::UpdateStatus PipelineCache::UpdateColorBlendState() {
   auto& regs = update_color_blend_state_regs_;
-  auto& state_info = update_color_blend_state_info_;
+  auto& description = update_description_;
 
   bool dirty = false;
   dirty |= SetShadowRegister(&regs.rb_color_mask, XE_GPU_REG_RB_COLOR_MASK);
@@ -1532,18 +2511,10 @@ PipelineCache::UpdateStatus PipelineCache::UpdateColorBlendState() {
   dirty |=
       SetShadowRegister(&regs.rb_blendcontrol[3], XE_GPU_REG_RB_BLENDCONTROL3);
   dirty |= SetShadowRegister(&regs.rb_modecontrol, XE_GPU_REG_RB_MODECONTROL);
-  XXH3_64bits_update(&hash_state_, &regs, sizeof(regs));
   if (!dirty) {
     return UpdateStatus::kCompatible;
   }
 
-  state_info.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-  state_info.pNext = nullptr;
-  state_info.flags = 0;
-
-  state_info.logicOpEnable = VK_FALSE;
-  state_info.logicOp = VK_LOGIC_OP_NO_OP;
-
   auto enable_mode = static_cast<xenos::ModeControl>(regs.rb_modecontrol & 0x7);
 
   static const VkBlendFactor kBlendFactorMap[] = {
@@ -1572,45 +2543,36 @@ PipelineCache::UpdateStatus PipelineCache::UpdateColorBlendState() {
       /*  3 */ VK_BLEND_OP_MAX,
       /*  4 */ VK_BLEND_OP_REVERSE_SUBTRACT,
   };
-  auto& attachment_states = update_color_blend_attachment_states_;
   for (int i = 0; i < 4; ++i) {
     uint32_t blend_control = regs.rb_blendcontrol[i];
-    auto& attachment_state = attachment_states[i];
-    attachment_state.blendEnable = (blend_control & 0x1FFF1FFF) != 0x00010001;
+    PipelineRenderTarget& render_target = description.render_targets[i];
+    render_target.blend_enable =
+        (blend_control & 0x1FFF1FFF) != 0x00010001 ? 1 : 0;
     // A2XX_RB_BLEND_CONTROL_COLOR_SRCBLEND
-    attachment_state.srcColorBlendFactor =
+    render_target.src_color_blend_factor =
         kBlendFactorMap[(blend_control & 0x0000001F) >> 0];
     // A2XX_RB_BLEND_CONTROL_COLOR_DESTBLEND
-    attachment_state.dstColorBlendFactor =
+    render_target.dst_color_blend_factor =
         kBlendFactorMap[(blend_control & 0x00001F00) >> 8];
     // A2XX_RB_BLEND_CONTROL_COLOR_COMB_FCN
-    attachment_state.colorBlendOp =
+    render_target.color_blend_op =
         kBlendOpMap[(blend_control & 0x000000E0) >> 5];
     // A2XX_RB_BLEND_CONTROL_ALPHA_SRCBLEND
-    attachment_state.srcAlphaBlendFactor =
+    render_target.src_alpha_blend_factor =
         kBlendFactorMap[(blend_control & 0x001F0000) >> 16];
     // A2XX_RB_BLEND_CONTROL_ALPHA_DESTBLEND
-    attachment_state.dstAlphaBlendFactor =
+    render_target.dst_alpha_blend_factor =
         kBlendFactorMap[(blend_control & 0x1F000000) >> 24];
     // A2XX_RB_BLEND_CONTROL_ALPHA_COMB_FCN
-    attachment_state.alphaBlendOp =
+    render_target.alpha_blend_op =
         kBlendOpMap[(blend_control & 0x00E00000) >> 21];
     // A2XX_RB_COLOR_MASK_WRITE_* == D3DRS_COLORWRITEENABLE
     // Lines up with VkColorComponentFlagBits, where R=bit 1, G=bit 2, etc..
     uint32_t write_mask = (regs.rb_color_mask >> (i * 4)) & 0xF;
-    attachment_state.colorWriteMask =
+    render_target.color_write_mask =
         enable_mode == xenos::ModeControl::kColorDepth ? write_mask : 0;
   }
 
-  state_info.attachmentCount = 4;
-  state_info.pAttachments = attachment_states;
-
-  // Ignored; set dynamically.
-  state_info.blendConstants[0] = 0.0f;
-  state_info.blendConstants[1] = 0.0f;
-  state_info.blendConstants[2] = 0.0f;
-  state_info.blendConstants[3] = 0.0f;
-
   return UpdateStatus::kMismatch;
 }
 
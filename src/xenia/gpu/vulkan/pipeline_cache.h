@@ -10,11 +10,20 @@
 #ifndef XENIA_GPU_VULKAN_PIPELINE_CACHE_H_
 #define XENIA_GPU_VULKAN_PIPELINE_CACHE_H_
 
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
 #include <unordered_map>
+#include <vector>
 
+#include "xenia/base/platform.h"
 #include "xenia/base/string_buffer.h"
-#include "xenia/base/xxhash.h"
+#include "xenia/base/threading.h"
 #include "xenia/gpu/register_file.h"
+#include "xenia/gpu/shader_storage.h"
 #include "xenia/gpu/spirv_shader_translator.h"
 #include "xenia/gpu/vulkan/render_cache.h"
 #include "xenia/gpu/vulkan/vulkan_shader.h"
@@ -38,7 +47,8 @@ class PipelineCache {
     kError,
   };
 
-  PipelineCache(RegisterFile* register_file, ui::vulkan::VulkanDevice* device);
+  PipelineCache(RegisterFile* register_file, ui::vulkan::VulkanDevice* device,
+                RenderCache* render_cache);
   ~PipelineCache();
 
   VkResult Initialize(VkDescriptorSetLayout uniform_descriptor_set_layout,
@@ -46,6 +56,21 @@ class PipelineCache {
                       VkDescriptorSetLayout vertex_descriptor_set_layout);
   void Shutdown();
 
+  // Loads the guest shaders, their SPIR-V translations, the pipeline
+  // descriptions and the driver pipeline cache stored by previous runs of the
+  // title, translates and creates everything not loaded directly, and starts
+  // appending new shaders and pipelines to the storage. Everything is loaded
+  // by the time this returns regardless of blocking, as the pipelines are
+  // looked up without waiting on the processor thread.
+  void InitializeShaderStorage(const std::filesystem::path& cache_root,
+                               uint32_t title_id, bool blocking);
+  // Writes the driver pipeline cache and closes the storage files.
+  void ShutdownShaderStorage();
+
+  // Requests flushing of the storage files if anything was written to them
+  // since the last call.
+  void EndSubmission();
+
   // Loads a shader from the cache, possibly translating it.
   VulkanShader* LoadShader(xenos::ShaderType shader_type,
                            uint32_t guest_address, const uint32_t* host_address,
@@ -71,26 +96,121 @@ class PipelineCache {
   // Pipeline layout shared by all pipelines.
   VkPipelineLayout pipeline_layout() const { return pipeline_layout_; }
 
-  // Clears all cached content.
-  void ClearCache();
+  // Clears all cached content, reloading the shader storage if it's open and
+  // not shutting down.
+  void ClearCache(bool shutting_down = false);
 
  private:
+  // Update PipelineDescription::kVersion if any of the Pipeline* enums are
+  // changed!
+
+  enum class PipelineGeometryShader : uint32_t {
+    kNone,
+    kPointList,
+    kRectangleList,
+    kQuadList,
+    kLineQuadList,
+  };
+
+  // Vulkan enums are stored directly, only needing the bits for the values
+  // that are actually used.
+  XEPACKEDSTRUCT(PipelineRenderTarget, {
+    uint32_t blend_enable : 1;            // 1
+    uint32_t src_color_blend_factor : 5;  // 6
+    uint32_t dst_color_blend_factor : 5;  // 11
+    uint32_t color_blend_op : 3;          // 14
+    uint32_t src_alpha_blend_factor : 5;  // 19
+    uint32_t dst_alpha_blend_factor : 5;  // 24
+    uint32_t alpha_blend_op : 3;          // 27
+    uint32_t color_write_mask : 4;        // 31
+  });
+
+  // Everything needed to create a pipeline, also used as its key in the cache.
+  XEPACKEDSTRUCT(PipelineDescription, {
+    uint64_t vertex_shader_hash;
+    uint64_t vertex_shader_modification;
+    // 0 if drawing with the dummy pixel shader.
+    uint64_t pixel_shader_hash;
+    uint64_t pixel_shader_modification;
+
+    // For creating a compatible render pass.
+    xenos::ColorRenderTargetFormat color_formats[4];
+    xenos::DepthRenderTargetFormat depth_format;
+
+    uint32_t primitive_topology : 4;             // 4
+    uint32_t primitive_restart : 1;              // 5
+    PipelineGeometryShader geometry_shader : 3;  // 8
+    uint32_t depth_clamp_enable : 1;             // 9
+    uint32_t polygon_mode : 2;                   // 11
+    uint32_t cull_mode : 2;                      // 13
+    uint32_t front_face_clockwise : 1;           // 14
+    uint32_t depth_bias_enable : 1;              // 15
+    // k1X unless vulkan_native_msaa is enabled.
+    xenos::MsaaSamples msaa_samples : 2;  // 17
+    uint32_t depth_test_enable : 1;       // 18
+    uint32_t depth_write_enable : 1;      // 19
+    uint32_t depth_compare_op : 3;        // 22
+    uint32_t stencil_test_enable : 1;     // 23
+
+    uint32_t stencil_front_fail_op : 3;        // 3
+    uint32_t stencil_front_pass_op : 3;        // 6
+    uint32_t stencil_front_depth_fail_op : 3;  // 9
+    uint32_t stencil_front_compare_op : 3;     // 12
+    uint32_t stencil_back_fail_op : 3;         // 15
+    uint32_t stencil_back_pass_op : 3;         // 18
+    uint32_t stencil_back_depth_fail_op : 3;   // 21
+    uint32_t stencil_back_compare_op : 3;      // 24
+
+    PipelineRenderTarget render_targets[4];
+
+    static constexpr uint32_t kVersion = 0x20201222;
+  });
+
+  XEPACKEDSTRUCT(PipelineStoredDescription, {
+    uint64_t description_hash;
+    PipelineDescription description;
+  });
+
+  VulkanShader* LoadShader(xenos::ShaderType shader_type,
+                           const uint32_t* host_address, uint32_t dword_count,
+                           uint64_t data_hash);
+
   // Creates or retrieves an existing pipeline for the currently configured
   // state.
-  VkPipeline GetPipeline(const RenderState* render_state, uint64_t hash_key);
+  VkPipeline GetPipeline(VkRenderPass render_pass, uint64_t hash_key);
+  // Can be called from multiple threads.
+  VkPipeline CreateVulkanPipeline(const PipelineDescription& description,
+                                  VkShaderModule vertex_shader,
+                                  VkShaderModule pixel_shader,
+                                  VkRenderPass render_pass);
 
   bool TranslateShader(VulkanShader::VulkanTranslation& translation);
+  // Can be called from multiple threads.
+  bool TranslateAnalyzedShader(ShaderTranslator& translator,
+                               VulkanShader::VulkanTranslation& translation);
+  // Loads SPIR-V translated by a previous run. Can be called from multiple
+  // threads.
+  bool LoadStoredTranslation(VulkanShader::VulkanTranslation& translation,
+                             std::vector<uint8_t> spirv);
+  // Queues writing of the ucode and the SPIR-V of a new valid translation to
+  // the storage.
+  void StoreTranslation(VulkanShader::VulkanTranslation& translation);
+
+  void LoadPipelineCacheData(const std::filesystem::path& path);
+  void SavePipelineCacheData(const std::filesystem::path& path);
 
   void DumpShaderDisasmAMD(VkPipeline pipeline);
   void DumpShaderDisasmNV(const VkGraphicsPipelineCreateInfo& info);
 
-  // Gets a geometry shader used to emulate the given primitive type.
-  // Returns nullptr if the primitive doesn't need to be emulated.
-  VkShaderModule GetGeometryShader(xenos::PrimitiveType primitive_type,
-                                   bool is_line_mode);
+  // Gets the geometry shader used to emulate the given primitive type.
+  // Returns kNone if the primitive doesn't need to be emulated.
+  static PipelineGeometryShader GetGeometryShaderType(
+      xenos::PrimitiveType primitive_type, bool is_line_mode);
+  VkShaderModule GetGeometryShader(PipelineGeometryShader geometry_shader);
 
   RegisterFile* register_file_ = nullptr;
   ui::vulkan::VulkanDevice* device_ = nullptr;
+  RenderCache* render_cache_ = nullptr;
 
   // Temporary storage for AnalyzeUcode calls.
   StringBuffer ucode_disasm_buffer_;
@@ -101,8 +221,7 @@ class PipelineCache {
   // All loaded shaders mapped by their guest hash key.
   std::unordered_map<uint64_t, VulkanShader*> shader_map_;
 
-  // Vulkan pipeline cache, which in theory helps us out.
-  // This can be serialized to disk and reused, if we want.
+  // Vulkan pipeline cache, serialized to the local shader storage.
   VkPipelineCache pipeline_cache_ = nullptr;
   // Layout used for all pipelines describing our uniforms, textures, and push
   // constants.
@@ -119,11 +238,13 @@ class PipelineCache {
   // Shared dummy pixel shader.
   VkShaderModule dummy_pixel_shader_;
 
-  // Hash state used to incrementally produce pipeline hashes during update.
-  // By the time the full update pass has run the hash will represent the
-  // current state in a way that can uniquely identify the produced VkPipeline.
-  XXH3_state_t hash_state_;
-  // All previously generated pipelines mapped by hash.
+  // Description of the pipeline for the current state, produced during the
+  // update pass. Its hash identifies the VkPipeline.
+  PipelineDescription update_description_;
+  // Translations of the current shaders, also produced during the update pass.
+  VulkanShader::VulkanTranslation* update_vertex_shader_translation_ = nullptr;
+  VulkanShader::VulkanTranslation* update_pixel_shader_translation_ = nullptr;
+  // All previously generated pipelines mapped by description hash.
   std::unordered_map<uint64_t, VkPipeline> cached_pipelines_;
 
   // Previously used pipeline. This matches our current state settings
@@ -131,18 +252,44 @@ class PipelineCache {
   // changed.
   VkPipeline current_pipeline_ = nullptr;
 
+  // Currently open shader storage path.
+  std::filesystem::path shader_storage_cache_root_;
+  uint32_t shader_storage_title_id_ = 0;
+
+  // Storage output streams, for preload in the next emulator runs.
+  FILE* shader_storage_file_ = nullptr;
+  FILE* spirv_storage_file_ = nullptr;
+  FILE* pipeline_storage_file_ = nullptr;
+  // For only writing shaders to the currently open storage once, incremented
+  // when switching the storage.
+  uint32_t shader_storage_index_ = 0;
+  bool storage_file_flush_needed_ = false;
+
+  // Thread for asynchronous writing to the storage streams.
+  void StorageWriteThread();
+  std::mutex storage_write_request_lock_;
+  std::condition_variable storage_write_request_cond_;
+  // Storage thread input is protected with storage_write_request_lock_, and the
+  // thread is notified about its change via storage_write_request_cond_.
+  std::deque<const Shader*> storage_write_shader_queue_;
+  std::deque<const VulkanShader::VulkanTranslation*>
+      storage_write_spirv_queue_;
+  std::deque<PipelineStoredDescription> storage_write_pipeline_queue_;
+  bool storage_write_flush_ = false;
+  bool storage_write_thread_shutdown_ = false;
+  std::unique_ptr<xe::threading::Thread> storage_write_thread_;
+
  private:
-  UpdateStatus UpdateState(VulkanShader* vertex_shader,
+  UpdateStatus UpdateState(const RenderState* render_state,
+                           VulkanShader* vertex_shader,
                            VulkanShader* pixel_shader,
                            xenos::PrimitiveType primitive_type);
 
-  UpdateStatus UpdateRenderTargetState();
+  UpdateStatus UpdateRenderTargetState(const RenderState* render_state);
   UpdateStatus UpdateShaderStages(VulkanShader* vertex_shader,
                                   VulkanShader* pixel_shader,
                                   xenos::PrimitiveType primitive_type);
-  UpdateStatus UpdateVertexInputState(VulkanShader* vertex_shader);
   UpdateStatus UpdateInputAssemblyState(xenos::PrimitiveType primitive_type);
-  UpdateStatus UpdateViewportState();
   UpdateStatus UpdateRasterizationState(xenos::PrimitiveType primitive_type);
   UpdateStatus UpdateMultisampleState();
   UpdateStatus UpdateDepthStencilState();
@@ -153,21 +300,8 @@ class PipelineCache {
   bool SetShadowRegisterArray(uint32_t* dest, uint32_t num,
                               uint32_t register_name);
 
-  struct UpdateRenderTargetsRegisters {
-    uint32_t rb_modecontrol;
-    reg::RB_SURFACE_INFO rb_surface_info;
-    reg::RB_COLOR_INFO rb_color_info;
-    reg::RB_DEPTH_INFO rb_depth_info;
-    reg::RB_COLOR_INFO rb_color1_info;
-    reg::RB_COLOR_INFO rb_color2_info;
-    reg::RB_COLOR_INFO rb_color3_info;
-    uint32_t rb_color_mask;
-    uint32_t rb_depthcontrol;
-    uint32_t rb_stencilrefmask;
-
-    UpdateRenderTargetsRegisters() { Reset(); }
-    void Reset() { std::memset(this, 0, sizeof(*this)); }
-  } update_render_targets_regs_;
+  // Makes the next update pass rebuild the whole description.
+  void ResetUpdateState();
 
   struct UpdateShaderStagesRegisters {
     xenos::PrimitiveType primitive_type;
@@ -179,19 +313,6 @@ class PipelineCache {
     UpdateShaderStagesRegisters() { Reset(); }
     void Reset() { std::memset(this, 0, sizeof(*this)); }
   } update_shader_stages_regs_;
-  VkPipelineShaderStageCreateInfo update_shader_stages_info_[3];
-  uint32_t update_shader_stages_stage_count_ = 0;
-
-  struct UpdateVertexInputStateRegisters {
-    VulkanShader* vertex_shader;
-
-    UpdateVertexInputStateRegisters() { Reset(); }
-    void Reset() { std::memset(this, 0, sizeof(*this)); }
-  } update_vertex_input_state_regs_;
-  VkPipelineVertexInputStateCreateInfo update_vertex_input_state_info_;
-  VkVertexInputBindingDescription update_vertex_input_state_binding_descrs_[32];
-  VkVertexInputAttributeDescription
-      update_vertex_input_state_attrib_descrs_[96];
 
   struct UpdateInputAssemblyStateRegisters {
     xenos::PrimitiveType primitive_type;
@@ -201,27 +322,6 @@ class PipelineCache {
     UpdateInputAssemblyStateRegisters() { Reset(); }
     void Reset() { std::memset(this, 0, sizeof(*this)); }
   } update_input_assembly_state_regs_;
-  VkPipelineInputAssemblyStateCreateInfo update_input_assembly_state_info_;
-
-  struct UpdateViewportStateRegisters {
-    // uint32_t pa_cl_clip_cntl;
-    uint32_t rb_surface_info;
-    uint32_t pa_cl_vte_cntl;
-    uint32_t pa_su_sc_mode_cntl;
-    uint32_t pa_sc_window_offset;
-    uint32_t pa_sc_window_scissor_tl;
-    uint32_t pa_sc_window_scissor_br;
-    float pa_cl_vport_xoffset;
-    float pa_cl_vport_yoffset;
-    float pa_cl_vport_zoffset;
-    float pa_cl_vport_xscale;
-    float pa_cl_vport_yscale;
-    float pa_cl_vport_zscale;
-
-    UpdateViewportStateRegisters() { Reset(); }
-    void Reset() { std::memset(this, 0, sizeof(*this)); }
-  } update_viewport_state_regs_;
-  VkPipelineViewportStateCreateInfo update_viewport_state_info_;
 
   struct UpdateRasterizationStateRegisters {
     xenos::PrimitiveType primitive_type;
@@ -236,7 +336,6 @@ class PipelineCache {
     UpdateRasterizationStateRegisters() { Reset(); }
     void Reset() { std::memset(this, 0, sizeof(*this)); }
   } update_rasterization_state_regs_;
-  VkPipelineRasterizationStateCreateInfo update_rasterization_state_info_;
 
   struct UpdateMultisampleStateeRegisters {
     uint32_t pa_sc_aa_config;
@@ -246,7 +345,6 @@ class PipelineCache {
     UpdateMultisampleStateeRegisters() { Reset(); }
     void Reset() { std::memset(this, 0, sizeof(*this)); }
   } update_multisample_state_regs_;
-  VkPipelineMultisampleStateCreateInfo update_multisample_state_info_;
 
   struct UpdateDepthStencilStateRegisters {
     uint32_t rb_depthcontrol;
@@ -255,7 +353,6 @@ class PipelineCache {
     UpdateDepthStencilStateRegisters() { Reset(); }
     void Reset() { std::memset(this, 0, sizeof(*this)); }
   } update_depth_stencil_state_regs_;
-  VkPipelineDepthStencilStateCreateInfo update_depth_stencil_state_info_;
 
   struct UpdateColorBlendStateRegisters {
     uint32_t rb_color_mask;
@@ -265,8 +362,6 @@ class PipelineCache {
     UpdateColorBlendStateRegisters() { Reset(); }
     void Reset() { std::memset(this, 0, sizeof(*this)); }
   } update_color_blend_state_regs_;
-  VkPipelineColorBlendStateCreateInfo update_color_blend_state_info_;
-  VkPipelineColorBlendAttachmentState update_color_blend_attachment_states_[4];
 
   struct SetDynamicStateRegisters {
     uint32_t pa_sc_window_offset;
@@ -848,36 +848,46 @@ bool RenderCache::ParseConfiguration(RenderConfiguration* config) {
   return true;
 }
 
-bool RenderCache::ConfigureRenderPass(VkCommandBuffer command_buffer,
-                                      RenderConfiguration* config,
-                                      CachedRenderPass** out_render_pass,
-                                      CachedFramebuffer** out_framebuffer) {
-  *out_render_pass = nullptr;
-  *out_framebuffer = nullptr;
+VkRenderPass RenderCache::GetRenderPass(const RenderConfiguration& config) {
+  CachedRenderPass* render_pass = FindOrCreateRenderPass(config);
+  return render_pass ? render_pass->handle : nullptr;
+}
 
+CachedRenderPass* RenderCache::FindOrCreateRenderPass(
+    const RenderConfiguration& config) {
   // TODO(benvanik): better lookup.
   // Attempt to find the render pass in our cache.
-  CachedRenderPass* render_pass = nullptr;
   for (auto cached_render_pass : cached_render_passes_) {
-    if (cached_render_pass->IsCompatible(*config)) {
+    if (cached_render_pass->IsCompatible(config)) {
       // Found a match.
-      render_pass = cached_render_pass;
-      break;
+      return cached_render_pass;
     }
   }
 
   // If no render pass was found in the cache create a new one.
-  if (!render_pass) {
-    render_pass = new CachedRenderPass(*device_, *config);
-    VkResult status = render_pass->Initialize();
-    if (status != VK_SUCCESS) {
-      XELOGE("{}: Failed to create render pass, status {}", __func__,
-             ui::vulkan::to_string(status));
-      delete render_pass;
-      return false;
-    }
+  CachedRenderPass* render_pass = new CachedRenderPass(*device_, config);
+  VkResult status = render_pass->Initialize();
+  if (status != VK_SUCCESS) {
+    XELOGE("{}: Failed to create render pass, status {}", __func__,
+           ui::vulkan::to_string(status));
+    delete render_pass;
+    return nullptr;
+  }
 
-    cached_render_passes_.push_back(render_pass);
+  cached_render_passes_.push_back(render_pass);
+  return render_pass;
+}
+
+bool RenderCache::ConfigureRenderPass(VkCommandBuffer command_buffer,
+                                      RenderConfiguration* config,
+                                      CachedRenderPass** out_render_pass,
+                                      CachedFramebuffer** out_framebuffer) {
+  *out_render_pass = nullptr;
+  *out_framebuffer = nullptr;
+
+  CachedRenderPass* render_pass = FindOrCreateRenderPass(*config);
+  if (!render_pass) {
+    return false;
   }
 
   // TODO(benvanik): better lookup.
@@ -298,6 +298,10 @@ class RenderCache {
   // The command buffer will be transitioned out of the render pass phase.
   void EndRenderPass();
 
+  // Gets or creates a render pass compatible with the given configuration, for
+  // creating pipelines before they're used in a render pass.
+  VkRenderPass GetRenderPass(const RenderConfiguration& config);
+
   // Clears all cached content.
   void ClearCache();
 
@@ -349,6 +353,9 @@ class RenderCache {
   void UpdateTileView(VkCommandBuffer command_buffer, CachedTileView* view,
                       bool load, bool insert_barrier = true);
 
+  // Gets or creates a render pass for the given configuration.
+  CachedRenderPass* FindOrCreateRenderPass(const RenderConfiguration& config);
+
   // Gets or creates a render pass and frame buffer for the given configuration.
   // This attempts to reuse as much as possible across render passes and
   // framebuffers.
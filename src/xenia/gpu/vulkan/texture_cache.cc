@@ -16,6 +16,7 @@
 #include "xenia/base/math.h"
 #include "xenia/base/memory.h"
 #include "xenia/base/profiling.h"
+#include "xenia/base/threading.h"
 #include "xenia/gpu/gpu_flags.h"
 #include "xenia/gpu/sampler_info.h"
 #include "xenia/gpu/texture_conversion.h"
@@ -37,6 +38,9 @@ using xe::ui::vulkan::CheckResult;
 
 constexpr uint32_t kMaxTextureSamplers = 32;
 constexpr VkDeviceSize kStagingBufferSize = 64 * 1024 * 1024;
+// Smaller textures are converted on the command processor thread only.
+constexpr size_t kParallelConversionMinLength = 256 * 1024;
+constexpr uint32_t kConversionJobLength = 64 * 1024;
 
 const char* get_dimension_name(xenos::DataDimension dimension) {
   static const char* names[] = {
@@ -155,10 +159,20 @@ VkResult TextureCache::Initialize() {
       memory_->RegisterPhysicalMemoryInvalidationCallback(
           MemoryInvalidationCallbackThunk, this);
 
+  int32_t conversion_thread_count = cvars::vulkan_texture_conversion_threads;
+  if (conversion_thread_count < 0) {
+    conversion_thread_count = int32_t(
+        std::min(xe::threading::logical_processor_count(), 5u) - 1);
+  }
+  conversion_workers_ = std::make_unique<texture_conversion::ConversionWorkers>(
+      uint32_t(std::max(conversion_thread_count, 0)));
+
   return VK_SUCCESS;
 }
 
 void TextureCache::Shutdown() {
+  conversion_workers_.reset();
+
   if (memory_invalidation_callback_handle_ != nullptr) {
     memory_->UnregisterPhysicalMemoryInvalidationCallback(
         memory_invalidation_callback_handle_);
@@ -981,63 +995,36 @@ void TextureCache::FlushPendingCommands(VkCommandBuffer command_buffer,
   vkBeginCommandBuffer(command_buffer, &begin_info);
 }
 
-bool TextureCache::ConvertTexture(uint8_t* dest, VkBufferImageCopy* copy_region,
-                                  uint32_t mip, const TextureInfo& src) {
-#if FINE_GRAINED_DRAW_SCOPES
-  SCOPE_profile_cpu_f("gpu");
-#endif  // FINE_GRAINED_DRAW_SCOPES
+bool TextureCache::PrepareTextureConversion(
+    uint8_t* dest, VkBufferImageCopy* copy_region, uint32_t mip,
+    const TextureInfo& src, std::vector<ConversionJob>& jobs) {
   uint32_t offset_x = 0;
   uint32_t offset_y = 0;
-  uint32_t address = src.GetMipLocation(mip, &offset_x, &offset_y, true);
-  if (!address) {
+  if (!src.GetMipLocation(mip, &offset_x, &offset_y, true)) {
     return false;
   }
 
-  void* host_address = memory_->TranslatePhysical(address);
-
   auto is_cube = src.dimension == xenos::DataDimension::kCube;
   auto src_extent = src.GetMipExtent(mip, true);
   auto dst_extent = GetMipExtent(src, mip);
 
-  uint32_t src_pitch =
-      src_extent.block_pitch_h * src.format_info()->bytes_per_block();
+  // Split big mips into bands of rows, so a single big mip doesn't end up on
+  // one thread.
+  uint32_t row_count =
+      src.is_tiled ? src_extent.block_height : dst_extent.block_height;
   uint32_t dst_pitch =
       dst_extent.block_pitch_h * GetFormatInfo(src.format)->bytes_per_block();
-
-  auto copy_block = GetFormatCopyBlock(src.format);
-
-  const uint8_t* src_mem = reinterpret_cast<const uint8_t*>(host_address);
-  if (!src.is_tiled) {
-    for (uint32_t face = 0; face < dst_extent.depth; face++) {
-      src_mem += offset_y * src_pitch;
-      src_mem += offset_x * src.format_info()->bytes_per_block();
-      for (uint32_t y = 0; y < dst_extent.block_height; y++) {
-        copy_block(src.endianness, dest + y * dst_pitch,
-                   src_mem + y * src_pitch, dst_pitch);
-      }
-      src_mem += src_pitch * src_extent.block_pitch_v;
-      dest += dst_pitch * dst_extent.block_pitch_v;
-    }
-  } else {
-    // Untile image.
-    // We could do this in a shader to speed things up, as this is pretty slow.
-    for (uint32_t face = 0; face < dst_extent.depth; face++) {
-      texture_conversion::UntileInfo untile_info;
-      std::memset(&untile_info, 0, sizeof(untile_info));
-      untile_info.offset_x = offset_x;
-      untile_info.offset_y = offset_y;
-      untile_info.width = src_extent.block_width;
-      untile_info.height = src_extent.block_height;
-      untile_info.input_pitch = src_extent.block_pitch_h;
-      untile_info.output_pitch = dst_extent.block_pitch_h;
-      untile_info.input_format_info = src.format_info();
-      untile_info.output_format_info = GetFormatInfo(src.format);
-      untile_info.copy_callback = [=](auto o, auto i, auto l) {
-        copy_block(src.endianness, o, i, l);
-      };
-      texture_conversion::Untile(dest, src_mem, &untile_info);
-      src_mem += src_pitch * src_extent.block_pitch_v;
-      dest += dst_pitch * dst_extent.block_pitch_v;
+  uint32_t job_row_count =
+      std::max(kConversionJobLength / std::max(dst_pitch, 1u), 1u);
+  for (uint32_t slice = 0; slice < dst_extent.depth; slice++) {
+    for (uint32_t row = 0; row < row_count; row += job_row_count) {
+      ConversionJob job;
+      job.dest = dest;
+      job.mip = mip;
+      job.slice = slice;
+      job.first_row = row;
+      job.row_count = std::min(job_row_count, row_count - row);
+      jobs.push_back(job);
     }
   }
 
@@ -1053,6 +1040,55 @@ bool TextureCache::ConvertTexture(uint8_t* dest, VkBufferImageCopy* copy_region,
   return true;
 }
 
+void TextureCache::ConvertTexture(const ConversionJob& job,
+                                  const TextureInfo& src) {
+#if FINE_GRAINED_DRAW_SCOPES
+  SCOPE_profile_cpu_f("gpu");
+#endif  // FINE_GRAINED_DRAW_SCOPES
+  uint32_t offset_x = 0;
+  uint32_t offset_y = 0;
+  uint32_t address = src.GetMipLocation(job.mip, &offset_x, &offset_y, true);
+  const uint8_t* src_mem = memory_->TranslatePhysical(address);
+
+  auto src_extent = src.GetMipExtent(job.mip, true);
+  auto dst_extent = GetMipExtent(src, job.mip);
+
+  uint32_t src_pitch =
+      src_extent.block_pitch_h * src.format_info()->bytes_per_block();
+  uint32_t dst_pitch =
+      dst_extent.block_pitch_h * GetFormatInfo(src.format)->bytes_per_block();
+
+  auto copy_block = GetFormatCopyBlock(src.format);
+
+  src_mem += src_pitch * src_extent.block_pitch_v * job.slice;
+  uint8_t* dest = job.dest + dst_pitch * dst_extent.block_pitch_v * job.slice +
+                  dst_pitch * job.first_row;
+  if (!src.is_tiled) {
+    src_mem += offset_y * src_pitch;
+    src_mem += offset_x * src.format_info()->bytes_per_block();
+    for (uint32_t y = job.first_row; y < job.first_row + job.row_count; y++) {
+      copy_block(src.endianness, dest, src_mem + y * src_pitch, dst_pitch);
+      dest += dst_pitch;
+    }
+  } else {
+    // Untile image.
+    // We could do this in a shader to speed things up, as this is pretty slow.
+    texture_conversion::UntileInfo untile_info;
+    std::memset(&untile_info, 0, sizeof(untile_info));
+    untile_info.offset_x = offset_x;
+    untile_info.offset_y = offset_y + job.first_row;
+    untile_info.width = src_extent.block_width;
+    untile_info.height = job.row_count;
+    untile_info.input_pitch = src_extent.block_pitch_h;
+    untile_info.output_pitch = dst_extent.block_pitch_h;
+    untile_info.input_format_info = src.format_info();
+    untile_info.output_format_info = GetFormatInfo(src.format);
+    untile_info.endian = src.endianness;
+    untile_info.copy_block = copy_block;
+    texture_conversion::Untile(dest, src_mem, &untile_info);
+  }
+}
+
 bool TextureCache::UploadTexture(VkCommandBuffer command_buffer,
                                  VkFence completion_fence, Texture* dest,
                                  const TextureInfo& src) {
@@ -1131,10 +1167,12 @@ bool TextureCache::UploadTexture(VkCommandBuffer command_buffer,
   // Upload all mips.
   auto unpack_buffer = reinterpret_cast<uint8_t*>(alloc->host_ptr);
   VkDeviceSize unpack_offset = 0;
+  conversion_jobs_.clear();
   for (uint32_t mip = src.mip_min_level, region = 0; mip <= src.mip_max_level;
        mip++, region++) {
-    if (!ConvertTexture(&unpack_buffer[unpack_offset], &copy_regions[region],
-                        mip, src)) {
+    if (!PrepareTextureConversion(&unpack_buffer[unpack_offset],
+                                  &copy_regions[region], mip, src,
+                                  conversion_jobs_)) {
       XELOGW("Failed to convert texture mip {}!", mip);
       return false;
     }
@@ -1151,6 +1189,18 @@ bool TextureCache::UploadTexture(VkCommandBuffer command_buffer,
     unpack_offset += ComputeMipStorage(src, mip);
   }
 
+  // Convert the mips, slices and bands of rows in parallel.
+  auto convert = [this, &src](size_t job_index) {
+    ConvertTexture(conversion_jobs_[job_index], src);
+  };
+  if (unpack_length >= kParallelConversionMinLength) {
+    conversion_workers_->Run(conversion_jobs_.size(), convert);
+  } else {
+    for (size_t i = 0; i < conversion_jobs_.size(); ++i) {
+      convert(i);
+    }
+  }
+
   if (cvars::texture_dump) {
     TextureDump(src, unpack_buffer, unpack_length);
   }
@@ -139,6 +139,16 @@ class TextureCache {
     bool is_mip;
   };
 
+  // A range of block rows of a slice of a mip to convert.
+  struct ConversionJob {
+    // Start of the mip in the staging buffer.
+    uint8_t* dest;
+    uint32_t mip;
+    uint32_t slice;
+    uint32_t first_row;
+    uint32_t row_count;
+  };
+
   // Allocates a new texture and memory to back it on the GPU.
   Texture* AllocateTexture(const TextureInfo& texture_info,
                            VkFormatFeatureFlags required_flags =
@@ -163,8 +173,12 @@ class TextureCache {
   void FlushPendingCommands(VkCommandBuffer command_buffer,
                             VkFence completion_fence);
 
-  bool ConvertTexture(uint8_t* dest, VkBufferImageCopy* copy_region,
-                      uint32_t mip, const TextureInfo& src);
+  // Fills the copy region of a mip and splits its conversion into jobs.
+  bool PrepareTextureConversion(uint8_t* dest, VkBufferImageCopy* copy_region,
+                                uint32_t mip, const TextureInfo& src,
+                                std::vector<ConversionJob>& jobs);
+  // Thread-safe.
+  void ConvertTexture(const ConversionJob& job, const TextureInfo& src);
 
   static const FormatInfo* GetFormatInfo(xenos::TextureFormat format);
   static texture_conversion::CopyBlockCallback GetFormatCopyBlock(
@@ -214,6 +228,9 @@ class TextureCache {
 
   VmaAllocator mem_allocator_ = nullptr;
 
+  std::unique_ptr<texture_conversion::ConversionWorkers> conversion_workers_;
+  std::vector<ConversionJob> conversion_jobs_;
+
   ui::vulkan::CircularBuffer staging_buffer_;
   ui::vulkan::CircularBuffer wb_staging_buffer_;
   std::unordered_map<uint64_t, Texture*> textures_;
@@ -59,6 +59,12 @@ void VulkanCommandProcessor::ClearCaches() {
   cache_clear_requested_ = true;
 }
 
+void VulkanCommandProcessor::InitializeShaderStorage(
+    const std::filesystem::path& cache_root, uint32_t title_id, bool blocking) {
+  CommandProcessor::InitializeShaderStorage(cache_root, title_id, blocking);
+  pipeline_cache_->InitializeShaderStorage(cache_root, title_id, blocking);
+}
+
 bool VulkanCommandProcessor::SetupContext() {
   if (!CommandProcessor::SetupContext()) {
     XELOGE("Unable to initialize base command processor context");
@@ -109,7 +115,17 @@ bool VulkanCommandProcessor::SetupContext() {
     return false;
   }
 
-  pipeline_cache_ = std::make_unique<PipelineCache>(register_file_, device_);
+  render_cache_ = std::make_unique<RenderCache>(register_file_, device_);
+  status = render_cache_->Initialize();
+  if (status != VK_SUCCESS) {
+    XELOGE("Unable to initialize render cache");
+    render_cache_->Shutdown();
+    return false;
+  }
+
+  // The pipeline cache creates render passes for the stored pipelines.
+  pipeline_cache_ = std::make_unique<PipelineCache>(register_file_, device_,
+                                                    render_cache_.get());
   status = pipeline_cache_->Initialize(
       buffer_cache_->constant_descriptor_set_layout(),
       texture_cache_->texture_descriptor_set_layout(),
@@ -120,14 +136,6 @@ bool VulkanCommandProcessor::SetupContext() {
     return false;
   }
 
-  render_cache_ = std::make_unique<RenderCache>(register_file_, device_);
-  status = render_cache_->Initialize();
-  if (status != VK_SUCCESS) {
-    XELOGE("Unable to initialize render cache");
-    render_cache_->Shutdown();
-    return false;
-  }
-
   return true;
 }
 
@@ -395,6 +403,8 @@ void VulkanCommandProcessor::EndFrame() {
   current_setup_buffer_ = nullptr;
   command_buffer_pool_->EndBatch();
 
+  pipeline_cache_->EndSubmission();
+
   frame_open_ = false;
 }
 
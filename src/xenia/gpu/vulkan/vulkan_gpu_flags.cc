@@ -14,3 +14,8 @@ DEFINE_bool(vulkan_renderdoc_capture_all, false,
 DEFINE_bool(vulkan_native_msaa, false, "Use native MSAA", "Vulkan");
 DEFINE_bool(vulkan_dump_disasm, false,
             "Dump shader disassembly. NVIDIA only supported.", "Vulkan");
+DEFINE_int32(vulkan_texture_conversion_threads, -1,
+             "Number of threads converting textures along with the GPU "
+             "command thread, or -1 to choose it based on the number of "
+             "logical processors.",
+             "Vulkan");
@@ -0,0 +1,207 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2020 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "xenia/base/atomic.h"
+#include "xenia/base/cvar.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/main.h"
+#include "xenia/base/platform.h"
+#include "xenia/base/threading.h"
+#include "xenia/kernel/kernel_flags.h"
+#include "xenia/kernel/xboxkrnl/xboxkrnl_rtl.h"
+#include "xenia/kernel/xboxkrnl/xboxkrnl_threading.h"
+
+#if XE_PLATFORM_WIN32
+#include "xenia/base/platform_win.h"
+#else
+#include <sys/resource.h>
+#endif  // XE_PLATFORM_WIN32
+
+DEFINE_int32(guest_lock_bench_threads, -1,
+             "Number of contending threads, or -1 for twice the number of "
+             "logical processors.",
+             "Kernel");
+DEFINE_int32(guest_lock_bench_iterations, 100000,
+             "Number of times each thread acquires the lock.", "Kernel");
+DEFINE_int32(guest_lock_bench_hold_work, 200,
+             "Number of increments done while holding the lock.", "Kernel");
+
+namespace xe {
+namespace kernel {
+namespace xboxkrnl {
+
+// User and kernel time of the whole process.
+double GetProcessCpuSeconds() {
+#if XE_PLATFORM_WIN32
+  FILETIME creation_time, exit_time, kernel_time, user_time;
+  if (!GetProcessTimes(GetCurrentProcess(), &creation_time, &exit_time,
+                       &kernel_time, &user_time)) {
+    return 0.0;
+  }
+  auto to_seconds = [](const FILETIME& time) {
+    return ((uint64_t(time.dwHighDateTime) << 32) | time.dwLowDateTime) *
+           1.0e-7;
+  };
+  return to_seconds(kernel_time) + to_seconds(user_time);
+#else
+  rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage)) {
+    return 0.0;
+  }
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+         (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1.0e-6;
+#endif  // XE_PLATFORM_WIN32
+}
+
+struct LockBenchResult {
+  double acquisitions_per_second;
+  double cpu_seconds;
+  double wall_seconds;
+  bool counter_correct;
+};
+
+// Runs the threads through the lock functions, checking that a counter only
+// incremented under the lock comes out right.
+LockBenchResult RunLockBench(
+    uint32_t thread_count, uint32_t iterations, uint32_t hold_work,
+    const std::function<void(uint32_t thread_index)>& acquire,
+    const std::function<void()>& release) {
+  volatile uint64_t counter = 0;
+  std::vector<std::unique_ptr<xe::threading::Thread>> threads;
+  auto start_fence = xe::threading::Event::CreateManualResetEvent(false);
+  for (uint32_t i = 0; i < thread_count; ++i) {
+    threads.push_back(xe::threading::Thread::Create({}, [&, i]() {
+      xe::threading::Wait(start_fence.get(), false);
+      for (uint32_t j = 0; j < iterations; ++j) {
+        acquire(i);
+        for (uint32_t k = 0; k < hold_work; ++k) {
+          counter = counter + 1;
+        }
+        release();
+      }
+    }));
+    threads.back()->set_name("Guest Lock Bench");
+  }
+
+  double cpu_start = GetProcessCpuSeconds();
+  auto start = std::chrono::steady_clock::now();
+  start_fence->Set();
+  for (auto& thread : threads) {
+    xe::threading::Wait(thread.get(), false);
+  }
+  LockBenchResult result;
+  result.wall_seconds = std::chrono::duration<double>(
+                            std::chrono::steady_clock::now() - start)
+                            .count();
+  result.cpu_seconds = GetProcessCpuSeconds() - cpu_start;
+  result.acquisitions_per_second =
+      double(thread_count) * iterations / result.wall_seconds;
+  result.counter_correct =
+      counter == uint64_t(thread_count) * iterations * hold_work;
+  return result;
+}
+
+int guest_lock_bench_main(const std::vector<std::string>& args) {
+  if (cvars::guest_lock_bench_iterations <= 0 ||
+      cvars::guest_lock_bench_hold_work < 0) {
+    XELOGE("The iteration count must be positive and the work non-negative");
+    return 1;
+  }
+  int32_t thread_count = cvars::guest_lock_bench_threads;
+  if (thread_count <= 0) {
+    thread_count = int32_t(xe::threading::logical_processor_count()) * 2;
+  }
+  uint32_t iterations = uint32_t(cvars::guest_lock_bench_iterations);
+  uint32_t hold_work = uint32_t(cvars::guest_lock_bench_hold_work);
+
+  std::printf("%d threads, %u acquisitions each, %u increments held:\n",
+              thread_count, iterations, hold_work);
+  std::printf("%-36s %14s %10s %10s %8s\n", "Lock", "Acquisitions/s",
+              "Wall s", "CPU s", "Correct");
+  auto print_result = [](const char* name, const LockBenchResult& result) {
+    std::printf("%-36s %14.0f %10.3f %10.3f %8s\n", name,
+                result.acquisitions_per_second, result.wall_seconds,
+                result.cpu_seconds, result.counter_correct ? "yes" : "NO");
+  };
+  bool all_correct = true;
+
+  uint32_t spin_lock = 0;
+  auto acquire_spin_lock = [&spin_lock](uint32_t thread_index) {
+    xeKeAcquireSpinLockAtRaisedIrql(&spin_lock);
+  };
+  auto release_spin_lock = [&spin_lock]() {
+    xeKeReleaseSpinLockFromRaisedIrql(&spin_lock);
+  };
+  cvars::guest_lock_parking = false;
+  LockBenchResult spin_result =
+      RunLockBench(uint32_t(thread_count), iterations, hold_work,
+                   acquire_spin_lock, release_spin_lock);
+  print_result("Spin lock, spinning", spin_result);
+  all_correct &= spin_result.counter_correct;
+  cvars::guest_lock_parking = true;
+  LockBenchResult parked_spin_result =
+      RunLockBench(uint32_t(thread_count), iterations, hold_work,
+                   acquire_spin_lock, release_spin_lock);
+  print_result("Spin lock, spin then park", parked_spin_result);
+  all_correct &= parked_spin_result.counter_correct;
+
+  // Waiting on the guest event of a critical section needs the kernel state,
+  // so the event path is measured with a host auto-reset event, which is what
+  // the guest event wraps, in place of xeKeWaitForSingleObject and
+  // xeKeSetEvent. Critical sections don't spin by default before waiting.
+  X_RTL_CRITICAL_SECTION event_cs;
+  xeRtlInitializeCriticalSection(&event_cs, 0);
+  auto event_cs_event = xe::threading::Event::CreateAutoResetEvent(false);
+  LockBenchResult event_cs_result = RunLockBench(
+      uint32_t(thread_count), iterations, hold_work,
+      [&](uint32_t thread_index) {
+        if (xe::atomic_inc(&event_cs.lock_count) != 0) {
+          xe::threading::Wait(event_cs_event.get(), false);
+        }
+        event_cs.owning_thread = 0x1000 + thread_index * 0x10;
+        event_cs.recursion_count = 1;
+      },
+      [&]() {
+        event_cs.recursion_count = 0;
+        event_cs.owning_thread = 0;
+        if (xe::atomic_dec(&event_cs.lock_count) != -1) {
+          event_cs_event->Set();
+        }
+      });
+  print_result("Critical section, event", event_cs_result);
+  all_correct &= event_cs_result.counter_correct;
+
+  X_RTL_CRITICAL_SECTION cs;
+  xeRtlInitializeCriticalSection(&cs, 0);
+  LockBenchResult cs_result = RunLockBench(
+      uint32_t(thread_count), iterations, hold_work,
+      [&cs](uint32_t thread_index) {
+        // Any unique non-zero guest thread object address.
+        xeRtlEnterCriticalSection(&cs, 0x1000 + thread_index * 0x10);
+      },
+      [&cs]() { xeRtlLeaveCriticalSection(&cs); });
+  print_result("Critical section, spin then park", cs_result);
+  all_correct &= cs_result.counter_correct;
+
+  return all_correct ? 0 : 1;
+}
+
+}  // namespace xboxkrnl
+}  // namespace kernel
+}  // namespace xe
+
+DEFINE_ENTRY_POINT("xenia-kernel-guest-lock-bench",
+                   xe::kernel::xboxkrnl::guest_lock_bench_main, "");
@@ -14,3 +14,13 @@ DEFINE_bool(headless, false,
             "UI");
 DEFINE_bool(log_high_frequency_kernel_calls, false,
             "Log kernel calls with the kHighFrequency tag.", "Kernel");
+DEFINE_bool(guest_lock_parking, true,
+            "Make threads contending for guest critical sections and spin "
+            "locks spin adaptively, then sleep in host wait queues keyed by "
+            "the lock address, rather than waiting on kernel events or "
+            "spinning with yields.",
+            "Kernel");
+DEFINE_int32(guest_lock_max_spin_count, 2000,
+             "Maximum number of times a thread checks a contended guest lock "
+             "before sleeping, when guest_lock_parking is enabled.",
+             "Kernel");
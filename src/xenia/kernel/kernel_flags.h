@@ -13,5 +13,7 @@
 
 DECLARE_bool(headless);
 DECLARE_bool(log_high_frequency_kernel_calls);
+DECLARE_bool(guest_lock_parking);
+DECLARE_int32(guest_lock_max_spin_count);
 
 #endif  // XENIA_KERNEL_KERNEL_FLAGS_H_
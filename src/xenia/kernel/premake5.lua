@@ -21,3 +21,32 @@ project("xenia-kernel")
   files({
     "debug_visualizers.natvis",
   })
+
+group("src")
+project("xenia-kernel-guest-lock-bench")
+  uuid("5b2d8e61-7c4a-4f93-a1e0-c8f36d29b4a7")
+  kind("ConsoleApp")
+  language("C++")
+  links({
+    "aes_128",
+    "capstone",
+    "fmt",
+    "mspack",
+    "snappy",
+    "xenia-apu",
+    "xenia-base",
+    "xenia-core",
+    "xenia-cpu",
+    "xenia-cpu-backend-x64",
+    "xenia-hid",
+    "xenia-kernel",
+    "xenia-ui", -- needed by xenia-base
+    "xenia-vfs",
+    "xxhash",
+  })
+  defines({
+  })
+  files({
+    "guest_lock_bench_main.cc",
+    "../base/main_"..platform_suffix..".cc",
+  })
@@ -0,0 +1,143 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2020 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/kernel/util/address_wait_table.h"
+
+#include <algorithm>
+
+#include "xenia/base/assert.h"
+
+namespace xe {
+namespace kernel {
+namespace util {
+
+AddressWaitTable& AddressWaitTable::global() {
+  static AddressWaitTable table;
+  return table;
+}
+
+AddressWaitTable::Bucket& AddressWaitTable::bucket(uintptr_t address) const {
+  // Locks are at least 4-byte aligned and often in arrays of structures, so mix
+  // the bits above the alignment.
+  uint64_t hash = uint64_t(address >> 2) * 0x9E3779B97F4A7C15ull;
+  return buckets_[hash >> 56];
+}
+
+void AddressWaitTable::Enqueue(Bucket& bucket, Waiter* waiter) {
+  waiter->next = nullptr;
+  if (bucket.tail) {
+    bucket.tail->next = waiter;
+  } else {
+    bucket.head = waiter;
+  }
+  bucket.tail = waiter;
+}
+
+void AddressWaitTable::Remove(Bucket& bucket, Waiter* waiter) {
+  Waiter* previous = nullptr;
+  for (Waiter* it = bucket.head; it; previous = it, it = it->next) {
+    if (it != waiter) {
+      continue;
+    }
+    if (previous) {
+      previous->next = it->next;
+    } else {
+      bucket.head = it->next;
+    }
+    if (bucket.tail == it) {
+      bucket.tail = previous;
+    }
+    return;
+  }
+}
+
+void AddressWaitTable::Wait(const void* address) {
+  uintptr_t key = reinterpret_cast<uintptr_t>(address);
+  Bucket& b = bucket(key);
+  std::unique_lock<std::mutex> lock(b.mutex);
+  auto pending = b.pending_wakes.find(key);
+  if (pending != b.pending_wakes.end()) {
+    if (!--pending->second) {
+      b.pending_wakes.erase(pending);
+    }
+    return;
+  }
+  Waiter waiter;
+  waiter.address = key;
+  waiter.woken = false;
+  Enqueue(b, &waiter);
+  waiter.cv.wait(lock, [&waiter]() { return waiter.woken; });
+}
+
+void AddressWaitTable::WaitWhileEqual(const volatile uint32_t* value,
+                                      uint32_t expected,
+                                      std::chrono::microseconds timeout) {
+  uintptr_t key = reinterpret_cast<uintptr_t>(value);
+  Bucket& b = bucket(key);
+  std::unique_lock<std::mutex> lock(b.mutex);
+  if (*value != expected) {
+    return;
+  }
+  Waiter waiter;
+  waiter.address = key;
+  waiter.woken = false;
+  Enqueue(b, &waiter);
+  if (!waiter.cv.wait_for(lock, timeout,
+                          [&waiter]() { return waiter.woken; })) {
+    Remove(b, &waiter);
+  }
+}
+
+void AddressWaitTable::Wake(const void* address, bool keep_if_none) {
+  uintptr_t key = reinterpret_cast<uintptr_t>(address);
+  Bucket& b = bucket(key);
+  std::lock_guard<std::mutex> lock(b.mutex);
+  for (Waiter* waiter = b.head; waiter; waiter = waiter->next) {
+    if (waiter->address != key) {
+      continue;
+    }
+    Remove(b, waiter);
+    waiter->woken = true;
+    // Notifying under the lock, as the waiter owns the condition variable and
+    // may return as soon as the lock is released.
+    waiter->cv.notify_one();
+    return;
+  }
+  if (keep_if_none) {
+    ++b.pending_wakes[key];
+  }
+}
+
+uint32_t AddressWaitTable::spin_count(const void* address,
+                                      uint32_t max_spin_count) const {
+  uint32_t estimate =
+      bucket(reinterpret_cast<uintptr_t>(address))
+          .spin_estimate.load(std::memory_order_relaxed);
+  return std::min(max_spin_count, estimate * 2 + 16);
+}
+
+void AddressWaitTable::UpdateSpinCount(const void* address, uint32_t spins,
+                                       bool acquired) {
+  std::atomic<uint32_t>& estimate =
+      bucket(reinterpret_cast<uintptr_t>(address)).spin_estimate;
+  int32_t current = int32_t(estimate.load(std::memory_order_relaxed));
+  if (acquired) {
+    // Converge towards the number of spins the lock took to become free.
+    current += (int32_t(spins) - current) / 8;
+  } else {
+    // The lock is held for longer than spinning can cover - spin less.
+    current -= current / 4 + 1;
+  }
+  estimate.store(uint32_t(std::max(current, int32_t(0))),
+                 std::memory_order_relaxed);
+}
+
+}  // namespace util
+}  // namespace kernel
+}  // namespace xe
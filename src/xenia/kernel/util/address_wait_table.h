@@ -0,0 +1,90 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2020 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_KERNEL_UTIL_ADDRESS_WAIT_TABLE_H_
+#define XENIA_KERNEL_UTIL_ADDRESS_WAIT_TABLE_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
+namespace xe {
+namespace kernel {
+namespace util {
+
+// Host wait queues keyed by the address of a guest lock, similar to futexes
+// and WaitOnAddress. Contended guest locks sleep here without needing a kernel
+// object, and releasing a lock wakes exactly one waiter.
+//
+// Addresses are hashed into a fixed number of buckets, each with its own
+// mutex, so unrelated locks rarely contend on the table itself.
+class AddressWaitTable {
+ public:
+  // The table shared by all guest locks.
+  static AddressWaitTable& global();
+
+  // Sleeps until a Wake for the address. A Wake with nobody waiting is kept
+  // and consumed by the next Wait instead, so a hand-off can't be lost between
+  // deciding to wait and sleeping.
+  void Wait(const void* address);
+
+  // Sleeps while *value == expected, until woken by Wake or until the timeout
+  // elapses. The value is checked under the bucket lock, so a Wake after the
+  // value was changed can't be missed.
+  void WaitWhileEqual(const volatile uint32_t* value, uint32_t expected,
+                      std::chrono::microseconds timeout);
+
+  // Wakes the longest waiting thread for the address. If nobody is waiting and
+  // keep_if_none is set, the wake is kept for the next Wait.
+  void Wake(const void* address, bool keep_if_none);
+
+  // Number of spins to try before sleeping on the address, adapted to how long
+  // the locks hashed to the same bucket have recently been held.
+  uint32_t spin_count(const void* address, uint32_t max_spin_count) const;
+
+  // Updates the spin estimate after a lock was acquired by spinning for the
+  // given number of iterations, or after spinning failed and the thread had to
+  // sleep.
+  void UpdateSpinCount(const void* address, uint32_t spins, bool acquired);
+
+ private:
+  struct Waiter {
+    uintptr_t address;
+    bool woken;
+    std::condition_variable cv;
+    Waiter* next;
+  };
+
+  struct alignas(64) Bucket {
+    std::mutex mutex;
+    // FIFO of threads sleeping on addresses hashed to this bucket.
+    Waiter* head = nullptr;
+    Waiter* tail = nullptr;
+    // Wakes that arrived with nobody waiting, by address.
+    std::unordered_map<uintptr_t, uint32_t> pending_wakes;
+    std::atomic<uint32_t> spin_estimate = {0};
+  };
+
+  static constexpr uint32_t kBucketCount = 256;
+
+  Bucket& bucket(uintptr_t address) const;
+  static void Enqueue(Bucket& bucket, Waiter* waiter);
+  static void Remove(Bucket& bucket, Waiter* waiter);
+
+  mutable Bucket buckets_[kBucketCount];
+};
+
+}  // namespace util
+}  // namespace kernel
+}  // namespace xe
+
+#endif  // XENIA_KERNEL_UTIL_ADDRESS_WAIT_TABLE_H_
@@ -9,6 +9,8 @@
 
 #include "xenia/kernel/xboxkrnl/xboxkrnl_rtl.h"
 
+#include <emmintrin.h>
+
 #include <algorithm>
 #include <string>
 
@@ -17,7 +19,9 @@
 #include "xenia/base/string.h"
 #include "xenia/base/threading.h"
 #include "xenia/kernel/kernel_state.h"
+#include "xenia/kernel/kernel_flags.h"
 #include "xenia/kernel/user_module.h"
+#include "xenia/kernel/util/address_wait_table.h"
 #include "xenia/kernel/util/shim_utils.h"
 #include "xenia/kernel/xboxkrnl/xboxkrnl_private.h"
 #include "xenia/kernel/xboxkrnl/xboxkrnl_threading.h"
@@ -359,19 +363,6 @@ DECLARE_XBOXKRNL_EXPORT1(RtlImageXexHeaderField, kNone, kImplemented);
 // Ref:
 // https://github.com/reactos/reactos/blob/master/sdk/lib/rtl/critical.c
 
-// This structure tries to match the one on the 360 as best I can figure out.
-// Unfortunately some games have the critical sections pre-initialized in
-// their embedded data and InitializeCriticalSection will never be called.
-#pragma pack(push, 1)
-struct X_RTL_CRITICAL_SECTION {
-  X_DISPATCH_HEADER header;
-  int32_t lock_count;               // 0x10 -1 -> 0 on first lock
-  xe::be<int32_t> recursion_count;  // 0x14  0 -> 1 on first lock
-  xe::be<uint32_t> owning_thread;   // 0x18 PKTHREAD 0 unless locked
-};
-#pragma pack(pop)
-static_assert_size(X_RTL_CRITICAL_SECTION, 28);
-
 void xeRtlInitializeCriticalSection(X_RTL_CRITICAL_SECTION* cs,
                                     uint32_t cs_ptr) {
   cs->header.type = 1;      // EventSynchronizationObject (auto reset)
@@ -415,8 +406,8 @@ dword_result_t RtlInitializeCriticalSectionAndSpinCount(
 DECLARE_XBOXKRNL_EXPORT1(RtlInitializeCriticalSectionAndSpinCount, kNone,
                          kImplemented);
 
-void RtlEnterCriticalSection(pointer_t<X_RTL_CRITICAL_SECTION> cs) {
-  uint32_t cur_thread = XThread::GetCurrentThread()->guest_object();
+void xeRtlEnterCriticalSection(X_RTL_CRITICAL_SECTION* cs,
+                               uint32_t cur_thread) {
   uint32_t spin_count = cs->header.absolute * 256;
 
   if (cs->owning_thread == cur_thread) {
@@ -426,26 +417,55 @@ void RtlEnterCriticalSection(pointer_t<X_RTL_CRITICAL_SECTION> cs) {
     return;
   }
 
-  // Spin loop
-  while (spin_count--) {
-    if (xe::atomic_cas(-1, 0, &cs->lock_count)) {
-      // Acquired.
-      cs->owning_thread = cur_thread;
-      cs->recursion_count = 1;
-      return;
+  if (cvars::guest_lock_parking) {
+    // Spin for about as long as the lock has recently been held, then sleep
+    // until the owner hands the lock over in RtlLeaveCriticalSection.
+    auto& wait_table = util::AddressWaitTable::global();
+    spin_count = wait_table.spin_count(
+        cs, std::max(uint32_t(std::max(cvars::guest_lock_max_spin_count, 0)),
+                     spin_count));
+    // Poll with plain loads so the line isn't pulled exclusive on every spin,
+    // and only try to take the lock once it looks free.
+    auto lock_count = reinterpret_cast<volatile int32_t*>(&cs->lock_count);
+    for (uint32_t i = 0; i < spin_count; ++i) {
+      if (*lock_count == -1 && xe::atomic_cas(-1, 0, &cs->lock_count)) {
+        wait_table.UpdateSpinCount(cs, i, true);
+        cs->owning_thread = cur_thread;
+        cs->recursion_count = 1;
+        return;
+      }
+      _mm_pause();
+    }
+    wait_table.UpdateSpinCount(cs, spin_count, false);
+    if (xe::atomic_inc(&cs->lock_count) != 0) {
+      wait_table.Wait(cs);
+    }
+  } else {
+    // Spin loop
+    while (spin_count--) {
+      if (xe::atomic_cas(-1, 0, &cs->lock_count)) {
+        // Acquired.
+        cs->owning_thread = cur_thread;
+        cs->recursion_count = 1;
+        return;
+      }
+      _mm_pause();
     }
-  }
 
-  if (xe::atomic_inc(&cs->lock_count) != 0) {
-    // Create a full waiter.
-    xeKeWaitForSingleObject(reinterpret_cast<void*>(cs.host_address()), 8, 0, 0,
-                            nullptr);
+    if (xe::atomic_inc(&cs->lock_count) != 0) {
+      // Create a full waiter.
+      xeKeWaitForSingleObject(reinterpret_cast<void*>(cs), 8, 0, 0, nullptr);
+    }
   }
 
   assert_true(cs->owning_thread == 0);
   cs->owning_thread = cur_thread;
   cs->recursion_count = 1;
 }
+
+void RtlEnterCriticalSection(pointer_t<X_RTL_CRITICAL_SECTION> cs) {
+  xeRtlEnterCriticalSection(cs, XThread::GetCurrentThread()->guest_object());
+}
 DECLARE_XBOXKRNL_EXPORT2(RtlEnterCriticalSection, kNone, kImplemented,
                          kHighFrequency);
 
@@ -471,9 +491,7 @@ dword_result_t RtlTryEnterCriticalSection(
 DECLARE_XBOXKRNL_EXPORT2(RtlTryEnterCriticalSection, kNone, kImplemented,
                          kHighFrequency);
 
-void RtlLeaveCriticalSection(pointer_t<X_RTL_CRITICAL_SECTION> cs) {
-  assert_true(cs->owning_thread == XThread::GetCurrentThread()->guest_object());
-
+void xeRtlLeaveCriticalSection(X_RTL_CRITICAL_SECTION* cs) {
   // Drop recursion count - if it isn't zero we still have the lock.
   assert_true(cs->recursion_count > 0);
   if (--cs->recursion_count != 0) {
@@ -487,9 +505,20 @@ void RtlLeaveCriticalSection(pointer_t<X_RTL_CRITICAL_SECTION> cs) {
   cs->owning_thread = 0;
   if (xe::atomic_dec(&cs->lock_count) != -1) {
     // There were waiters - wake one of them.
-    xeKeSetEvent(reinterpret_cast<X_KEVENT*>(cs.host_address()), 1, 0);
+    if (cvars::guest_lock_parking) {
+      // The waiter may not be sleeping yet, in which case the wake is kept for
+      // it, like the signal state of the event.
+      util::AddressWaitTable::global().Wake(cs, true);
+    } else {
+      xeKeSetEvent(reinterpret_cast<X_KEVENT*>(cs), 1, 0);
+    }
   }
 }
+
+void RtlLeaveCriticalSection(pointer_t<X_RTL_CRITICAL_SECTION> cs) {
+  assert_true(cs->owning_thread == XThread::GetCurrentThread()->guest_object());
+  xeRtlLeaveCriticalSection(cs);
+}
 DECLARE_XBOXKRNL_EXPORT2(RtlLeaveCriticalSection, kNone, kImplemented,
                          kHighFrequency);
 
@@ -10,19 +10,35 @@
 #ifndef XENIA_KERNEL_XBOXKRNL_XBOXKRNL_RTL_H_
 #define XENIA_KERNEL_XBOXKRNL_XBOXKRNL_RTL_H_
 
+#include "xenia/kernel/xobject.h"
 #include "xenia/xbox.h"
 
 namespace xe {
 namespace kernel {
 namespace xboxkrnl {
 
-struct X_RTL_CRITICAL_SECTION;
+// This structure tries to match the one on the 360 as best I can figure out.
+// Unfortunately some games have the critical sections pre-initialized in
+// their embedded data and InitializeCriticalSection will never be called.
+#pragma pack(push, 1)
+struct X_RTL_CRITICAL_SECTION {
+  X_DISPATCH_HEADER header;
+  int32_t lock_count;               // 0x10 -1 -> 0 on first lock
+  xe::be<int32_t> recursion_count;  // 0x14  0 -> 1 on first lock
+  xe::be<uint32_t> owning_thread;   // 0x18 PKTHREAD 0 unless locked
+};
+#pragma pack(pop)
+static_assert_size(X_RTL_CRITICAL_SECTION, 28);
 
 void xeRtlInitializeCriticalSection(X_RTL_CRITICAL_SECTION* cs,
                                     uint32_t cs_ptr);
 X_STATUS xeRtlInitializeCriticalSectionAndSpinCount(X_RTL_CRITICAL_SECTION* cs,
                                                     uint32_t cs_ptr,
                                                     uint32_t spin_count);
+// Enters the critical section as the given guest thread object.
+void xeRtlEnterCriticalSection(X_RTL_CRITICAL_SECTION* cs,
+                               uint32_t cur_thread);
+void xeRtlLeaveCriticalSection(X_RTL_CRITICAL_SECTION* cs);
 
 }  // namespace xboxkrnl
 }  // namespace kernel
@@ -7,6 +7,8 @@
  ******************************************************************************
  */
 
+#include <emmintrin.h>
+
 #include <algorithm>
 #include <vector>
 
@@ -16,7 +18,9 @@
 #include "xenia/base/mutex.h"
 #include "xenia/cpu/processor.h"
 #include "xenia/kernel/kernel_state.h"
+#include "xenia/kernel/kernel_flags.h"
 #include "xenia/kernel/user_module.h"
+#include "xenia/kernel/util/address_wait_table.h"
 #include "xenia/kernel/util/shim_utils.h"
 #include "xenia/kernel/xboxkrnl/xboxkrnl_private.h"
 #include "xenia/kernel/xboxkrnl/xboxkrnl_threading.h"
@@ -888,16 +892,93 @@ dword_result_t NtSignalAndWaitForSingleObjectEx(dword_t signal_handle,
 DECLARE_XBOXKRNL_EXPORT3(NtSignalAndWaitForSingleObjectEx, kThreading,
                          kImplemented, kBlocking, kHighFrequency);
 
+// With guest_lock_parking, a spin lock is 0 when free, 1 when held, and 2 when
+// held while other threads may be sleeping on it, like a futex-based mutex.
+static void AcquireSpinLockParked(uint32_t* lock) {
+  // The guest and other host threads change the lock behind the compiler's
+  // back, so always reload it.
+  volatile uint32_t* lock_value = lock;
+  auto& wait_table = util::AddressWaitTable::global();
+  uint32_t spin_count = wait_table.spin_count(
+      lock, uint32_t(std::max(cvars::guest_lock_max_spin_count, 0)));
+  for (uint32_t i = 0; i < spin_count; ++i) {
+    if (!*lock_value && xe::atomic_cas(0, 1, lock)) {
+      wait_table.UpdateSpinCount(lock, i, true);
+      return;
+    }
+    _mm_pause();
+  }
+  wait_table.UpdateSpinCount(lock, spin_count, false);
+
+  // Mark the lock as contended before sleeping so the release wakes a thread.
+  // Once acquired this way, it stays marked as others may still be sleeping.
+  while (true) {
+    uint32_t value = *lock_value;
+    if (!value) {
+      if (xe::atomic_cas(0, 2, lock)) {
+        return;
+      }
+      continue;
+    }
+    if (value != 2 && !xe::atomic_cas(value, 2, lock)) {
+      continue;
+    }
+    // Guest code may release the lock inline without waking anyone, so don't
+    // sleep indefinitely.
+    wait_table.WaitWhileEqual(lock_value, 2, std::chrono::milliseconds(1));
+  }
+}
+
+void xeKeAcquireSpinLockAtRaisedIrql(uint32_t* lock) {
+  if (xe::atomic_cas(0, 1, lock)) {
+    return;
+  }
+  if (cvars::guest_lock_parking) {
+    AcquireSpinLockParked(lock);
+    return;
+  }
+  while (!xe::atomic_cas(0, 1, lock)) {
+    // Spin!
+    // TODO(benvanik): error on deadlock?
+    _mm_pause();
+  }
+}
+
+bool xeKeTryToAcquireSpinLockAtRaisedIrql(uint32_t* lock) {
+  return xe::atomic_cas(0, 1, lock);
+}
+
+void xeKeReleaseSpinLockFromRaisedIrql(uint32_t* lock) {
+  if (!cvars::guest_lock_parking) {
+    xe::atomic_dec(lock);
+    return;
+  }
+  volatile uint32_t* lock_value = lock;
+  uint32_t value;
+  do {
+    value = *lock_value;
+  } while (!xe::atomic_cas(value, 0, lock));
+  if (value == 2) {
+    util::AddressWaitTable::global().Wake(lock, false);
+  }
+}
+
 uint32_t xeKeKfAcquireSpinLock(uint32_t* lock) {
   // XELOGD(
   //     "KfAcquireSpinLock({:08X})",
   //     lock_ptr);
 
   // Lock.
-  while (!xe::atomic_cas(0, 1, lock)) {
-    // Spin!
-    // TODO(benvanik): error on deadlock?
-    xe::threading::MaybeYield();
+  if (cvars::guest_lock_parking) {
+    if (!xe::atomic_cas(0, 1, lock)) {
+      AcquireSpinLockParked(lock);
+    }
+  } else {
+    while (!xe::atomic_cas(0, 1, lock)) {
+      // Spin!
+      // TODO(benvanik): error on deadlock?
+      xe::threading::MaybeYield();
+    }
   }
 
   // Raise IRQL to DISPATCH.
@@ -920,7 +1001,7 @@ void xeKeKfReleaseSpinLock(uint32_t* lock, dword_t old_irql) {
   thread->LowerIrql(old_irql);
 
   // Unlock.
-  xe::atomic_dec(lock);
+  xeKeReleaseSpinLockFromRaisedIrql(lock);
 }
 
 void KfReleaseSpinLock(lpdword_t lock_ptr, dword_t old_irql) {
@@ -933,10 +1014,7 @@ DECLARE_XBOXKRNL_EXPORT2(KfReleaseSpinLock, kThreading, kImplemented,
 void KeAcquireSpinLockAtRaisedIrql(lpdword_t lock_ptr) {
   // Lock.
   auto lock = reinterpret_cast<uint32_t*>(lock_ptr.host_address());
-  while (!xe::atomic_cas(0, 1, lock)) {
-    // Spin!
-    // TODO(benvanik): error on deadlock?
-  }
+  xeKeAcquireSpinLockAtRaisedIrql(lock);
 }
 DECLARE_XBOXKRNL_EXPORT3(KeAcquireSpinLockAtRaisedIrql, kThreading,
                          kImplemented, kBlocking, kHighFrequency);
@@ -944,10 +1022,7 @@ DECLARE_XBOXKRNL_EXPORT3(KeAcquireSpinLockAtRaisedIrql, kThreading,
 dword_result_t KeTryToAcquireSpinLockAtRaisedIrql(lpdword_t lock_ptr) {
   // Lock.
   auto lock = reinterpret_cast<uint32_t*>(lock_ptr.host_address());
-  if (!xe::atomic_cas(0, 1, lock)) {
-    return 0;
-  }
-  return 1;
+  return xeKeTryToAcquireSpinLockAtRaisedIrql(lock) ? 1 : 0;
 }
 DECLARE_XBOXKRNL_EXPORT4(KeTryToAcquireSpinLockAtRaisedIrql, kThreading,
                          kImplemented, kBlocking, kHighFrequency, kSketchy);
@@ -955,7 +1030,7 @@ DECLARE_XBOXKRNL_EXPORT4(KeTryToAcquireSpinLockAtRaisedIrql, kThreading,
 void KeReleaseSpinLockFromRaisedIrql(lpdword_t lock_ptr) {
   // Unlock.
   auto lock = reinterpret_cast<uint32_t*>(lock_ptr.host_address());
-  xe::atomic_dec(lock);
+  xeKeReleaseSpinLockFromRaisedIrql(lock);
 }
 DECLARE_XBOXKRNL_EXPORT2(KeReleaseSpinLockFromRaisedIrql, kThreading,
                          kImplemented, kHighFrequency);
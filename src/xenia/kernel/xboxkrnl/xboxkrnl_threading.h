@@ -32,6 +32,11 @@ uint32_t xeKeWaitForSingleObject(void* object_ptr, uint32_t wait_reason,
                                  uint64_t* timeout_ptr);
 uint32_t xeKeSetEvent(X_KEVENT* event_ptr, uint32_t increment, uint32_t wait);
 
+// Spin lock operations without the IRQL changes, on host pointers to the lock.
+void xeKeAcquireSpinLockAtRaisedIrql(uint32_t* lock);
+bool xeKeTryToAcquireSpinLockAtRaisedIrql(uint32_t* lock);
+void xeKeReleaseSpinLockFromRaisedIrql(uint32_t* lock);
+
 }  // namespace xboxkrnl
 }  // namespace kernel
 }  // namespace xe
@@ -948,6 +948,7 @@ bool XThread::Save(ByteStream* stream) {
     state.context.cr[5] = context->cr5.value;
     state.context.cr[6] = context->cr6.value;
     state.context.cr[7] = context->cr7.value;
+    context->MaterializeFPSCR();
     state.context.fpscr = context->fpscr.value;
     state.context.xer_ca = context->xer_ca;
     state.context.xer_ov = context->xer_ov;
@@ -10,10 +10,17 @@
 #include "xenia/memory.h"
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstring>
+#include <functional>
+#include <iterator>
+#include <memory>
 #include <utility>
+#include <vector>
 
 #include "third_party/fmt/include/fmt/format.h"
+#include "third_party/snappy/snappy.h"
 #include "xenia/base/assert.h"
 #include "xenia/base/byte_stream.h"
 #include "xenia/base/clock.h"
@@ -32,6 +39,18 @@ DEFINE_bool(protect_on_release, false,
             "Protect released memory to prevent accesses.", "Memory");
 DEFINE_bool(scribble_heap, false,
             "Scribble 0xCD into all allocated heap memory.", "Memory");
+DEFINE_bool(system_heap_slabs, true,
+            "Allocate system heap blocks smaller than a page from shared pages "
+            "of equal slots rather than from whole pages.",
+            "Memory");
+DEFINE_bool(heap_free_page_index, true,
+            "Find space for heap allocations using an index of free page runs "
+            "rather than by scanning the page table.",
+            "Memory");
+DEFINE_int32(save_state_threads, -1,
+             "Number of threads compressing and decompressing guest memory in "
+             "save states, or -1 for the number of logical processors.",
+             "Memory");
 
 namespace xe {
 uint32_t get_page_count(uint32_t value, uint32_t page_size) {
@@ -195,6 +214,8 @@ bool Memory::Initialize() {
       kMemoryAllocationReserve | kMemoryAllocationCommit,
       kMemoryProtectRead | kMemoryProtectWrite);
 
+  system_heap_slabs_.Initialize(LookupHeapByType(false, 4096));
+
   // Add handlers for MMIO.
   mmio_handler_ = cpu::MMIOHandler::Install(
       virtual_membase_, physical_membase_, physical_membase_ + 0x1FFFFFFF,
@@ -309,6 +330,7 @@ void Memory::Reset() {
   heaps_.v80000000.Reset();
   heaps_.v90000000.Reset();
   heaps_.physical.Reset();
+  system_heap_slabs_.Reset();
 }
 
 const BaseHeap* Memory::LookupHeap(uint32_t address) const {
@@ -528,10 +550,18 @@ void Memory::EnablePhysicalMemoryAccessCallbacks(
 
 uint32_t Memory::SystemHeapAlloc(uint32_t size, uint32_t alignment,
                                  uint32_t system_heap_flags) {
-  // TODO(benvanik): lightweight pool.
   bool is_physical = !!(system_heap_flags & kSystemHeapPhysical);
-  auto heap = LookupHeapByType(is_physical, 4096);
   uint32_t address;
+  // Physical memory may be watched by the GPU, which is only notified when
+  // whole allocations are released, so only virtual blocks share pages.
+  if (!is_physical && cvars::system_heap_slabs) {
+    address = system_heap_slabs_.Alloc(size, alignment);
+    if (address) {
+      Zero(address, size);
+      return address;
+    }
+  }
+  auto heap = LookupHeapByType(is_physical, 4096);
   if (!heap->Alloc(size, alignment,
                    kMemoryAllocationReserve | kMemoryAllocationCommit,
                    kMemoryProtectRead | kMemoryProtectWrite, false, &address)) {
@@ -545,7 +575,9 @@ void Memory::SystemHeapFree(uint32_t address) {
   if (!address) {
     return;
   }
-  // TODO(benvanik): lightweight pool.
+  if (system_heap_slabs_.Free(address)) {
+    return;
+  }
   auto heap = LookupHeap(address);
   heap->Release(address);
 }
@@ -578,30 +610,309 @@ void Memory::DumpMap() {
   heaps_.vC0000000.DumpMap();
   heaps_.vE0000000.DumpMap();
   XELOGE("");
+  XELOGE("------------------------------------------------------------------");
+  XELOGE("System Heap Slabs");
+  XELOGE("------------------------------------------------------------------");
+  XELOGE("");
+  system_heap_slabs_.DumpStats();
+  XELOGE("");
+}
+
+std::array<BaseHeap*, Memory::kSavedHeapCount> Memory::saved_heaps() {
+  return {&heaps_.v00000000, &heaps_.v40000000, &heaps_.v80000000,
+          &heaps_.v90000000, &heaps_.physical};
 }
 
 bool Memory::Save(ByteStream* stream) {
   XELOGD("Serializing memory...");
-  heaps_.v00000000.Save(stream);
-  heaps_.v40000000.Save(stream);
-  heaps_.v80000000.Save(stream);
-  heaps_.v90000000.Save(stream);
-  heaps_.physical.Save(stream);
+  stream->Write(kSaveStateVersion);
+  for (BaseHeap* heap : saved_heaps()) {
+    if (!heap->Save(stream)) {
+      return false;
+    }
+  }
+  if (!system_heap_slabs_.Save(stream)) {
+    return false;
+  }
 
   return true;
 }
 
 bool Memory::Restore(ByteStream* stream) {
   XELOGD("Restoring memory...");
-  heaps_.v00000000.Restore(stream);
-  heaps_.v40000000.Restore(stream);
-  heaps_.v80000000.Restore(stream);
-  heaps_.v90000000.Restore(stream);
-  heaps_.physical.Restore(stream);
+  uint32_t version = stream->Read<uint32_t>();
+  if (version != kSaveStateVersion) {
+    XELOGE("Unsupported memory save state version {:08X}", version);
+    return false;
+  }
+  for (BaseHeap* heap : saved_heaps()) {
+    if (!heap->Restore(stream)) {
+      return false;
+    }
+  }
+  if (!system_heap_slabs_.Restore(stream)) {
+    return false;
+  }
 
   return true;
 }
 
+size_t Memory::SnapshotDelta::page_count() const {
+  size_t count = 0;
+  for (const HeapSnapshotDelta& heap : heaps) {
+    count += heap.pages.size();
+  }
+  return count;
+}
+
+size_t Memory::SnapshotDelta::data_size() const {
+  size_t size = 0;
+  for (const HeapSnapshotDelta& heap : heaps) {
+    size += heap.data_size();
+  }
+  return size;
+}
+
+void Memory::SnapshotDelta::Undo(Snapshot& snapshot) {
+  for (size_t i = 0; i < kSavedHeapCount; ++i) {
+    heaps[i].Undo(snapshot.heaps[i]);
+  }
+  snapshot.slabs = std::move(slabs);
+}
+
+void Memory::CaptureSnapshot(Snapshot& snapshot, SnapshotDelta& delta) {
+  auto heaps = saved_heaps();
+  for (size_t i = 0; i < kSavedHeapCount; ++i) {
+    heaps[i]->CaptureSnapshot(snapshot.heaps[i], delta.heaps[i]);
+  }
+  delta.slabs = std::move(snapshot.slabs);
+  snapshot.slabs = system_heap_slabs_.Save();
+}
+
+bool Memory::SaveSnapshot(const Snapshot& snapshot, ByteStream* stream) {
+  stream->Write(kSaveStateVersion);
+  auto heaps = saved_heaps();
+  for (size_t i = 0; i < kSavedHeapCount; ++i) {
+    if (!heaps[i]->SaveSnapshot(snapshot.heaps[i], stream)) {
+      return false;
+    }
+  }
+  stream->Write(uint32_t(snapshot.slabs.size()));
+  stream->Write(snapshot.slabs.data(),
+                snapshot.slabs.size() * sizeof(SystemHeapSlabs::SlabState));
+  return true;
+}
+
+bool Memory::RestoreSnapshot(const Snapshot& snapshot) {
+  auto heaps = saved_heaps();
+  for (size_t i = 0; i < kSavedHeapCount; ++i) {
+    if (!heaps[i]->RestoreSnapshot(snapshot.heaps[i])) {
+      return false;
+    }
+  }
+  system_heap_slabs_.Restore(snapshot.slabs);
+  return true;
+}
+
+void SystemHeapSlabs::Initialize(BaseHeap* heap) {
+  heap_ = heap;
+  Reset();
+}
+
+void SystemHeapSlabs::Reset() {
+  auto global_lock = global_critical_region_.Acquire();
+  slabs_.clear();
+  for (SizeClass& size_class : size_classes_) {
+    size_class = {};
+  }
+}
+
+std::vector<SystemHeapSlabs::SlabState> SystemHeapSlabs::Save() {
+  auto global_lock = global_critical_region_.Acquire();
+  std::vector<SlabState> slabs;
+  slabs.reserve(slabs_.size());
+  for (const auto& it : slabs_) {
+    const Slab& slab = it.second;
+    SlabState state;
+    state.address = slab.address;
+    state.size_class = slab.size_class;
+    std::memcpy(state.free_slots, slab.free_slots, sizeof(state.free_slots));
+    slabs.push_back(state);
+  }
+  return slabs;
+}
+
+void SystemHeapSlabs::Restore(const std::vector<SlabState>& slabs) {
+  auto global_lock = global_critical_region_.Acquire();
+  slabs_.clear();
+  // Keep the allocation totals, they're only statistics.
+  for (SizeClass& size_class : size_classes_) {
+    size_class.partial_slabs = nullptr;
+    size_class.slab_count = 0;
+    size_class.used_slot_count = 0;
+  }
+  for (const SlabState& state : slabs) {
+    Slab* slab = &slabs_[state.address];
+    *slab = {};
+    slab->address = state.address;
+    slab->size_class = state.size_class;
+    std::memcpy(slab->free_slots, state.free_slots, sizeof(slab->free_slots));
+    for (uint64_t free_slots : slab->free_slots) {
+      slab->free_slot_count += xe::bit_count(free_slots);
+    }
+    SizeClass& size_class = size_classes_[slab->size_class];
+    ++size_class.slab_count;
+    size_class.used_slot_count +=
+        slot_count(slab->size_class) - slab->free_slot_count;
+    if (slab->free_slot_count) {
+      LinkPartial(slab);
+    }
+  }
+}
+
+bool SystemHeapSlabs::Save(ByteStream* stream) {
+  std::vector<SlabState> slabs = Save();
+  stream->Write(uint32_t(slabs.size()));
+  stream->Write(slabs.data(), slabs.size() * sizeof(SlabState));
+  return true;
+}
+
+bool SystemHeapSlabs::Restore(ByteStream* stream) {
+  std::vector<SlabState> slabs(stream->Read<uint32_t>());
+  stream->Read(slabs.data(), slabs.size() * sizeof(SlabState));
+  for (const SlabState& slab : slabs) {
+    if ((slab.address & (kSlabSize - 1)) ||
+        slab.size_class >= kSizeClassCount) {
+      XELOGE("SystemHeapSlabs::Restore: invalid slab {:08X}", slab.address);
+      return false;
+    }
+  }
+  Restore(slabs);
+  return true;
+}
+
+void SystemHeapSlabs::LinkPartial(Slab* slab) {
+  SizeClass& size_class = size_classes_[slab->size_class];
+  slab->previous_partial = nullptr;
+  slab->next_partial = size_class.partial_slabs;
+  if (size_class.partial_slabs) {
+    size_class.partial_slabs->previous_partial = slab;
+  }
+  size_class.partial_slabs = slab;
+}
+
+void SystemHeapSlabs::UnlinkPartial(Slab* slab) {
+  if (slab->previous_partial) {
+    slab->previous_partial->next_partial = slab->next_partial;
+  } else {
+    size_classes_[slab->size_class].partial_slabs = slab->next_partial;
+  }
+  if (slab->next_partial) {
+    slab->next_partial->previous_partial = slab->previous_partial;
+  }
+  slab->previous_partial = nullptr;
+  slab->next_partial = nullptr;
+}
+
+uint32_t SystemHeapSlabs::Alloc(uint32_t size, uint32_t alignment) {
+  uint32_t slot_size = std::max(std::max(size, alignment),
+                                uint32_t(1) << kMinSlotSizeLog2);
+  uint32_t slot_size_log2 = 32 - xe::lzcnt(slot_size - 1);
+  if (!heap_ || slot_size_log2 > kMaxSlotSizeLog2) {
+    return 0;
+  }
+  uint32_t size_class_index = slot_size_log2 - kMinSlotSizeLog2;
+  SizeClass& size_class = size_classes_[size_class_index];
+
+  auto global_lock = global_critical_region_.Acquire();
+
+  Slab* slab = size_class.partial_slabs;
+  if (!slab) {
+    uint32_t slab_address;
+    if (!heap_->Alloc(kSlabSize, kSlabSize,
+                      kMemoryAllocationReserve | kMemoryAllocationCommit,
+                      kMemoryProtectRead | kMemoryProtectWrite, false,
+                      &slab_address)) {
+      return 0;
+    }
+    slab = &slabs_[slab_address];
+    *slab = {};
+    slab->address = slab_address;
+    slab->size_class = size_class_index;
+    slab->free_slot_count = slot_count(size_class_index);
+    for (uint32_t i = 0; i < slab->free_slot_count; i += 64) {
+      uint32_t word_slot_count = std::min(slab->free_slot_count - i, 64u);
+      slab->free_slots[i / 64] = word_slot_count < 64
+                                     ? (uint64_t(1) << word_slot_count) - 1
+                                     : UINT64_MAX;
+    }
+    LinkPartial(slab);
+    ++size_class.slab_count;
+  }
+
+  uint32_t word_index = 0;
+  while (!slab->free_slots[word_index]) {
+    ++word_index;
+  }
+  uint32_t slot_index =
+      word_index * 64 + xe::tzcnt(slab->free_slots[word_index]);
+  slab->free_slots[word_index] &= ~(uint64_t(1) << (slot_index & 63));
+  if (!--slab->free_slot_count) {
+    UnlinkPartial(slab);
+  }
+  ++size_class.used_slot_count;
+  ++size_class.total_alloc_count;
+  return slab->address + (slot_index << slot_size_log2);
+}
+
+bool SystemHeapSlabs::Free(uint32_t address) {
+  auto global_lock = global_critical_region_.Acquire();
+
+  auto it = slabs_.find(address & ~(kSlabSize - 1));
+  if (it == slabs_.end()) {
+    return false;
+  }
+  Slab& slab = it->second;
+  SizeClass& size_class = size_classes_[slab.size_class];
+  uint32_t slot_size_log2 = kMinSlotSizeLog2 + slab.size_class;
+  uint32_t slot_index = (address - slab.address) >> slot_size_log2;
+  uint64_t slot_bit = uint64_t(1) << (slot_index & 63);
+  uint64_t& free_slots = slab.free_slots[slot_index / 64];
+  if ((address & ((uint32_t(1) << slot_size_log2) - 1)) ||
+      (free_slots & slot_bit)) {
+    XELOGE("SystemHeapSlabs::Free: {:08X} is not an allocated slot", address);
+    return true;
+  }
+  free_slots |= slot_bit;
+  --size_class.used_slot_count;
+  if (!slab.free_slot_count++) {
+    LinkPartial(&slab);
+  }
+  // Give the page back unless it's the only one with free slots, so a single
+  // object being created and destroyed repeatedly doesn't churn pages.
+  if (slab.free_slot_count == slot_count(slab.size_class) &&
+      (slab.previous_partial || slab.next_partial)) {
+    UnlinkPartial(&slab);
+    heap_->Release(slab.address);
+    --size_class.slab_count;
+    slabs_.erase(it);
+  }
+  return true;
+}
+
+void SystemHeapSlabs::DumpStats() {
+  auto global_lock = global_critical_region_.Acquire();
+  XELOGE("  Slot Size  Slabs  Used Slots  Free Slots  Total Allocs");
+  for (uint32_t i = 0; i < kSizeClassCount; ++i) {
+    const SizeClass& size_class = size_classes_[i];
+    XELOGE("  {:9d}  {:5d}  {:10d}  {:10d}  {:12d}",
+           uint32_t(1) << (kMinSlotSizeLog2 + i), size_class.slab_count,
+           size_class.used_slot_count,
+           size_class.slab_count * slot_count(i) - size_class.used_slot_count,
+           size_class.total_alloc_count);
+  }
+}
+
 xe::memory::PageAccess ToPageAccess(uint32_t protect) {
   if ((protect & kMemoryProtectRead) && !(protect & kMemoryProtectWrite)) {
     return xe::memory::PageAccess::kReadOnly;
@@ -650,6 +961,22 @@ void BaseHeap::Initialize(Memory* memory, uint8_t* membase, HeapType heap_type,
   page_size_ = page_size;
   host_address_offset_ = host_address_offset;
   page_table_.resize(heap_size / page_size);
+  RebuildFreePageIndex();
+}
+
+void BaseHeap::RebuildFreePageIndex() {
+  uint32_t page_count = uint32_t(page_table_.size());
+  free_pages_.Reset(page_count);
+  uint32_t free_run_start = 0;
+  for (uint32_t i = 0; i <= page_count; ++i) {
+    if (i < page_count && !page_table_[i].state) {
+      continue;
+    }
+    if (i > free_run_start) {
+      free_pages_.MarkFree(free_run_start, i - free_run_start);
+    }
+    free_run_start = i + 1;
+  }
 }
 
 void BaseHeap::Dispose() {
@@ -745,81 +1072,458 @@ uint32_t BaseHeap::GetUnreservedPageCount() {
   return count;
 }
 
-bool BaseHeap::Save(ByteStream* stream) {
-  XELOGD("Heap {:08X}-{:08X}", heap_base_, heap_base_ + (heap_size_ - 1));
+// Calls job for every index below job_count on up to save_state_threads
+// threads, the calling one included.
+void RunSaveStateJobs(size_t job_count,
+                      const std::function<void(size_t job_index)>& job) {
+  uint32_t thread_count = cvars::save_state_threads > 0
+                              ? uint32_t(cvars::save_state_threads)
+                              : xe::threading::logical_processor_count();
+  thread_count = uint32_t(
+      std::min(size_t(std::max(thread_count, uint32_t(1))), job_count));
+  std::atomic<size_t> next_job_index(0);
+  auto thread_function = [&]() {
+    for (;;) {
+      size_t job_index = next_job_index++;
+      if (job_index >= job_count) {
+        return;
+      }
+      job(job_index);
+    }
+  };
+  std::vector<std::unique_ptr<xe::threading::Thread>> threads;
+  while (threads.size() + 1 < thread_count) {
+    threads.push_back(xe::threading::Thread::Create({}, thread_function));
+    threads.back()->set_name("Save State Compression");
+  }
+  thread_function();
+  for (auto& thread : threads) {
+    xe::threading::Wait(thread.get(), false);
+  }
+}
 
-  for (size_t i = 0; i < page_table_.size(); i++) {
-    auto& page = page_table_[i];
-    stream->Write(page.qword);
-    if (!page.state) {
-      // Unallocated.
+// Committed pages are saved in chunks of up to this many bytes, so they can be
+// compressed and decompressed in parallel.
+constexpr uint32_t kSaveStateChunkSize = 1024 * 1024;
+
+// Table of contents entry of a chunk of committed pages. The compressed data
+// of the chunks follows the table, in the same order.
+struct SaveStateChunk {
+  uint32_t first_page;
+  uint32_t page_count;
+  // Size of the data in the stream, equal to the size of the pages if they
+  // are stored uncompressed because compression didn't make them smaller.
+  uint32_t stored_size;
+};
+static_assert(sizeof(SaveStateChunk) == 12, "Chunks must be tightly packed");
+
+void BaseHeap::GetSaveStateChunks(const std::vector<PageEntry>& page_table,
+                                  std::vector<SaveStateChunk>& chunks) const {
+  chunks.clear();
+  uint32_t chunk_page_count = std::max(kSaveStateChunkSize / page_size_, 1u);
+  uint32_t page_count = uint32_t(page_table.size());
+  uint32_t run_first = 0;
+  while (run_first < page_count) {
+    if (!(page_table[run_first].state & kMemoryAllocationCommit)) {
+      ++run_first;
       continue;
     }
+    uint32_t run_end = run_first + 1;
+    while (run_end < page_count &&
+           (page_table[run_end].state & kMemoryAllocationCommit)) {
+      ++run_end;
+    }
+    for (uint32_t i = run_first; i < run_end; i += chunk_page_count) {
+      SaveStateChunk chunk;
+      chunk.first_page = i;
+      chunk.page_count = std::min(chunk_page_count, run_end - i);
+      chunk.stored_size = chunk.page_count * page_size_;
+      chunks.push_back(chunk);
+    }
+    run_first = run_end;
+  }
+}
 
-    // TODO(DrChat): write compressed with snappy.
-    if (page.state & kMemoryAllocationCommit) {
-      void* addr = TranslateRelative(i * page_size_);
+void BaseHeap::ApplyGuestProtection(uint32_t first_page, uint32_t page_count) {
+  // Sets the protection once for each run of pages with the same guest
+  // protection rather than for every page. Restored pages are committed as
+  // read/write, so those are skipped.
+  uint32_t end_page = first_page + page_count;
+  uint32_t run_first = first_page;
+  while (run_first < end_page) {
+    xe::memory::PageAccess run_access =
+        ToPageAccess(page_table_[run_first].current_protect);
+    uint32_t run_end = run_first + 1;
+    while (run_end < end_page &&
+           ToPageAccess(page_table_[run_end].current_protect) == run_access) {
+      ++run_end;
+    }
+    if (run_access != xe::memory::PageAccess::kReadWrite) {
+      xe::memory::Protect(TranslateRelative(run_first * page_size_),
+                          (run_end - run_first) * page_size_, run_access,
+                          nullptr);
+    }
+    run_first = run_end;
+  }
+}
 
-      memory::PageAccess old_access;
-      memory::Protect(addr, page_size_, memory::PageAccess::kReadWrite,
-                      &old_access);
+void BaseHeap::GetInaccessibleRuns(
+    std::vector<std::pair<uint32_t, uint32_t>>& runs) const {
+  runs.clear();
+  for (uint32_t i = 0; i < uint32_t(page_table_.size()); ++i) {
+    const PageEntry& page = page_table_[i];
+    if (!(page.state & kMemoryAllocationCommit) ||
+        (page.current_protect & kMemoryProtectRead)) {
+      continue;
+    }
+    if (!runs.empty() && runs.back().first + runs.back().second == i) {
+      ++runs.back().second;
+    } else {
+      runs.emplace_back(i, 1);
+    }
+  }
+}
+
+void BaseHeap::ProtectRuns(
+    const std::vector<std::pair<uint32_t, uint32_t>>& runs,
+    xe::memory::PageAccess access) {
+  for (const auto& run : runs) {
+    xe::memory::Protect(TranslateRelative(run.first * page_size_),
+                        run.second * page_size_, access, nullptr);
+  }
+}
 
-      stream->Write(addr, page_size_);
+bool BaseHeap::WriteSaveState(
+    ByteStream* stream, const std::vector<PageEntry>& page_table,
+    const std::function<const uint8_t*(uint32_t page_number)>& page_data)
+    const {
+  auto start = std::chrono::steady_clock::now();
+  size_t start_offset = stream->offset();
+
+  std::vector<SaveStateChunk> chunks;
+  GetSaveStateChunks(page_table, chunks);
+  std::vector<std::vector<char>> compressed(chunks.size());
+  RunSaveStateJobs(chunks.size(), [&](size_t chunk_index) {
+    SaveStateChunk& chunk = chunks[chunk_index];
+    // Gather the pages if they aren't contiguous in the host memory.
+    const uint8_t* chunk_data = page_data(chunk.first_page);
+    std::unique_ptr<uint8_t[]> gathered;
+    for (uint32_t i = 1; i < chunk.page_count; ++i) {
+      const uint8_t* data = page_data(chunk.first_page + i);
+      if (!gathered && data == chunk_data + i * page_size_) {
+        continue;
+      }
+      if (!gathered) {
+        gathered.reset(new uint8_t[chunk.stored_size]);
+        std::memcpy(gathered.get(), chunk_data, i * page_size_);
+      }
+      std::memcpy(gathered.get() + i * page_size_, data, page_size_);
+    }
+    if (gathered) {
+      chunk_data = gathered.get();
+    }
+    std::vector<char>& chunk_compressed = compressed[chunk_index];
+    chunk_compressed.resize(snappy::MaxCompressedLength(chunk.stored_size));
+    size_t compressed_length;
+    snappy::RawCompress(reinterpret_cast<const char*>(chunk_data),
+                        chunk.stored_size, chunk_compressed.data(),
+                        &compressed_length);
+    if (compressed_length < chunk.stored_size) {
+      chunk.stored_size = uint32_t(compressed_length);
+      chunk_compressed.resize(compressed_length);
+    } else {
+      chunk_compressed.clear();
+    }
+  });
 
-      memory::Protect(addr, page_size_, old_access, nullptr);
+  size_t page_table_size = page_table.size() * sizeof(PageEntry);
+  size_t save_size = page_table_size + sizeof(uint32_t) +
+                     chunks.size() * sizeof(SaveStateChunk);
+  for (const SaveStateChunk& chunk : chunks) {
+    save_size += chunk.stored_size;
+  }
+  if (stream->data_length() - start_offset < save_size) {
+    XELOGE("Heap {:08X}: {} bytes don't fit in the save state", heap_base_,
+           save_size);
+    return false;
+  }
+  stream->Write(page_table.data(), page_table_size);
+  stream->Write(uint32_t(chunks.size()));
+  stream->Write(chunks.data(), chunks.size() * sizeof(SaveStateChunk));
+  uint64_t committed_bytes = 0;
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    const SaveStateChunk& chunk = chunks[i];
+    uint32_t chunk_size = chunk.page_count * page_size_;
+    committed_bytes += chunk_size;
+    if (chunk.stored_size != chunk_size) {
+      stream->Write(compressed[i].data(), compressed[i].size());
+      continue;
+    }
+    for (uint32_t j = 0; j < chunk.page_count; ++j) {
+      stream->Write(page_data(chunk.first_page + j), page_size_);
     }
   }
 
+  XELOGD(
+      "Heap {:08X}-{:08X}: {} committed bytes in {} chunks saved as {} bytes "
+      "in {:.3f} ms",
+      heap_base_, heap_base_ + (heap_size_ - 1), committed_bytes,
+      chunks.size(), stream->offset() - start_offset,
+      std::chrono::duration<double, std::milli>(
+          std::chrono::steady_clock::now() - start)
+          .count());
   return true;
 }
 
+bool BaseHeap::Save(ByteStream* stream) {
+  std::vector<std::pair<uint32_t, uint32_t>> inaccessible_runs;
+  GetInaccessibleRuns(inaccessible_runs);
+  ProtectRuns(inaccessible_runs, xe::memory::PageAccess::kReadOnly);
+  bool saved = WriteSaveState(stream, page_table_, [this](uint32_t page) {
+    return TranslateRelative<const uint8_t*>(page * page_size_);
+  });
+  ProtectRuns(inaccessible_runs, xe::memory::PageAccess::kNoAccess);
+  return saved;
+}
+
+bool BaseHeap::SaveSnapshot(const HeapSnapshot& snapshot,
+                            ByteStream* stream) const {
+  if (snapshot.page_table.size() != page_table_.size()) {
+    XELOGE("Heap {:08X}: no snapshot has been captured", heap_base_);
+    return false;
+  }
+  return WriteSaveState(stream, snapshot.page_table,
+                        [&snapshot](uint32_t page) {
+                          return snapshot.pages[page].get();
+                        });
+}
+
 bool BaseHeap::Restore(ByteStream* stream) {
-  XELOGD("Heap {:08X}-{:08X}", heap_base_, heap_base_ + (heap_size_ - 1));
+  auto start = std::chrono::steady_clock::now();
+
+  stream->Read(page_table_.data(), page_table_.size() * sizeof(PageEntry));
+
+  // Validate the table of contents against the restored page table before
+  // writing anything to the guest memory.
+  std::vector<SaveStateChunk> expected_chunks;
+  GetSaveStateChunks(page_table_, expected_chunks);
+  uint32_t chunk_count = stream->Read<uint32_t>();
+  if (chunk_count != expected_chunks.size()) {
+    XELOGE("Heap {:08X}: {} chunks saved, {} committed page chunks expected",
+           heap_base_, chunk_count, expected_chunks.size());
+    return false;
+  }
+  std::vector<SaveStateChunk> chunks(chunk_count);
+  stream->Read(chunks.data(), chunks.size() * sizeof(SaveStateChunk));
+  std::vector<size_t> chunk_offsets(chunk_count);
+  size_t data_offset = stream->offset();
+  for (uint32_t i = 0; i < chunk_count; ++i) {
+    const SaveStateChunk& chunk = chunks[i];
+    if (chunk.first_page != expected_chunks[i].first_page ||
+        chunk.page_count != expected_chunks[i].page_count ||
+        chunk.stored_size > chunk.page_count * page_size_) {
+      XELOGE("Heap {:08X}: chunk {} doesn't match the page table", heap_base_,
+             i);
+      return false;
+    }
+    chunk_offsets[i] = data_offset;
+    data_offset += chunk.stored_size;
+  }
+  if (data_offset > stream->data_length()) {
+    XELOGE("Heap {:08X}: the save state is truncated", heap_base_);
+    return false;
+  }
 
-  for (size_t i = 0; i < page_table_.size(); i++) {
-    auto& page = page_table_[i];
-    page.qword = stream->Read<uint64_t>();
-    if (!page.state) {
-      // Unallocated.
-      continue;
+  // Commit the memory if it isn't already. We do not need to reserve any
+  // memory, as the mapping has already taken care of that.
+  for (const SaveStateChunk& chunk : chunks) {
+    xe::memory::AllocFixed(TranslateRelative(chunk.first_page * page_size_),
+                           chunk.page_count * page_size_,
+                           memory::AllocationType::kCommit,
+                           memory::PageAccess::kReadWrite);
+  }
+  std::atomic<bool> chunks_valid(true);
+  RunSaveStateJobs(chunks.size(), [&](size_t chunk_index) {
+    const SaveStateChunk& chunk = chunks[chunk_index];
+    const char* stored = reinterpret_cast<const char*>(stream->data()) +
+                         chunk_offsets[chunk_index];
+    char* pages = TranslateRelative<char*>(chunk.first_page * page_size_);
+    uint32_t chunk_size = chunk.page_count * page_size_;
+    if (chunk.stored_size == chunk_size) {
+      std::memcpy(pages, stored, chunk_size);
+      return;
+    }
+    size_t uncompressed_length;
+    if (!snappy::GetUncompressedLength(stored, chunk.stored_size,
+                                       &uncompressed_length) ||
+        uncompressed_length != chunk_size ||
+        !snappy::RawUncompress(stored, chunk.stored_size, pages)) {
+      chunks_valid = false;
     }
+  });
+  stream->set_offset(data_offset);
+  for (const SaveStateChunk& chunk : chunks) {
+    ApplyGuestProtection(chunk.first_page, chunk.page_count);
+  }
+  if (!chunks_valid) {
+    XELOGE("Heap {:08X}: failed to decompress the saved pages", heap_base_);
+    return false;
+  }
+
+  RebuildFreePageIndex();
+
+  XELOGD("Heap {:08X}-{:08X}: {} chunks restored in {:.3f} ms", heap_base_,
+         heap_base_ + (heap_size_ - 1), chunks.size(),
+         std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+             .count());
+  return true;
+}
+
+void HeapSnapshotDelta::Undo(HeapSnapshot& snapshot) {
+  for (Page& page : pages) {
+    snapshot.page_table[page.page_number] = page.entry;
+    snapshot.pages[page.page_number] = std::move(page.data);
+  }
+  pages.clear();
+}
 
-    memory::PageAccess page_access = memory::PageAccess::kNoAccess;
-    if ((page.current_protect & kMemoryProtectRead) &&
-        (page.current_protect & kMemoryProtectWrite)) {
-      page_access = memory::PageAccess::kReadWrite;
-    } else if (page.current_protect & kMemoryProtectRead) {
-      page_access = memory::PageAccess::kReadOnly;
+size_t HeapSnapshotDelta::data_size() const {
+  size_t size = pages.size() * sizeof(Page);
+  for (const Page& page : pages) {
+    if (page.data) {
+      size += page_size;
     }
+  }
+  return size;
+}
 
-    // Commit the memory if it isn't already. We do not need to reserve any
-    // memory, as the mapping has already taken care of that.
-    if (page.state & kMemoryAllocationCommit) {
-      xe::memory::AllocFixed(TranslateRelative(i * page_size_), page_size_,
-                             memory::AllocationType::kCommit,
-                             memory::PageAccess::kReadWrite);
+void BaseHeap::CaptureSnapshot(HeapSnapshot& snapshot,
+                               HeapSnapshotDelta& delta) {
+  uint32_t page_count = uint32_t(page_table_.size());
+  if (snapshot.page_table.size() != page_count) {
+    snapshot.page_table.clear();
+    snapshot.page_table.resize(page_count);
+    snapshot.pages.clear();
+    snapshot.pages.resize(page_count);
+  }
+  delta.page_size = page_size_;
+
+  std::vector<std::pair<uint32_t, uint32_t>> inaccessible_runs;
+  GetInaccessibleRuns(inaccessible_runs);
+  ProtectRuns(inaccessible_runs, xe::memory::PageAccess::kReadOnly);
+
+  // Compare the pages in parallel, each job collecting its own changes.
+  uint32_t job_page_count = std::max(kSaveStateChunkSize / page_size_, 1u);
+  size_t job_count = (page_count + job_page_count - 1) / job_page_count;
+  std::vector<std::vector<HeapSnapshotDelta::Page>> job_pages(job_count);
+  RunSaveStateJobs(job_count, [&](size_t job_index) {
+    uint32_t first_page = uint32_t(job_index) * job_page_count;
+    uint32_t end_page = std::min(first_page + job_page_count, page_count);
+    for (uint32_t i = first_page; i < end_page; ++i) {
+      PageEntry page = page_table_[i];
+      std::unique_ptr<uint8_t[]>& snapshot_data = snapshot.pages[i];
+      bool committed = (page.state & kMemoryAllocationCommit) != 0;
+      const uint8_t* host_page = TranslateRelative(i * page_size_);
+      if (page.qword == snapshot.page_table[i].qword &&
+          committed == bool(snapshot_data) &&
+          (!committed ||
+           !std::memcmp(host_page, snapshot_data.get(), page_size_))) {
+        continue;
+      }
+      HeapSnapshotDelta::Page changed_page;
+      changed_page.page_number = i;
+      changed_page.entry = snapshot.page_table[i];
+      changed_page.data = std::move(snapshot_data);
+      job_pages[job_index].push_back(std::move(changed_page));
+      snapshot.page_table[i] = page;
+      if (committed) {
+        snapshot_data.reset(new uint8_t[page_size_]);
+        std::memcpy(snapshot_data.get(), host_page, page_size_);
+      }
     }
+  });
 
-    // Now read into memory. We'll set R/W protection first, then set the
-    // protection back to its previous state.
-    // TODO(DrChat): read compressed with snappy.
-    if (page.state & kMemoryAllocationCommit) {
-      void* addr = TranslateRelative(i * page_size_);
-      xe::memory::Protect(addr, page_size_, memory::PageAccess::kReadWrite,
-                          nullptr);
+  ProtectRuns(inaccessible_runs, xe::memory::PageAccess::kNoAccess);
+
+  for (auto& pages : job_pages) {
+    std::move(pages.begin(), pages.end(), std::back_inserter(delta.pages));
+  }
+}
 
-      stream->Read(addr, page_size_);
+bool BaseHeap::RestoreSnapshot(const HeapSnapshot& snapshot) {
+  uint32_t page_count = uint32_t(page_table_.size());
+  if (snapshot.page_table.size() != page_count) {
+    XELOGE("Heap {:08X}: no snapshot has been captured", heap_base_);
+    return false;
+  }
 
-      xe::memory::Protect(addr, page_size_, page_access, nullptr);
+  // Make the committed pages writable, and commit the pages only committed in
+  // the snapshot, once for each run of them.
+  std::vector<std::pair<uint32_t, uint32_t>> protected_runs;
+  std::vector<std::pair<uint32_t, uint32_t>> commit_runs;
+  auto append_page = [](std::vector<std::pair<uint32_t, uint32_t>>& runs,
+                        uint32_t page_number) {
+    if (!runs.empty() &&
+        runs.back().first + runs.back().second == page_number) {
+      ++runs.back().second;
+    } else {
+      runs.emplace_back(page_number, 1);
+    }
+  };
+  for (uint32_t i = 0; i < page_count; ++i) {
+    const PageEntry& page = page_table_[i];
+    if (page.state & kMemoryAllocationCommit) {
+      if (ToPageAccess(page.current_protect) !=
+          xe::memory::PageAccess::kReadWrite) {
+        append_page(protected_runs, i);
+      }
+    } else if (snapshot.pages[i]) {
+      append_page(commit_runs, i);
     }
   }
+  ProtectRuns(protected_runs, xe::memory::PageAccess::kReadWrite);
+  for (const auto& run : commit_runs) {
+    xe::memory::AllocFixed(TranslateRelative(run.first * page_size_),
+                           run.second * page_size_,
+                           memory::AllocationType::kCommit,
+                           memory::PageAccess::kReadWrite);
+  }
+
+  uint32_t job_page_count = std::max(kSaveStateChunkSize / page_size_, 1u);
+  size_t job_count = (page_count + job_page_count - 1) / job_page_count;
+  RunSaveStateJobs(job_count, [&](size_t job_index) {
+    uint32_t first_page = uint32_t(job_index) * job_page_count;
+    uint32_t end_page = std::min(first_page + job_page_count, page_count);
+    for (uint32_t i = first_page; i < end_page; ++i) {
+      const uint8_t* snapshot_data = snapshot.pages[i].get();
+      if (!snapshot_data) {
+        continue;
+      }
+      uint8_t* host_page = TranslateRelative(i * page_size_);
+      if (std::memcmp(host_page, snapshot_data, page_size_)) {
+        std::memcpy(host_page, snapshot_data, page_size_);
+      }
+    }
+  });
 
+  page_table_ = snapshot.page_table;
+  for (const auto& run : protected_runs) {
+    ApplyGuestProtection(run.first, run.second);
+  }
+  std::vector<SaveStateChunk> chunks;
+  GetSaveStateChunks(page_table_, chunks);
+  for (const SaveStateChunk& chunk : chunks) {
+    ApplyGuestProtection(chunk.first_page, chunk.page_count);
+  }
+  RebuildFreePageIndex();
   return true;
 }
 
 void BaseHeap::Reset() {
   // TODO(DrChat): protect pages.
   std::memset(page_table_.data(), 0, sizeof(PageEntry) * page_table_.size());
+  RebuildFreePageIndex();
   // TODO(Triang3l): Remove access callbacks from pages if this is a physical
   // memory heap.
 }
@@ -910,6 +1614,7 @@ bool BaseHeap::AllocFixed(uint32_t base_address, uint32_t size,
     page_entry.current_protect = protect;
     page_entry.state = kMemoryAllocationReserve | allocation_type;
   }
+  free_pages_.MarkUsed(start_page_number, page_count);
 
   return true;
 }
@@ -941,12 +1646,23 @@ bool BaseHeap::AllocRange(uint32_t low_address, uint32_t high_address,
   // Find a free page range.
   // The base page must match the requested alignment, so we first scan for
   // a free aligned page and only then check for continuous free pages.
-  // TODO(benvanik): optimized searching (free list buckets, bitmap, etc).
   uint32_t start_page_number = UINT_MAX;
   uint32_t end_page_number = UINT_MAX;
   uint32_t page_scan_stride = alignment / page_size_;
   high_page_number = high_page_number - (high_page_number % page_scan_stride);
-  if (top_down) {
+  if (cvars::heap_free_page_index) {
+    // Same placement as the scan below, but skipping whole free and used runs
+    // rather than individual pages.
+    if (high_page_number >= page_count) {
+      uint32_t base_page_number = free_pages_.Find(
+          std::max(page_count, uint32_t(1)), page_scan_stride, low_page_number,
+          high_page_number - page_count, top_down);
+      if (base_page_number != FreeRunIndex::kInvalidIndex) {
+        start_page_number = base_page_number;
+        end_page_number = base_page_number + page_count - 1;
+      }
+    }
+  } else if (top_down) {
     for (int64_t base_page_number =
              high_page_number - xe::round_up(page_count, page_scan_stride);
          base_page_number >= low_page_number;
@@ -1055,6 +1771,7 @@ bool BaseHeap::AllocRange(uint32_t low_address, uint32_t high_address,
     page_entry.current_protect = protect;
     page_entry.state = kMemoryAllocationReserve | allocation_type;
   }
+  free_pages_.MarkUsed(start_page_number, page_count);
 
   *out_address = heap_base_ + (start_page_number * page_size_);
   return true;
@@ -1145,6 +1862,7 @@ bool BaseHeap::Release(uint32_t base_address, uint32_t* out_region_size) {
     auto& page_entry = page_table_[page_number];
     page_entry.qword = 0;
   }
+  free_pages_.MarkFree(base_page_number, base_page_entry.region_page_count);
 
   return true;
 }
@@ -10,13 +10,17 @@
 #ifndef XENIA_MEMORY_H_
 #define XENIA_MEMORY_H_
 
+#include <array>
 #include <cstdint>
+#include <functional>
 #include <memory>
 #include <mutex>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
+#include "xenia/base/free_run_index.h"
 #include "xenia/base/memory.h"
 #include "xenia/base/mutex.h"
 #include "xenia/cpu/mmio_handler.h"
@@ -28,6 +32,7 @@ class ByteStream;
 namespace xe {
 
 class Memory;
+struct SaveStateChunk;
 
 enum SystemHeapFlag : uint32_t {
   kSystemHeapVirtual = 1 << 0,
@@ -98,6 +103,33 @@ union PageEntry {
   uint64_t qword;
 };
 
+// Copy of the page table and the committed pages of a heap, kept in host
+// memory for rewinding.
+struct HeapSnapshot {
+  std::vector<PageEntry> page_table;
+  // Contents of the committed pages, null for the other pages.
+  std::vector<std::unique_ptr<uint8_t[]>> pages;
+};
+
+// Pages of a HeapSnapshot replaced by a capture, for going back to the state
+// before it.
+struct HeapSnapshotDelta {
+  struct Page {
+    uint32_t page_number;
+    PageEntry entry;
+    // Null if the page wasn't committed.
+    std::unique_ptr<uint8_t[]> data;
+  };
+  uint32_t page_size = 0;
+  std::vector<Page> pages;
+
+  // Host memory used by the pages.
+  size_t data_size() const;
+  // Reverts the snapshot to the state before the capture that made the delta,
+  // moving the pages out of the delta.
+  void Undo(HeapSnapshot& snapshot);
+};
+
 // Heap abstraction for page-based allocation.
 class BaseHeap {
  public:
@@ -190,6 +222,15 @@ class BaseHeap {
   bool Save(ByteStream* stream);
   bool Restore(ByteStream* stream);
 
+  // Updates the snapshot to the current state of the heap, moving the pages
+  // that changed since the previous capture into delta.
+  void CaptureSnapshot(HeapSnapshot& snapshot, HeapSnapshotDelta& delta);
+  // Makes the heap match the snapshot, copying only the pages that differ.
+  bool RestoreSnapshot(const HeapSnapshot& snapshot);
+  // Writes the snapshot like Save writes the heap. Only reads the snapshot, so
+  // it can be done while the heap is being changed.
+  bool SaveSnapshot(const HeapSnapshot& snapshot, ByteStream* stream) const;
+
   void Reset();
 
  protected:
@@ -199,6 +240,26 @@ class BaseHeap {
                   uint32_t heap_base, uint32_t heap_size, uint32_t page_size,
                   uint32_t host_address_offset = 0);
 
+  // Recreates free_pages_ from page_table_ after it was changed wholesale.
+  void RebuildFreePageIndex();
+
+  // Splits the runs of committed pages into the chunks saved in save states.
+  void GetSaveStateChunks(const std::vector<PageEntry>& page_table,
+                          std::vector<SaveStateChunk>& chunks) const;
+  // Writes a page table and its committed pages in the save state format.
+  bool WriteSaveState(
+      ByteStream* stream, const std::vector<PageEntry>& page_table,
+      const std::function<const uint8_t*(uint32_t page_number)>& page_data)
+      const;
+  // Finds the runs of committed pages the host can't read, as first page and
+  // page count.
+  void GetInaccessibleRuns(
+      std::vector<std::pair<uint32_t, uint32_t>>& runs) const;
+  void ProtectRuns(const std::vector<std::pair<uint32_t, uint32_t>>& runs,
+                   xe::memory::PageAccess access);
+  // Applies the guest protection of restored committed pages to the host.
+  void ApplyGuestProtection(uint32_t first_page, uint32_t page_count);
+
   Memory* memory_;
   uint8_t* membase_;
   HeapType heap_type_;
@@ -208,6 +269,9 @@ class BaseHeap {
   uint32_t host_address_offset_;
   xe::global_critical_region global_critical_region_;
   std::vector<PageEntry> page_table_;
+  // Runs of unreserved pages in page_table_, kept in sync with it for range
+  // allocation.
+  FreeRunIndex free_pages_;
 };
 
 // Normal heap allowing allocations from guest virtual address ranges.
@@ -279,6 +343,88 @@ class PhysicalHeap : public BaseHeap {
   std::vector<SystemPageFlagsBlock> system_page_flags_;
 };
 
+// Sub-allocates system heap blocks smaller than a page from pages split into
+// equal slots, one size class per page, so small kernel objects don't take a
+// whole page of guest address space and a page table search each.
+class SystemHeapSlabs {
+ public:
+  // Size of the pages slots are carved from.
+  static constexpr uint32_t kSlabSize = 4096;
+  // Slots are powers of two from 32 to 2048 bytes, aligned to their size.
+  static constexpr uint32_t kMinSlotSizeLog2 = 5;
+  static constexpr uint32_t kMaxSlotSizeLog2 = 11;
+  static constexpr uint32_t kSizeClassCount =
+      kMaxSlotSizeLog2 - kMinSlotSizeLog2 + 1;
+  static constexpr uint32_t kFreeSlotWordCount =
+      (kSlabSize >> kMinSlotSizeLog2) / 64;
+
+  // Slot usage of a slab page, saved along with the heaps since the restored
+  // objects keep the addresses of their slots.
+  struct SlabState {
+    uint32_t address;
+    uint32_t size_class;
+    // Set bits are free slots.
+    uint64_t free_slots[kFreeSlotWordCount];
+  };
+
+  // Sets the heap the slab pages are allocated from.
+  void Initialize(BaseHeap* heap);
+
+  // Allocates a slot for the block, returning 0 if the block is too big or
+  // too aligned for slots, or if a slab page couldn't be allocated.
+  uint32_t Alloc(uint32_t size, uint32_t alignment);
+
+  // Frees a slot in O(1), returning false if the address is not a slot.
+  bool Free(uint32_t address);
+
+  // Forgets all slabs without releasing their pages, for when the heap has
+  // been reset.
+  void Reset();
+
+  // Gets the slot usage of all slabs.
+  std::vector<SlabState> Save();
+  // Replaces the slabs with the saved ones, whose pages must be allocated in
+  // the heap already.
+  void Restore(const std::vector<SlabState>& slabs);
+
+  bool Save(ByteStream* stream);
+  bool Restore(ByteStream* stream);
+
+  // Dumps the usage of each size class to the log.
+  void DumpStats();
+
+ private:
+  struct Slab {
+    uint32_t address;
+    uint32_t size_class;
+    uint32_t free_slot_count;
+    // Set bits are free slots.
+    uint64_t free_slots[kFreeSlotWordCount];
+    // Doubly-linked list of the slabs of the size class with free slots.
+    Slab* previous_partial;
+    Slab* next_partial;
+  };
+
+  struct SizeClass {
+    Slab* partial_slabs;
+    uint32_t slab_count;
+    uint32_t used_slot_count;
+    uint64_t total_alloc_count;
+  };
+
+  static uint32_t slot_count(uint32_t size_class) {
+    return kSlabSize >> (kMinSlotSizeLog2 + size_class);
+  }
+  void LinkPartial(Slab* slab);
+  void UnlinkPartial(Slab* slab);
+
+  BaseHeap* heap_ = nullptr;
+  xe::global_critical_region global_critical_region_;
+  // Keyed by the page address.
+  std::unordered_map<uint32_t, Slab> slabs_;
+  SizeClass size_classes_[kSizeClassCount] = {};
+};
+
 // Models the entire guest memory system on the console.
 // This exposes interfaces to both virtual and physical memory and a TLB and
 // page table for allocation, mapping, and protection.
@@ -475,10 +621,43 @@ class Memory {
   // Dumps a map of all allocated memory to the log.
   void DumpMap();
 
+  static constexpr size_t kSavedHeapCount = 5;
+
+  // Heaps are saved as their page tables followed by the committed pages,
+  // compressed in independent chunks, and then the system heap slabs.
+  static constexpr uint32_t kSaveStateVersion = 3;
+
   bool Save(ByteStream* stream);
   bool Restore(ByteStream* stream);
 
+  // In-memory copy of the heaps included in save states.
+  struct Snapshot {
+    HeapSnapshot heaps[kSavedHeapCount];
+    std::vector<SystemHeapSlabs::SlabState> slabs;
+  };
+  struct SnapshotDelta {
+    HeapSnapshotDelta heaps[kSavedHeapCount];
+    // The slabs of the snapshot before the capture, saved whole since there
+    // are few of them.
+    std::vector<SystemHeapSlabs::SlabState> slabs;
+
+    size_t page_count() const;
+    size_t data_size() const;
+    void Undo(Snapshot& snapshot);
+  };
+
+  // Updates the snapshot to the current guest memory, moving the pages changed
+  // since the previous capture into delta.
+  void CaptureSnapshot(Snapshot& snapshot, SnapshotDelta& delta);
+  bool RestoreSnapshot(const Snapshot& snapshot);
+  // Writes the snapshot in the format of Save. Doesn't access the guest memory,
+  // so the emulation may continue meanwhile.
+  bool SaveSnapshot(const Snapshot& snapshot, ByteStream* stream);
+
  private:
+  // Heaps included in save states, in the order they're saved.
+  std::array<BaseHeap*, kSavedHeapCount> saved_heaps();
+
   int MapViews(uint8_t* mapping_base);
   void UnmapViews();
 
@@ -530,6 +709,8 @@ class Memory {
     PhysicalHeap vE0000000;
   } heaps_;
 
+  SystemHeapSlabs system_heap_slabs_;
+
   friend class BaseHeap;
 
   friend class PhysicalHeap;
@@ -0,0 +1,140 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2020 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "xenia/base/cvar.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/main.h"
+#include "xenia/memory.h"
+
+DEFINE_int32(memory_churn_bench_allocations, 4096,
+             "Number of allocations kept alive in each heap.", "Memory");
+DEFINE_int32(memory_churn_bench_operations, 200000,
+             "Number of release and allocation pairs per run.", "Memory");
+DEFINE_int32(memory_churn_bench_max_pages, 64,
+             "Maximum size of an allocation, in pages.", "Memory");
+
+DECLARE_bool(heap_free_page_index);
+
+namespace xe {
+
+struct ChurnResult {
+  double operations_per_second;
+  // Hash of all the addresses returned, to compare placement.
+  uint64_t placement_hash;
+  uint32_t failed_allocations;
+};
+
+// Keeps a fixed number of allocations alive in a heap, replacing a random one
+// on every operation, like titles allocating and freeing buffers every frame.
+// The pages are only reserved, as committing them on the host would dominate
+// the time.
+ChurnResult RunChurn(BaseHeap* heap, uint32_t allocation_count,
+                     uint32_t operation_count, uint32_t max_pages) {
+  ChurnResult result = {};
+  result.placement_hash = 14695981039346656037ull;
+  std::mt19937 random(allocation_count);
+  std::vector<uint32_t> addresses(allocation_count, 0);
+  auto allocate = [&](uint32_t& address) {
+    uint32_t page_count = 1 + random() % max_pages;
+    // Mostly small allocations, with some large ones to fragment the heap.
+    if (random() % 4) {
+      page_count = 1 + page_count % 4;
+    }
+    uint32_t alignment = (random() % 4) ? heap->page_size() : 64 * 1024;
+    bool top_down = (random() % 4) == 0;
+    if (!heap->Alloc(page_count * heap->page_size(), alignment,
+                     kMemoryAllocationReserve, kMemoryProtectNoAccess,
+                     top_down, &address)) {
+      address = 0;
+      ++result.failed_allocations;
+    }
+    result.placement_hash =
+        (result.placement_hash ^ address) * 1099511628211ull;
+  };
+
+  for (uint32_t& address : addresses) {
+    allocate(address);
+  }
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < operation_count; ++i) {
+    uint32_t& address = addresses[random() % allocation_count];
+    if (address) {
+      heap->Release(address);
+    }
+    allocate(address);
+  }
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  for (uint32_t address : addresses) {
+    if (address) {
+      heap->Release(address);
+    }
+  }
+  result.operations_per_second = operation_count / seconds;
+  return result;
+}
+
+int memory_churn_bench_main(const std::vector<std::string>& args) {
+  if (cvars::memory_churn_bench_allocations <= 0 ||
+      cvars::memory_churn_bench_operations <= 0 ||
+      cvars::memory_churn_bench_max_pages <= 0) {
+    XELOGE("The allocation, operation and page counts must be positive");
+    return 1;
+  }
+  uint32_t allocation_count = uint32_t(cvars::memory_churn_bench_allocations);
+  uint32_t operation_count = uint32_t(cvars::memory_churn_bench_operations);
+  uint32_t max_pages = uint32_t(cvars::memory_churn_bench_max_pages);
+
+  Memory memory;
+  if (!memory.Initialize()) {
+    XELOGE("Failed to initialize the guest memory");
+    return 1;
+  }
+
+  const struct {
+    const char* name;
+    BaseHeap* heap;
+  } heaps[] = {
+      {"Virtual 4 KB", memory.LookupHeapByType(false, 4096)},
+      {"Physical 4 KB", memory.LookupHeapByType(true, 4096)},
+  };
+  std::printf("%u live allocations, %u operations, up to %u pages:\n",
+              allocation_count, operation_count, max_pages);
+  std::printf("%-16s %14s %14s %10s %10s\n", "Heap", "Scan ops/s",
+              "Index ops/s", "Failed", "Placement");
+  int exit_code = 0;
+  for (const auto& heap : heaps) {
+    cvars::heap_free_page_index = false;
+    ChurnResult scan =
+        RunChurn(heap.heap, allocation_count, operation_count, max_pages);
+    cvars::heap_free_page_index = true;
+    ChurnResult index =
+        RunChurn(heap.heap, allocation_count, operation_count, max_pages);
+    bool same_placement = scan.placement_hash == index.placement_hash &&
+                          scan.failed_allocations == index.failed_allocations;
+    if (!same_placement) {
+      exit_code = 1;
+    }
+    std::printf("%-16s %14.0f %14.0f %10u %10s\n", heap.name,
+                scan.operations_per_second, index.operations_per_second,
+                index.failed_allocations, same_placement ? "same" : "DIFFERS");
+  }
+  return exit_code;
+}
+
+}  // namespace xe
+
+DEFINE_ENTRY_POINT("xenia-memory-churn-bench", xe::memory_churn_bench_main, "");
@@ -8,8 +8,31 @@ project("xenia-core")
   language("C++")
   links({
     "fmt",
+    "snappy",
     "xenia-base",
   })
   defines({
   })
   files({"*.h", "*.cc"})
+  removefiles({"*_main.cc"})
+
+group("src")
+project("xenia-memory-churn-bench")
+  uuid("e7a1d4c9-2b6f-4f38-9c05-3d8b7a6e1f24")
+  kind("ConsoleApp")
+  language("C++")
+  links({
+    "fmt",
+    "mspack",
+    "snappy",
+    "xenia-base",
+    "xenia-core",
+    "xenia-cpu",
+    "xenia-ui", -- needed by xenia-base
+  })
+  defines({
+  })
+  files({
+    "memory_churn_bench_main.cc",
+    "base/main_"..platform_suffix..".cc",
+  })
@@ -10,18 +10,39 @@
 #include "xenia/vfs/devices/stfs_container_device.h"
 
 #include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <functional>
 #include <queue>
+#include <thread>
 #include <vector>
 
+#include "xenia/base/cvar.h"
+#include "xenia/base/filesystem.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
+#include "xenia/base/threading.h"
+#include "xenia/base/xxhash.h"
 #include "xenia/vfs/devices/stfs_container_entry.h"
 
+#include "third_party/crypto/TinySHA1.hpp"
+#include "third_party/fmt/include/fmt/format.h"
+
 #if XE_PLATFORM_WIN32
 #include "xenia/base/platform_win.h"
 #define timegm _mkgmtime
 #endif
 
+DEFINE_bool(stfs_index_cache, true,
+            "Store the directory tree of mounted STFS packages in an index "
+            "file in the cache directory, so mounting them again doesn't "
+            "require parsing.",
+            "Storage");
+DEFINE_bool(stfs_verify_hashes, false,
+            "Verify the SHA-1 hashes of the file table and file data blocks of "
+            "STFS packages when parsing them, ignoring the index files.",
+            "Storage");
+
 namespace xe {
 namespace vfs {
 
@@ -53,11 +74,128 @@ uint64_t decode_fat_timestamp(uint32_t date, uint32_t time) {
   return (timet + 11644473600LL) * 10000000;
 }
 
-StfsContainerDevice::StfsContainerDevice(const std::string_view mount_path,
-                                         const std::filesystem::path& host_path)
+namespace {
+
+// Calls fn for every index in [0, count) on worker threads, each taking the
+// next index once it's done with the previous one. Small inputs are handled on
+// the calling thread alone.
+void ParallelFor(size_t count, const std::function<void(size_t)>& fn) {
+  const size_t kMinCountPerThread = 16;
+  size_t thread_count =
+      std::min(size_t(xe::threading::logical_processor_count()),
+               count / kMinCountPerThread);
+  std::atomic<size_t> next_index(0);
+  auto worker = [&]() {
+    size_t index;
+    while ((index = next_index.fetch_add(1, std::memory_order_relaxed)) <
+           count) {
+      fn(index);
+    }
+  };
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < thread_count; i++) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+void CollectFileEntries(const Entry* entry,
+                        std::vector<StfsContainerEntry*>* out_entries) {
+  for (auto& child : entry->children()) {
+    if (child->attributes() & kFileAttributeDirectory) {
+      CollectFileEntries(child.get(), out_entries);
+    } else {
+      out_entries->push_back(static_cast<StfsContainerEntry*>(child.get()));
+    }
+  }
+}
+
+// Directory index file layout (host endianness):
+//   uint32_t magic, version
+//   uint8_t header_hash[0x14]
+//   uint32_t descriptor_type, data_file_count
+//   uint64_t data_size - combined size of the mapped files
+//   uint32_t entry_count
+//   Entries in pre-order, the root first:
+//     uint32_t parent_index
+//     uint16_t name_length, char name[name_length]
+//     uint32_t attributes
+//     uint64_t size, allocation_size, data_offset, data_size, block
+//     uint64_t create_timestamp, access_timestamp, write_timestamp
+//     uint32_t block_count
+//     { uint32_t file, uint64_t offset, uint64_t length }[block_count]
+const uint32_t kIndexMagic = 0x49545358;  // 'XSTI'
+const uint32_t kIndexVersion = 1;
+const uint32_t kIndexNoParent = UINT32_MAX;
+
+template <typename T>
+void AppendIndexValue(std::vector<uint8_t>* buffer, T value) {
+  size_t offset = buffer->size();
+  buffer->resize(offset + sizeof(T));
+  std::memcpy(buffer->data() + offset, &value, sizeof(T));
+}
+
+void AppendIndexEntry(std::vector<uint8_t>* buffer,
+                      const StfsContainerEntry* entry, uint32_t parent_index,
+                      uint32_t* entry_count) {
+  uint32_t index = (*entry_count)++;
+  AppendIndexValue<uint32_t>(buffer, parent_index);
+  const std::string& name = entry->name();
+  AppendIndexValue<uint16_t>(buffer, uint16_t(name.size()));
+  buffer->insert(buffer->end(), name.begin(), name.end());
+  AppendIndexValue<uint32_t>(buffer, entry->attributes());
+  AppendIndexValue<uint64_t>(buffer, entry->size());
+  AppendIndexValue<uint64_t>(buffer, entry->allocation_size());
+  AppendIndexValue<uint64_t>(buffer, entry->data_offset());
+  AppendIndexValue<uint64_t>(buffer, entry->data_size());
+  AppendIndexValue<uint64_t>(buffer, entry->block());
+  AppendIndexValue<uint64_t>(buffer, entry->create_timestamp());
+  AppendIndexValue<uint64_t>(buffer, entry->access_timestamp());
+  AppendIndexValue<uint64_t>(buffer, entry->write_timestamp());
+  auto& block_list = entry->block_list();
+  AppendIndexValue<uint32_t>(buffer, uint32_t(block_list.size()));
+  for (auto& record : block_list) {
+    AppendIndexValue<uint32_t>(buffer, uint32_t(record.file));
+    AppendIndexValue<uint64_t>(buffer, record.offset);
+    AppendIndexValue<uint64_t>(buffer, record.length);
+  }
+  for (auto& child : entry->children()) {
+    AppendIndexEntry(buffer,
+                     static_cast<const StfsContainerEntry*>(child.get()), index,
+                     entry_count);
+  }
+}
+
+struct IndexReader {
+  const uint8_t* ptr;
+  const uint8_t* end;
+
+  bool ReadBytes(void* out, size_t length) {
+    if (size_t(end - ptr) < length) {
+      return false;
+    }
+    std::memcpy(out, ptr, length);
+    ptr += length;
+    return true;
+  }
+  template <typename T>
+  bool Read(T* out) {
+    return ReadBytes(out, sizeof(T));
+  }
+};
+
+}  // namespace
+
+StfsContainerDevice::StfsContainerDevice(
+    const std::string_view mount_path, const std::filesystem::path& host_path,
+    const std::filesystem::path& index_root)
     : Device(mount_path),
       name_("STFS"),
       host_path_(host_path),
+      index_root_(index_root),
       mmap_total_size_(),
       base_offset_(),
       magic_offset_(),
@@ -89,16 +227,33 @@ bool StfsContainerDevice::Initialize() {
     return false;
   }
 
+  bool use_index = cvars::stfs_index_cache && !index_root_.empty();
+  auto index_path = use_index ? GetIndexPath() : std::filesystem::path();
+  if (use_index && !cvars::stfs_verify_hashes && ReadIndex(index_path)) {
+    XELOGI("Loaded STFS directory index {}", xe::path_to_utf8(index_path));
+    return true;
+  }
+
+  Error result;
   switch (header_.descriptor_type) {
     case StfsDescriptorType::kStfs:
-      return ReadSTFS() == Error::kSuccess;
+      result = ReadSTFS();
       break;
     case StfsDescriptorType::kSvod:
-      return ReadSVOD() == Error::kSuccess;
+      result = ReadSVOD();
+      break;
     default:
       XELOGE("Unknown STFS Descriptor Type: {}", header_.descriptor_type);
       return false;
   }
+  if (result != Error::kSuccess) {
+    return false;
+  }
+
+  if (use_index) {
+    WriteIndex(index_path);
+  }
+  return true;
 }
 
 StfsContainerDevice::Error StfsContainerDevice::MapFiles() {
@@ -312,7 +467,19 @@ StfsContainerDevice::Error StfsContainerDevice::ReadSVOD() {
   root_entry_ = std::unique_ptr<Entry>(root_entry);
 
   // Traverse all child entries
-  return ReadEntrySVOD(root_block, 0, root_entry);
+  auto result = ReadEntrySVOD(root_block, 0, root_entry);
+  if (result != Error::kSuccess) {
+    return result;
+  }
+
+  // Block lists of large games have millions of records, build them in
+  // parallel once the tree is known.
+  std::vector<StfsContainerEntry*> file_entries;
+  CollectFileEntries(root_entry, &file_entries);
+  ParallelFor(file_entries.size(),
+              [&](size_t i) { ReadBlockListSVOD(file_entries[i]); });
+
+  return Error::kSuccess;
 }
 
 StfsContainerDevice::Error StfsContainerDevice::ReadEntrySVOD(
@@ -385,35 +552,7 @@ StfsContainerDevice::Error StfsContainerDevice::ReadEntrySVOD(
     entry->access_timestamp_ = root_entry_->create_timestamp();
     entry->create_timestamp_ = root_entry_->create_timestamp();
     entry->write_timestamp_ = root_entry_->create_timestamp();
-
-    // Fill in all block records, sector by sector.
-    if (entry->attributes() & X_FILE_ATTRIBUTE_NORMAL) {
-      uint32_t block_index = data_block;
-      size_t remaining_size = xe::round_up(length, 0x800);
-
-      size_t last_record = -1;
-      size_t last_offset = -1;
-      while (remaining_size) {
-        const size_t BLOCK_SIZE = 0x800;
-
-        size_t offset, file_index;
-        BlockToOffsetSVOD(block_index, &offset, &file_index);
-
-        block_index++;
-        remaining_size -= BLOCK_SIZE;
-
-        if (offset - last_offset == 0x800) {
-          // Consecutive, so append to last entry.
-          entry->block_list_[last_record].length += BLOCK_SIZE;
-          last_offset = offset;
-          continue;
-        }
-
-        entry->block_list_.push_back({file_index, offset, BLOCK_SIZE});
-        last_record = entry->block_list_.size() - 1;
-        last_offset = offset;
-      }
-    }
+    // The block records are filled in by ReadSVOD.
   }
 
   parent->children_.emplace_back(std::move(entry));
@@ -429,6 +568,34 @@ StfsContainerDevice::Error StfsContainerDevice::ReadEntrySVOD(
   return Error::kSuccess;
 }
 
+void StfsContainerDevice::ReadBlockListSVOD(StfsContainerEntry* entry) {
+  // Fill in all block records, sector by sector.
+  const size_t BLOCK_SIZE = 0x800;
+  uint32_t block_index = uint32_t(entry->block_);
+  size_t remaining_size = xe::round_up(entry->data_size_, BLOCK_SIZE);
+
+  size_t last_record = -1;
+  size_t last_offset = -1;
+  while (remaining_size) {
+    size_t offset, file_index;
+    BlockToOffsetSVOD(block_index, &offset, &file_index);
+
+    block_index++;
+    remaining_size -= BLOCK_SIZE;
+
+    if (offset - last_offset == 0x800) {
+      // Consecutive, so append to last entry.
+      entry->block_list_[last_record].length += BLOCK_SIZE;
+      last_offset = offset;
+      continue;
+    }
+
+    entry->block_list_.push_back({file_index, offset, BLOCK_SIZE});
+    last_record = entry->block_list_.size() - 1;
+    last_offset = offset;
+  }
+}
+
 void StfsContainerDevice::BlockToOffsetSVOD(size_t block, size_t* out_address,
                                             size_t* out_file_index) {
   // SVOD Systems use hash blocks for integrity checks. These hash blocks
@@ -491,106 +658,187 @@ void StfsContainerDevice::BlockToOffsetSVOD(size_t block, size_t* out_address,
 }
 
 StfsContainerDevice::Error StfsContainerDevice::ReadSTFS() {
-  auto data = mmap_.at(0)->data();
+  auto& map = mmap_.at(0);
+  const uint8_t* data = map->data();
+  size_t data_size = map->size();
 
   auto root_entry = new StfsContainerEntry(this, nullptr, "", &mmap_);
   root_entry->attributes_ = kFileAttributeDirectory;
   root_entry_ = std::unique_ptr<Entry>(root_entry);
 
-  std::vector<StfsContainerEntry*> all_entries;
-
-  // Load all listings.
+  // Follow the chain of file table blocks first, the listings in them are
+  // parsed in parallel below.
   auto& volume_descriptor = header_.stfs_volume_descriptor;
+  std::vector<uint32_t> table_blocks;
+  table_blocks.reserve(volume_descriptor.file_table_block_count);
   uint32_t table_block_index = volume_descriptor.file_table_block_number;
   for (size_t n = 0; n < volume_descriptor.file_table_block_count; n++) {
-    const uint8_t* p = data + BlockToOffsetSTFS(table_block_index);
+    if (BlockToOffsetSTFS(table_block_index) + kSectorSize > data_size) {
+      XELOGE("STFS file table block {:X} is outside of the package",
+             table_block_index);
+      return Error::kErrorDamagedFile;
+    }
+    table_blocks.push_back(table_block_index);
+
+    auto block_hash = GetBlockHash(data, table_block_index, 0);
+    if (table_size_shift_ && block_hash.info < 0x80) {
+      block_hash = GetBlockHash(data, table_block_index, 1);
+    }
+    table_block_index = block_hash.next_block_index;
+    if (table_block_index == 0xFFFFFF) {
+      break;
+    }
+  }
+
+  // Load all listings.
+  struct DirectoryRecord {
+    std::string name;
+    uint8_t name_length_flags;
+    uint32_t start_block_index;
+    uint16_t path_indicator;
+    uint32_t file_size;
+    uint64_t create_timestamp;
+    uint64_t access_timestamp;
+  };
+  std::vector<std::vector<DirectoryRecord>> table_records(table_blocks.size());
+  bool verify_hashes = cvars::stfs_verify_hashes;
+  std::atomic<uint32_t> hash_mismatch_count(0);
+  ParallelFor(table_blocks.size(), [&](size_t n) {
+    if (verify_hashes && !VerifyBlockSTFS(data, data_size, table_blocks[n])) {
+      ++hash_mismatch_count;
+    }
+    const uint8_t* p = data + BlockToOffsetSTFS(table_blocks[n]);
+    auto& records = table_records[n];
     for (size_t m = 0; m < 0x1000 / 0x40; m++) {
       const uint8_t* name_buffer = p;  // 0x28b
       if (name_buffer[0] == 0) {
         // Done.
         break;
       }
-      uint8_t name_length_flags = xe::load_and_swap<uint8_t>(p + 0x28);
+      DirectoryRecord record;
+      record.name_length_flags = xe::load_and_swap<uint8_t>(p + 0x28);
       // TODO(benvanik): use for allocation_size_?
       // uint32_t allocated_block_count = load_uint24_le(p + 0x29);
-      uint32_t start_block_index = load_uint24_le(p + 0x2F);
-      uint16_t path_indicator = xe::load_and_swap<uint16_t>(p + 0x32);
-      uint32_t file_size = xe::load_and_swap<uint32_t>(p + 0x34);
+      record.start_block_index = load_uint24_le(p + 0x2F);
+      record.path_indicator = xe::load_and_swap<uint16_t>(p + 0x32);
+      record.file_size = xe::load_and_swap<uint32_t>(p + 0x34);
 
       // both date and time parts of the timestamp are big endian
       uint16_t update_date = xe::load_and_swap<uint16_t>(p + 0x38);
       uint16_t update_time = xe::load_and_swap<uint16_t>(p + 0x3A);
       uint32_t access_date = xe::load_and_swap<uint16_t>(p + 0x3C);
       uint32_t access_time = xe::load_and_swap<uint16_t>(p + 0x3E);
+      record.create_timestamp = decode_fat_timestamp(update_date, update_time);
+      record.access_timestamp = decode_fat_timestamp(access_date, access_time);
       p += 0x40;
 
+      record.name.assign(reinterpret_cast<const char*>(name_buffer),
+                         record.name_length_flags & 0x3F);
+      records.push_back(std::move(record));
+    }
+  });
+
+  // Link the entries, parents always precede their children.
+  std::vector<StfsContainerEntry*> all_entries;
+  std::vector<StfsContainerEntry*> file_entries;
+  for (auto& records : table_records) {
+    for (auto& record : records) {
       StfsContainerEntry* parent_entry = nullptr;
-      if (path_indicator == 0xFFFF) {
+      if (record.path_indicator == 0xFFFF) {
         parent_entry = root_entry;
+      } else if (record.path_indicator < all_entries.size()) {
+        parent_entry = all_entries[record.path_indicator];
       } else {
-        parent_entry = all_entries[path_indicator];
+        XELOGE("STFS entry {} has an invalid parent {}", record.name,
+               record.path_indicator);
+        return Error::kErrorDamagedFile;
       }
 
-      std::string name(reinterpret_cast<const char*>(name_buffer),
-                       name_length_flags & 0x3F);
-      auto entry = StfsContainerEntry::Create(this, parent_entry, name, &mmap_);
+      auto entry =
+          StfsContainerEntry::Create(this, parent_entry, record.name, &mmap_);
 
       // bit 0x40 = consecutive blocks (not fragmented?)
-      if (name_length_flags & 0x80) {
+      if (record.name_length_flags & 0x80) {
         entry->attributes_ = kFileAttributeDirectory;
       } else {
         entry->attributes_ = kFileAttributeNormal | kFileAttributeReadOnly;
-        entry->data_offset_ = BlockToOffsetSTFS(start_block_index);
-        entry->data_size_ = file_size;
+        entry->data_offset_ = BlockToOffsetSTFS(record.start_block_index);
+        entry->data_size_ = record.file_size;
+        entry->block_ = record.start_block_index;
+        file_entries.push_back(entry.get());
       }
-      entry->size_ = file_size;
-      entry->allocation_size_ = xe::round_up(file_size, kSectorSize);
+      entry->size_ = record.file_size;
+      entry->allocation_size_ = xe::round_up(record.file_size, kSectorSize);
 
-      entry->create_timestamp_ = decode_fat_timestamp(update_date, update_time);
-      entry->access_timestamp_ = decode_fat_timestamp(access_date, access_time);
+      entry->create_timestamp_ = record.create_timestamp;
+      entry->access_timestamp_ = record.access_timestamp;
       entry->write_timestamp_ = entry->create_timestamp_;
 
       all_entries.push_back(entry.get());
-
-      // Fill in all block records.
-      // It's easier to do this now and just look them up later, at the cost
-      // of some memory. Nasty chain walk.
-      // TODO(benvanik): optimize if flag 0x40 (consecutive) is set.
-      if (entry->attributes() & X_FILE_ATTRIBUTE_NORMAL) {
-        uint32_t block_index = start_block_index;
-        size_t remaining_size = file_size;
-        uint32_t info = 0x80;
-        while (remaining_size && block_index && info >= 0x80) {
-          size_t block_size =
-              std::min(static_cast<size_t>(0x1000), remaining_size);
-          size_t offset = BlockToOffsetSTFS(block_index);
-          entry->block_list_.push_back({0, offset, block_size});
-          remaining_size -= block_size;
-          auto block_hash = GetBlockHash(data, block_index, 0);
-          if (table_size_shift_ && block_hash.info < 0x80) {
-            block_hash = GetBlockHash(data, block_index, 1);
-          }
-          block_index = block_hash.next_block_index;
-          info = block_hash.info;
-        }
-      }
-
       parent_entry->children_.emplace_back(std::move(entry));
     }
+  }
 
-    auto block_hash = GetBlockHash(data, table_block_index, 0);
-    if (table_size_shift_ && block_hash.info < 0x80) {
-      block_hash = GetBlockHash(data, table_block_index, 1);
-    }
-    table_block_index = block_hash.next_block_index;
-    if (table_block_index == 0xFFFFFF) {
-      break;
+  ParallelFor(file_entries.size(), [&](size_t i) {
+    if (!ReadBlockListSTFS(file_entries[i], verify_hashes)) {
+      ++hash_mismatch_count;
     }
+  });
+
+  if (hash_mismatch_count) {
+    XELOGW("STFS package has {} files or file table blocks not matching their "
+           "hashes",
+           hash_mismatch_count.load());
   }
 
   return Error::kSuccess;
 }
 
+bool StfsContainerDevice::ReadBlockListSTFS(StfsContainerEntry* entry,
+                                            bool verify_hashes) {
+  // Fill in all block records.
+  // It's easier to do this now and just look them up later, at the cost
+  // of some memory. Nasty chain walk.
+  // TODO(benvanik): optimize if flag 0x40 (consecutive) is set.
+  auto& map = mmap_.at(0);
+  const uint8_t* data = map->data();
+  bool hashes_match = true;
+  uint32_t block_index = uint32_t(entry->block_);
+  size_t remaining_size = entry->data_size_;
+  uint32_t info = 0x80;
+  while (remaining_size && block_index && info >= 0x80) {
+    size_t block_size = std::min(static_cast<size_t>(0x1000), remaining_size);
+    size_t offset = BlockToOffsetSTFS(block_index);
+    entry->block_list_.push_back({0, offset, block_size});
+    remaining_size -= block_size;
+    if (verify_hashes && !VerifyBlockSTFS(data, map->size(), block_index)) {
+      hashes_match = false;
+    }
+    auto block_hash = GetBlockHash(data, block_index, 0);
+    if (table_size_shift_ && block_hash.info < 0x80) {
+      block_hash = GetBlockHash(data, block_index, 1);
+    }
+    block_index = block_hash.next_block_index;
+    info = block_hash.info;
+  }
+  return hashes_match;
+}
+
+bool StfsContainerDevice::VerifyBlockSTFS(const uint8_t* map_ptr,
+                                          size_t map_size,
+                                          uint32_t block_index) {
+  size_t offset = BlockToOffsetSTFS(block_index);
+  if (offset + kSectorSize > map_size) {
+    return false;
+  }
+  uint8_t digest[0x14];
+  sha1::SHA1 s;
+  s.processBytes(map_ptr + offset, kSectorSize);
+  s.finalize(digest);
+  return std::memcmp(digest, GetBlockHash(map_ptr, block_index, 0).hash,
+                     sizeof(digest)) == 0;
+}
+
 size_t StfsContainerDevice::BlockToOffsetSTFS(uint64_t block_index) {
   uint64_t block;
   uint32_t block_shift = 0;
@@ -633,7 +881,184 @@ StfsContainerDevice::BlockHash StfsContainerDevice::GetBlockHash(
   const uint8_t* record_data = hash_data + record * 0x18;
   uint32_t info = xe::load_and_swap<uint8_t>(record_data + 0x14);
   uint32_t next_block_index = load_uint24_be(record_data + 0x15);
-  return {next_block_index, info};
+  return {next_block_index, info, record_data};
+}
+
+std::filesystem::path StfsContainerDevice::GetIndexPath() const {
+  // Different packages may have the same file name, and the same package may
+  // be replaced with a different version.
+  std::string host_path = xe::path_to_utf8(
+      std::filesystem::absolute(host_path_).lexically_normal());
+  XXH3_state_t hash_state;
+  XXH3_64bits_reset(&hash_state);
+  XXH3_64bits_update(&hash_state, host_path.data(), host_path.size());
+  XXH3_64bits_update(&hash_state, header_.header_hash,
+                     sizeof(header_.header_hash));
+  return index_root_ / fmt::format("{:016X}.xindex",
+                                   XXH3_64bits_digest(&hash_state));
+}
+
+bool StfsContainerDevice::ReadIndex(const std::filesystem::path& path) {
+  if (!std::filesystem::exists(path)) {
+    return false;
+  }
+  auto map = MappedMemory::Open(path, MappedMemory::Mode::kRead);
+  if (!map) {
+    return false;
+  }
+  IndexReader reader = {map->data(), map->data() + map->size()};
+
+  uint64_t mapped_size = 0;
+  for (auto& it : mmap_) {
+    mapped_size += it.second->size();
+  }
+  uint32_t magic, version, descriptor_type, data_file_count, entry_count;
+  uint8_t header_hash[0x14];
+  uint64_t data_size;
+  if (!reader.Read(&magic) || magic != kIndexMagic || !reader.Read(&version) ||
+      version != kIndexVersion ||
+      !reader.ReadBytes(header_hash, sizeof(header_hash)) ||
+      std::memcmp(header_hash, header_.header_hash, sizeof(header_hash)) ||
+      !reader.Read(&descriptor_type) ||
+      descriptor_type != uint32_t(header_.descriptor_type) ||
+      !reader.Read(&data_file_count) || data_file_count != mmap_.size() ||
+      !reader.Read(&data_size) || data_size != mapped_size) {
+    XELOGI("STFS directory index {} is outdated", xe::path_to_utf8(path));
+    return false;
+  }
+
+  auto invalid = [&path]() {
+    XELOGW("STFS directory index {} is damaged", xe::path_to_utf8(path));
+    return false;
+  };
+  if (!reader.Read(&entry_count) || !entry_count) {
+    return invalid();
+  }
+  std::unique_ptr<Entry> root_entry;
+  std::vector<StfsContainerEntry*> entries;
+  entries.reserve(entry_count);
+  for (uint32_t i = 0; i < entry_count; i++) {
+    uint32_t parent_index;
+    uint16_t name_length;
+    if (!reader.Read(&parent_index) || !reader.Read(&name_length)) {
+      return invalid();
+    }
+    std::string name(name_length, '\0');
+    if (!reader.ReadBytes(name.data(), name_length)) {
+      return invalid();
+    }
+
+    std::unique_ptr<StfsContainerEntry> entry;
+    if (!i) {
+      if (parent_index != kIndexNoParent) {
+        return invalid();
+      }
+      entry = std::make_unique<StfsContainerEntry>(this, nullptr, "", &mmap_);
+    } else {
+      if (parent_index >= i) {
+        return invalid();
+      }
+      entry = StfsContainerEntry::Create(this, entries[parent_index], name,
+                                         &mmap_);
+    }
+
+    uint32_t attributes, block_count;
+    uint64_t size, allocation_size, data_offset, entry_data_size, block;
+    uint64_t create_timestamp, access_timestamp, write_timestamp;
+    if (!reader.Read(&attributes) || !reader.Read(&size) ||
+        !reader.Read(&allocation_size) || !reader.Read(&data_offset) ||
+        !reader.Read(&entry_data_size) || !reader.Read(&block) ||
+        !reader.Read(&create_timestamp) || !reader.Read(&access_timestamp) ||
+        !reader.Read(&write_timestamp) || !reader.Read(&block_count)) {
+      return invalid();
+    }
+    entry->attributes_ = attributes;
+    entry->size_ = size_t(size);
+    entry->allocation_size_ = size_t(allocation_size);
+    entry->data_offset_ = size_t(data_offset);
+    entry->data_size_ = size_t(entry_data_size);
+    entry->block_ = size_t(block);
+    entry->create_timestamp_ = create_timestamp;
+    entry->access_timestamp_ = access_timestamp;
+    entry->write_timestamp_ = write_timestamp;
+
+    entry->block_list_.reserve(block_count);
+    for (uint32_t j = 0; j < block_count; j++) {
+      uint32_t file;
+      uint64_t offset, length;
+      if (!reader.Read(&file) || !reader.Read(&offset) ||
+          !reader.Read(&length)) {
+        return invalid();
+      }
+      auto file_map = mmap_.find(file);
+      if (file_map == mmap_.end() || offset > file_map->second->size() ||
+          length > file_map->second->size() - offset) {
+        return invalid();
+      }
+      entry->block_list_.push_back(
+          {size_t(file), size_t(offset), size_t(length)});
+    }
+
+    entries.push_back(entry.get());
+    if (!i) {
+      root_entry = std::move(entry);
+    } else {
+      entries[parent_index]->children_.emplace_back(std::move(entry));
+    }
+  }
+
+  root_entry_ = std::move(root_entry);
+  return true;
+}
+
+bool StfsContainerDevice::WriteIndex(const std::filesystem::path& path) {
+  uint64_t mapped_size = 0;
+  for (auto& it : mmap_) {
+    mapped_size += it.second->size();
+  }
+
+  std::vector<uint8_t> buffer;
+  AppendIndexValue<uint32_t>(&buffer, kIndexMagic);
+  AppendIndexValue<uint32_t>(&buffer, kIndexVersion);
+  buffer.insert(buffer.end(), std::begin(header_.header_hash),
+                std::end(header_.header_hash));
+  AppendIndexValue<uint32_t>(&buffer, uint32_t(header_.descriptor_type));
+  AppendIndexValue<uint32_t>(&buffer, uint32_t(mmap_.size()));
+  AppendIndexValue<uint64_t>(&buffer, mapped_size);
+  size_t entry_count_offset = buffer.size();
+  AppendIndexValue<uint32_t>(&buffer, 0);
+  uint32_t entry_count = 0;
+  AppendIndexEntry(&buffer,
+                   static_cast<const StfsContainerEntry*>(root_entry_.get()),
+                   kIndexNoParent, &entry_count);
+  std::memcpy(buffer.data() + entry_count_offset, &entry_count,
+              sizeof(entry_count));
+
+  std::error_code error;
+  std::filesystem::create_directories(path.parent_path(), error);
+
+  // Write to a temporary file first so a partially written index is never
+  // picked up.
+  auto temp_path = path;
+  temp_path += ".tmp";
+  FILE* file = xe::filesystem::OpenFile(temp_path, "wb");
+  if (!file) {
+    XELOGW("Failed to create STFS directory index {}",
+           xe::path_to_utf8(path));
+    return false;
+  }
+  bool written =
+      std::fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+  std::fclose(file);
+  if (written) {
+    std::filesystem::rename(temp_path, path, error);
+  }
+  if (!written || error) {
+    std::filesystem::remove(temp_path, error);
+    XELOGW("Failed to write STFS directory index {}", xe::path_to_utf8(path));
+    return false;
+  }
+  return true;
 }
 
 bool StfsVolumeDescriptor::Read(const uint8_t* p) {
@@ -10,9 +10,11 @@
 #ifndef XENIA_VFS_DEVICES_STFS_CONTAINER_DEVICE_H_
 #define XENIA_VFS_DEVICES_STFS_CONTAINER_DEVICE_H_
 
+#include <filesystem>
 #include <map>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "xenia/base/mapped_memory.h"
 #include "xenia/vfs/device.h"
@@ -165,8 +167,11 @@ class StfsHeader {
 
 class StfsContainerDevice : public Device {
  public:
+  // The directory index of the package is stored in index_root, unless it's
+  // empty.
   StfsContainerDevice(const std::string_view mount_path,
-                      const std::filesystem::path& host_path);
+                      const std::filesystem::path& host_path,
+                      const std::filesystem::path& index_root = {});
   ~StfsContainerDevice() override;
 
   bool Initialize() override;
@@ -199,6 +204,8 @@ class StfsContainerDevice : public Device {
   struct BlockHash {
     uint32_t next_block_index;
     uint32_t info;
+    // SHA-1 of the block's 0x1000 bytes.
+    const uint8_t* hash;
   };
 
   const uint32_t kSTFSHashSpacing = 170;
@@ -213,16 +220,30 @@ class StfsContainerDevice : public Device {
   Error ReadSVOD();
   Error ReadEntrySVOD(uint32_t sector, uint32_t ordinal,
                       StfsContainerEntry* parent);
+  void ReadBlockListSVOD(StfsContainerEntry* entry);
   void BlockToOffsetSVOD(size_t sector, size_t* address, size_t* file_index);
 
   Error ReadSTFS();
+  // Returns false if hash verification is requested and a block of the file
+  // doesn't match its hash.
+  bool ReadBlockListSTFS(StfsContainerEntry* entry, bool verify_hashes);
+  bool VerifyBlockSTFS(const uint8_t* map_ptr, size_t map_size,
+                       uint32_t block_index);
   size_t BlockToOffsetSTFS(uint64_t block);
 
   BlockHash GetBlockHash(const uint8_t* map_ptr, uint32_t block_index,
                          uint32_t table_offset);
 
+  // The directory index caches the entry tree of the package in a file in
+  // index_root_, named after the package path and header hash, so it doesn't
+  // have to be parsed again on the next mount.
+  std::filesystem::path GetIndexPath() const;
+  bool ReadIndex(const std::filesystem::path& path);
+  bool WriteIndex(const std::filesystem::path& path);
+
   std::string name_;
   std::filesystem::path host_path_;
+  std::filesystem::path index_root_;
   std::map<size_t, std::unique_ptr<MappedMemory>> mmap_;
   size_t mmap_total_size_;
 